@@ -49,6 +49,9 @@
 # define NEW_GDK_WINDOW_GET_DISPLAY
 #endif
 
+/* a key not answered by fcitx within this time is treated as not handled */
+#define PROCESS_KEY_TIMEOUT 1000
+
 static const FcitxCapacityFlags purpose_related_capacity =
     CAPACITY_ALPHA |
     CAPACITY_DIGIT |
@@ -89,8 +92,23 @@ struct _FcitxIMContext {
     gint last_cursor_pos;
     gint last_anchor_pos;
     struct xkb_compose_state* xkbComposeState;
+    GQueue pending_keys;
+    gboolean key_stalled;
 };
 
+/*
+ * key sent to fcitx, or key waiting behind such one. Unhandled keys are
+ * put back to gdk strictly in the order they were pressed.
+ */
+typedef struct _FcitxIMPendingKey {
+    FcitxIMContext* context;
+    GdkEventKey* event;
+    GCancellable* cancellable;
+    gint ret;
+    gboolean finished;
+    gboolean in_flight;
+} FcitxIMPendingKey;
+
 struct _FcitxIMContextClass {
     GtkIMContextClass parent;
     /* klass members */
@@ -158,6 +176,10 @@ static void
 _fcitx_im_context_update_formatted_preedit_cb(FcitxClient* im, GPtrArray* array, int cursor_pos, void* user_data);
 static void
 _fcitx_im_context_process_key_cb(GObject* source_object, GAsyncResult* res, gpointer user_data);
+static gboolean
+_fcitx_im_context_queue_key(FcitxIMContext* fcitxcontext, GdkEventKey* event);
+static void
+_fcitx_im_context_flush_keys(FcitxIMContext* fcitxcontext);
 static void
 _fcitx_im_context_set_capacity(FcitxIMContext* fcitxcontext, gboolean force);
 
@@ -200,7 +222,6 @@ static guint _signal_preedit_start_id = 0;
 static guint _signal_preedit_end_id = 0;
 static guint _signal_delete_surrounding_id = 0;
 static guint _signal_retrieve_surrounding_id = 0;
-static gboolean _use_sync_mode = 0;
 
 static GtkIMContext *_focus_im_context = NULL;
 static const gchar *_no_snooper_apps = NO_SNOOPER_APPS;
@@ -356,9 +377,6 @@ fcitx_im_context_class_init(FcitxIMContextClass *klass)
         g_strfreev (apps);
     }
 
-    /* make ibus fix benefits us */
-    _use_sync_mode = fcitx_utils_get_boolean_env("IBUS_ENABLE_SYNC_MODE", FALSE)
-                     || fcitx_utils_get_boolean_env("FCITX_ENABLE_SYNC_MODE", FALSE);
     /* always install snooper */
     if (_key_snooper_id == 0)
         _key_snooper_id = gtk_key_snooper_install (_key_snooper_cb, NULL);
@@ -392,6 +410,7 @@ fcitx_im_context_init(FcitxIMContext *context)
     context->preedit_string = NULL;
     context->attrlist = NULL;
     context->last_updated_capacity = CAPACITY_SURROUNDING_TEXT;
+    g_queue_init(&context->pending_keys);
 
     context->slave = gtk_im_context_simple_new();
     gtk_im_context_simple_add_table(GTK_IM_CONTEXT_SIMPLE(context->slave),
@@ -609,40 +628,79 @@ fcitx_im_context_filter_keypress(GtkIMContext *context,
             return FALSE;
 
         fcitxcontext->time = event->time;
+    }
 
-        if (_use_sync_mode) {
-            int ret = fcitx_client_process_key_sync(fcitxcontext->client,
-                                                    event->keyval,
-                                                    event->hardware_keycode,
-                                                    event->state,
-                                                    (event->type == GDK_KEY_PRESS) ? (FCITX_PRESS_KEY) : (FCITX_RELEASE_KEY),
-                                                    event->time);
-            if (ret <= 0) {
-                event->state |= FcitxKeyState_IgnoredMask;
-                return fcitx_im_context_filter_keypress_fallback(fcitxcontext, event);
-            } else {
-                event->state |= FcitxKeyState_HandledMask;
-                return TRUE;
-            }
-        } else {
-            fcitx_client_process_key_async(fcitxcontext->client,
-                                           event->keyval,
-                                           event->hardware_keycode,
-                                           event->state,
-                                           (event->type == GDK_KEY_PRESS) ? (FCITX_PRESS_KEY) : (FCITX_RELEASE_KEY),
-                                           event->time,
-                                           -1,
-                                           NULL,
-                                           _fcitx_im_context_process_key_cb,
-                                           gdk_event_copy((GdkEvent *) event)
-                                          );
-            event->state |= FcitxKeyState_HandledMask;
-            return TRUE;
-        }
+    if (fcitxcontext->has_focus && _fcitx_im_context_queue_key(fcitxcontext, event)) {
+        event->state |= FcitxKeyState_HandledMask;
+        return TRUE;
+    }
+    return fcitx_im_context_filter_keypress_fallback(fcitxcontext, event);
+}
+
+static gboolean
+_fcitx_im_context_queue_key(FcitxIMContext* fcitxcontext, GdkEventKey* event)
+{
+    gboolean send = fcitx_client_is_valid(fcitxcontext->client)
+                    && !fcitxcontext->key_stalled;
+
+    /* nothing to keep in order with, let the caller handle it right away */
+    if (!send && g_queue_is_empty(&fcitxcontext->pending_keys))
+        return FALSE;
+
+    FcitxIMPendingKey* key = g_new0(FcitxIMPendingKey, 1);
+    key->context = g_object_ref(fcitxcontext);
+    key->event = (GdkEventKey*) gdk_event_copy((GdkEvent *) event);
+    g_queue_push_tail(&fcitxcontext->pending_keys, key);
+
+    if (send) {
+        key->in_flight = TRUE;
+        key->cancellable = g_cancellable_new();
+        fcitx_client_process_key_async(fcitxcontext->client,
+                                       event->keyval,
+                                       event->hardware_keycode,
+                                       event->state,
+                                       (event->type == GDK_KEY_PRESS) ? (FCITX_PRESS_KEY) : (FCITX_RELEASE_KEY),
+                                       event->time,
+                                       PROCESS_KEY_TIMEOUT,
+                                       key->cancellable,
+                                       _fcitx_im_context_process_key_cb,
+                                       key
+                                      );
     } else {
-        return fcitx_im_context_filter_keypress_fallback(fcitxcontext, event);
+        /* wait behind the keys still in flight, and then go to fallback */
+        key->finished = TRUE;
+    }
+    return TRUE;
+}
+
+static void
+_fcitx_im_context_free_key(FcitxIMPendingKey* key)
+{
+    if (key->event) {
+        gdk_event_free((GdkEvent *) key->event);
+        key->event = NULL;
+    }
+    /* the reply callback still holds it */
+    if (key->in_flight)
+        return;
+    if (key->cancellable)
+        g_object_unref(key->cancellable);
+    g_object_unref(key->context);
+    g_free(key);
+}
+
+static void
+_fcitx_im_context_flush_keys(FcitxIMContext* fcitxcontext)
+{
+    FcitxIMPendingKey* key;
+    while ((key = g_queue_peek_head(&fcitxcontext->pending_keys)) && key->finished) {
+        g_queue_pop_head(&fcitxcontext->pending_keys);
+        if (key->ret <= 0) {
+            key->event->state |= FcitxKeyState_IgnoredMask;
+            gdk_event_put((GdkEvent *)key->event);
+        }
+        _fcitx_im_context_free_key(key);
     }
-    return FALSE;
 }
 
 static void
@@ -650,13 +708,38 @@ _fcitx_im_context_process_key_cb (GObject *source_object,
                                   GAsyncResult *res,
                                   gpointer user_data)
 {
-    GdkEventKey* event = user_data;
+    FcitxIMPendingKey* key = user_data;
+    FcitxIMContext* context = g_object_ref(key->context);
     int ret = fcitx_client_process_key_finish(FCITX_CLIENT(source_object), res);
-    if (ret <= 0) {
-        event->state |= FcitxKeyState_IgnoredMask;
-        gdk_event_put((GdkEvent *)event);
+    key->in_flight = FALSE;
+
+    if (!key->event) {
+        /* already given up, but a late reply means fcitx is back */
+        if (ret >= 0)
+            context->key_stalled = FALSE;
+        _fcitx_im_context_free_key(key);
+    } else {
+        key->ret = ret;
+        key->finished = TRUE;
+        if (ret < 0) {
+            /*
+             * timed out or failed, the keys sent after it would wait just as
+             * long, so give up all of them and bypass fcitx until it answers
+             * again or the context gets focus. They are put back to gdk, so
+             * the ones still queued by the client must not reach fcitx.
+             */
+            GList* l;
+            for (l = g_queue_peek_head_link(&context->pending_keys); l; l = l->next) {
+                FcitxIMPendingKey* pending = l->data;
+                pending->finished = TRUE;
+                if (pending->in_flight)
+                    g_cancellable_cancel(pending->cancellable);
+            }
+            context->key_stalled = TRUE;
+        }
+        _fcitx_im_context_flush_keys(context);
     }
-    gdk_event_free((GdkEvent *)event);
+    g_object_unref(context);
 }
 
 static void
@@ -811,6 +894,7 @@ fcitx_im_context_focus_in(GtkIMContext *context)
     _fcitx_im_context_set_capacity(fcitxcontext, FALSE);
 
     fcitxcontext->has_focus = true;
+    fcitxcontext->key_stalled = FALSE;
 
     /*
      * Do not call gtk_im_context_focus_out() here.
@@ -1098,6 +1182,8 @@ _fcitx_im_context_set_capacity(FcitxIMContext* fcitxcontext, gboolean force)
         if (fcitxcontext->support_surrounding_text) {
             flags |= CAPACITY_SURROUNDING_TEXT;
         }
+        // keys are pipelined, let fcitx-gclient batch them
+        flags |= CAPACITY_BATCH_KEY_EVENT;
 
         // always run this code against all gtk version
         // seems visibility != PASSWORD hint
@@ -1497,6 +1583,7 @@ void _fcitx_im_context_connect_cb(FcitxClient* im, void* user_data)
 {
     FCITX_UNUSED(im);
     FcitxIMContext* context =  FCITX_IM_CONTEXT(user_data);
+    context->key_stalled = FALSE;
     _fcitx_im_context_set_capacity(context, TRUE);
     if (context->has_focus && _focus_im_context == (GtkIMContext*) context && fcitx_client_is_valid(context->client))
         fcitx_client_focus_in(context->client);
@@ -1571,35 +1658,10 @@ _key_snooper_cb(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
         if (G_UNLIKELY(!fcitxcontext))
             return FALSE;
         fcitxcontext->time = event->time;
-
-        if (_use_sync_mode) {
-
-            int ret = fcitx_client_process_key_sync(fcitxcontext->client,
-                                                    event->keyval,
-                                                    event->hardware_keycode,
-                                                    event->state,
-                                                    (event->type == GDK_KEY_PRESS) ? (FCITX_PRESS_KEY) : (FCITX_RELEASE_KEY),
-                                                    event->time);
-            if (ret <= 0)
-                retval = FALSE;
-            else
-                retval = TRUE;
-        } else {
-            fcitx_client_process_key_async(fcitxcontext->client,
-                                           event->keyval,
-                                           event->hardware_keycode,
-                                           event->state,
-                                           (event->type == GDK_KEY_PRESS) ? (FCITX_PRESS_KEY) : (FCITX_RELEASE_KEY),
-                                           event->time,
-                                           -1,
-                                           NULL,
-                                           _fcitx_im_context_process_key_cb,
-                                           gdk_event_copy((GdkEvent *) event)
-                                          );
-            retval = TRUE;
-        }
     } while(0);
 
+    retval = _fcitx_im_context_queue_key(fcitxcontext, event);
+
     if (!retval) {
         event->state |= FcitxKeyState_IgnoredMask;
         return FALSE;
@@ -23,6 +23,8 @@
 #include "fcitx/fcitx.h"
 #include "fcitx/frontend.h"
 #include "fcitx-utils/utils.h"
+#include "fcitx-utils/uthash.h"
+#include "fcitx-utils/shmchannel.h"
 #include "module/dbus/fcitx-dbus.h"
 #include "module/dbusstuff/property.h"
 #include "fcitx/instance.h"
@@ -30,10 +32,18 @@
 #include "fcitx-utils/log.h"
 #include "fcitx/configfile.h"
 #include "fcitx/hook.h"
+#include "fcitx/keytrace.h"
+#include "fcitx/candidate.h"
 #include "ipc.h"
 
 #define GetIPCIC(ic) ((FcitxIPCIC*) (ic)->privateic)
 
+#define IPC_HASH_INIT 14695981039346656037ULL
+
+/* connections with signals queued but not flushed yet */
+#define IPC_PENDING_CONN (1 << 0)
+#define IPC_PENDING_PRIVCONN (1 << 1)
+
 typedef struct _FcitxIPCCreateICPriv {
     DBusMessage* message;
     DBusConnection* conn;
@@ -46,6 +56,34 @@ typedef struct _FcitxLastSentIMInfo
     char* langCode;
 } FcitxLastSentIMInfo;
 
+/* hash of every field sent with UpdateClientSideUIDelta last time */
+typedef struct _FcitxIPCClientSideUI {
+    uint32_t serial;
+    boolean valid;
+    uint64_t messages[3]; /* aux up, aux down, preedit */
+    uint64_t imName;
+    int cursor;
+    unsigned int candidateCount;
+    unsigned int candidateFlags;
+    uint64_t candidates[MAX_CAND_WORD];
+} FcitxIPCClientSideUI;
+
+/*
+ * shared memory channel of one client, key events come in and commit string,
+ * preedit, forward key and delete surrounding text go out through it, all
+ * other signals stay on dbus.
+ */
+typedef struct _FcitxIPCShm {
+    char* owner; /* unique name of the client */
+    DBusConnection* conn;
+    FcitxShmChannel* channel;
+    int watchid;
+    boolean closed;
+    struct _FcitxIPCFrontend* ipc;
+    struct _FcitxIPCShm* next; /* closed channels waiting to be freed */
+    UT_hash_handle hh;
+} FcitxIPCShm;
+
 typedef struct _FcitxIPCIC {
     int id;
     char path[32];
@@ -55,9 +93,18 @@ typedef struct _FcitxIPCIC {
     char* surroundingText;
     unsigned int anchor;
     unsigned int cursor;
-    boolean lastPreeditIsEmpty;
+    /* hash of the preedit and client side ui sent last time */
+    uint64_t lastPreedit;
+    uint64_t lastClientSideUI;
+    boolean lastPreeditValid;
+    boolean lastClientSideUIValid;
     boolean isPriv;
     FcitxLastSentIMInfo lastSentIMInfo;
+    FcitxIPCClientSideUI clientSideUI;
+    FcitxInputContext* context;
+    char* owner;
+    FcitxIPCShm* shm;
+    UT_hash_handle hh;
 } FcitxIPCIC;
 
 typedef struct _FcitxIPCFrontend {
@@ -66,6 +113,12 @@ typedef struct _FcitxIPCFrontend {
     DBusConnection* _conn;
     DBusConnection* _privconn;
     FcitxInstance* owner;
+    uint64_t signalSent;
+    uint64_t signalSkipped;
+    unsigned int pendingFlush;
+    FcitxIPCIC* ics; /* id -> ic, used to route method calls on ic */
+    FcitxIPCShm* shms; /* client unique name -> shared memory channel */
+    FcitxIPCShm* closedShms;
 } FcitxIPCFrontend;
 
 typedef struct _FcitxIPCKeyEvent {
@@ -95,6 +148,7 @@ static void IPCICFocusOut(FcitxIPCFrontend* ipc, FcitxInputContext* ic);
 static void IPCICReset(FcitxIPCFrontend* ipc, FcitxInputContext* ic);
 static void IPCICSetCursorRect(FcitxIPCFrontend* ipc, FcitxInputContext* ic, int x, int y, int w, int h);
 static int IPCProcessKey(FcitxIPCFrontend* ipc, FcitxInputContext* callic, const uint32_t originsym, const uint32_t keycode, const uint32_t originstate, uint32_t t, FcitxKeyEventType type);
+static DBusMessage* IPCProcessKeyEvents(FcitxIPCFrontend* ipc, FcitxInputContext* ic, DBusMessage* msg);
 static boolean IPCCheckICFromSameApplication(void* arg, FcitxInputContext* icToCheck, FcitxInputContext* ic);
 static void IPCEmitPropertiesChanged(void* arg, const char* const* properties);
 static void IPCEmitPropertyChanged(void* arg, const char* property);
@@ -106,6 +160,14 @@ static void IPCSetPropertyCurrentIM(void* arg, DBusMessageIter* iter);
 static void IPCUpdateCurrentIM(void* arg);
 static void IPCUpdateIMInfoForIC(void* arg);
 static pid_t IPCGetPid(void* arg, FcitxInputContext* ic);
+static void IPCFlushConnection(FcitxIPCFrontend* ipc, DBusConnection* conn);
+static void IPCFlushPendingSignals(void* arg);
+static FcitxIPCShm* IPCFindShm(FcitxIPCFrontend* ipc, const char* owner, DBusConnection* conn);
+static DBusMessage* IPCOpenShm(FcitxIPCFrontend* ipc, DBusConnection* conn, DBusMessage* msg);
+static void IPCCloseShm(FcitxIPCFrontend* ipc, FcitxIPCShm* shm);
+static void IPCPurgeShm(void* arg);
+static boolean IPCShmSend(FcitxIPCFrontend* ipc, FcitxIPCIC* ipcic, uint32_t type, const void* data, uint32_t length);
+static boolean IPCShmSendPreedit(FcitxIPCFrontend* ipc, FcitxIPCIC* ipcic, char** strs, FcitxMessages* formats, int count, int cursor);
 
 const FcitxDBusPropertyTable propertTable[] = {
     { FCITX_IM_DBUS_INTERFACE, "IMList", "a(sssb)", IPCGetPropertyIMList, IPCSetPropertyIMList },
@@ -211,6 +273,22 @@ const char * im_introspection_xml =
     "<method name=\"GetCurrentState\">"
     "<arg name=\"state\" direction=\"out\" type=\"i\"/>"
     "</method>"
+    "<method name=\"GetKeyTraceReport\">"
+    "<arg name=\"report\" direction=\"out\" type=\"s\"/>"
+    "</method>"
+    "<method name=\"GetSignalStats\">"
+    "<arg name=\"sent\" direction=\"out\" type=\"t\"/>"
+    "<arg name=\"skipped\" direction=\"out\" type=\"t\"/>"
+    "</method>"
+    "<method name=\"OpenShmChannel\">"
+    "<arg name=\"memfd\" direction=\"out\" type=\"h\"/>"
+    "<arg name=\"rxfd\" direction=\"out\" type=\"h\"/>"
+    "<arg name=\"txfd\" direction=\"out\" type=\"h\"/>"
+    "</method>"
+    "<method name=\"CloseShmChannel\">"
+    "</method>"
+    "<signal name=\"ShmChannelClosed\">"
+    "</signal>"
     "<property access=\"readwrite\" type=\"a(sssb)\" name=\"IMList\">"
     "<annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"true\"/>"
     "</property>"
@@ -277,6 +355,10 @@ const char * ic_introspection_xml =
     "<arg name=\"time\" direction=\"in\" type=\"u\"/>"
     "<arg name=\"ret\" direction=\"out\" type=\"i\"/>"
     "</method>"
+    "<method name=\"ProcessKeyEvents\">"
+    "<arg name=\"events\" direction=\"in\" type=\"a(uuuiu)\"/>"
+    "<arg name=\"ret\" direction=\"out\" type=\"ai\"/>"
+    "</method>"
     "<signal name=\"EnableIM\">"
     "</signal>"
     "<signal name=\"CloseIM\">"
@@ -309,6 +391,18 @@ const char * ic_introspection_xml =
     "<arg name=\"imname\" type=\"s\"/>"
     "<arg name=\"cursorpos\" type=\"i\"/>"
     "</signal>"
+    "<signal name=\"UpdateClientSideUIDelta\">"
+    "<arg name=\"serial\" type=\"u\"/>"
+    "<arg name=\"changed\" type=\"u\"/>"
+    "<arg name=\"auxup\" type=\"a(si)\"/>"
+    "<arg name=\"auxdown\" type=\"a(si)\"/>"
+    "<arg name=\"preedit\" type=\"a(si)\"/>"
+    "<arg name=\"cursorpos\" type=\"i\"/>"
+    "<arg name=\"imname\" type=\"s\"/>"
+    "<arg name=\"candidatecount\" type=\"u\"/>"
+    "<arg name=\"candidateflags\" type=\"u\"/>"
+    "<arg name=\"candidates\" type=\"a(isssi)\"/>"
+    "</signal>"
     "<signal name=\"ForwardKey\">"
     "<arg name=\"keyval\" type=\"u\"/>"
     "<arg name=\"state\" type=\"u\"/>"
@@ -378,7 +472,13 @@ void* IPCCreate(FcitxInstance* instance, int frontendid)
 
 boolean IPCDestroy(void* arg)
 {
-    FCITX_UNUSED(arg);
+    FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
+    while (ipc->shms)
+        IPCCloseShm(ipc, ipc->shms);
+    FcitxInstanceRemoveTimeoutByFunc(ipc->owner, IPCPurgeShm);
+    IPCPurgeShm(ipc);
+    FcitxInstanceRemoveTimeoutByFunc(ipc->owner, IPCFlushPendingSignals);
+    IPCFlushPendingSignals(ipc);
     return true;
 }
 
@@ -395,9 +495,14 @@ void IPCCreateIC(void* arg, FcitxInputContext* context, void* priv)
 
     ipcic->id = ipc->maxid;
     ipc->maxid ++;
-    ipcic->lastPreeditIsEmpty = false;
+    ipcic->context = context;
+    HASH_ADD_INT(ipc->ics, id, ipcic);
     ipcic->isPriv = (ipcpriv->conn != ipc->_conn);
     sprintf(ipcic->path, FCITX_IC_DBUS_PATH, ipcic->id);
+    if (dbus_message_get_sender(message)) {
+        ipcic->owner = strdup(dbus_message_get_sender(message));
+        ipcic->shm = IPCFindShm(ipc, ipcic->owner, ipcpriv->conn);
+    }
 
     uint32_t arg1, arg2, arg3, arg4;
     arg1 = config->hkTrigger[0].sym;
@@ -487,13 +592,13 @@ void IPCCreateIC(void* arg, FcitxInputContext* context, void* priv)
     if (!ipcic->isPriv) {
         if (ipc->_conn) {
             dbus_connection_register_object_path(ipc->_conn, ipcic->path, &vtable, ipc);
-            dbus_connection_flush(ipc->_conn);
+            IPCFlushConnection(ipc, ipc->_conn);
         }
     }
     else {
         if (ipc->_privconn) {
             dbus_connection_register_object_path(ipc->_privconn, ipcic->path, &vtable, ipc);
-            dbus_connection_flush(ipc->_privconn);
+            IPCFlushConnection(ipc, ipc->_privconn);
         }
     }
 }
@@ -512,6 +617,7 @@ void IPCDestroyIC(void* arg, FcitxInputContext* context)
     FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
     FcitxIPCIC* ipcic = GetIPCIC(context);
 
+    HASH_DEL(ipc->ics, ipcic);
     if (!ipcic->isPriv) {
         if (ipc->_conn)
             dbus_connection_unregister_object_path(ipc->_conn, GetIPCIC(context)->path);
@@ -524,25 +630,101 @@ void IPCDestroyIC(void* arg, FcitxInputContext* context)
     fcitx_utils_free(ipcic->lastSentIMInfo.uniqueName);
     fcitx_utils_free(ipcic->lastSentIMInfo.langCode);
     fcitx_utils_free(ipcic->surroundingText);
+    fcitx_utils_free(ipcic->owner);
     free(context->privateic);
     context->privateic = NULL;
 }
 
+/* FNV-1a, only used to tell whether the content changed since last time */
+static inline uint64_t IPCHashBytes(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static inline uint64_t IPCHashString(uint64_t hash, const char* str)
+{
+    return IPCHashBytes(hash, str, strlen(str) + 1);
+}
+
+static inline uint64_t IPCHashInt(uint64_t hash, int32_t value)
+{
+    return IPCHashBytes(hash, &value, sizeof(value));
+}
+
+/*
+ * client may change its preedit by itself, e.g. clear it on commit or reset,
+ * so next update must be sent no matter what we sent last time.
+ */
+static inline void IPCICInvalidateSnapshot(FcitxIPCIC* ipcic)
+{
+    ipcic->lastPreeditValid = false;
+    ipcic->lastClientSideUIValid = false;
+    ipcic->clientSideUI.valid = false;
+}
+
+/* return false if the same content is already sent */
+static boolean IPCICUpdateSnapshot(FcitxIPCFrontend* ipc, uint64_t* last, boolean* valid, uint64_t hash)
+{
+    if (*valid && *last == hash) {
+        ipc->signalSkipped++;
+        return false;
+    }
+    *last = hash;
+    *valid = true;
+    return true;
+}
+
+void IPCFlushConnection(FcitxIPCFrontend* ipc, DBusConnection* conn)
+{
+    dbus_connection_flush(conn);
+    if (conn == ipc->_conn)
+        ipc->pendingFlush &= ~IPC_PENDING_CONN;
+    if (conn == ipc->_privconn)
+        ipc->pendingFlush &= ~IPC_PENDING_PRIVCONN;
+}
+
+void IPCFlushPendingSignals(void* arg)
+{
+    FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
+    if ((ipc->pendingFlush & IPC_PENDING_CONN) && ipc->_conn)
+        dbus_connection_flush(ipc->_conn);
+    if ((ipc->pendingFlush & IPC_PENDING_PRIVCONN) && ipc->_privconn)
+        dbus_connection_flush(ipc->_privconn);
+    ipc->pendingFlush = 0;
+}
+
+/*
+ * signals are only queued here, one key event usually emits several of them,
+ * they are written out together when the instance goes back to main loop,
+ * or together with the reply of the method call being handled.
+ */
 void IPCSendSignal(FcitxIPCFrontend* ipc, FcitxIPCIC* ipcic, DBusMessage* msg)
 {
+    unsigned int pending = ipc->pendingFlush;
+    ipc->signalSent++;
     if (!ipcic || !ipcic->isPriv) {
         if (ipc->_conn) {
             dbus_connection_send(ipc->_conn, msg, NULL);
-            dbus_connection_flush(ipc->_conn);
+            ipc->pendingFlush |= IPC_PENDING_CONN;
         }
     }
     if (!ipcic || ipcic->isPriv) {
         if (ipc->_privconn) {
             dbus_connection_send(ipc->_privconn, msg, NULL);
-            dbus_connection_flush(ipc->_privconn);
+            ipc->pendingFlush |= IPC_PENDING_PRIVCONN;
         }
     }
     dbus_message_unref(msg);
+
+    if (!pending && ipc->pendingFlush
+        && !FcitxInstanceCheckTimeoutByFunc(ipc->owner, IPCFlushPendingSignals))
+        FcitxInstanceAddTimeout(ipc->owner, 0, IPCFlushPendingSignals, ipc);
 }
 
 void IPCEnableIM(void* arg, FcitxInputContext* ic)
@@ -552,6 +734,7 @@ void IPCEnableIM(void* arg, FcitxInputContext* ic)
                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
                        "EnableIM"); // name of the signal
 
+    IPCICInvalidateSnapshot(GetIPCIC(ic));
     IPCSendSignal(ipc, GetIPCIC(ic), msg);
 }
 
@@ -561,6 +744,7 @@ void IPCCloseIM(void* arg, FcitxInputContext* ic)
     DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
                        "CloseIM"); // name of the signal
+    IPCICInvalidateSnapshot(GetIPCIC(ic));
     IPCSendSignal(ipc, GetIPCIC(ic), msg);
 }
 
@@ -570,6 +754,9 @@ void IPCCommitString(void* arg, FcitxInputContext* ic, const char* str)
 
     if (!fcitx_utf8_check_string(str))
         return;
+    IPCICInvalidateSnapshot(GetIPCIC(ic));
+    if (IPCShmSend(ipc, GetIPCIC(ic), FCITX_SHM_COMMIT_STRING, str, strlen(str) + 1))
+        return;
     DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
                        "CommitString"); // name of the signal
@@ -581,6 +768,13 @@ void IPCCommitString(void* arg, FcitxInputContext* ic, const char* str)
 void IPCForwardKey(void* arg, FcitxInputContext* ic, FcitxKeyEventType event, FcitxKeySym sym, unsigned int state)
 {
     FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
+    FcitxShmForwardKey key;
+    key.keyval = sym;
+    key.state = state;
+    key.type = event;
+    if (IPCShmSend(ipc, GetIPCIC(ic), FCITX_SHM_FORWARD_KEY, &key, sizeof(key)))
+        return;
+
     DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
                        "ForwardKey"); // name of the signal
@@ -711,6 +905,28 @@ static DBusHandlerResult IPCDBusEventHandler(DBusConnection *connection, DBusMes
         dbus_message_append_args(reply,
                                  DBUS_TYPE_INT32, &r,
                                  DBUS_TYPE_INVALID);
+    } else if (dbus_message_is_method_call(msg, FCITX_IM_DBUS_INTERFACE, "GetKeyTraceReport")) {
+        char* report = FcitxInstanceGetKeyTraceReport(ipc->owner);
+        const char* result = report ? report : "";
+        reply = dbus_message_new_method_return(msg);
+        dbus_message_append_args(reply,
+                                 DBUS_TYPE_STRING, &result,
+                                 DBUS_TYPE_INVALID);
+        fcitx_utils_free(report);
+    } else if (dbus_message_is_method_call(msg, FCITX_IM_DBUS_INTERFACE, "GetSignalStats")) {
+        dbus_uint64_t sent = ipc->signalSent, skipped = ipc->signalSkipped;
+        reply = dbus_message_new_method_return(msg);
+        dbus_message_append_args(reply,
+                                 DBUS_TYPE_UINT64, &sent,
+                                 DBUS_TYPE_UINT64, &skipped,
+                                 DBUS_TYPE_INVALID);
+    } else if (dbus_message_is_method_call(msg, FCITX_IM_DBUS_INTERFACE, "OpenShmChannel")) {
+        reply = IPCOpenShm(ipc, connection, msg);
+    } else if (dbus_message_is_method_call(msg, FCITX_IM_DBUS_INTERFACE, "CloseShmChannel")) {
+        FcitxIPCShm* shm = IPCFindShm(ipc, dbus_message_get_sender(msg), connection);
+        if (shm)
+            IPCCloseShm(ipc, shm);
+        reply = dbus_message_new_method_return(msg);
     } else if (dbus_message_is_method_call(msg, FCITX_IM_DBUS_INTERFACE, "ConfigureAddon")) {
         DBusError error;
         dbus_error_init(&error);
@@ -764,7 +980,7 @@ static DBusHandlerResult IPCDBusEventHandler(DBusConnection *connection, DBusMes
         dbus_connection_send(connection, reply, NULL);
         dbus_message_unref(reply);
         if (flush) {
-            dbus_connection_flush(connection);
+            IPCFlushConnection(ipc, connection);
         }
         result = DBUS_HANDLER_RESULT_HANDLED;
     }
@@ -773,12 +989,19 @@ static DBusHandlerResult IPCDBusEventHandler(DBusConnection *connection, DBusMes
 }
 
 
+static FcitxInputContext* IPCFindIC(FcitxIPCFrontend* ipc, int id)
+{
+    FcitxIPCIC* ipcic = NULL;
+    HASH_FIND_INT(ipc->ics, &id, ipcic);
+    return ipcic ? ipcic->context : NULL;
+}
+
 static DBusHandlerResult IPCICDBusEventHandler(DBusConnection *connection, DBusMessage *msg, void *user_data)
 {
     FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) user_data;
     int id = -1;
     sscanf(dbus_message_get_path(msg), FCITX_IC_DBUS_PATH, &id);
-    FcitxInputContext* ic = FcitxInstanceFindIC(ipc->owner, ipc->frontendid, &id);
+    FcitxInputContext* ic = IPCFindIC(ipc, id);
     DBusHandlerResult result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     DBusMessage *reply = NULL;
     boolean flush = false;
@@ -799,12 +1022,15 @@ static DBusHandlerResult IPCICDBusEventHandler(DBusConnection *connection, DBusM
             FcitxInstanceCloseIM(ipc->owner, ic);
             reply = dbus_message_new_method_return(msg);
         } else if (dbus_message_is_method_call(msg, FCITX_IC_DBUS_INTERFACE, "FocusIn")) {
+            IPCICInvalidateSnapshot(GetIPCIC(ic));
             IPCICFocusIn(ipc, ic);
             reply = dbus_message_new_method_return(msg);
         } else if (dbus_message_is_method_call(msg, FCITX_IC_DBUS_INTERFACE, "FocusOut")) {
+            IPCICInvalidateSnapshot(GetIPCIC(ic));
             IPCICFocusOut(ipc, ic);
             reply = dbus_message_new_method_return(msg);
         } else if (dbus_message_is_method_call(msg, FCITX_IC_DBUS_INTERFACE, "Reset")) {
+            IPCICInvalidateSnapshot(GetIPCIC(ic));
             IPCICReset(ipc, ic);
             reply = dbus_message_new_method_return(msg);
         } else if (dbus_message_is_method_call(msg, FCITX_IC_DBUS_INTERFACE, "MouseEvent")) {
@@ -832,6 +1058,7 @@ static DBusHandlerResult IPCICDBusEventHandler(DBusConnection *connection, DBusM
             uint32_t flags;
             if (dbus_message_get_args(msg, &error, DBUS_TYPE_UINT32, &flags, DBUS_TYPE_INVALID)) {
                 ic->contextCaps = flags;
+                IPCICInvalidateSnapshot(GetIPCIC(ic));
                 if (!(ic->contextCaps & CAPACITY_SURROUNDING_TEXT)) {
                     if (GetIPCIC(ic)->surroundingText)
                         free(GetIPCIC(ic)->surroundingText);
@@ -903,6 +1130,9 @@ static DBusHandlerResult IPCICDBusEventHandler(DBusConnection *connection, DBusM
             } else {
                 reply = FcitxDBusPropertyUnknownMethod(msg);
             }
+        } else if (dbus_message_is_method_call(msg, FCITX_IC_DBUS_INTERFACE, "ProcessKeyEvents")) {
+            reply = IPCProcessKeyEvents(ipc, ic, msg);
+            flush = true;
         }
         dbus_error_free(&error);
     }
@@ -911,7 +1141,7 @@ static DBusHandlerResult IPCICDBusEventHandler(DBusConnection *connection, DBusM
         dbus_connection_send(connection, reply, NULL);
         dbus_message_unref(reply);
         if (flush) {
-            dbus_connection_flush(connection);
+            IPCFlushConnection(ipc, connection);
         }
         result = DBUS_HANDLER_RESULT_HANDLED;
     }
@@ -967,6 +1197,262 @@ static int IPCProcessKey(FcitxIPCFrontend* ipc, FcitxInputContext* callic, const
         return 1;
 }
 
+/*
+ * key events are processed in order, the reply has one result for each of
+ * them, same as the one of ProcessKeyEvent.
+ */
+static DBusMessage* IPCProcessKeyEvents(FcitxIPCFrontend* ipc, FcitxInputContext* ic, DBusMessage* msg)
+{
+    DBusMessageIter args, array, sub;
+    DBusMessageIter rargs, rarray;
+
+    if (!dbus_message_has_signature(msg, "a(uuuiu)"))
+        return dbus_message_new_error_printf(msg, DBUS_ERROR_INVALID_ARGS, "Invalid signature ('%s'), expected 'a(uuuiu)'", dbus_message_get_signature(msg));
+
+    DBusMessage* reply = dbus_message_new_method_return(msg);
+    dbus_message_iter_init_append(reply, &rargs);
+    dbus_message_iter_open_container(&rargs, DBUS_TYPE_ARRAY, "i", &rarray);
+
+    dbus_message_iter_init(msg, &args);
+    dbus_message_iter_recurse(&args, &array);
+    while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+        uint32_t keyval, keycode, state, t;
+        int32_t itype;
+        dbus_message_iter_recurse(&array, &sub);
+        dbus_message_iter_get_basic(&sub, &keyval);
+        dbus_message_iter_next(&sub);
+        dbus_message_iter_get_basic(&sub, &keycode);
+        dbus_message_iter_next(&sub);
+        dbus_message_iter_get_basic(&sub, &state);
+        dbus_message_iter_next(&sub);
+        dbus_message_iter_get_basic(&sub, &itype);
+        dbus_message_iter_next(&sub);
+        dbus_message_iter_get_basic(&sub, &t);
+
+        int32_t ret = IPCProcessKey(ipc, ic, keyval, keycode, state, t, (FcitxKeyEventType) itype);
+        dbus_message_iter_append_basic(&rarray, DBUS_TYPE_INT32, &ret);
+        dbus_message_iter_next(&array);
+    }
+
+    dbus_message_iter_close_container(&rargs, &rarray);
+    return reply;
+}
+
+FcitxIPCShm* IPCFindShm(FcitxIPCFrontend* ipc, const char* owner, DBusConnection* conn)
+{
+    FcitxIPCShm* shm = NULL;
+    if (!owner)
+        return NULL;
+    HASH_FIND_STR(ipc->shms, owner, shm);
+    /* unique names of session bus and private bus are not related */
+    if (shm && shm->conn != conn)
+        return NULL;
+    return shm;
+}
+
+static void IPCShmSendKeyResult(FcitxIPCFrontend* ipc, FcitxIPCShm* shm, int32_t icid, uint32_t serial, int32_t ret)
+{
+    FcitxShmKeyResult result;
+    result.result = ret;
+    if (!fcitx_shm_channel_send(shm->channel, FCITX_SHM_KEY_RESULT, icid, serial, &result, sizeof(result)))
+        IPCCloseShm(ipc, shm);
+}
+
+static void IPCShmProcessEvent(void* arg, int fd)
+{
+    FcitxIPCShm* shm = (FcitxIPCShm*) arg;
+    FcitxIPCFrontend* ipc = shm->ipc;
+    FcitxShmMessage message;
+    FCITX_UNUSED(fd);
+
+    /* key processing may close the channel if client doesn't read it */
+    while (!shm->closed && fcitx_shm_channel_receive(shm->channel, &message)) {
+        if (message.type != FCITX_SHM_KEY_EVENT)
+            continue;
+        FcitxShmKeyEvent key;
+        int32_t ret = 0;
+        if (message.length == sizeof(key)) {
+            memcpy(&key, message.data, sizeof(key));
+            FcitxInputContext* ic = IPCFindIC(ipc, message.icid);
+            /* the channel can only send keys to ic of its own client */
+            if (ic && GetIPCIC(ic)->shm == shm)
+                ret = IPCProcessKey(ipc, ic, key.keyval, key.keycode, key.state, key.time, (FcitxKeyEventType) key.type);
+        }
+        if (!shm->closed)
+            IPCShmSendKeyResult(ipc, shm, message.icid, message.serial, ret);
+    }
+
+    if (!shm->closed && fcitx_shm_channel_is_broken(shm->channel)) {
+        FcitxLog(WARNING, "Invalid data from shared memory channel of %s", shm->owner);
+        IPCCloseShm(ipc, shm);
+    }
+}
+
+static void IPCShmOwnerChanged(void* user_data, void* arg, const char* serviceName, const char* oldName, const char* newName)
+{
+    FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) user_data;
+    FCITX_UNUSED(arg);
+    FCITX_UNUSED(oldName);
+    if (newName && newName[0])
+        return;
+    FcitxIPCShm* shm = IPCFindShm(ipc, serviceName, ipc->_conn);
+    if (shm)
+        IPCCloseShm(ipc, shm);
+}
+
+/*
+ * the fds can only be passed over a unix socket, which also means the
+ * client is on the same host. Existing ic of the client are switched to
+ * the new channel, and so are ic created later.
+ */
+DBusMessage* IPCOpenShm(FcitxIPCFrontend* ipc, DBusConnection* conn, DBusMessage* msg)
+{
+#ifdef DBUS_TYPE_UNIX_FD
+    const char* sender = dbus_message_get_sender(msg);
+    FcitxIPCShm* shm;
+    FcitxShmChannel* channel;
+
+    if (sender && dbus_connection_can_send_type(conn, DBUS_TYPE_UNIX_FD)
+        && (channel = fcitx_shm_channel_new(0)) != NULL) {
+        /* same unique name on the other bus would share the key, drop it too */
+        HASH_FIND_STR(ipc->shms, sender, shm);
+        if (shm)
+            IPCCloseShm(ipc, shm);
+
+        shm = fcitx_utils_new(FcitxIPCShm);
+        shm->owner = strdup(sender);
+        shm->conn = conn;
+        shm->channel = channel;
+        shm->ipc = ipc;
+        if (!FcitxDBusAddIOWatch(ipc->owner, fcitx_shm_channel_get_fd(channel), IPCShmProcessEvent, shm)) {
+            fcitx_shm_channel_free(channel);
+            free(shm->owner);
+            free(shm);
+        } else {
+            int memfd, rxfd, txfd;
+            FcitxIPCIC* ipcic;
+
+            HASH_ADD_KEYPTR(hh, ipc->shms, shm->owner, strlen(shm->owner), shm);
+            /* private bus is gone together with fcitx, only watch session bus */
+            if (conn == ipc->_conn)
+                shm->watchid = FcitxDBusWatchName(ipc->owner, sender, ipc, IPCShmOwnerChanged, NULL, NULL);
+            for (ipcic = ipc->ics; ipcic; ipcic = ipcic->hh.next) {
+                if (ipcic->owner && strcmp(ipcic->owner, sender) == 0
+                    && ipcic->isPriv == (conn != ipc->_conn))
+                    ipcic->shm = shm;
+            }
+
+            fcitx_shm_channel_get_peer_fds(channel, &memfd, &rxfd, &txfd);
+            DBusMessage* reply = dbus_message_new_method_return(msg);
+            dbus_message_append_args(reply,
+                                     DBUS_TYPE_UNIX_FD, &memfd,
+                                     DBUS_TYPE_UNIX_FD, &rxfd,
+                                     DBUS_TYPE_UNIX_FD, &txfd,
+                                     DBUS_TYPE_INVALID);
+            return reply;
+        }
+    }
+#else
+    FCITX_UNUSED(ipc);
+    FCITX_UNUSED(conn);
+#endif
+    return dbus_message_new_error(msg, DBUS_ERROR_NOT_SUPPORTED, "Shared memory channel is not available");
+}
+
+/*
+ * ShmChannelClosed is queued before anything sent on dbus for the ic of the
+ * client after this point, so client can drain the ring first and keep the
+ * order. Key events without result are lost.
+ */
+void IPCCloseShm(FcitxIPCFrontend* ipc, FcitxIPCShm* shm)
+{
+    FcitxIPCIC* ipcic;
+
+    if (shm->closed)
+        return;
+    shm->closed = true;
+    HASH_DEL(ipc->shms, shm);
+    for (ipcic = ipc->ics; ipcic; ipcic = ipcic->hh.next) {
+        if (ipcic->shm == shm)
+            ipcic->shm = NULL;
+    }
+    FcitxDBusRemoveIOWatch(ipc->owner, fcitx_shm_channel_get_fd(shm->channel));
+
+    DBusMessage* msg = dbus_message_new_signal(FCITX_IM_DBUS_PATH, // object name of the signal
+                       FCITX_IM_DBUS_INTERFACE, // interface name of the signal
+                       "ShmChannelClosed"); // name of the signal
+    dbus_message_set_destination(msg, shm->owner);
+    dbus_connection_send(shm->conn, msg, NULL);
+    dbus_message_unref(msg);
+    ipc->pendingFlush |= (shm->conn == ipc->_conn) ? IPC_PENDING_CONN : IPC_PENDING_PRIVCONN;
+    if (!FcitxInstanceCheckTimeoutByFunc(ipc->owner, IPCFlushPendingSignals))
+        FcitxInstanceAddTimeout(ipc->owner, 0, IPCFlushPendingSignals, ipc);
+
+    /* might be called from the callback of the channel or the name watch */
+    shm->next = ipc->closedShms;
+    ipc->closedShms = shm;
+    if (!FcitxInstanceCheckTimeoutByFunc(ipc->owner, IPCPurgeShm))
+        FcitxInstanceAddTimeout(ipc->owner, 0, IPCPurgeShm, ipc);
+}
+
+void IPCPurgeShm(void* arg)
+{
+    FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
+    while (ipc->closedShms) {
+        FcitxIPCShm* shm = ipc->closedShms;
+        ipc->closedShms = shm->next;
+        if (shm->watchid)
+            FcitxDBusUnwatchName(ipc->owner, shm->watchid);
+        fcitx_shm_channel_free(shm->channel);
+        free(shm->owner);
+        free(shm);
+    }
+}
+
+/*
+ * return false if ic has no channel, or the message can't be sent through
+ * it, in which case the channel is closed and the message goes to dbus.
+ */
+boolean IPCShmSend(FcitxIPCFrontend* ipc, FcitxIPCIC* ipcic, uint32_t type, const void* data, uint32_t length)
+{
+    FcitxIPCShm* shm = ipcic->shm;
+    if (!shm)
+        return false;
+    if (fcitx_shm_channel_send(shm->channel, type, ipcic->id, 0, data, length))
+        return true;
+    IPCCloseShm(ipc, shm);
+    return false;
+}
+
+/* int32 cursor, then int32 format and nul terminated string of each segment */
+boolean IPCShmSendPreedit(FcitxIPCFrontend* ipc, FcitxIPCIC* ipcic, char** strs, FcitxMessages* formats, int count, int cursor)
+{
+    if (!ipcic->shm)
+        return false;
+
+    size_t length = sizeof(int32_t);
+    int i;
+    for (i = 0; i < count; i++)
+        length += sizeof(int32_t) + strlen(strs[i]) + 1;
+
+    char* buf = fcitx_utils_malloc0(length);
+    char* p = buf;
+    int32_t value = cursor;
+    memcpy(p, &value, sizeof(value));
+    p += sizeof(value);
+    for (i = 0; i < count; i++) {
+        size_t len = strlen(strs[i]) + 1;
+        value = formats ? FcitxMessagesGetClientMessageType(formats, i) : 0;
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+        memcpy(p, strs[i], len);
+        p += len;
+    }
+    boolean result = IPCShmSend(ipc, ipcic, FCITX_SHM_UPDATE_PREEDIT, buf, length);
+    free(buf);
+    return result;
+}
+
 static void IPCICFocusIn(FcitxIPCFrontend* ipc, FcitxInputContext* ic)
 {
     if (ic == NULL)
@@ -1031,69 +1517,83 @@ void IPCUpdatePreedit(void* arg, FcitxInputContext* ic)
     FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
     FcitxInputState* input = FcitxInstanceGetInputState(ipc->owner);
     FcitxMessages* clientPreedit = FcitxInputStateGetClientPreedit(input);
+    FcitxIPCIC* ipcic = GetIPCIC(ic);
+    int count = FcitxMessagesGetMessageCount(clientPreedit);
     int i = 0;
-    for (i = 0; i < FcitxMessagesGetMessageCount(clientPreedit) ; i ++) {
+    for (i = 0; i < count; i ++) {
         char* str = FcitxMessagesGetMessageString(clientPreedit, i);
         if (!fcitx_utf8_check_string(str))
             return;
     }
 
-    /* a small optimization, don't need to update empty preedit */
-    FcitxIPCIC* ipcic = GetIPCIC(ic);
-    if (ipcic->lastPreeditIsEmpty && FcitxMessagesGetMessageCount(clientPreedit) == 0)
-        return;
-
-    ipcic->lastPreeditIsEmpty = (FcitxMessagesGetMessageCount(clientPreedit) == 0);
+    int iCursorPos = FcitxInputStateGetClientCursorPos(input);
+    uint64_t hash = IPC_HASH_INIT;
 
     if (ic->contextCaps & CAPACITY_FORMATTED_PREEDIT) {
-        DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
-                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
-                        "UpdateFormattedPreedit"); // name of the signal
+        /* filter first, what client sees is the filtered string */
+        char* origin[count > 0 ? count : 1];
+        char* strs[count > 0 ? count : 1];
+        for (i = 0; i < count; i ++) {
+            origin[i] = strs[i] = FcitxMessagesGetMessageString(clientPreedit, i);
+        }
+        FcitxInstanceProcessOutputFilterArray(ipc->owner, strs, count);
 
-        DBusMessageIter args, array, sub;
-        dbus_message_iter_init_append(msg, &args);
-        dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(si)", &array);
-        int i = 0;
-        for (i = 0; i < FcitxMessagesGetMessageCount(clientPreedit) ; i ++) {
-            dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, 0, &sub);
-            char* str = FcitxMessagesGetMessageString(clientPreedit, i);
-            char* needtofree = FcitxInstanceProcessOutputFilter(ipc->owner, str);
-            if (needtofree) {
-                str = needtofree;
-            }
-            int type = FcitxMessagesGetClientMessageType(clientPreedit, i);
-            dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &str);
-            dbus_message_iter_append_basic(&sub, DBUS_TYPE_INT32, &type);
-            dbus_message_iter_close_container(&array, &sub);
-            if (needtofree)
-                free(needtofree);
+        hash = IPCHashInt(hash, 1);
+        for (i = 0; i < count; i ++) {
+            hash = IPCHashString(hash, strs[i]);
+            hash = IPCHashInt(hash, FcitxMessagesGetClientMessageType(clientPreedit, i));
         }
-        dbus_message_iter_close_container(&args, &array);
+        hash = IPCHashInt(hash, iCursorPos);
+
+        if (IPCICUpdateSnapshot(ipc, &ipcic->lastPreedit, &ipcic->lastPreeditValid, hash)
+            && !IPCShmSendPreedit(ipc, ipcic, strs, clientPreedit, count, iCursorPos)) {
+            DBusMessage* msg = dbus_message_new_signal(ipcic->path, // object name of the signal
+                            FCITX_IC_DBUS_INTERFACE, // interface name of the signal
+                            "UpdateFormattedPreedit"); // name of the signal
+
+            DBusMessageIter args, array, sub;
+            dbus_message_iter_init_append(msg, &args);
+            dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(si)", &array);
+            for (i = 0; i < count; i ++) {
+                dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, 0, &sub);
+                int type = FcitxMessagesGetClientMessageType(clientPreedit, i);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &strs[i]);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_INT32, &type);
+                dbus_message_iter_close_container(&array, &sub);
+            }
+            dbus_message_iter_close_container(&args, &array);
+            dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &iCursorPos);
 
-        int iCursorPos = FcitxInputStateGetClientCursorPos(input);
-        dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &iCursorPos);
+            IPCSendSignal(ipc, ipcic, msg);
+        }
 
-        IPCSendSignal(ipc, GetIPCIC(ic), msg);
+        for (i = 0; i < count; i ++) {
+            if (strs[i] != origin[i])
+                free(strs[i]);
+        }
     }
     else {
-        FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
-        FcitxInputState* input = FcitxInstanceGetInputState(ipc->owner);
-        DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
-                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
-                        "UpdatePreedit"); // name of the signal
-
-        char* strPreedit = FcitxUIMessagesToCString(FcitxInputStateGetClientPreedit(input));
+        char* strPreedit = FcitxUIMessagesToCString(clientPreedit);
         char* str = FcitxInstanceProcessOutputFilter(ipc->owner, strPreedit);
         if (str) {
             free(strPreedit);
             strPreedit = str;
         }
 
-        int iCursorPos = FcitxInputStateGetClientCursorPos(input);
+        hash = IPCHashInt(hash, 0);
+        hash = IPCHashString(hash, strPreedit);
+        hash = IPCHashInt(hash, iCursorPos);
 
-        dbus_message_append_args(msg, DBUS_TYPE_STRING, &strPreedit, DBUS_TYPE_INT32, &iCursorPos, DBUS_TYPE_INVALID);
+        if (IPCICUpdateSnapshot(ipc, &ipcic->lastPreedit, &ipcic->lastPreeditValid, hash)
+            && !IPCShmSendPreedit(ipc, ipcic, &strPreedit, NULL, 1, iCursorPos)) {
+            DBusMessage* msg = dbus_message_new_signal(ipcic->path, // object name of the signal
+                            FCITX_IC_DBUS_INTERFACE, // interface name of the signal
+                            "UpdatePreedit"); // name of the signal
 
-        IPCSendSignal(ipc, GetIPCIC(ic), msg);
+            dbus_message_append_args(msg, DBUS_TYPE_STRING, &strPreedit, DBUS_TYPE_INT32, &iCursorPos, DBUS_TYPE_INVALID);
+
+            IPCSendSignal(ipc, ipcic, msg);
+        }
         free(strPreedit);
     }
 }
@@ -1133,6 +1633,12 @@ void IPCDeleteSurroundingText(void* arg, FcitxInputContext* ic, int offset, unsi
     }
 
 
+    FcitxShmDeleteSurroundingText text;
+    text.offset = offset;
+    text.nchar = size;
+    if (IPCShmSend(ipc, ipcic, FCITX_SHM_DELETE_SURROUNDING_TEXT, &text, sizeof(text)))
+        return;
+
     DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
                        FCITX_IC_DBUS_INTERFACE, // interface name of the signal
                        "DeleteSurroundingText"); // name of the signal
@@ -1164,13 +1670,199 @@ boolean IPCGetSurroundingText(void* arg, FcitxInputContext* ic, char** str, unsi
 }
 
 
+static uint64_t IPCHashMessages(FcitxMessages* messages, char** strs)
+{
+    uint64_t hash = IPC_HASH_INIT;
+    int i;
+    for (i = 0; i < FcitxMessagesGetMessageCount(messages); i++) {
+        hash = IPCHashString(hash, strs[i]);
+        hash = IPCHashInt(hash, FcitxMessagesGetMessageType(messages, i));
+    }
+    return hash;
+}
+
+static void IPCAppendMessages(DBusMessageIter* args, FcitxMessages* messages,
+                              char** strs, boolean changed)
+{
+    DBusMessageIter array, sub;
+    int i;
+    dbus_message_iter_open_container(args, DBUS_TYPE_ARRAY, "(si)", &array);
+    for (i = 0; changed && i < FcitxMessagesGetMessageCount(messages); i++) {
+        int type = FcitxMessagesGetMessageType(messages, i);
+        dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, 0, &sub);
+        dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &strs[i]);
+        dbus_message_iter_append_basic(&sub, DBUS_TYPE_INT32, &type);
+        dbus_message_iter_close_container(&array, &sub);
+    }
+    dbus_message_iter_close_container(args, &array);
+}
+
+/*
+ * send aux, preedit and candidates as they are instead of flattened strings,
+ * and only the fields (and candidates) differ from the last signal.
+ */
+static void IPCUpdateClientSideUIDelta(FcitxIPCFrontend* ipc, FcitxIPCIC* ipcic)
+{
+    static const uint32_t messageFlags[3] = {
+        FCITX_CLIENT_SIDE_UI_AUX_UP,
+        FCITX_CLIENT_SIDE_UI_AUX_DOWN,
+        FCITX_CLIENT_SIDE_UI_PREEDIT
+    };
+    FcitxInputState* input = FcitxInstanceGetInputState(ipc->owner);
+    FcitxCandidateWordList* candList = FcitxInputStateGetCandidateList(input);
+    FcitxIPCClientSideUI* ui = &ipcic->clientSideUI;
+    FcitxMessages* messages[3] = {
+        FcitxInputStateGetAuxUp(input),
+        FcitxInputStateGetAuxDown(input),
+        FcitxInputStateGetPreedit(input)
+    };
+    FcitxCandidateWord* words[MAX_CAND_WORD];
+    int candCount = 0;
+    int total = 0;
+    int i, j, n;
+
+    FcitxCandidateWord* candWord;
+    for (candWord = FcitxCandidateWordGetCurrentWindow(candList);
+         candWord != NULL && candCount < MAX_CAND_WORD;
+         candWord = FcitxCandidateWordGetCurrentWindowNext(candList, candWord))
+        words[candCount++] = candWord;
+
+    for (i = 0; i < 3; i++)
+        total += FcitxMessagesGetMessageCount(messages[i]);
+    total += candCount * 2;
+
+    /* all strings go through the output filter at once */
+    char* origin[total > 0 ? total : 1];
+    char* strs[total > 0 ? total : 1];
+    char** messageStrs[3];
+    n = 0;
+    for (i = 0; i < 3; i++) {
+        messageStrs[i] = &strs[n];
+        for (j = 0; j < FcitxMessagesGetMessageCount(messages[i]); j++)
+            origin[n++] = FcitxMessagesGetMessageString(messages[i], j);
+    }
+    char** candStrs = &strs[n];
+    for (i = 0; i < candCount; i++) {
+        origin[n++] = words[i]->strWord;
+        origin[n++] = words[i]->strExtra ? words[i]->strExtra : "";
+    }
+    memcpy(strs, origin, sizeof(char*) * total);
+    FcitxInstanceProcessOutputFilterArray(ipc->owner, strs, total);
+
+    uint32_t changed = 0;
+    if (!ui->valid) {
+        changed = FCITX_CLIENT_SIDE_UI_FULL | FCITX_CLIENT_SIDE_UI_AUX_UP
+                  | FCITX_CLIENT_SIDE_UI_AUX_DOWN | FCITX_CLIENT_SIDE_UI_PREEDIT
+                  | FCITX_CLIENT_SIDE_UI_CURSOR | FCITX_CLIENT_SIDE_UI_IM_NAME
+                  | FCITX_CLIENT_SIDE_UI_CANDIDATE;
+    }
+
+    for (i = 0; i < 3; i++) {
+        uint64_t hash = IPCHashMessages(messages[i], messageStrs[i]);
+        if (hash != ui->messages[i]) {
+            ui->messages[i] = hash;
+            changed |= messageFlags[i];
+        }
+    }
+
+    int iCursorPos = FcitxInputStateGetCursorPos(input);
+    if (iCursorPos != ui->cursor) {
+        ui->cursor = iCursorPos;
+        changed |= FCITX_CLIENT_SIDE_UI_CURSOR;
+    }
+
+    FcitxIM* im = FcitxInstanceGetCurrentIM(ipc->owner);
+    char* imname = im ? im->strName : "En";
+    uint64_t hash = IPCHashString(IPC_HASH_INIT, imname);
+    if (hash != ui->imName) {
+        ui->imName = hash;
+        changed |= FCITX_CLIENT_SIDE_UI_IM_NAME;
+    }
+
+    const char* choose = FcitxCandidateWordGetChoose(candList);
+    char labels[MAX_CAND_WORD][2];
+    boolean candChanged[MAX_CAND_WORD];
+    for (i = 0; i < candCount; i++) {
+        labels[i][0] = choose[i];
+        labels[i][1] = '\0';
+        hash = IPCHashString(IPC_HASH_INIT, labels[i]);
+        hash = IPCHashString(hash, candStrs[i * 2]);
+        hash = IPCHashString(hash, candStrs[i * 2 + 1]);
+        hash = IPCHashInt(hash, words[i]->wordType);
+        candChanged[i] = (changed & FCITX_CLIENT_SIDE_UI_FULL)
+                         || (unsigned int) i >= ui->candidateCount
+                         || hash != ui->candidates[i];
+        if (candChanged[i]) {
+            ui->candidates[i] = hash;
+            changed |= FCITX_CLIENT_SIDE_UI_CANDIDATE;
+        }
+    }
+    unsigned int candFlags = 0;
+    if (FcitxCandidateWordHasPrev(candList))
+        candFlags |= FCITX_CLIENT_SIDE_UI_HAS_PREV;
+    if (FcitxCandidateWordHasNext(candList))
+        candFlags |= FCITX_CLIENT_SIDE_UI_HAS_NEXT;
+    if ((unsigned int) candCount != ui->candidateCount || candFlags != ui->candidateFlags) {
+        ui->candidateCount = candCount;
+        ui->candidateFlags = candFlags;
+        changed |= FCITX_CLIENT_SIDE_UI_CANDIDATE;
+    }
+
+    if (changed) {
+        ui->valid = true;
+        ui->serial++;
+
+        DBusMessage* msg = dbus_message_new_signal(ipcic->path, // object name of the signal
+                           FCITX_IC_DBUS_INTERFACE, // interface name of the signal
+                           "UpdateClientSideUIDelta"); // name of the signal
+        DBusMessageIter args, array, sub;
+        const char* sentName = (changed & FCITX_CLIENT_SIDE_UI_IM_NAME) ? imname : "";
+        dbus_message_iter_init_append(msg, &args);
+        dbus_message_iter_append_basic(&args, DBUS_TYPE_UINT32, &ui->serial);
+        dbus_message_iter_append_basic(&args, DBUS_TYPE_UINT32, &changed);
+        for (i = 0; i < 3; i++)
+            IPCAppendMessages(&args, messages[i], messageStrs[i], changed & messageFlags[i]);
+        dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &iCursorPos);
+        dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &sentName);
+        dbus_message_iter_append_basic(&args, DBUS_TYPE_UINT32, &ui->candidateCount);
+        dbus_message_iter_append_basic(&args, DBUS_TYPE_UINT32, &candFlags);
+        dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(isssi)", &array);
+        for (i = 0; i < candCount; i++) {
+            if (!candChanged[i])
+                continue;
+            char* label = labels[i];
+            int type = words[i]->wordType;
+            dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, 0, &sub);
+            dbus_message_iter_append_basic(&sub, DBUS_TYPE_INT32, &i);
+            dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &label);
+            dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &candStrs[i * 2]);
+            dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &candStrs[i * 2 + 1]);
+            dbus_message_iter_append_basic(&sub, DBUS_TYPE_INT32, &type);
+            dbus_message_iter_close_container(&array, &sub);
+        }
+        dbus_message_iter_close_container(&args, &array);
+
+        IPCSendSignal(ipc, ipcic, msg);
+    } else {
+        ipc->signalSkipped++;
+    }
+
+    for (i = 0; i < total; i++) {
+        if (strs[i] != origin[i])
+            free(strs[i]);
+    }
+}
+
 void IPCUpdateClientSideUI(void* arg, FcitxInputContext* ic)
 {
     FcitxIPCFrontend* ipc = (FcitxIPCFrontend*) arg;
     FcitxInputState* input = FcitxInstanceGetInputState(ipc->owner);
-    DBusMessage* msg = dbus_message_new_signal(GetIPCIC(ic)->path, // object name of the signal
-                       FCITX_IC_DBUS_INTERFACE, // interface name of the signal
-                       "UpdateClientSideUI"); // name of the signal
+    FcitxIPCIC* ipcic = GetIPCIC(ic);
+
+    if (ic->contextCaps & CAPACITY_STRUCTURED_CLIENT_SIDE_UI) {
+        IPCUpdateClientSideUIDelta(ipc, ipcic);
+        return;
+    }
 
     char *str;
     char* strAuxUp = FcitxUIMessagesToCString(FcitxInputStateGetAuxUp(input));
@@ -1206,16 +1898,30 @@ void IPCUpdateClientSideUI(void* arg, FcitxInputContext* ic)
 
     int iCursorPos = FcitxInputStateGetCursorPos(input);
 
-    dbus_message_append_args(msg,
-                             DBUS_TYPE_STRING, &strAuxUp,
-                             DBUS_TYPE_STRING, &strAuxDown,
-                             DBUS_TYPE_STRING, &strPreedit,
-                             DBUS_TYPE_STRING, &candidateword,
-                             DBUS_TYPE_STRING, &imname,
-                             DBUS_TYPE_INT32, &iCursorPos,
-                             DBUS_TYPE_INVALID);
+    uint64_t hash = IPC_HASH_INIT;
+    hash = IPCHashString(hash, strAuxUp);
+    hash = IPCHashString(hash, strAuxDown);
+    hash = IPCHashString(hash, strPreedit);
+    hash = IPCHashString(hash, candidateword);
+    hash = IPCHashString(hash, imname);
+    hash = IPCHashInt(hash, iCursorPos);
+
+    if (IPCICUpdateSnapshot(ipc, &ipcic->lastClientSideUI, &ipcic->lastClientSideUIValid, hash)) {
+        DBusMessage* msg = dbus_message_new_signal(ipcic->path, // object name of the signal
+                           FCITX_IC_DBUS_INTERFACE, // interface name of the signal
+                           "UpdateClientSideUI"); // name of the signal
+
+        dbus_message_append_args(msg,
+                                 DBUS_TYPE_STRING, &strAuxUp,
+                                 DBUS_TYPE_STRING, &strAuxDown,
+                                 DBUS_TYPE_STRING, &strPreedit,
+                                 DBUS_TYPE_STRING, &candidateword,
+                                 DBUS_TYPE_STRING, &imname,
+                                 DBUS_TYPE_INT32, &iCursorPos,
+                                 DBUS_TYPE_INVALID);
 
-    IPCSendSignal(ipc, GetIPCIC(ic), msg);
+        IPCSendSignal(ipc, ipcic, msg);
+    }
     free(strAuxUp);
     free(strAuxDown);
     free(strPreedit);
@@ -31,6 +31,23 @@ extern "C" {
 #define FCITX_IM_DBUS_INTERFACE "org.fcitx.Fcitx.InputMethod"
 #define FCITX_IC_DBUS_INTERFACE "org.fcitx.Fcitx.InputContext"
 
+/*
+ * changed fields of UpdateClientSideUIDelta, fields not flagged are sent
+ * empty and client should keep what it has. With FULL set, client should
+ * drop everything it has first.
+ */
+#define FCITX_CLIENT_SIDE_UI_FULL (1 << 0)
+#define FCITX_CLIENT_SIDE_UI_AUX_UP (1 << 1)
+#define FCITX_CLIENT_SIDE_UI_AUX_DOWN (1 << 2)
+#define FCITX_CLIENT_SIDE_UI_PREEDIT (1 << 3)
+#define FCITX_CLIENT_SIDE_UI_CURSOR (1 << 4)
+#define FCITX_CLIENT_SIDE_UI_IM_NAME (1 << 5)
+#define FCITX_CLIENT_SIDE_UI_CANDIDATE (1 << 6)
+
+/* candidateflags of UpdateClientSideUIDelta */
+#define FCITX_CLIENT_SIDE_UI_HAS_PREV (1 << 0)
+#define FCITX_CLIENT_SIDE_UI_HAS_NEXT (1 << 1)
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,6 +19,7 @@
 
 #include <QApplication>
 #include <QInputContextFactory>
+#include <QPointer>
 #include <QTextCharFormat>
 
 #include <sys/time.h>
@@ -52,6 +53,9 @@ static const int XKeyRelease = KeyRelease;
 #undef FocusOut
 #endif
 
+/* a key not answered by fcitx within this time is treated as not handled */
+#define PROCESS_KEY_TIMEOUT 1000
+
 #ifndef Q_LIKELY
 #define Q_LIKELY(x) (x)
 #endif
@@ -90,7 +94,6 @@ QFcitxInputContext::QFcitxInputContext()
     : m_improxy(0),
       m_cursorPos(0),
       m_useSurroundingText(false),
-      m_syncMode(true),
       m_connection(new FcitxQtConnection(this)),
       m_xkbContext(_xkb_context_new_helper()),
       m_xkbComposeTable(m_xkbContext ? xkb_compose_table_new_from_locale(m_xkbContext.data(), get_locale(), XKB_COMPOSE_COMPILE_NO_FLAGS) : 0),
@@ -105,12 +108,25 @@ QFcitxInputContext::QFcitxInputContext()
     connect(m_connection, SIGNAL(connected()), this, SLOT(connected()));
     connect(m_connection, SIGNAL(disconnected()), this, SLOT(cleanUp()));
 
+#if defined(Q_WS_X11) && defined(ENABLE_X11)
+    m_keyStalled = false;
+    m_replayScheduled = false;
+    m_keyTimer = new QTimer(this);
+    m_keyTimer->setSingleShot(true);
+    m_keyTimer->setInterval(PROCESS_KEY_TIMEOUT);
+    connect(m_keyTimer, SIGNAL(timeout()), this, SLOT(x11ProcessKeyEventTimeout()));
+#endif
+
     m_connection->startConnection();
 }
 
 QFcitxInputContext::~QFcitxInputContext()
 {
     cleanUp();
+#if defined(Q_WS_X11) && defined(ENABLE_X11)
+    qDeleteAll(m_pendingKeys);
+    qDeleteAll(m_replayKeys);
+#endif
 }
 
 void QFcitxInputContext::connected()
@@ -429,6 +445,10 @@ void QFcitxInputContext::setFocusWidget(QWidget* w)
 
     FcitxQtInputContextProxy* newproxy = validICByWidget(w);
 
+#if defined(Q_WS_X11) && defined(ENABLE_X11)
+    m_keyStalled = false;
+#endif
+
     if (newproxy) {
         newproxy->FocusIn();
     } else {
@@ -482,8 +502,13 @@ bool QFcitxInputContext::x11FilterEvent(QWidget* keywidget, XEvent* event)
 
     FcitxQtInputContextProxy* proxy = validICByWidget(keywidget);
 
-    if (Q_UNLIKELY(!proxy)) {
-        return x11FilterEventFallback(event, sym);
+    if (Q_UNLIKELY(!proxy || m_keyStalled)) {
+        if (m_pendingKeys.isEmpty() && m_replayKeys.isEmpty())
+            return x11FilterEventFallback(event, sym);
+        /* wait behind the keys still in flight or not replayed yet */
+        m_pendingKeys.append(new FcitxQtPendingKey(event, sym, FcitxQtPendingKey::Unhandled));
+        x11FlushKeys();
+        return true;
     }
 
     QDBusPendingReply< int > result = proxy->ProcessKeyEvent(
@@ -493,46 +518,104 @@ bool QFcitxInputContext::x11FilterEvent(QWidget* keywidget, XEvent* event)
                                           (event->type == XKeyPress) ? FCITX_PRESS_KEY : FCITX_RELEASE_KEY,
                                           event->xkey.time
                                       );
-    if (Q_UNLIKELY(m_syncMode)) {
-        do {
-            QCoreApplication::processEvents (QEventLoop::WaitForMoreEvents);
-        } while (QCoreApplication::hasPendingEvents () || !result.isFinished ());
-
-        if (!m_connection->isConnected() || !result.isFinished() || result.isError() || result.value() <= 0) {
-            return x11FilterEventFallback(event, sym);
-        } else {
-            update();
-            return true;
-        }
-        return false;
-    }
-    else {
-        ProcessKeyWatcher* watcher = new ProcessKeyWatcher(event, sym, result);
-        connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), SLOT(x11ProcessKeyEventCallback(QDBusPendingCallWatcher*)));
-        return true;
-    }
+    FcitxQtPendingKey* key = new FcitxQtPendingKey(event, sym, FcitxQtPendingKey::Pending);
+    key->watcher = new QDBusPendingCallWatcher(result, this);
+    connect(key->watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), SLOT(x11ProcessKeyEventCallback(QDBusPendingCallWatcher*)));
+    if (m_pendingKeys.isEmpty())
+        m_keyTimer->start();
+    m_pendingKeys.append(key);
+    return true;
 }
 
 void QFcitxInputContext::x11ProcessKeyEventCallback(QDBusPendingCallWatcher* watcher)
 {
-    ProcessKeyWatcher* pkwatcher = static_cast<ProcessKeyWatcher*>(watcher);
     QDBusPendingReply< int > result(*watcher);
-    bool r = false;
-    if (result.isError() || result.value() <= 0) {
-        r = x11FilterEventFallback(pkwatcher->event, pkwatcher->sym);
-    } else {
-        r = true;
+    watcher->deleteLater();
+
+    FcitxQtPendingKey* key = 0;
+    Q_FOREACH(FcitxQtPendingKey* pending, m_pendingKeys) {
+        if (pending->watcher == watcher) {
+            key = pending;
+            break;
+        }
     }
 
+    if (!key) {
+        /* already given up, but a late reply means fcitx is back */
+        if (!result.isError())
+            m_keyStalled = false;
+        return;
+    }
+
+    key->watcher = 0;
+    if (result.isError() || result.value() <= 0)
+        key->state = FcitxQtPendingKey::Unhandled;
+    else
+        key->state = FcitxQtPendingKey::Handled;
+
     if (!result.isError()) {
         update();
     }
 
-    if (r)
-        delete pkwatcher;
-    else {
-        pkwatcher->event->xkey.state |= FcitxKeyState_IgnoredMask;
-        QMetaObject::invokeMethod(pkwatcher, "processEvent", Qt::QueuedConnection);
+    x11FlushKeys();
+}
+
+void QFcitxInputContext::x11ProcessKeyEventTimeout()
+{
+    /*
+     * the keys sent after the timed out one would wait just as long, so give
+     * up all of them and bypass fcitx until it answers again or focus changes.
+     */
+    Q_FOREACH(FcitxQtPendingKey* key, m_pendingKeys) {
+        if (key->state == FcitxQtPendingKey::Pending) {
+            key->state = FcitxQtPendingKey::Unhandled;
+            key->watcher = 0;
+        }
+    }
+    m_keyStalled = true;
+    x11FlushKeys();
+}
+
+/*
+ * called from the reply slot and the timer, delivering a key right here could
+ * re-enter this input context or destroy it, so the unhandled keys are only
+ * put in order and replayed from a queued call.
+ */
+void QFcitxInputContext::x11FlushKeys()
+{
+    bool advanced = false;
+    while (!m_pendingKeys.isEmpty() && m_pendingKeys.first()->state != FcitxQtPendingKey::Pending) {
+        FcitxQtPendingKey* key = m_pendingKeys.takeFirst();
+        if (key->state == FcitxQtPendingKey::Unhandled)
+            m_replayKeys.append(key);
+        else
+            delete key;
+        advanced = true;
+    }
+
+    if (m_pendingKeys.isEmpty())
+        m_keyTimer->stop();
+    else if (advanced)
+        m_keyTimer->start();
+
+    if (!m_replayKeys.isEmpty() && !m_replayScheduled) {
+        m_replayScheduled = true;
+        QMetaObject::invokeMethod(this, "x11ReplayKeys", Qt::QueuedConnection);
+    }
+}
+
+void QFcitxInputContext::x11ReplayKeys()
+{
+    m_replayScheduled = false;
+    QPointer<QFcitxInputContext> self(this);
+    /* keys filtered meanwhile are appended, so take one at a time */
+    while (self && !m_replayKeys.isEmpty()) {
+        FcitxQtPendingKey* key = m_replayKeys.takeFirst();
+        if (!x11FilterEventFallback(&key->event, key->sym)) {
+            key->event.xkey.state |= FcitxKeyState_IgnoredMask;
+            qApp->x11ProcessEvent(&key->event);
+        }
+        delete key;
     }
 }
 
@@ -624,11 +707,6 @@ void QFcitxInputContext::createInputContextFinished(QDBusPendingCallWatcher* wat
         if (m_useSurroundingText)
             flag |= CAPACITY_SURROUNDING_TEXT;
 
-        /*
-         * event loop will cause some problem, so we tries to use async way.
-         */
-        m_syncMode = fcitx_utils_get_boolean_env("FCITX_QT_USE_SYNC", false);
-
         addCapacity(data, flag, true);
     } while(0);
     delete watcher;
@@ -28,6 +28,7 @@
 #include <QDir>
 #include <QApplication>
 #include <QWeakPointer>
+#include <QTimer>
 
 #include <xkbcommon/xkbcommon-compose.h>
 #include "fcitx-qt/fcitxqtinputcontextproxy.h"
@@ -59,28 +60,22 @@ struct FcitxQtICData {
 
 class FcitxQtConnection;
 
-class ProcessKeyWatcher : public QDBusPendingCallWatcher
-{
-    Q_OBJECT
-public:
-    ProcessKeyWatcher(XEvent* e, KeySym s, const QDBusPendingCall &call, QObject *parent = 0) : QDBusPendingCallWatcher(call, parent) {
-        event = static_cast<XEvent*>(malloc(sizeof(XEvent)));
-        *event = *e;
-        sym = s;
-    }
-
-    virtual ~ProcessKeyWatcher() {
-        free(event);
-    }
-
-public slots:
-    void processEvent() {
-        qApp->x11ProcessEvent(event);
-        deleteLater();
-    }
-public:
-    XEvent* event;
+/*
+ * key sent to fcitx, or key waiting behind such one. Unhandled keys are
+ * replayed strictly in the order they were pressed.
+ */
+struct FcitxQtPendingKey {
+    enum State {
+        Pending,
+        Handled,
+        Unhandled
+    };
+
+    FcitxQtPendingKey(XEvent* e, KeySym s, State st) : event(*e), sym(s), watcher(0), state(st) {}
+    XEvent event;
     KeySym sym;
+    QDBusPendingCallWatcher* watcher;
+    State state;
 };
 #endif
 
@@ -147,6 +142,8 @@ private Q_SLOTS:
     void updateCursor();
 #if defined(Q_WS_X11) && defined(ENABLE_X11)
     void x11ProcessKeyEventCallback(QDBusPendingCallWatcher* watcher);
+    void x11ProcessKeyEventTimeout();
+    void x11ReplayKeys();
 #endif
 private:
     QWidget* validFocusWidget();
@@ -155,6 +152,7 @@ private:
     bool checkCompactTable(const struct _FcitxComposeTableCompact *table);
 #if defined(Q_WS_X11) && defined(ENABLE_X11)
     bool x11FilterEventFallback(XEvent *event, KeySym sym);
+    void x11FlushKeys();
     XEvent* createXEvent(Display* dpy, WId wid, uint keyval, uint state, int type);
 #endif // Q_WS_X11
     QKeyEvent* createKeyEvent(uint keyval, uint state, int type);
@@ -190,8 +188,15 @@ private:
     FcitxQtFormattedPreeditList m_preeditList;
     int m_cursorPos;
     bool m_useSurroundingText;
-    bool m_syncMode;
     FcitxQtConnection* m_connection;
+#if defined(Q_WS_X11) && defined(ENABLE_X11)
+    QList<FcitxQtPendingKey*> m_pendingKeys;
+    /* unhandled keys in order, delivered later by x11ReplayKeys */
+    QList<FcitxQtPendingKey*> m_replayKeys;
+    bool m_replayScheduled;
+    QTimer* m_keyTimer;
+    bool m_keyStalled;
+#endif
     QHash<WId, FcitxQtICData*> m_icMap;
     QScopedPointer<struct xkb_context, XkbContextDeleter> m_xkbContext;
     QScopedPointer<struct xkb_compose_table, XkbComposeTableDeleter>  m_xkbComposeTable;
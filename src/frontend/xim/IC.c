@@ -207,6 +207,8 @@ void XimDestroyIC(void* arg, FcitxInputContext* context)
         free(privic->resource_name);
     if (privic->resource_class)
         free(privic->resource_class);
+    fcitx_utils_free(privic->onspot_preedit);
+    fcitx_utils_free(privic->onspot_feedback);
 
     context->privateic = NULL;
     free(privic);
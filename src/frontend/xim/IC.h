@@ -80,6 +80,11 @@ typedef struct _FcitxXimIC {
     CARD16 connect_id;
     int bPreeditStarted;
     uint onspot_preedit_length;
+    /* preedit shown by client, only the changed part is drawn next time */
+    char* onspot_preedit;
+    XIMFeedback* onspot_feedback;
+    boolean bPreeditSynced;
+    uint onspot_caret;
     boolean bHasCursorLocation;
     int offset_x;
     int offset_y;
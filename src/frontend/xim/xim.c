@@ -353,6 +353,8 @@ boolean XimDestroy(void* arg)
         xim->ims = NULL;
     }
     XimQueueDestroy(xim);
+    XimCompoundTextCacheFree(xim);
+    free(xim->feedback);
     free(xim);
     return true;
 }
@@ -361,42 +363,44 @@ void XimEnableIM(void* arg, FcitxInputContext* ic)
 {
     FcitxXimFrontend* xim = (FcitxXimFrontend*) arg;
     FcitxXimIC* ximic = (FcitxXimIC*) ic->privateic;
-    IMChangeFocusStruct* call_data = fcitx_utils_new(IMChangeFocusStruct);
-    call_data->connect_id = ximic->connect_id;
-    call_data->icid = ximic->id;
-    XimPendingCall(xim, XCT_PREEDIT_START, (XPointer) call_data);
+    XimQueueItem* item = XimQueueNewItem(xim);
+    item->call.focus.connect_id = ximic->connect_id;
+    item->call.focus.icid = ximic->id;
+    XimPendingCall(xim, XCT_PREEDIT_START, item);
 }
 
 void XimCloseIM(void* arg, FcitxInputContext* ic)
 {
     FcitxXimFrontend* xim = (FcitxXimFrontend*) arg;
-    IMChangeFocusStruct* call_data = fcitx_utils_new(IMChangeFocusStruct);
+    XimQueueItem* item = XimQueueNewItem(xim);
     FcitxXimIC* ximic = (FcitxXimIC*) ic->privateic;
-    call_data->connect_id = ximic->connect_id;
-    call_data->icid = ximic->id;
-    XimPendingCall(xim, XCT_PREEDIT_END, (XPointer) call_data);
+    item->call.focus.connect_id = ximic->connect_id;
+    item->call.focus.icid = ximic->id;
+    XimPendingCall(xim, XCT_PREEDIT_END, item);
 }
 
 void XimCommitString(void* arg, FcitxInputContext* ic, const char* str)
 {
     FcitxXimFrontend* xim = (FcitxXimFrontend*) arg;
-    XTextProperty tp;
-    FcitxXimIC* ximic = (FcitxXimIC*) ic->privateic;
+    size_t length;
 
     /* avoid Seg fault */
     if (!ic)
         return;
 
-
-    Xutf8TextListToTextProperty(xim->display, (char **) &str, 1, XCompoundTextStyle, &tp);
-    IMCommitStruct* cms = fcitx_utils_new(IMCommitStruct);
+    FcitxXimIC* ximic = (FcitxXimIC*) ic->privateic;
+    const char* text = XimCompoundTextFromUtf8(xim, str, &length);
+    if (!text)
+        return;
+    XimQueueItem* item = XimQueueNewItem(xim);
+    IMCommitStruct* cms = &item->call.commit;
 
     cms->major_code = XIM_COMMIT;
     cms->icid = ximic->id;
     cms->connect_id = ximic->connect_id;
     cms->flag = XimLookupChars;
-    cms->commit_string = (char *) tp.value;
-    XimPendingCall(xim, XCT_COMMIT, (XPointer) cms);
+    cms->commit_string = memcpy(XimQueueItemString(item, length + 1), text, length + 1);
+    XimPendingCall(xim, XCT_COMMIT, item);
 }
 
 void XimForwardKey(void *arg, FcitxInputContext* ic, FcitxKeyEventType event, FcitxKeySym sym, unsigned int state)
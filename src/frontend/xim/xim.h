@@ -32,6 +32,15 @@
 
 #define GetXimIC(c) ((FcitxXimIC*)(c)->privateic)
 
+/* recent utf8 to compound text conversions, preedit is redrawn a lot */
+#define XIM_CT_CACHE_SIZE 8
+
+typedef struct _XimCompoundText {
+    char* utf8;
+    char* text;
+    size_t length;
+} XimCompoundText;
+
 typedef struct _FcitxXimFrontend {
     FcitxGenericConfig gconfig;
     boolean bUseOnTheSpotStyle;
@@ -50,6 +59,10 @@ typedef struct _FcitxXimFrontend {
     int feedback_len;
     Window xim_window;
     UT_array* queue;
+    struct _XimQueueItem* queuePool;
+    int queuePoolSize;
+    XimCompoundText ctCache[XIM_CT_CACHE_SIZE];
+    int ctCacheNext;
 } FcitxXimFrontend;
 
 CONFIG_BINDING_DECLARE(FcitxXimFrontend)
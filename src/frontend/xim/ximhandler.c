@@ -86,6 +86,7 @@ Bool XIMUnsetFocusHandler(FcitxXimFrontend* xim, IMChangeICStruct * call_data)
 {
     FcitxInputContext* ic = FcitxInstanceGetCurrentIC(xim->owner);
     if (ic && GetXimIC(ic)->id == call_data->icid) {
+        GetXimIC(ic)->bPreeditSynced = false;
         FcitxUICloseInputWindow(xim->owner);
         FcitxInstanceResetInput(xim->owner);
     }
@@ -97,6 +98,8 @@ Bool XIMResetICHandler(FcitxXimFrontend* xim, IMResetICStruct * call_data)
 {
     FcitxInputContext* ic = FcitxInstanceGetCurrentIC(xim->owner);
     if (ic && GetXimIC(ic)->id == call_data->icid) {
+        /* client drops its preedit by itself on reset */
+        GetXimIC(ic)->bPreeditSynced = false;
         FcitxUICommitPreedit(xim->owner);
         FcitxUICloseInputWindow(xim->owner);
         FcitxInstanceSetCurrentIC(xim->owner, NULL);
@@ -269,7 +272,8 @@ void XimForwardKeyInternal(FcitxXimFrontend *xim,
                            XEvent* xEvent
                           )
 {
-    IMForwardEventStruct* forwardEvent = fcitx_utils_new(IMForwardEventStruct);
+    XimQueueItem* item = XimQueueNewItem(xim);
+    IMForwardEventStruct* forwardEvent = &item->call.forward;
 
     forwardEvent->connect_id = ic->connect_id;
     forwardEvent->icid = ic->id;
@@ -278,50 +282,96 @@ void XimForwardKeyInternal(FcitxXimFrontend *xim,
     forwardEvent->serial_number = xim->currentSerialNumberCallData;
 
     memcpy(&(forwardEvent->event), xEvent, sizeof(XEvent));
-    XimPendingCall(xim, XCT_FORWARD, (XPointer)forwardEvent);
+    XimPendingCall(xim, XCT_FORWARD, item);
 }
 
 void
 XimPreeditCallbackStart(FcitxXimFrontend *xim, const FcitxXimIC* ic)
 {
-    IMPreeditCBStruct* pcb = fcitx_utils_new(IMPreeditCBStruct);
+    XimQueueItem* item = XimQueueNewItem(xim);
+    IMPreeditCBStruct* pcb = &item->call.preedit;
 
     pcb->major_code = XIM_PREEDIT_START;
     pcb->minor_code = 0;
     pcb->connect_id = ic->connect_id;
     pcb->icid = ic->id;
     pcb->todo.return_value = 0;
-    XimPendingCall(xim, XCT_CALLCALLBACK, (XPointer) pcb);
+    XimPendingCall(xim, XCT_CALLCALLBACK, item);
 }
 
 
 void
 XimPreeditCallbackDone(FcitxXimFrontend *xim, const FcitxXimIC* ic)
 {
-    IMPreeditCBStruct* pcb = fcitx_utils_new(IMPreeditCBStruct);
+    XimQueueItem* item = XimQueueNewItem(xim);
+    IMPreeditCBStruct* pcb = &item->call.preedit;
 
     pcb->major_code = XIM_PREEDIT_DONE;
     pcb->minor_code = 0;
     pcb->connect_id = ic->connect_id;
     pcb->icid = ic->id;
     pcb->todo.return_value = 0;
-    XimPendingCall(xim, XCT_CALLCALLBACK, (XPointer) pcb);
+    XimPendingCall(xim, XCT_CALLCALLBACK, item);
 }
 
+const char* XimCompoundTextFromUtf8(FcitxXimFrontend* xim, const char* str, size_t* length)
+{
+    XTextProperty tp;
+    int i;
+    for (i = 0; i < XIM_CT_CACHE_SIZE; i++) {
+        XimCompoundText* ct = &xim->ctCache[i];
+        if (ct->utf8 && strcmp(ct->utf8, str) == 0) {
+            *length = ct->length;
+            return ct->text;
+        }
+    }
+
+    if (Xutf8TextListToTextProperty(xim->display, (char**) &str, 1,
+                                    XCompoundTextStyle, &tp) < 0 || !tp.value)
+        return NULL;
+
+    XimCompoundText* ct = &xim->ctCache[xim->ctCacheNext];
+    xim->ctCacheNext = (xim->ctCacheNext + 1) % XIM_CT_CACHE_SIZE;
+    fcitx_utils_free(ct->utf8);
+    if (ct->text)
+        XFree(ct->text);
+    ct->utf8 = strdup(str);
+    ct->text = (char*) tp.value;
+    ct->length = strlen(ct->text);
+    *length = ct->length;
+    return ct->text;
+}
+
+void XimCompoundTextCacheFree(FcitxXimFrontend* xim)
+{
+    int i;
+    for (i = 0; i < XIM_CT_CACHE_SIZE; i++) {
+        XimCompoundText* ct = &xim->ctCache[i];
+        fcitx_utils_free(ct->utf8);
+        if (ct->text)
+            XFree(ct->text);
+    }
+    memset(xim->ctCache, 0, sizeof(xim->ctCache));
+}
+
+/*
+ * only the part between the common prefix and the common suffix (same
+ * characters with same feedback) of the old and new preedit is sent.
+ */
 void
 XimPreeditCallbackDraw(FcitxXimFrontend* xim, FcitxXimIC* ic,
                        const char* preedit_string, int cursorPos)
 {
-    XTextProperty tp;
-
-    int i, len;
+    int i;
+    unsigned int len, offset = 0;
 
     if (preedit_string == NULL)
         return;
 
+    size_t bytes = strlen(preedit_string);
     len = fcitx_utf8_strlen(preedit_string);
 
-    if (len + 1 > xim->feedback_len) {
+    if ((int) len + 1 > xim->feedback_len) {
         xim->feedback_len = len + 1;
         xim->feedback = realloc(xim->feedback,
                                 sizeof(XIMFeedback) * xim->feedback_len);
@@ -329,8 +379,7 @@ XimPreeditCallbackDraw(FcitxXimFrontend* xim, FcitxXimIC* ic,
 
     FcitxInputState* input = FcitxInstanceGetInputState(xim->owner);
     FcitxMessages* clientPreedit = FcitxInputStateGetClientPreedit(input);
-    int offset = 0;
-    for (i = 0;i < FcitxMessagesGetMessageCount(clientPreedit);i++) {
+    for (i = 0;i < FcitxMessagesGetMessageCount(clientPreedit) && offset < len;i++) {
         int type = FcitxMessagesGetClientMessageType(clientPreedit, i);
         char* str = FcitxMessagesGetMessageString(clientPreedit, i);
         XIMFeedback fb = 0;
@@ -338,35 +387,98 @@ XimPreeditCallbackDraw(FcitxXimFrontend* xim, FcitxXimIC* ic,
             fb |= XIMUnderline;
         if (type & MSG_HIGHLIGHT)
             fb |= XIMReverse;
-        unsigned int j;
-        unsigned int str_len = fcitx_utf8_strlen(str);
-        for (j = 0;j < str_len;j++) {
-            xim->feedback[offset] = fb;
-            offset++;
-        }
+        /* output filter may change the string, never go beyond it */
+        for (; *str && offset < len; str = fcitx_utf8_get_nth_char(str, 1))
+            xim->feedback[offset++] = fb;
     }
+    for (; offset < len; offset++)
+        xim->feedback[offset] = XIMUnderline;
     xim->feedback[len] = 0;
 
-    IMPreeditCBStruct *pcb = fcitx_utils_new(IMPreeditCBStruct);
-    XIMText* text = fcitx_utils_new(XIMText);
+    /* common prefix, in characters and bytes */
+    const char* old = ic->bPreeditSynced && ic->onspot_preedit ? ic->onspot_preedit : "";
+    size_t oldBytes = strlen(old);
+    unsigned int oldLen = ic->bPreeditSynced ? ic->onspot_preedit_length : 0;
+    unsigned int prefix = 0;
+    size_t prefixBytes = 0;
+    while (prefix < len && prefix < oldLen) {
+        int charLen = fcitx_utf8_char_len(preedit_string + prefixBytes);
+        if (memcmp(preedit_string + prefixBytes, old + prefixBytes, charLen) != 0
+            || xim->feedback[prefix] != ic->onspot_feedback[prefix])
+            break;
+        prefix++;
+        prefixBytes += charLen;
+    }
+
+    /* common suffix, equal bytes, then back to a character boundary */
+    size_t suffixBytes = 0;
+    while (suffixBytes < bytes - prefixBytes && suffixBytes < oldBytes - prefixBytes
+           && preedit_string[bytes - suffixBytes - 1] == old[oldBytes - suffixBytes - 1])
+        suffixBytes++;
+    while (suffixBytes && (preedit_string[bytes - suffixBytes] & 0xc0) == 0x80)
+        suffixBytes--;
+    unsigned int suffix = fcitx_utf8_strlen(preedit_string + bytes - suffixBytes);
+    unsigned int same = 0;
+    while (same < suffix
+           && xim->feedback[len - same - 1] == ic->onspot_feedback[oldLen - same - 1])
+        same++;
+    suffixBytes -= fcitx_utf8_get_nth_char((char*) preedit_string + bytes - suffixBytes,
+                                           suffix - same) - (preedit_string + bytes - suffixBytes);
+    suffix = same;
+
+    unsigned int caret = fcitx_utf8_strnlen(preedit_string, cursorPos);
+    if (ic->bPreeditSynced && prefix == len && prefix == oldLen
+        && caret == ic->onspot_caret)
+        return;
+
+    XimQueueItem* item = XimQueueNewItem(xim);
+    IMPreeditCBStruct *pcb = &item->call.preedit;
+    XIMText* text = &item->text;
     pcb->major_code = XIM_PREEDIT_DRAW;
     pcb->connect_id = ic->connect_id;
     pcb->icid = ic->id;
 
-    pcb->todo.draw.caret = fcitx_utf8_strnlen(preedit_string, cursorPos);
-    pcb->todo.draw.chg_first = 0;
-    pcb->todo.draw.chg_length = ic->onspot_preedit_length;
+    pcb->todo.draw.caret = caret;
     pcb->todo.draw.text = text;
+    if (ic->bPreeditSynced) {
+        pcb->todo.draw.chg_first = prefix;
+        pcb->todo.draw.chg_length = oldLen - prefix - suffix;
+    } else {
+        /* what client has is unknown, replace all of it */
+        prefix = suffix = 0;
+        prefixBytes = suffixBytes = 0;
+        pcb->todo.draw.chg_first = 0;
+        pcb->todo.draw.chg_length = ic->onspot_preedit_length;
+    }
 
-    text->feedback = xim->feedback;
-
-    Xutf8TextListToTextProperty(xim->display, (char**)&preedit_string,
-                                1, XCompoundTextStyle, &tp);
+    unsigned int count = len - prefix - suffix;
+    text->feedback = XimQueueItemFeedback(item, count + 1);
+    memcpy(text->feedback, xim->feedback + prefix, sizeof(XIMFeedback) * count);
+    text->feedback[count] = 0;
     text->encoding_is_wchar = 0;
-    text->length = strlen((char*)tp.value);
-    text->string.multi_byte = (char*)tp.value;
-    XimPendingCall(xim, XCT_CALLCALLBACK, (XPointer) pcb);
+
+    size_t changedBytes = bytes - prefixBytes - suffixBytes;
+    const char* ctext = "";
+    size_t ctextLength = 0;
+    if (changedBytes) {
+        char* changed = strndup(preedit_string + prefixBytes, changedBytes);
+        ctext = XimCompoundTextFromUtf8(xim, changed, &ctextLength);
+        free(changed);
+        if (!ctext) {
+            ctext = "";
+            ctextLength = 0;
+        }
+    }
+    text->length = ctextLength;
+    text->string.multi_byte = memcpy(XimQueueItemString(item, ctextLength + 1), ctext, ctextLength + 1);
+    XimPendingCall(xim, XCT_CALLCALLBACK, item);
+
+    fcitx_utils_string_swap(&ic->onspot_preedit, preedit_string);
+    ic->onspot_feedback = realloc(ic->onspot_feedback, sizeof(XIMFeedback) * (len + 1));
+    memcpy(ic->onspot_feedback, xim->feedback, sizeof(XIMFeedback) * (len + 1));
     ic->onspot_preedit_length = len;
+    ic->onspot_caret = caret;
+    ic->bPreeditSynced = true;
 }
 
 // kate: indent-mode cstyle; space-indent on; indent-width 0;
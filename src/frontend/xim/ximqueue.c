@@ -7,13 +7,23 @@
 #include "fcitx-utils/log.h"
 #include "ximqueue.h"
 
+/* more than this is only needed for a burst, give them back */
+#define XIM_QUEUE_POOL_MAX 32
+
 struct _XimQueue {
     XimCallType type;
-    XPointer ptr;
+    XimQueueItem* item;
 };
 
 static const UT_icd ptr_icd = { sizeof(XimQueue), NULL, NULL, NULL };
 
+static void XimQueueFreeItem(XimQueueItem* item)
+{
+    free(item->string);
+    free(item->feedback);
+    free(item);
+}
+
 void XimQueueInit(FcitxXimFrontend* xim)
 {
     utarray_new(xim->queue, &ptr_icd);
@@ -21,7 +31,62 @@ void XimQueueInit(FcitxXimFrontend* xim)
 
 void XimQueueDestroy(FcitxXimFrontend* xim)
 {
+    XimQueue *queue;
+    for (queue = (XimQueue*) utarray_front(xim->queue);
+         queue != NULL;
+         queue = (XimQueue*) utarray_next(xim->queue, queue)) {
+        XimQueueFreeItem(queue->item);
+    }
     utarray_free(xim->queue);
+    while (xim->queuePool) {
+        XimQueueItem* item = xim->queuePool;
+        xim->queuePool = item->next;
+        XimQueueFreeItem(item);
+    }
+}
+
+XimQueueItem* XimQueueNewItem(FcitxXimFrontend* xim)
+{
+    XimQueueItem* item = xim->queuePool;
+    if (item) {
+        xim->queuePool = item->next;
+        xim->queuePoolSize--;
+        memset(&item->call, 0, sizeof(item->call));
+        memset(&item->text, 0, sizeof(item->text));
+        item->next = NULL;
+    } else {
+        item = fcitx_utils_new(XimQueueItem);
+    }
+    return item;
+}
+
+char* XimQueueItemString(XimQueueItem* item, size_t size)
+{
+    if (size > item->stringSize) {
+        item->stringSize = size;
+        item->string = realloc(item->string, size);
+    }
+    return item->string;
+}
+
+XIMFeedback* XimQueueItemFeedback(XimQueueItem* item, size_t count)
+{
+    if (count > item->feedbackSize) {
+        item->feedbackSize = count;
+        item->feedback = realloc(item->feedback, sizeof(XIMFeedback) * count);
+    }
+    return item->feedback;
+}
+
+static void XimQueueReleaseItem(FcitxXimFrontend* xim, XimQueueItem* item)
+{
+    if (xim->queuePoolSize >= XIM_QUEUE_POOL_MAX) {
+        XimQueueFreeItem(item);
+        return;
+    }
+    item->next = xim->queuePool;
+    xim->queuePool = item;
+    xim->queuePoolSize++;
 }
 
 void
@@ -29,40 +94,32 @@ XimConsumeQueue(FcitxXimFrontend *xim)
 {
     if (!xim->ims)
         return;
-    XimQueue *item;
+    XimQueue *queue;
 
     size_t len = utarray_len(xim->queue);
 
-    for (item = (XimQueue*) utarray_front(xim->queue);
-         item != NULL;
-         item = (XimQueue*) utarray_next(xim->queue, item)) {
-        switch(item->type) {
+    for (queue = (XimQueue*) utarray_front(xim->queue);
+         queue != NULL;
+         queue = (XimQueue*) utarray_next(xim->queue, queue)) {
+        XimQueueItem* item = queue->item;
+        switch(queue->type) {
         case XCT_FORWARD:
-            IMForwardEvent(xim->ims, item->ptr);
+            IMForwardEvent(xim->ims, (XPointer) &item->call);
             break;
-        case XCT_CALLCALLBACK: {
-            IMCallCallback(xim->ims, item->ptr);
-            IMPreeditCBStruct* pcb = (IMPreeditCBStruct*) item->ptr;
-            if (pcb->major_code == XIM_PREEDIT_DRAW) {
-                XFree(pcb->todo.draw.text->string.multi_byte);
-                free(pcb->todo.draw.text);
-            }
+        case XCT_CALLCALLBACK:
+            IMCallCallback(xim->ims, (XPointer) &item->call);
             break;
-        }
-        case XCT_COMMIT: {
-            IMCommitString(xim->ims, item->ptr);
-            IMCommitStruct *cms = (IMCommitStruct*)item->ptr;
-            XFree(cms->commit_string);
+        case XCT_COMMIT:
+            IMCommitString(xim->ims, (XPointer) &item->call);
             break;
-        }
         case XCT_PREEDIT_START:
-            IMPreeditStart(xim->ims, item->ptr);
+            IMPreeditStart(xim->ims, (XPointer) &item->call);
             break;
         case XCT_PREEDIT_END:
-            IMPreeditEnd(xim->ims, item->ptr);
+            IMPreeditEnd(xim->ims, (XPointer) &item->call);
             break;
         }
-        free(item->ptr);
+        XimQueueReleaseItem(xim, item);
     }
 
     utarray_clear(xim->queue);
@@ -71,10 +128,10 @@ XimConsumeQueue(FcitxXimFrontend *xim)
     }
 }
 
-void XimPendingCall(FcitxXimFrontend* xim, XimCallType type, XPointer ptr)
+void XimPendingCall(FcitxXimFrontend* xim, XimCallType type, XimQueueItem* item)
 {
-    XimQueue item;
-    item.type = type;
-    item.ptr = ptr;
-    utarray_push_back(xim->queue, &item);
+    XimQueue queue;
+    queue.type = type;
+    queue.item = item;
+    utarray_push_back(xim->queue, &queue);
 }
@@ -1,4 +1,5 @@
 #include "xim.h"
+#include <Xi18n.h>
 #include <fcitx/module.h>
 
 typedef enum _XimCallType {
@@ -11,7 +12,29 @@ typedef enum _XimCallType {
 
 typedef struct _XimQueue XimQueue;
 
+/*
+ * one pending call, items are reused after the queue is consumed, and the
+ * string and feedback buffers are kept with them.
+ */
+typedef struct _XimQueueItem {
+    union {
+        IMForwardEventStruct forward;
+        IMCommitStruct commit;
+        IMPreeditCBStruct preedit;
+        IMChangeFocusStruct focus;
+    } call;
+    XIMText text;
+    char* string;
+    size_t stringSize;
+    XIMFeedback* feedback;
+    size_t feedbackSize;
+    struct _XimQueueItem* next;
+} XimQueueItem;
+
 void XimQueueInit(FcitxXimFrontend *xim);
 void XimConsumeQueue(FcitxXimFrontend *xim);
-void XimPendingCall(FcitxXimFrontend *xim, XimCallType type, XPointer ptr);
+XimQueueItem* XimQueueNewItem(FcitxXimFrontend *xim);
+char* XimQueueItemString(XimQueueItem* item, size_t size);
+XIMFeedback* XimQueueItemFeedback(XimQueueItem* item, size_t count);
+void XimPendingCall(FcitxXimFrontend *xim, XimCallType type, XimQueueItem* item);
 void XimQueueDestroy(FcitxXimFrontend *xim);
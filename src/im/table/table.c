@@ -993,7 +993,8 @@ INPUT_RETURN_VALUE TableGetCandWords(void* arg)
         if (table->tableDict->currentRecord->type != RECORDTYPE_CONSTRUCT &&
             table->tableDict->currentRecord->type != RECORDTYPE_PROMPT &&
             !TableCompareCode(table, FcitxInputStateGetRawInputBuffer(input), table->tableDict->currentRecord->strCode, table->bTableExactMatch)) {
-            TABLECANDWORD* tableCandWord = fcitx_utils_malloc0(sizeof(TABLECANDWORD));
+            TABLECANDWORD* tableCandWord =
+                FcitxCandidateWordAlloc(candList, sizeof(TABLECANDWORD));
             TableAddCandWord(table->tableDict->currentRecord, tableCandWord);
             utarray_push_back(&candTemp, &tableCandWord);
         }
@@ -1013,7 +1014,8 @@ INPUT_RETURN_VALUE TableGetCandWords(void* arg)
         candWord.callback = TableGetCandWord;
         candWord.owner = table;
         candWord.priv = tableCandWord;
-        candWord.strWord = strdup(tableCandWord->candWord.record->strHZ);
+        candWord.strWord = FcitxCandidateWordStrdup(
+            candList, tableCandWord->candWord.record->strHZ);
         candWord.strExtra = NULL;
         candWord.wordType = MSG_OTHER;
 
@@ -1045,7 +1047,8 @@ INPUT_RETURN_VALUE TableGetCandWords(void* arg)
                         totallen += 1;
                 }
 
-                candWord.strExtra = fcitx_utils_malloc0(sizeof(char) * (totallen + 1 + 3));
+                candWord.strExtra = FcitxCandidateWordAlloc(
+                    candList, sizeof(char) * (totallen + 1 + 3));
                 if (codelen)
                     strcpy(candWord.strExtra, "\xef\xbd\x9e");
                 for (i = 0; i < codelen; i ++) {
@@ -1059,7 +1062,7 @@ INPUT_RETURN_VALUE TableGetCandWords(void* arg)
                 }
             }
             else {
-                candWord.strExtra = strdup(pstr);
+                candWord.strExtra = FcitxCandidateWordStrdup(candList, pstr);
             }
             candWord.extraType = MSG_CODE;
         }
@@ -1072,7 +1075,8 @@ INPUT_RETURN_VALUE TableGetCandWords(void* arg)
         for (i = table->tableDict->iAutoPhrase - 1; i >= 0; i--) {
             if (!TableCompareCode(table, FcitxInputStateGetRawInputBuffer(input), table->tableDict->autoPhrase[i].strCode, table->bTableExactMatch)) {
                 if (TableHasPhrase(table->tableDict, table->tableDict->autoPhrase[i].strCode, table->tableDict->autoPhrase[i].strHZ)) {
-                    TABLECANDWORD* tableCandWord = fcitx_utils_malloc0(sizeof(TABLECANDWORD));
+                    TABLECANDWORD* tableCandWord = FcitxCandidateWordAlloc(
+                        candList, sizeof(TABLECANDWORD));
                     TableAddAutoCandWord(table, i, tableCandWord);
                     utarray_push_back(&candTemp, &tableCandWord);
                 }
@@ -1088,7 +1092,8 @@ INPUT_RETURN_VALUE TableGetCandWords(void* arg)
         candWord.callback = TableGetCandWord;
         candWord.owner = table;
         candWord.priv = tableCandWord;
-        candWord.strWord = strdup(tableCandWord->candWord.autoPhrase->strHZ);
+        candWord.strWord = FcitxCandidateWordStrdup(
+            candList, tableCandWord->candWord.autoPhrase->strHZ);
         candWord.strExtra = NULL;
         candWord.wordType = MSG_USERPHR;
 
@@ -1267,14 +1272,17 @@ INPUT_RETURN_VALUE TableGetRemindCandWords(TableMetaData* table)
             if (!fcitx_utf8_strncmp(tableRemind->strHZ,
                                     tbl->strTableRemindSource, iLength) &&
                 fcitx_utf8_get_nth_char(tableRemind->strHZ, iLength)) {
-                TABLECANDWORD *tableCandWord = fcitx_utils_new(TABLECANDWORD);
+                TABLECANDWORD *tableCandWord =
+                    FcitxCandidateWordAlloc(cand_list, sizeof(TABLECANDWORD));
                 TableAddRemindCandWord(tableRemind, tableCandWord);
                 FcitxCandidateWord candWord;
                 candWord.callback = TableGetCandWord;
                 candWord.owner = table;
                 candWord.priv = tableCandWord;
                 candWord.strExtra = NULL;
-                candWord.strWord = strdup(tableCandWord->candWord.record->strHZ + strlen(tbl->strTableRemindSource));
+                candWord.strWord = FcitxCandidateWordStrdup(
+                    cand_list, tableCandWord->candWord.record->strHZ +
+                    strlen(tbl->strTableRemindSource));
                 candWord.wordType = MSG_OTHER;
                 FcitxCandidateWordAppend(cand_list, &candWord);
             }
@@ -1333,8 +1341,10 @@ INPUT_RETURN_VALUE TableGetFHCandWords(TableMetaData* table)
     if (!table->tableDict->iFH)
         return IRV_DISPLAY_MESSAGE;
 
+    FcitxCandidateWordList *cand_list = FcitxInputStateGetCandidateList(input);
     for (i = 0; i < table->tableDict->iFH; i++) {
-        TABLECANDWORD* tableCandWord = fcitx_utils_malloc0(sizeof(TABLECANDWORD));
+        TABLECANDWORD* tableCandWord =
+            FcitxCandidateWordAlloc(cand_list, sizeof(TABLECANDWORD));
         tableCandWord->flag = CT_FH;
         tableCandWord->candWord.iFHIndex = i;
         FcitxCandidateWord candWord;
@@ -1342,9 +1352,10 @@ INPUT_RETURN_VALUE TableGetFHCandWords(TableMetaData* table)
         candWord.owner = table;
         candWord.priv = tableCandWord;
         candWord.strExtra = NULL;
-        candWord.strWord = strdup(table->tableDict->fh[i].strFH);
+        candWord.strWord = FcitxCandidateWordStrdup(cand_list,
+                                                    table->tableDict->fh[i].strFH);
         candWord.wordType = MSG_OTHER;
-        FcitxCandidateWordAppend(FcitxInputStateGetCandidateList(input), &candWord);
+        FcitxCandidateWordAppend(cand_list, &candWord);
     }
     return IRV_DISPLAY_CANDWORDS;
 }
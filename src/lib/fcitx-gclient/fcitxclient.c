@@ -23,6 +23,7 @@
 #include "module/dbus/dbusstuff.h"
 #include "frontend/ipc/ipc.h"
 #include "fcitx/fcitx.h"
+#include "fcitx/frontend.h"
 #include "fcitxclient.h"
 #include "fcitxconnection.h"
 #include "marshall.h"
@@ -36,6 +37,8 @@
 #define fcitx_gclient_debug(...)
 #endif
 typedef struct _ProcessKeyStruct ProcessKeyStruct;
+typedef struct _PendingKeyEvent PendingKeyEvent;
+typedef struct _ProcessKeysStruct ProcessKeysStruct;
 
 /**
  * FcitxClient:
@@ -54,6 +57,23 @@ struct _ProcessKeyStruct {
     void* user_data;
 };
 
+/* key event waiting to be sent with ProcessKeyEvents */
+struct _PendingKeyEvent {
+    guint32 keyval;
+    guint32 keycode;
+    guint32 state;
+    gint32 type;
+    guint32 t;
+    gint timeout_msec;
+    GCancellable* cancellable;
+    GSimpleAsyncResult* result;
+};
+
+struct _ProcessKeysStruct {
+    FcitxClient* self;
+    GPtrArray* events;
+};
+
 struct _FcitxClientPrivate {
     GDBusProxy* improxy;
     GDBusProxy* icproxy;
@@ -62,6 +82,10 @@ struct _FcitxClientPrivate {
     int id;
     GCancellable* cancellable;
     FcitxConnection* connection;
+    gboolean batchKeyEvent; /* CAPACITY_BATCH_KEY_EVENT is set */
+    gboolean batchUnsupported; /* fcitx doesn't know ProcessKeyEvents */
+    guint keyCallsInFlight;
+    GQueue pendingKeys;
 };
 
 static const gchar introspection_xml[] =
@@ -122,6 +146,10 @@ static const gchar ic_introspection_xml[] =
     "      <arg name=\"time\" direction=\"in\" type=\"u\"/>\n"
     "      <arg name=\"ret\" direction=\"out\" type=\"i\"/>\n"
     "    </method>\n"
+    "    <method name=\"ProcessKeyEvents\">\n"
+    "      <arg name=\"events\" direction=\"in\" type=\"a(uuuiu)\"/>\n"
+    "      <arg name=\"ret\" direction=\"out\" type=\"ai\"/>\n"
+    "    </method>\n"
     "    <signal name=\"EnableIM\">\n"
     "    </signal>\n"
     "    <signal name=\"CloseIM\">\n"
@@ -188,6 +216,7 @@ static void fcitx_client_finalize(GObject *object);
 static void fcitx_client_dispose(GObject *object);
 static void fcitx_client_constructed(GObject *object);
 static void _fcitx_client_clean_up(FcitxClient* self, gboolean dont_emit_disconn);
+static void _fcitx_client_send_pending_keys(FcitxClient* self);
 
 static void
 fcitx_client_set_property(GObject      *gobject,
@@ -265,6 +294,7 @@ fcitx_client_dispose(GObject *object)
 FCITX_EXPORT_API
 void fcitx_client_enable_ic(FcitxClient* self)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "EnableIC", NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -279,6 +309,7 @@ void fcitx_client_enable_ic(FcitxClient* self)
 FCITX_EXPORT_API
 void fcitx_client_close_ic(FcitxClient* self)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "CloseIC", NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -293,6 +324,7 @@ void fcitx_client_close_ic(FcitxClient* self)
 FCITX_EXPORT_API
 void fcitx_client_focus_in(FcitxClient* self)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "FocusIn", NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -307,6 +339,7 @@ void fcitx_client_focus_in(FcitxClient* self)
 FCITX_EXPORT_API
 void fcitx_client_focus_out(FcitxClient* self)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "FocusOut", NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -321,6 +354,7 @@ void fcitx_client_focus_out(FcitxClient* self)
 FCITX_EXPORT_API
 void fcitx_client_reset(FcitxClient* self)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "Reset", NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -337,6 +371,8 @@ FCITX_EXPORT_API
 void fcitx_client_set_capacity(FcitxClient* self, guint flags)
 {
     uint32_t iflags = flags;
+    self->priv->batchKeyEvent = (flags & CAPACITY_BATCH_KEY_EVENT) != 0;
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "SetCapacity", g_variant_new("(u)", iflags), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -373,6 +409,7 @@ void fcitx_client_set_cusor_rect(FcitxClient* self, int x, int y, int w, int h)
 FCITX_EXPORT_API
 void fcitx_client_set_cursor_rect(FcitxClient* self, int x, int y, int w, int h)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy, "SetCursorRect", g_variant_new("(iiii)", x, y, w, h), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
     }
@@ -388,6 +425,7 @@ void fcitx_client_set_cursor_rect(FcitxClient* self, int x, int y, int w, int h)
 FCITX_EXPORT_API
 void fcitx_client_set_surrounding_text(FcitxClient* self, gchar* text, guint cursor, guint anchor)
 {
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         if (text) {
             g_dbus_proxy_call(self->priv->icproxy, "SetSurroundingText", g_variant_new("(suu)", text, cursor, anchor), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
@@ -417,6 +455,7 @@ FCITX_EXPORT_API
 void fcitx_client_process_key(FcitxClient* self, GAsyncReadyCallback cb, gpointer user_data, guint32 keyval, guint32 keycode, guint32 state, gint type, guint32 t)
 {
     int itype = type;
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         g_dbus_proxy_call(self->priv->icproxy,
                           "ProcessKeyEvent",
@@ -441,6 +480,13 @@ FCITX_EXPORT_API
 gint fcitx_client_process_key_finish(FcitxClient* self, GAsyncResult* res)
 {
     gint ret = -1;
+    if (g_simple_async_result_is_valid(res, G_OBJECT(self), fcitx_client_process_key_async)) {
+        GSimpleAsyncResult* simple = G_SIMPLE_ASYNC_RESULT(res);
+        if (g_simple_async_result_propagate_error(simple, NULL))
+            return -1;
+        return g_simple_async_result_get_op_res_gssize(simple);
+    }
+
     if (!self->priv->icproxy)
         return -1;
 
@@ -490,6 +536,11 @@ void _fcitx_client_process_key_cancelled(GCancellable* cancellable, gpointer use
  * @user_data: (closure): user data
  *
  * use this function with #fcitx_client_process_key_finish
+ *
+ * If %CAPACITY_BATCH_KEY_EVENT is set with #fcitx_client_set_capacity, key
+ * events sent while a previous one is still being processed by fcitx are
+ * queued, and sent together with one ProcessKeyEvents call. A queued key
+ * event whose @cancellable is cancelled is not sent at all.
  **/
 FCITX_EXPORT_API
 void fcitx_client_process_key_async(FcitxClient* self,
@@ -501,7 +552,25 @@ void fcitx_client_process_key_async(FcitxClient* self,
                                     gpointer user_data)
 {
     int itype = type;
-    if (self->priv->icproxy) {
+    if (self->priv->icproxy && self->priv->batchKeyEvent
+        && !self->priv->batchUnsupported) {
+        PendingKeyEvent* event = g_new(PendingKeyEvent, 1);
+        event->keyval = keyval;
+        event->keycode = keycode;
+        event->state = state;
+        event->type = itype;
+        event->t = t;
+        event->timeout_msec = timeout_msec;
+        event->result = g_simple_async_result_new(G_OBJECT(self), callback,
+                                                  user_data,
+                                                  fcitx_client_process_key_async);
+        event->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+        if (cancellable)
+            g_simple_async_result_set_check_cancellable(event->result, cancellable);
+        g_queue_push_tail(&self->priv->pendingKeys, event);
+        if (self->priv->keyCallsInFlight == 0)
+            _fcitx_client_send_pending_keys(self);
+    } else if (self->priv->icproxy) {
         ProcessKeyStruct* pk = g_new(ProcessKeyStruct, 1);
         pk->self = g_object_ref(self);
         pk->callback = callback;
@@ -535,6 +604,7 @@ int fcitx_client_process_key_sync(FcitxClient* self, guint32 keyval, guint32 key
 {
     int itype = type;
     int ret = -1;
+    _fcitx_client_send_pending_keys(self);
     if (self->priv->icproxy) {
         GVariant* result =  g_dbus_proxy_call_sync(self->priv->icproxy,
                             "ProcessKeyEvent",
@@ -563,6 +633,7 @@ fcitx_client_init(FcitxClient *self)
     self->priv->cancellable = NULL;
     self->priv->improxy = NULL;
     self->priv->icproxy = NULL;
+    g_queue_init(&self->priv->pendingKeys);
 }
 
 static void
@@ -591,6 +662,8 @@ _fcitx_client_create_ic(FcitxConnection* connection, gpointer user_data)
 
     _fcitx_client_clean_up(self, FALSE);
 
+    /* new fcitx may support it */
+    self->priv->batchUnsupported = FALSE;
     g_object_ref(self);
     self->priv->cancellable = g_cancellable_new ();
     g_dbus_proxy_new(
@@ -1079,6 +1152,169 @@ void fcitx_client_set_property(GObject* gobject, guint prop_id, const GValue* va
     }
 }
 
+static void
+_pending_key_event_free(PendingKeyEvent* event)
+{
+    g_object_unref(event->result);
+    if (event->cancellable)
+        g_object_unref(event->cancellable);
+    g_free(event);
+}
+
+static void
+_pending_key_event_complete(PendingKeyEvent* event, gint ret)
+{
+    g_simple_async_result_set_op_res_gssize(event->result, ret);
+    g_simple_async_result_complete(event->result);
+    _pending_key_event_free(event);
+}
+
+/* the key event never reaches fcitx, the caller still gets its reply */
+static void
+_pending_key_event_drop(PendingKeyEvent* event)
+{
+    g_simple_async_result_set_op_res_gssize(event->result, -1);
+    g_simple_async_result_complete_in_idle(event->result);
+    _pending_key_event_free(event);
+}
+
+static void
+_fcitx_client_process_pending_key_cb(GObject *source_object,
+                                     GAsyncResult *res,
+                                     gpointer user_data)
+{
+    PendingKeyEvent* event = user_data;
+    gint ret = -1;
+    GVariant* result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object), res, NULL);
+    if (result) {
+        g_variant_get(result, "(i)", &ret);
+        g_variant_unref(result);
+    }
+    _pending_key_event_complete(event, ret);
+}
+
+static void
+_fcitx_client_send_pending_key(GDBusProxy* proxy, PendingKeyEvent* event)
+{
+    g_dbus_proxy_call(proxy,
+                      "ProcessKeyEvent",
+                      g_variant_new("(uuuiu)", event->keyval, event->keycode,
+                                    event->state, event->type, event->t),
+                      G_DBUS_CALL_FLAGS_NONE,
+                      event->timeout_msec,
+                      event->cancellable,
+                      _fcitx_client_process_pending_key_cb,
+                      event);
+}
+
+static void
+_fcitx_client_process_keys_cb(GObject *source_object,
+                              GAsyncResult *res,
+                              gpointer user_data)
+{
+    ProcessKeysStruct* pk = user_data;
+    FcitxClient* self = pk->self;
+    GError* error = NULL;
+    GVariant* result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object), res, &error);
+    guint i;
+
+    self->priv->keyCallsInFlight--;
+    if (!result && g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+        /* old fcitx, send them one by one, and don't try again */
+        self->priv->batchUnsupported = TRUE;
+        for (i = 0; i < pk->events->len; i++)
+            _fcitx_client_send_pending_key(G_DBUS_PROXY(source_object),
+                                           g_ptr_array_index(pk->events, i));
+    } else {
+        GVariantIter* iter = NULL;
+        if (result)
+            g_variant_get(result, "(ai)", &iter);
+        for (i = 0; i < pk->events->len; i++) {
+            gint32 ret = -1;
+            if (iter && !g_variant_iter_next(iter, "i", &ret))
+                ret = -1;
+            _pending_key_event_complete(g_ptr_array_index(pk->events, i), ret);
+        }
+        if (iter)
+            g_variant_iter_free(iter);
+    }
+
+    if (result)
+        g_variant_unref(result);
+    if (error)
+        g_error_free(error);
+    g_ptr_array_free(pk->events, TRUE);
+    g_free(pk);
+
+    /* things queued up while waiting for this call */
+    if (self->priv->keyCallsInFlight == 0)
+        _fcitx_client_send_pending_keys(self);
+    g_object_unref(self);
+}
+
+static void
+_fcitx_client_send_pending_keys(FcitxClient* self)
+{
+    PendingKeyEvent* event;
+    if (g_queue_is_empty(&self->priv->pendingKeys))
+        return;
+
+    if (!self->priv->icproxy) {
+        while ((event = g_queue_pop_head(&self->priv->pendingKeys)))
+            _pending_key_event_drop(event);
+        return;
+    }
+
+    if (self->priv->batchUnsupported) {
+        while ((event = g_queue_pop_head(&self->priv->pendingKeys))) {
+            if (g_cancellable_is_cancelled(event->cancellable))
+                _pending_key_event_drop(event);
+            else
+                _fcitx_client_send_pending_key(self->priv->icproxy, event);
+        }
+        return;
+    }
+
+    GPtrArray* events = g_ptr_array_sized_new(g_queue_get_length(&self->priv->pendingKeys));
+    while ((event = g_queue_pop_head(&self->priv->pendingKeys))) {
+        /* given up by the caller while waiting in the queue */
+        if (g_cancellable_is_cancelled(event->cancellable))
+            _pending_key_event_drop(event);
+        else
+            g_ptr_array_add(events, event);
+    }
+    if (events->len == 0) {
+        g_ptr_array_free(events, TRUE);
+        return;
+    }
+
+    ProcessKeysStruct* pk = g_new(ProcessKeysStruct, 1);
+    GVariantBuilder builder;
+    gint timeout_msec = -1;
+    guint i;
+    pk->self = g_object_ref(self);
+    pk->events = events;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(uuuiu)"));
+    for (i = 0; i < events->len; i++) {
+        event = g_ptr_array_index(events, i);
+        g_variant_builder_add(&builder, "(uuuiu)", event->keyval,
+                              event->keycode, event->state, event->type,
+                              event->t);
+        if (event->timeout_msec > timeout_msec)
+            timeout_msec = event->timeout_msec;
+    }
+
+    self->priv->keyCallsInFlight++;
+    g_dbus_proxy_call(self->priv->icproxy,
+                      "ProcessKeyEvents",
+                      g_variant_new("(a(uuuiu))", &builder),
+                      G_DBUS_CALL_FLAGS_NONE,
+                      timeout_msec,
+                      NULL,
+                      _fcitx_client_process_keys_cb,
+                      pk);
+}
+
 static void
 _fcitx_client_clean_up(FcitxClient* self, gboolean dont_emit_disconn)
 {
@@ -1103,6 +1339,8 @@ _fcitx_client_clean_up(FcitxClient* self, gboolean dont_emit_disconn)
             g_signal_emit(self, signals[DISCONNECTED_SIGNAL], 0);
     }
 
+    /* the ic is gone, queued key events can't be processed any more */
+    _fcitx_client_send_pending_keys(self);
 }
 
 // kate: indent-mode cstyle; replace-tabs on;
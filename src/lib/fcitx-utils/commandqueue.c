@@ -0,0 +1,210 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "fcitx/fcitx.h"
+#include "utils.h"
+#include "commandqueue.h"
+
+typedef struct _FcitxCommand {
+    FcitxCommandCallback callback;
+    void* arg;
+    /* only for sync command, lives on the stack of the caller */
+    sem_t* done;
+    struct _FcitxCommand* next;
+} FcitxCommand;
+
+struct _FcitxCommandQueue {
+    pthread_mutex_t lock;
+    FcitxCommand* head;
+    FcitxCommand* tail;
+    int pipefd[2];
+    uint64_t pushed;
+    uint64_t dispatched;
+    uint64_t contended;
+    boolean closed;
+};
+
+FCITX_EXPORT_API
+FcitxCommandQueue*
+fcitx_command_queue_new()
+{
+    FcitxCommandQueue* queue = fcitx_utils_new(FcitxCommandQueue);
+    if (pipe(queue->pipefd) < 0) {
+        free(queue);
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < 2; i++) {
+        fcntl(queue->pipefd[i], F_SETFL, O_NONBLOCK);
+        fcntl(queue->pipefd[i], F_SETFD, FD_CLOEXEC);
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    return queue;
+}
+
+FCITX_EXPORT_API
+void
+fcitx_command_queue_free(FcitxCommandQueue* queue)
+{
+    FcitxCommand* command = queue->head;
+    while (command) {
+        FcitxCommand* next = command->next;
+        if (command->done)
+            sem_post(command->done);
+        else
+            free(command);
+        command = next;
+    }
+    close(queue->pipefd[0]);
+    close(queue->pipefd[1]);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+static boolean
+fcitx_command_queue_append(FcitxCommandQueue* queue, FcitxCommand* command)
+{
+    boolean wakeup;
+    command->next = NULL;
+    if (pthread_mutex_trylock(&queue->lock) != 0) {
+        __sync_fetch_and_add(&queue->contended, 1);
+        pthread_mutex_lock(&queue->lock);
+    }
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    /* only the first pending command needs to wake up the owner */
+    wakeup = (queue->head == NULL);
+    if (queue->tail)
+        queue->tail->next = command;
+    else
+        queue->head = command;
+    queue->tail = command;
+    queue->pushed++;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (wakeup) {
+        char c = 0;
+        while (write(queue->pipefd[1], &c, sizeof(char)) < 0 && errno == EINTR);
+    }
+    return true;
+}
+
+FCITX_EXPORT_API
+boolean
+fcitx_command_queue_push(FcitxCommandQueue* queue,
+                         FcitxCommandCallback callback, void* arg)
+{
+    FcitxCommand* command = fcitx_utils_new(FcitxCommand);
+    command->callback = callback;
+    command->arg = arg;
+    if (!fcitx_command_queue_append(queue, command)) {
+        free(command);
+        return false;
+    }
+    return true;
+}
+
+FCITX_EXPORT_API
+boolean
+fcitx_command_queue_push_sync(FcitxCommandQueue* queue,
+                              FcitxCommandCallback callback, void* arg)
+{
+    FcitxCommand command;
+    sem_t done;
+    boolean result;
+    sem_init(&done, 0, 0);
+    command.callback = callback;
+    command.arg = arg;
+    command.done = &done;
+    result = fcitx_command_queue_append(queue, &command);
+    if (result)
+        while (sem_wait(&done) < 0 && errno == EINTR);
+    sem_destroy(&done);
+    return result;
+}
+
+FCITX_EXPORT_API
+void
+fcitx_command_queue_close(FcitxCommandQueue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+FCITX_EXPORT_API
+int
+fcitx_command_queue_get_fd(FcitxCommandQueue* queue)
+{
+    return queue->pipefd[0];
+}
+
+FCITX_EXPORT_API
+unsigned int
+fcitx_command_queue_dispatch(FcitxCommandQueue* queue)
+{
+    FcitxCommand* command;
+    unsigned int count = 0;
+    char buf[16];
+
+    pthread_mutex_lock(&queue->lock);
+    command = queue->head;
+    queue->head = queue->tail = NULL;
+    while (read(queue->pipefd[0], buf, sizeof(buf)) > 0);
+    pthread_mutex_unlock(&queue->lock);
+
+    while (command) {
+        /* sync command is gone after sem_post, so save next first */
+        FcitxCommand* next = command->next;
+        command->callback(command->arg);
+        /* a sync caller may read the stats as soon as it is woken up */
+        __sync_fetch_and_add(&queue->dispatched, 1);
+        if (command->done)
+            sem_post(command->done);
+        else
+            free(command);
+        command = next;
+        count++;
+    }
+
+    return count;
+}
+
+FCITX_EXPORT_API
+void
+fcitx_command_queue_get_stats(FcitxCommandQueue* queue,
+                              FcitxCommandQueueStats* stats)
+{
+    pthread_mutex_lock(&queue->lock);
+    stats->pushed = queue->pushed;
+    pthread_mutex_unlock(&queue->lock);
+    stats->dispatched = __sync_fetch_and_add(&queue->dispatched, 0);
+    stats->contended = __sync_fetch_and_add(&queue->contended, 0);
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @addtogroup FcitxUtils
+ * @{
+ */
+
+/**
+ * @file commandqueue.h
+ *
+ * a thread safe queue of callbacks, commands can be pushed from any thread,
+ * and will be run by the thread owning the queue when it calls
+ * fcitx_command_queue_dispatch.
+ *
+ * The lock is only held while a command is linked or the pending list is
+ * taken out, never while a command runs.
+ *
+ * @code
+ * FcitxCommandQueue* queue = fcitx_command_queue_new();
+ * // other thread
+ * fcitx_command_queue_push(queue, callback, arg);
+ * // owner thread, after fcitx_command_queue_get_fd() becomes readable
+ * fcitx_command_queue_dispatch(queue);
+ * @endcode
+ */
+
+#ifndef __FCITX_UTILS_COMMANDQUEUE_H
+#define __FCITX_UTILS_COMMANDQUEUE_H
+
+#include <stdint.h>
+#include <fcitx-utils/utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef void (*FcitxCommandCallback)(void* arg);
+
+    typedef struct _FcitxCommandQueue FcitxCommandQueue;
+
+    /**
+     * statistics of a command queue
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxCommandQueueStats {
+        uint64_t pushed; /**< number of commands pushed */
+        uint64_t dispatched; /**< number of commands already run */
+        uint64_t contended; /**< number of times the queue lock was busy */
+    } FcitxCommandQueueStats;
+
+    /**
+     * create a command queue
+     *
+     * @return newly created queue, NULL if the wake up pipe can't be created
+     * @since 4.2.9.3
+     **/
+    FcitxCommandQueue* fcitx_command_queue_new();
+
+    /**
+     * free a command queue, pending commands are dropped
+     *
+     * @param queue queue
+     * @return void
+     * @since 4.2.9.3
+     **/
+    void fcitx_command_queue_free(FcitxCommandQueue* queue);
+
+    /**
+     * push a command and return immediately
+     *
+     * @param queue queue
+     * @param callback command
+     * @param arg argument to callback
+     * @return false if the queue is closed
+     * @since 4.2.9.3
+     **/
+    boolean fcitx_command_queue_push(FcitxCommandQueue* queue,
+                                     FcitxCommandCallback callback, void* arg);
+
+    /**
+     * push a command and wait until the owner thread has run it,
+     * must not be called from the owner thread.
+     *
+     * @param queue queue
+     * @param callback command
+     * @param arg argument to callback
+     * @return false if the queue is closed, the command is not run then
+     * @since 4.2.9.3
+     **/
+    boolean fcitx_command_queue_push_sync(FcitxCommandQueue* queue,
+                                          FcitxCommandCallback callback,
+                                          void* arg);
+
+    /**
+     * refuse all later pushes, commands already pushed are still run by
+     * the next fcitx_command_queue_dispatch.
+     *
+     * @param queue queue
+     * @return void
+     * @since 4.2.9.3
+     **/
+    void fcitx_command_queue_close(FcitxCommandQueue* queue);
+
+    /**
+     * file descriptor that becomes readable when there are pending commands
+     *
+     * @param queue queue
+     * @return int fd
+     * @since 4.2.9.3
+     **/
+    int fcitx_command_queue_get_fd(FcitxCommandQueue* queue);
+
+    /**
+     * run all pending commands in the order they are pushed
+     *
+     * @param queue queue
+     * @return number of commands run
+     * @since 4.2.9.3
+     **/
+    unsigned int fcitx_command_queue_dispatch(FcitxCommandQueue* queue);
+
+    /**
+     * get statistics of the queue
+     *
+     * @param queue queue
+     * @param stats return the statistics
+     * @return void
+     * @since 4.2.9.3
+     **/
+    void fcitx_command_queue_get_stats(FcitxCommandQueue* queue,
+                                       FcitxCommandQueueStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**
+ * @}
+ */
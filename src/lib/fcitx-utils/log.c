@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <wchar.h>
 #include <libgen.h>
+#include <pthread.h>
 
 #include "config.h"
 #include "fcitx/fcitx.h"
@@ -31,8 +32,10 @@
 #include "log.h"
 #include "utils.h"
 
-static iconv_t iconvW = NULL;
-static int init = 0;
+/* FcitxLog may be called from worker threads, iconv_t is not reentrant */
+static pthread_once_t init = PTHREAD_ONCE_INIT;
+static pthread_mutex_t iconvLock = PTHREAD_MUTEX_INITIALIZER;
+static iconv_t iconvW = (iconv_t) - 1;
 static int is_utf8 = 0;
 
 #ifndef _DEBUG
@@ -58,14 +61,19 @@ FcitxLogLevel FcitxLogGetLevel()
 }
 
 
+static void
+FcitxLogInit()
+{
+    is_utf8 = fcitx_utils_current_locale_is_utf8();
+    if (!is_utf8)
+        iconvW = iconv_open("WCHAR_T", "utf-8");
+}
+
 FCITX_EXPORT_API void
 FcitxLogFuncV(FcitxLogLevel e, const char* filename, const int line,
               const char* fmt, va_list ap)
 {
-    if (!init) {
-        init = 1;
-        is_utf8 = fcitx_utils_current_locale_is_utf8();
-    }
+    pthread_once(&init, FcitxLogInit);
 
     if ((int) e < 0) {
         e = 0;
@@ -109,9 +117,6 @@ FcitxLogFuncV(FcitxLogLevel e, const char* filename, const int line,
         return;
     }
 
-    if (iconvW == NULL)
-        iconvW = iconv_open("WCHAR_T", "utf-8");
-
     if (iconvW == (iconv_t) - 1) {
         fprintf(stderr, "%s\n", buffer);
     } else {
@@ -123,7 +128,9 @@ FcitxLogFuncV(FcitxLogLevel e, const char* filename, const int line,
         IconvStr inp = buffer;
         char *outp = (char*) wmessage;
 
+        pthread_mutex_lock(&iconvLock);
         iconv(iconvW, &inp, &len, &outp, &wlen);
+        pthread_mutex_unlock(&iconvLock);
 
         fprintf(stderr, "%ls\n", wmessage);
         free(wmessage);
@@ -63,7 +63,7 @@ FcitxMemoryPool* fcitx_memory_pool_create()
 static inline void*
 memory_align_ptr(void *p)
 {
-    return (void*)fcitx_utils_align_to((uintptr_t)p, sizeof(int));
+    return (void*)fcitx_utils_align_to((uintptr_t)p, sizeof(void*));
 }
 
 FCITX_EXPORT_API
@@ -127,3 +127,40 @@ fcitx_memory_pool_clear(FcitxMemoryPool *pool)
     utarray_clear(pool->fullchunks);
     utarray_clear(pool->chunks);
 }
+
+FCITX_EXPORT_API
+void
+fcitx_memory_pool_reset(FcitxMemoryPool *pool)
+{
+    FcitxMemoryChunk* chunk;
+    /* chunks are moved, not copied, so don't run the destructor */
+    utarray_concat(pool->chunks, pool->fullchunks);
+    pool->fullchunks->i = 0;
+    for (chunk = (FcitxMemoryChunk*) utarray_front(pool->chunks);
+         chunk != NULL;
+         chunk = (FcitxMemoryChunk*) utarray_next(pool->chunks, chunk)) {
+        /* alloc always returns zeroed memory */
+        memset(chunk->memory, 0, chunk->cur - chunk->memory);
+        chunk->cur = chunk->memory;
+    }
+}
+
+FCITX_EXPORT_API
+boolean
+fcitx_memory_pool_contains(FcitxMemoryPool *pool, const void *ptr)
+{
+    FcitxMemoryChunk* chunk;
+    for (chunk = (FcitxMemoryChunk*) utarray_front(pool->chunks);
+         chunk != NULL;
+         chunk = (FcitxMemoryChunk*) utarray_next(pool->chunks, chunk)) {
+        if (ptr >= chunk->memory && ptr < chunk->end)
+            return true;
+    }
+    for (chunk = (FcitxMemoryChunk*) utarray_front(pool->fullchunks);
+         chunk != NULL;
+         chunk = (FcitxMemoryChunk*) utarray_next(pool->fullchunks, chunk)) {
+        if (ptr >= chunk->memory && ptr < chunk->end)
+            return true;
+    }
+    return false;
+}
@@ -46,6 +46,7 @@
 #define _FCITX_MEMORY_H_
 
 #include <stdlib.h>
+#include <fcitx-utils/utils.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -96,6 +97,27 @@ void fcitx_memory_pool_destroy(FcitxMemoryPool* pool);
  **/
 void fcitx_memory_pool_clear(FcitxMemoryPool* pool);
 
+/**
+ * make all the memory inside the pool available again, like
+ * fcitx_memory_pool_clear, but the memory is kept for the following
+ * allocations instead of being freed.
+ *
+ * @param pool memory pool
+ * @return void
+ * @since 4.2.9.3
+ **/
+void fcitx_memory_pool_reset(FcitxMemoryPool* pool);
+
+/**
+ * check whether a pointer is allocated from the pool
+ *
+ * @param pool memory pool
+ * @param ptr pointer
+ * @return boolean
+ * @since 4.2.9.3
+ **/
+boolean fcitx_memory_pool_contains(FcitxMemoryPool* pool, const void* ptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,433 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "fcitx/fcitx.h"
+#include "utils.h"
+#include "shmchannel.h"
+
+#define FCITX_SHM_MAGIC 0x46435348
+#define FCITX_SHM_VERSION 1
+#define FCITX_SHM_DEFAULT_SIZE (64 * 1024)
+#define FCITX_SHM_MIN_SIZE 4096
+#define FCITX_SHM_MAX_SIZE (16 * 1024 * 1024)
+#define FCITX_SHM_ALIGN(len) (((len) + 15) & ~((uint32_t) 15))
+/* type of the record filling the end of the ring before it wraps */
+#define FCITX_SHM_PAD 0
+
+typedef struct _FcitxShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    char padding[52];
+} FcitxShmHeader;
+
+/*
+ * head and tail are free running positions, they live on their own cache
+ * lines since they are written by different processes.
+ */
+typedef struct _FcitxShmRing {
+    volatile uint32_t head;
+    char padding1[60];
+    volatile uint32_t tail;
+    /* reader is about to sleep, writer needs to signal the eventfd */
+    volatile uint32_t waiting;
+    char padding2[56];
+} FcitxShmRing;
+
+typedef struct _FcitxShmRecord {
+    uint32_t type;
+    int32_t icid;
+    uint32_t serial;
+    uint32_t length;
+} FcitxShmRecord;
+
+struct _FcitxShmChannel {
+    void* mem;
+    size_t memsize;
+    uint32_t size;
+    FcitxShmRing* rx;
+    char* rxdata;
+    FcitxShmRing* tx;
+    char* txdata;
+    int memfd;
+    int rxfd;
+    int txfd;
+    /* only valid on the server end */
+    int peerrxfd;
+    int peertxfd;
+    char* buffer;
+    uint32_t buffersize;
+    boolean broken;
+};
+
+static inline FcitxShmRing*
+ShmRing(void* mem, uint32_t size, int idx)
+{
+    return (FcitxShmRing*)((char*) mem + sizeof(FcitxShmHeader)
+                           + idx * (sizeof(FcitxShmRing) + size));
+}
+
+static inline size_t
+ShmMemSize(uint32_t size)
+{
+    return sizeof(FcitxShmHeader) + 2 * (sizeof(FcitxShmRing) + size);
+}
+
+static void
+ShmCloseFd(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+static void
+ShmWakeUp(int fd)
+{
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+/*
+ * the file size is sealed before it is passed to the client, neither side
+ * can shrink it under the mapping of the other one (SIGBUS on access). A
+ * file that can't be sealed is not used.
+ */
+static int
+ShmCreateFile(size_t size)
+{
+#ifdef F_ADD_SEALS
+    int fd = -1;
+#ifdef __NR_memfd_create
+    /* MFD_CLOEXEC | MFD_ALLOW_SEALING */
+    fd = syscall(__NR_memfd_create, "fcitx-shm", 3);
+#endif
+    if (fd < 0) {
+        const char* tmpdir = getenv("TMPDIR");
+        char* path;
+        fcitx_utils_alloc_cat_str(path, tmpdir ? tmpdir : "/tmp",
+                                  "/fcitx-shm-XXXXXX");
+        fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        free(path);
+    }
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, size) < 0
+        || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    FCITX_UNUSED(size);
+    return -1;
+#endif
+}
+
+static boolean
+ShmChannelMap(FcitxShmChannel* channel, uint32_t size, int rxring)
+{
+    channel->memsize = ShmMemSize(size);
+    channel->mem = mmap(NULL, channel->memsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, channel->memfd, 0);
+    if (channel->mem == MAP_FAILED) {
+        channel->mem = NULL;
+        return false;
+    }
+    channel->size = size;
+    channel->rx = ShmRing(channel->mem, size, rxring);
+    channel->rxdata = (char*)(channel->rx + 1);
+    channel->tx = ShmRing(channel->mem, size, 1 - rxring);
+    channel->txdata = (char*)(channel->tx + 1);
+    return true;
+}
+
+FCITX_EXPORT_API
+FcitxShmChannel*
+fcitx_shm_channel_new(size_t size)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    uint32_t ringsize = FCITX_SHM_MIN_SIZE;
+    if (size == 0)
+        size = FCITX_SHM_DEFAULT_SIZE;
+    if (size > FCITX_SHM_MAX_SIZE)
+        return NULL;
+    while (ringsize < size)
+        ringsize <<= 1;
+
+    FcitxShmChannel* channel = fcitx_utils_new(FcitxShmChannel);
+    /* ring 0 is client to server, ring 1 is server to client */
+    channel->memfd = ShmCreateFile(ShmMemSize(ringsize));
+    channel->rxfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->txfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->peerrxfd = channel->txfd;
+    channel->peertxfd = channel->rxfd;
+    if (channel->memfd < 0 || channel->rxfd < 0 || channel->txfd < 0
+        || !ShmChannelMap(channel, ringsize, 0)) {
+        fcitx_shm_channel_free(channel);
+        return NULL;
+    }
+
+    FcitxShmHeader* header = channel->mem;
+    header->magic = FCITX_SHM_MAGIC;
+    header->version = FCITX_SHM_VERSION;
+    header->size = ringsize;
+    /* nobody is reading yet, so the first message always wakes up */
+    channel->rx->waiting = 1;
+    channel->tx->waiting = 1;
+    return channel;
+#else
+    FCITX_UNUSED(size);
+    return NULL;
+#endif
+}
+
+static boolean
+ShmIsSealed(int fd)
+{
+#ifdef F_GET_SEALS
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals >= 0 && (seals & F_SEAL_SHRINK);
+#else
+    FCITX_UNUSED(fd);
+    return false;
+#endif
+}
+
+FCITX_EXPORT_API
+FcitxShmChannel*
+fcitx_shm_channel_open(int memfd, int rxfd, int txfd)
+{
+    FcitxShmChannel* channel = fcitx_utils_new(FcitxShmChannel);
+    FcitxShmHeader header;
+    struct stat st;
+    channel->memfd = memfd;
+    channel->rxfd = rxfd;
+    channel->txfd = txfd;
+    channel->peerrxfd = -1;
+    channel->peertxfd = -1;
+
+    if (memfd < 0 || rxfd < 0 || txfd < 0 || !ShmIsSealed(memfd)
+        || fstat(memfd, &st) < 0
+        || (size_t) st.st_size < sizeof(FcitxShmHeader)
+        || pread(memfd, &header, sizeof(header), 0) != sizeof(header)
+        || header.magic != FCITX_SHM_MAGIC
+        || header.version != FCITX_SHM_VERSION
+        || header.size < FCITX_SHM_MIN_SIZE
+        || header.size > FCITX_SHM_MAX_SIZE
+        || (header.size & (header.size - 1)) != 0
+        || (size_t) st.st_size < ShmMemSize(header.size)
+        || !ShmChannelMap(channel, header.size, 1)) {
+        fcitx_shm_channel_free(channel);
+        return NULL;
+    }
+    fcntl(rxfd, F_SETFL, O_NONBLOCK);
+    fcntl(txfd, F_SETFL, O_NONBLOCK);
+    return channel;
+}
+
+FCITX_EXPORT_API
+void
+fcitx_shm_channel_free(FcitxShmChannel* channel)
+{
+    if (channel->mem)
+        munmap(channel->mem, channel->memsize);
+    ShmCloseFd(channel->memfd);
+    ShmCloseFd(channel->rxfd);
+    ShmCloseFd(channel->txfd);
+    fcitx_utils_free(channel->buffer);
+    free(channel);
+}
+
+FCITX_EXPORT_API
+void
+fcitx_shm_channel_get_peer_fds(FcitxShmChannel* channel, int* memfd,
+                               int* rxfd, int* txfd)
+{
+    *memfd = channel->memfd;
+    *rxfd = channel->peerrxfd;
+    *txfd = channel->peertxfd;
+}
+
+FCITX_EXPORT_API
+int
+fcitx_shm_channel_get_fd(FcitxShmChannel* channel)
+{
+    return channel->rxfd;
+}
+
+FCITX_EXPORT_API
+boolean
+fcitx_shm_channel_send(FcitxShmChannel* channel, uint32_t type,
+                       int32_t icid, uint32_t serial,
+                       const void* data, uint32_t length)
+{
+    FcitxShmRing* ring = channel->tx;
+    uint32_t mask = channel->size - 1;
+    /* keep room for other messages, a huge one should use dbus */
+    if (channel->broken || type == FCITX_SHM_PAD
+        || length > channel->size / 4)
+        return false;
+
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+    __sync_synchronize();
+    uint32_t used = head - tail;
+    if (used > channel->size)
+        return false;
+    uint32_t need = sizeof(FcitxShmRecord) + FCITX_SHM_ALIGN(length);
+    uint32_t pad = 0;
+    if ((head & mask) + need > channel->size)
+        pad = channel->size - (head & mask);
+    if (channel->size - used < pad + need)
+        return false;
+
+    FcitxShmRecord* record;
+    if (pad) {
+        record = (FcitxShmRecord*)(channel->txdata + (head & mask));
+        record->type = FCITX_SHM_PAD;
+        record->icid = 0;
+        record->serial = 0;
+        record->length = pad - sizeof(FcitxShmRecord);
+        head += pad;
+    }
+    record = (FcitxShmRecord*)(channel->txdata + (head & mask));
+    record->type = type;
+    record->icid = icid;
+    record->serial = serial;
+    record->length = length;
+    if (length)
+        memcpy(record + 1, data, length);
+    /* payload must be visible before the new head */
+    __sync_synchronize();
+    ring->head = head + need;
+    /* and the head must be visible before we look at waiting */
+    __sync_synchronize();
+    if (ring->waiting) {
+        ring->waiting = 0;
+        ShmWakeUp(channel->txfd);
+    }
+    return true;
+}
+
+FCITX_EXPORT_API
+boolean
+fcitx_shm_channel_receive(FcitxShmChannel* channel, FcitxShmMessage* message)
+{
+    FcitxShmRing* ring = channel->rx;
+    uint32_t mask = channel->size - 1;
+    if (channel->broken)
+        return false;
+
+    uint32_t tail = ring->tail;
+    while (true) {
+        uint32_t head = ring->head;
+        __sync_synchronize();
+        if (head == tail) {
+            uint64_t count;
+            while (read(channel->rxfd, &count, sizeof(count)) > 0);
+            ring->waiting = 1;
+            __sync_synchronize();
+            /* writer may have published between the check and waiting */
+            if (ring->head == tail)
+                return false;
+            continue;
+        }
+
+        uint32_t avail = head - tail;
+        uint32_t offset = tail & mask;
+        uint32_t contiguous = channel->size - offset;
+        FcitxShmRecord record;
+        if (avail > channel->size || avail < sizeof(FcitxShmRecord)
+            || (offset & 15) != 0)
+            break;
+        /* peer can still scribble the record, only trust a local copy */
+        memcpy(&record, channel->rxdata + offset, sizeof(record));
+        if (record.length > avail - sizeof(FcitxShmRecord)
+            || record.length > contiguous - sizeof(FcitxShmRecord))
+            break;
+        uint32_t total = sizeof(FcitxShmRecord) + FCITX_SHM_ALIGN(record.length);
+        if (total > avail || total > contiguous)
+            break;
+
+        if (record.type == FCITX_SHM_PAD) {
+            tail += total;
+            __sync_synchronize();
+            ring->tail = tail;
+            continue;
+        }
+
+        if (channel->buffersize < record.length + 1) {
+            char* buffer = realloc(channel->buffer, record.length + 1);
+            if (!buffer) {
+                /* drop the record, keeping it would stall the ring */
+                tail += total;
+                __sync_synchronize();
+                ring->tail = tail;
+                continue;
+            }
+            channel->buffer = buffer;
+            channel->buffersize = record.length + 1;
+        }
+        memcpy(channel->buffer, channel->rxdata + offset
+               + sizeof(FcitxShmRecord), record.length);
+        channel->buffer[record.length] = '\0';
+        /* the copy must be done before the writer can reuse the space */
+        __sync_synchronize();
+        ring->tail = tail + total;
+
+        message->type = record.type;
+        message->icid = record.icid;
+        message->serial = record.serial;
+        message->length = record.length;
+        message->data = channel->buffer;
+        return true;
+    }
+
+    channel->broken = true;
+    return false;
+}
+
+FCITX_EXPORT_API
+boolean
+fcitx_shm_channel_is_broken(FcitxShmChannel* channel)
+{
+    return channel->broken;
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
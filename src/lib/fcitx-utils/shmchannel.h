@@ -0,0 +1,247 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @addtogroup FcitxUtils
+ * @{
+ */
+
+/**
+ * @file shmchannel.h
+ *
+ * a bidirectional message channel between two processes on the same host,
+ * made of two single producer single consumer rings in a shared memory
+ * file, and one eventfd per direction to wake up the reader.
+ *
+ * The server end creates the channel and passes the file descriptors
+ * returned by fcitx_shm_channel_get_peer_fds to the client, which opens
+ * its end with fcitx_shm_channel_open. Each end must only be used by one
+ * thread. Data read from the peer is always validated, a malformed ring
+ * marks the channel as broken instead of crashing the reader.
+ *
+ * @code
+ * // server
+ * FcitxShmChannel* channel = fcitx_shm_channel_new(0);
+ * fcitx_shm_channel_get_peer_fds(channel, &memfd, &rxfd, &txfd);
+ * // client, after receiving the fds
+ * FcitxShmChannel* channel = fcitx_shm_channel_open(memfd, rxfd, txfd);
+ * fcitx_shm_channel_send(channel, FCITX_SHM_KEY_EVENT, icid, serial,
+ *                        &key, sizeof(key));
+ * // either end, after fcitx_shm_channel_get_fd() becomes readable
+ * FcitxShmMessage message;
+ * while (fcitx_shm_channel_receive(channel, &message))
+ *     handle(&message);
+ * @endcode
+ */
+
+#ifndef __FCITX_UTILS_SHMCHANNEL_H
+#define __FCITX_UTILS_SHMCHANNEL_H
+
+#include <stdint.h>
+#include <fcitx-utils/utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct _FcitxShmChannel FcitxShmChannel;
+
+    /**
+     * message types used by the input method frontend
+     *
+     * @since 4.2.9.3
+     **/
+    typedef enum _FcitxShmMessageType {
+        FCITX_SHM_KEY_EVENT = 1, /**< client to server, FcitxShmKeyEvent */
+        FCITX_SHM_KEY_RESULT = 2, /**< server to client, FcitxShmKeyResult */
+        FCITX_SHM_COMMIT_STRING = 3, /**< server to client, utf8 string */
+        /**
+         * server to client, int32_t cursor, followed by segments of
+         * int32_t format and a nul terminated utf8 string, the integers
+         * are not aligned
+         */
+        FCITX_SHM_UPDATE_PREEDIT = 4,
+        FCITX_SHM_FORWARD_KEY = 5, /**< server to client, FcitxShmForwardKey */
+        /** server to client, FcitxShmDeleteSurroundingText */
+        FCITX_SHM_DELETE_SURROUNDING_TEXT = 6
+    } FcitxShmMessageType;
+
+    /**
+     * payload of FCITX_SHM_KEY_EVENT
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxShmKeyEvent {
+        uint32_t keyval;
+        uint32_t keycode;
+        uint32_t state;
+        int32_t type;
+        uint32_t time;
+    } FcitxShmKeyEvent;
+
+    /**
+     * payload of FCITX_SHM_KEY_RESULT, serial of the message is the one
+     * of the key event
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxShmKeyResult {
+        int32_t result;
+    } FcitxShmKeyResult;
+
+    /**
+     * payload of FCITX_SHM_FORWARD_KEY
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxShmForwardKey {
+        uint32_t keyval;
+        uint32_t state;
+        int32_t type;
+    } FcitxShmForwardKey;
+
+    /**
+     * payload of FCITX_SHM_DELETE_SURROUNDING_TEXT
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxShmDeleteSurroundingText {
+        int32_t offset;
+        uint32_t nchar;
+    } FcitxShmDeleteSurroundingText;
+
+    /**
+     * a received message, data is always followed by a nul byte and stays
+     * valid until the next receive on the same channel
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxShmMessage {
+        uint32_t type;
+        int32_t icid;
+        uint32_t serial;
+        uint32_t length;
+        const char* data;
+    } FcitxShmMessage;
+
+    /**
+     * create the server end of a channel
+     *
+     * @param size size of each ring, rounded up to a power of two, 0 for
+     *        default
+     * @return newly created channel, NULL if not supported (including when
+     *         the shared memory file can't be sealed) or on failure
+     * @since 4.2.9.3
+     **/
+    FcitxShmChannel* fcitx_shm_channel_new(size_t size);
+
+    /**
+     * open the client end of a channel, the channel takes the ownership of
+     * the file descriptors, even on failure
+     *
+     * @param memfd shared memory file
+     * @param rxfd eventfd signalled when there is data to receive
+     * @param txfd eventfd to signal after sending data
+     * @return channel, NULL if the shared memory is not a valid channel or
+     *         its size is not sealed
+     * @since 4.2.9.3
+     **/
+    FcitxShmChannel* fcitx_shm_channel_open(int memfd, int rxfd, int txfd);
+
+    /**
+     * free a channel and close its file descriptors
+     *
+     * @param channel channel
+     * @return void
+     * @since 4.2.9.3
+     **/
+    void fcitx_shm_channel_free(FcitxShmChannel* channel);
+
+    /**
+     * get the file descriptors to be passed to the client, they are still
+     * owned by the channel
+     *
+     * @param channel server end of a channel
+     * @param memfd return shared memory file
+     * @param rxfd return eventfd the client reads from
+     * @param txfd return eventfd the client writes to
+     * @return void
+     * @since 4.2.9.3
+     **/
+    void fcitx_shm_channel_get_peer_fds(FcitxShmChannel* channel, int* memfd,
+                                        int* rxfd, int* txfd);
+
+    /**
+     * file descriptor that becomes readable when there may be messages
+     * to receive
+     *
+     * @param channel channel
+     * @return int fd
+     * @since 4.2.9.3
+     **/
+    int fcitx_shm_channel_get_fd(FcitxShmChannel* channel);
+
+    /**
+     * send a message to the peer
+     *
+     * @param channel channel
+     * @param type message type
+     * @param icid input context id
+     * @param serial serial of the message
+     * @param data payload
+     * @param length length of payload
+     * @return false if the ring is full, the message is too large or the
+     *         channel is broken
+     * @since 4.2.9.3
+     **/
+    boolean fcitx_shm_channel_send(FcitxShmChannel* channel, uint32_t type,
+                                   int32_t icid, uint32_t serial,
+                                   const void* data, uint32_t length);
+
+    /**
+     * receive the next message from the peer
+     *
+     * @param channel channel
+     * @param message return the message
+     * @return false if there is no message or the channel is broken, a
+     *         message that can't be copied for lack of memory is dropped
+     * @since 4.2.9.3
+     **/
+    boolean fcitx_shm_channel_receive(FcitxShmChannel* channel,
+                                      FcitxShmMessage* message);
+
+    /**
+     * check whether the peer has written malformed data
+     *
+     * @param channel channel
+     * @return boolean
+     * @since 4.2.9.3
+     **/
+    boolean fcitx_shm_channel_is_broken(FcitxShmChannel* channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**
+ * @}
+ */
@@ -21,6 +21,7 @@
 #ifndef _FCITX_CANDIDATE_INTERNAL_H_
 #define _FCITX_CANDIDATE_INTERNAL_H_
 
+#include "fcitx-utils/memory.h"
 #include "candidate.h"
 
 struct _FcitxCandidateWordList {
@@ -40,6 +41,12 @@ struct _FcitxCandidateWordList {
     boolean override;
     boolean overrideHighlight;
     boolean overrideHighlightValue;
+    FcitxCandidateWordProvider provider;
+    void* providerArg;
+    FcitxDestroyNotify providerDestroyNotify;
+    FcitxMemoryPool* pool;
+    UT_array* mergedPools;
+    boolean hasHeapWords;
 };
 
 #endif
@@ -18,12 +18,128 @@
  *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
  ***************************************************************************/
 
+#include <limits.h>
+
 #include "candidate-internal.h"
 
 static const UT_icd cand_icd = {
     sizeof(FcitxCandidateWord), NULL, NULL, FcitxCandidateWordFree
 };
 
+static void
+FcitxCandidateWordReleaseProvider(FcitxCandidateWordList* candList)
+{
+    if (candList->providerDestroyNotify)
+        candList->providerDestroyNotify(candList->providerArg);
+    candList->provider = NULL;
+    candList->providerArg = NULL;
+    candList->providerDestroyNotify = NULL;
+}
+
+static boolean
+FcitxCandidateWordIsPooled(FcitxCandidateWordList* candList, const void* ptr)
+{
+    if (!ptr)
+        return false;
+    if (candList->pool && fcitx_memory_pool_contains(candList->pool, ptr))
+        return true;
+    if (candList->mergedPools) {
+        utarray_foreach(pool, candList->mergedPools, FcitxMemoryPool*) {
+            if (fcitx_memory_pool_contains(*pool, ptr))
+                return true;
+        }
+    }
+    return false;
+}
+
+static void
+FcitxCandidateWordCheckHeap(FcitxCandidateWordList* candList,
+                            FcitxCandidateWord* candWord)
+{
+    if (candList->hasHeapWords)
+        return;
+    if ((candWord->strWord &&
+         !FcitxCandidateWordIsPooled(candList, candWord->strWord)) ||
+        (candWord->strExtra &&
+         !FcitxCandidateWordIsPooled(candList, candWord->strExtra)) ||
+        (candWord->priv &&
+         !FcitxCandidateWordIsPooled(candList, candWord->priv)))
+        candList->hasHeapWords = true;
+}
+
+/* clear pointers to pool memory so FcitxCandidateWordFree won't touch them */
+static void
+FcitxCandidateWordUnlinkPooled(FcitxCandidateWordList* candList,
+                               int start, int end)
+{
+    int i;
+    if (!candList->pool && !candList->mergedPools)
+        return;
+    for (i = start; i < end; i++) {
+        FcitxCandidateWord* candWord =
+            (FcitxCandidateWord*) utarray_eltptr(&candList->candWords, i);
+        if (!candWord)
+            break;
+        if (FcitxCandidateWordIsPooled(candList, candWord->strWord))
+            candWord->strWord = NULL;
+        if (FcitxCandidateWordIsPooled(candList, candWord->strExtra))
+            candWord->strExtra = NULL;
+        if (FcitxCandidateWordIsPooled(candList, candWord->priv))
+            candWord->priv = NULL;
+    }
+}
+
+static void
+FcitxCandidateWordClear(FcitxCandidateWordList* candList)
+{
+    if (candList->pool || candList->mergedPools) {
+        /* nothing to free one by one if all words live in the pool */
+        if (candList->hasHeapWords)
+            FcitxCandidateWordUnlinkPooled(candList, 0,
+                                           utarray_len(&candList->candWords));
+        else
+            candList->candWords.i = 0;
+    }
+    utarray_clear(&candList->candWords);
+    candList->hasHeapWords = false;
+    if (candList->pool)
+        fcitx_memory_pool_reset(candList->pool);
+    if (candList->mergedPools) {
+        utarray_foreach(pool, candList->mergedPools, FcitxMemoryPool*) {
+            fcitx_memory_pool_destroy(*pool);
+        }
+        utarray_free(candList->mergedPools);
+        candList->mergedPools = NULL;
+    }
+}
+
+/**
+ * ask the provider until there are at least size candidates, provider is
+ * cleared once it returns less than asked, but arg is kept until reset
+ * since candidates may still refer to it.
+ */
+static void
+FcitxCandidateWordFetch(FcitxCandidateWordList* candList, int size)
+{
+    FcitxCandidateWordProvider provider = candList->provider;
+    int len = utarray_len(&candList->candWords);
+    if (!provider || len >= size)
+        return;
+    int count = size - len;
+    /* the provider may look at the list itself, don't fetch again */
+    candList->provider = NULL;
+    if (provider(candList->providerArg, candList, len, count) >= count)
+        candList->provider = provider;
+}
+
+/* current page, and one more to know whether there is a next page */
+static inline void
+FcitxCandidateWordFetchWindow(FcitxCandidateWordList* candList)
+{
+    FcitxCandidateWordFetch(candList, (candList->currentPage + 1)
+                            * candList->wordPerPage + 1);
+}
+
 FCITX_EXPORT_API
 FcitxCandidateWordList* FcitxCandidateWordNewList()
 {
@@ -41,7 +157,11 @@ FcitxCandidateWordList* FcitxCandidateWordNewList()
 FCITX_EXPORT_API
 void FcitxCandidateWordFreeList(FcitxCandidateWordList* list)
 {
+    FcitxCandidateWordClear(list);
     utarray_done(&list->candWords);
+    FcitxCandidateWordReleaseProvider(list);
+    if (list->pool)
+        fcitx_memory_pool_destroy(list->pool);
     free(list);
 }
 
@@ -49,6 +169,7 @@ FCITX_EXPORT_API
 void FcitxCandidateWordInsert(FcitxCandidateWordList* candList,
                               FcitxCandidateWord* candWord, int position)
 {
+    FcitxCandidateWordCheckHeap(candList, candWord);
     fcitx_array_insert(&candList->candWords, candWord, position);
 }
 
@@ -60,6 +181,23 @@ FcitxCandidateWordMerge(FcitxCandidateWordList* candList,
     void *p;
     if (!newList)
         return;
+    FcitxCandidateWordFetch(newList, INT_MAX);
+    /* words keep pointing to the pool of newList, take it over */
+    if (newList->pool || newList->mergedPools) {
+        if (!candList->mergedPools)
+            utarray_new(candList->mergedPools, fcitx_ptr_icd);
+        if (newList->pool)
+            utarray_push_back(candList->mergedPools, &newList->pool);
+        if (newList->mergedPools) {
+            utarray_concat(candList->mergedPools, newList->mergedPools);
+            utarray_free(newList->mergedPools);
+            newList->mergedPools = NULL;
+        }
+        newList->pool = NULL;
+    }
+    if (newList->hasHeapWords)
+        candList->hasHeapWords = true;
+    newList->hasHeapWords = false;
     if (position >= 0) {
         fcitx_array_inserta(&candList->candWords, &newList->candWords,
                             position);
@@ -105,6 +243,7 @@ FcitxCandidateWordMoveByWord(FcitxCandidateWordList *candList,
 FCITX_EXPORT_API void
 FcitxCandidateWordRemoveByIndex(FcitxCandidateWordList *candList, int idx)
 {
+    FcitxCandidateWordUnlinkPooled(candList, idx, idx + 1);
     fcitx_array_erase(&candList->candWords, idx, 1);
 }
 
@@ -119,7 +258,10 @@ FcitxCandidateWordRemove(FcitxCandidateWordList *candList,
 FCITX_EXPORT_API void
 FcitxCandidateWordSetPage(FcitxCandidateWordList *candList, int index)
 {
-    if (index >= 0 && index < FcitxCandidateWordPageCount(candList)) {
+    if (index < 0)
+        return;
+    FcitxCandidateWordFetch(candList, index * candList->wordPerPage + 1);
+    if (index < FcitxCandidateWordPageCount(candList)) {
         candList->currentPage = index;
     }
 }
@@ -133,7 +275,8 @@ FcitxCandidateWordSetFocus(FcitxCandidateWordList* candList, int index)
 FCITX_EXPORT_API
 void FcitxCandidateWordReset(FcitxCandidateWordList* candList)
 {
-    utarray_clear(&candList->candWords);
+    FcitxCandidateWordClear(candList);
+    FcitxCandidateWordReleaseProvider(candList);
     if (candList->override) {
         candList->override = false;
         candList->hasPrev = false;
@@ -161,6 +304,7 @@ int FcitxCandidateWordGetCurrentIndex(FcitxCandidateWordList* candList)
 FCITX_EXPORT_API FcitxCandidateWord*
 FcitxCandidateWordGetCurrentWindow(FcitxCandidateWordList* candList)
 {
+    FcitxCandidateWordFetchWindow(candList);
     return FcitxCandidateWordGetByTotalIndex(
         candList, candList->currentPage * candList->wordPerPage);
 }
@@ -196,6 +340,8 @@ FcitxCandidateWordGetCurrentWindowPrev(FcitxCandidateWordList* candList,
 FCITX_EXPORT_API FcitxCandidateWord*
 FcitxCandidateWordGetByTotalIndex(FcitxCandidateWordList* candList, int index)
 {
+    if (index >= 0)
+        FcitxCandidateWordFetch(candList, index + 1);
     return fcitx_array_eltptr(&candList->candWords, index);
 }
 
@@ -268,6 +414,7 @@ boolean FcitxCandidateWordHasNext(FcitxCandidateWordList* candList)
 FCITX_EXPORT_API int
 FcitxCandidateWordPageCount(FcitxCandidateWordList* candList)
 {
+    FcitxCandidateWordFetchWindow(candList);
     return (utarray_len(&candList->candWords) + candList->wordPerPage - 1) / candList->wordPerPage;
 }
 
@@ -286,6 +433,7 @@ void FcitxCandidateWordFree(void* arg)
 FCITX_EXPORT_API
 void FcitxCandidateWordAppend(FcitxCandidateWordList* candList, FcitxCandidateWord* candWord)
 {
+    FcitxCandidateWordCheckHeap(candList, candWord);
     utarray_push_back(&candList->candWords, candWord);
 }
 
@@ -365,6 +513,9 @@ int FcitxCandidateWordGetCurrentPage(FcitxCandidateWordList* candList)
 FCITX_EXPORT_API
 void FcitxCandidateWordResize(FcitxCandidateWordList* candList, int length)
 {
+    if (length >= 0 && length < (int) utarray_len(&candList->candWords))
+        FcitxCandidateWordUnlinkPooled(candList, length,
+                                       utarray_len(&candList->candWords));
     fcitx_array_resize(&candList->candWords, length);
 }
 
@@ -386,6 +537,7 @@ void FcitxCandidateWordSetPageSize(FcitxCandidateWordList* candList, int size)
 FCITX_EXPORT_API
 int FcitxCandidateWordGetCurrentWindowSize(FcitxCandidateWordList* candList)
 {
+    FcitxCandidateWordFetchWindow(candList);
     if (utarray_len(&candList->candWords) == 0)
         return 0;
     /* last page */
@@ -400,6 +552,7 @@ int FcitxCandidateWordGetCurrentWindowSize(FcitxCandidateWordList* candList)
 FCITX_EXPORT_API
 int FcitxCandidateWordGetListSize(FcitxCandidateWordList* candList)
 {
+    FcitxCandidateWordFetchWindow(candList);
     return utarray_len(&candList->candWords);
 }
 
@@ -418,6 +571,7 @@ boolean FcitxCandidateWordGetHasGoneToNextPage(FcitxCandidateWordList* candList)
 FCITX_EXPORT_API
 FcitxCandidateWord* FcitxCandidateWordGetFirst(FcitxCandidateWordList* candList)
 {
+    FcitxCandidateWordFetchWindow(candList);
     return (FcitxCandidateWord*)utarray_front(&candList->candWords);
 }
 
@@ -484,6 +638,50 @@ void FcitxCandidateWordSetOverrideDefaultHighlight(FcitxCandidateWordList* candL
     candList->overrideHighlightValue = overrideValue;
 }
 
+FCITX_EXPORT_API
+void FcitxCandidateWordSetProvider(FcitxCandidateWordList* candList,
+                                   FcitxCandidateWordProvider provider,
+                                   void* arg,
+                                   FcitxDestroyNotify destroyNotify)
+{
+    FcitxCandidateWordReleaseProvider(candList);
+    candList->provider = provider;
+    candList->providerArg = arg;
+    candList->providerDestroyNotify = destroyNotify;
+}
+
+FCITX_EXPORT_API
+boolean FcitxCandidateWordIsListSizeKnown(FcitxCandidateWordList* candList)
+{
+    return candList->provider == NULL;
+}
+
+static inline FcitxMemoryPool*
+FcitxCandidateWordGetPool(FcitxCandidateWordList* candList)
+{
+    if (!candList->pool)
+        candList->pool = fcitx_memory_pool_create();
+    return candList->pool;
+}
+
+FCITX_EXPORT_API
+void* FcitxCandidateWordAlloc(FcitxCandidateWordList* candList, size_t size)
+{
+    return fcitx_memory_pool_alloc_align(FcitxCandidateWordGetPool(candList),
+                                         size, 1);
+}
+
+FCITX_EXPORT_API
+char* FcitxCandidateWordStrdup(FcitxCandidateWordList* candList,
+                               const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* result = fcitx_memory_pool_alloc(FcitxCandidateWordGetPool(candList),
+                                           len);
+    memcpy(result, str, len);
+    return result;
+}
+
 FCITX_EXPORT_API FcitxCandidateWord*
 FcitxCandidateWordGetFocus(FcitxCandidateWordList *cand_list, boolean clear)
 {
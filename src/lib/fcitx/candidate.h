@@ -341,7 +341,8 @@ extern "C" {
     boolean FcitxCandidateWordHasPrev(struct _FcitxCandidateWordList* candList);
 
     /**
-     * get number of total page
+     * get number of total page, see FcitxCandidateWordSetProvider when the
+     * list size is not known yet
      *
      * @param candList candidate word list
      * @return int
@@ -451,7 +452,8 @@ extern "C" {
     int FcitxCandidateWordGetCurrentWindowSize(struct _FcitxCandidateWordList* candList);
 
     /**
-     * get total candidate word count
+     * get total candidate word count, see FcitxCandidateWordSetProvider when
+     * the list size is not known yet
      *
      * @param candList candidate word list
      * @return int
@@ -580,6 +582,87 @@ extern "C" {
      */
     void FcitxCandidateWordSetOverrideDefaultHighlight(FcitxCandidateWordList* candList, boolean overrideValue);
 
+    /**
+     * candidate provider callback, append the candidates with total index
+     * [start, start + count) to candList with FcitxCandidateWordAppend.
+     * start is always the current size of the list.
+     *
+     * @param arg provider arg
+     * @param candList candidate words
+     * @param start index of the first requested candidate
+     * @param count number of requested candidates
+     * @return number of candidates appended, less than count means there is no more
+     *
+     * @since 4.2.9.3
+     **/
+    typedef int (*FcitxCandidateWordProvider)(void* arg,
+                                              FcitxCandidateWordList* candList,
+                                              int start, int count);
+
+    /**
+     * let the list fetch candidates on demand instead of having all of them
+     * appended up front. Candidates already in the list come first, the
+     * provider is asked for the rest when a page beyond them is needed.
+     *
+     * While the provider is not exhausted, FcitxCandidateWordGetListSize and
+     * FcitxCandidateWordPageCount only count the candidates fetched so far,
+     * which always includes the current page and one candidate after it, so
+     * FcitxCandidateWordHasNext and FcitxCandidateWordGoNextPage work as
+     * usual. Iterating with FcitxCandidateWordGetNext only walks the fetched
+     * candidates. The provider is dropped by FcitxCandidateWordReset.
+     *
+     * @param candList candidate words
+     * @param provider provider callback
+     * @param arg arg passed to provider
+     * @param destroyNotify called on arg when the provider is dropped
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxCandidateWordSetProvider(FcitxCandidateWordList* candList,
+                                       FcitxCandidateWordProvider provider,
+                                       void* arg,
+                                       FcitxDestroyNotify destroyNotify);
+
+    /**
+     * whether FcitxCandidateWordGetListSize is the real total, it is false
+     * only when a provider still has candidates not fetched.
+     *
+     * @param candList candidate words
+     * @return boolean
+     *
+     * @since 4.2.9.3
+     **/
+    boolean FcitxCandidateWordIsListSizeKnown(FcitxCandidateWordList* candList);
+
+    /**
+     * allocate zeroed memory for strWord, strExtra or priv of a candidate
+     * word that is going to be added to candList. It is released all at once
+     * by FcitxCandidateWordReset, so it must not be freed or replaced by the
+     * caller, and the word must not be moved to another list except with
+     * FcitxCandidateWordMerge.
+     *
+     * @param candList candidate words
+     * @param size size
+     * @return void*
+     *
+     * @since 4.2.9.3
+     **/
+    void* FcitxCandidateWordAlloc(FcitxCandidateWordList* candList,
+                                  size_t size);
+
+    /**
+     * strdup with FcitxCandidateWordAlloc
+     *
+     * @param candList candidate words
+     * @param str string
+     * @return char*
+     *
+     * @since 4.2.9.3
+     **/
+    char* FcitxCandidateWordStrdup(FcitxCandidateWordList* candList,
+                                   const char* str);
+
 /** convinient string for candidate word */
 #define DIGIT_STR_CHOOSE "1234567890"
 
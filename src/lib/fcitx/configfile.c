@@ -50,6 +50,7 @@ CONFIG_BINDING_REGISTER("Appearance", "ShowInputSpeed", bShowUserSpeed)
 CONFIG_BINDING_REGISTER("Appearance", "ShowVersion", bShowVersion)
 CONFIG_BINDING_REGISTER("Appearance", "HideInputWindowWhenOnlyPreeditString", bHideInputWindowWhenOnlyPreeditString);
 CONFIG_BINDING_REGISTER("Appearance", "HideInputWindowWhenOnlyOneCandidate", bHideInputWindowWhenOnlyOneCandidate);
+CONFIG_BINDING_REGISTER("Appearance", "UIUpdateInterval", iUIUpdateInterval)
 CONFIG_BINDING_REGISTER("Hotkey", "TriggerKey", hkTrigger)
 CONFIG_BINDING_REGISTER("Hotkey", "ActivateKey", hkActivate)
 CONFIG_BINDING_REGISTER("Hotkey", "InactivateKey", hkInactivate)
@@ -148,7 +148,8 @@ extern "C" {
             FcitxHotkey hkCustomSwitchKey[2];
             int _dummy7[8];
         };
-        int padding[7]; /**< padding */
+        int iUIUpdateInterval; /**< minimal interval between two input window updates in ms, since 4.2.9.3 */
+        int padding[6]; /**< padding */
     } FcitxGlobalConfig;
 
     /**
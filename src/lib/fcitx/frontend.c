@@ -35,6 +35,7 @@
 #include "instance.h"
 #include "instance-internal.h"
 #include "addon-internal.h"
+#include "keytrace-internal.h"
 #include "config.h"
 
 static void FcitxInstanceCleanUpIC(FcitxInstance* instance);
@@ -377,7 +378,10 @@ void FcitxInstanceCommitString(FcitxInstance* instance, FcitxInputContext* ic, c
     if (pfrontend == NULL)
         return;
     FcitxFrontend* frontend = (*pfrontend)->frontend;
+    FCITX_KEY_TRACE_BEGIN(span);
     frontend->CommitString((*pfrontend)->addonInstance, ic, str);
+    FCITX_KEY_TRACE_END(instance, span, FKTS_FRONTEND, NULL,
+                        (*pfrontend)->name);
 
     FcitxInputState* input = instance->input;
     fcitx_utf8_strncpy(input->strLastCommit, str, MAX_USER_INPUT);
@@ -440,7 +444,10 @@ void FcitxInstanceUpdatePreedit(FcitxInstance* instance, FcitxInputContext* ic)
     if (pfrontend == NULL)
         return;
     FcitxFrontend* frontend = (*pfrontend)->frontend;
+    FCITX_KEY_TRACE_BEGIN(span);
     frontend->UpdatePreedit((*pfrontend)->addonInstance, ic);
+    FCITX_KEY_TRACE_END(instance, span, FKTS_FRONTEND, NULL,
+                        (*pfrontend)->name);
 }
 
 FCITX_EXPORT_API
@@ -455,8 +462,12 @@ void FcitxInstanceUpdateClientSideUI(FcitxInstance* instance, FcitxInputContext*
     if (pfrontend == NULL)
         return;
     FcitxFrontend* frontend = (*pfrontend)->frontend;
-    if (frontend->UpdateClientSideUI)
+    if (frontend->UpdateClientSideUI) {
+        FCITX_KEY_TRACE_BEGIN(span);
         frontend->UpdateClientSideUI((*pfrontend)->addonInstance, ic);
+        FCITX_KEY_TRACE_END(instance, span, FKTS_FRONTEND, NULL,
+                            (*pfrontend)->name);
+    }
 }
 
 FCITX_EXPORT_API
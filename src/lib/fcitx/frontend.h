@@ -79,6 +79,8 @@ extern "C" {
         CAPACITY_ALPHA = (1 << 21),
         CAPACITY_NAME = (1 << 22),
         CAPACITY_GET_IM_INFO_ON_FOCUS = (1 << 23),
+        CAPACITY_BATCH_KEY_EVENT = (1 << 24), /**< client may send several key events with ProcessKeyEvents, @since 4.2.9.3 */
+        CAPACITY_STRUCTURED_CLIENT_SIDE_UI = (1 << 25), /**< client side ui is updated with changed fields only, @since 4.2.9.3 */
     } FcitxCapacityFlags;
 
     /**
@@ -23,6 +23,8 @@
  * private header of hook
  */
 
+#include <stdint.h>
+
 struct _FcitxInstance;
 
 /**
@@ -145,4 +147,12 @@ void FcitxInstanceProcessIMChangedHook(struct _FcitxInstance* instance);
  **/
 void FcitxInstanceProcessUIStatusChangedHook(struct _FcitxInstance* instance, const char* statusName);
 
+/**
+ * bit mask of active output filters, changed when a filter is toggled
+ *
+ * @param instance fcitx instance
+ * @return uint32_t
+ **/
+uint32_t FcitxInstanceGetOutputFilterState(struct _FcitxInstance* instance);
+
 // kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -18,6 +18,8 @@
  *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
  ***************************************************************************/
 
+#include <string.h>
+
 #include "fcitx/hook.h"
 #include "fcitx-utils/log.h"
 #include "ime.h"
@@ -26,6 +28,7 @@
 #include "fcitx/hook-internal.h"
 #include "fcitx-utils/utils.h"
 #include "instance-internal.h"
+#include "keytrace-internal.h"
 
 /**
  * @file hook.c
@@ -40,6 +43,7 @@ typedef struct _HookStack {
     union {
         FcitxKeyFilterHook keyfilter;
         FcitxStringFilterHook stringfilter;
+        FcitxStringFilterHookv2 stringfilter2;
         FcitxIMEventHook eventhook;
         FcitxICEventHook ichook;
         FcitxHotkeyHook hotkey;
@@ -75,12 +79,29 @@ typedef struct _HookStack {
         head->field = value; \
     }
 
+/**
+ * internal macro to define a v2 register function on an existing hook
+ */
+#define DEFINE_HOOK_V2(name, type, field) \
+    FCITX_EXPORT_API \
+    void FcitxInstanceRegister##name##v2(FcitxInstance* instance, type value) \
+    { \
+        HookStack* head = Get##name(instance); \
+        while(head->next != NULL) \
+            head = head->next; \
+        head->next = fcitx_utils_malloc0(sizeof(HookStack)); \
+        head = head->next; \
+        head->field = value; \
+    }
+
 DEFINE_HOOK(PreInputFilter, FcitxKeyFilterHook, keyfilter)
 DEFINE_HOOK(PostInputFilter, FcitxKeyFilterHook, keyfilter)
 DEFINE_HOOK(PreReleaseInputFilter, FcitxKeyFilterHook, keyfilter)
 DEFINE_HOOK(PostReleaseInputFilter, FcitxKeyFilterHook, keyfilter)
 DEFINE_HOOK(OutputFilter, FcitxStringFilterHook, stringfilter)
 DEFINE_HOOK(CommitFilter, FcitxStringFilterHook, stringfilter)
+DEFINE_HOOK_V2(OutputFilter, FcitxStringFilterHookv2, stringfilter2)
+DEFINE_HOOK_V2(CommitFilter, FcitxStringFilterHookv2, stringfilter2)
 DEFINE_HOOK(HotkeyFilter, FcitxHotkeyHook, hotkey)
 DEFINE_HOOK(ResetInputHook, FcitxIMEventHook, eventhook);
 DEFINE_HOOK(TriggerOnHook, FcitxIMEventHook, eventhook);
@@ -99,7 +120,11 @@ void FcitxInstanceProcessPreInputFilter(FcitxInstance* instance, FcitxKeySym sym
     stack = stack->next;
     *retval = IRV_TO_PROCESS;
     while (stack) {
-        if (stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval))
+        FCITX_KEY_TRACE_BEGIN(span);
+        boolean handled = stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval);
+        FCITX_KEY_TRACE_END(instance, span, FKTS_PRE_INPUT_FILTER,
+                            stack->keyfilter.func, NULL);
+        if (handled)
             break;
         stack = stack->next;
     }
@@ -110,7 +135,11 @@ void FcitxInstanceProcessPostInputFilter(FcitxInstance* instance, FcitxKeySym sy
     HookStack* stack = GetPostInputFilter(instance);
     stack = stack->next;
     while (stack) {
-        if (stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval))
+        FCITX_KEY_TRACE_BEGIN(span);
+        boolean handled = stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval);
+        FCITX_KEY_TRACE_END(instance, span, FKTS_POST_INPUT_FILTER,
+                            stack->keyfilter.func, NULL);
+        if (handled)
             break;
         stack = stack->next;
     }
@@ -122,7 +151,11 @@ void FcitxInstanceProcessPreReleaseInputFilter(FcitxInstance* instance, FcitxKey
     stack = stack->next;
     *retval = IRV_TO_PROCESS;
     while (stack) {
-        if (stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval))
+        FCITX_KEY_TRACE_BEGIN(span);
+        boolean handled = stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval);
+        FCITX_KEY_TRACE_END(instance, span, FKTS_PRE_INPUT_FILTER,
+                            stack->keyfilter.func, NULL);
+        if (handled)
             break;
         stack = stack->next;
     }
@@ -133,7 +166,11 @@ void FcitxInstanceProcessPostReleaseInputFilter(FcitxInstance* instance, FcitxKe
     HookStack* stack = GetPostReleaseInputFilter(instance);
     stack = stack->next;
     while (stack) {
-        if (stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval))
+        FCITX_KEY_TRACE_BEGIN(span);
+        boolean handled = stack->keyfilter.func(stack->keyfilter.arg, sym, state, retval);
+        FCITX_KEY_TRACE_END(instance, span, FKTS_POST_INPUT_FILTER,
+                            stack->keyfilter.func, NULL);
+        if (handled)
             break;
         stack = stack->next;
     }
@@ -149,6 +186,13 @@ void FcitxInstanceProcessUpdateCandidates(FcitxInstance* instance)
     }
 }
 
+static inline boolean
+StringFilterIsActive(HookStack* stack)
+{
+    return !stack->stringfilter2.isActive ||
+           stack->stringfilter2.isActive(stack->stringfilter2.arg);
+}
+
 FCITX_EXPORT_API
 char* FcitxInstanceProcessOutputFilter(FcitxInstance* instance, const char *in)
 {
@@ -157,7 +201,11 @@ char* FcitxInstanceProcessOutputFilter(FcitxInstance* instance, const char *in)
     char *out = NULL;
     char* newout = NULL;
     while (stack) {
-        newout = stack->stringfilter.func(stack->stringfilter.arg, in);
+        if (!StringFilterIsActive(stack)) {
+            stack = stack->next;
+            continue;
+        }
+        newout = stack->stringfilter2.func(stack->stringfilter2.arg, in);
         if (newout) {
             if (out) {
                 free(out);
@@ -170,6 +218,67 @@ char* FcitxInstanceProcessOutputFilter(FcitxInstance* instance, const char *in)
     return out;
 }
 
+uint32_t FcitxInstanceGetOutputFilterState(FcitxInstance* instance)
+{
+    HookStack* stack = GetOutputFilter(instance);
+    uint32_t state = 0;
+    int i = 0;
+    for (stack = stack->next; stack; stack = stack->next, i++) {
+        if (StringFilterIsActive(stack))
+            state |= (1u << (i % 32));
+    }
+    return state;
+}
+
+FCITX_EXPORT_API
+int FcitxInstanceProcessOutputFilterArray(FcitxInstance* instance, char** strs, int count)
+{
+    HookStack* stack = GetOutputFilter(instance);
+    stack = stack->next;
+    if (count <= 0)
+        return 0;
+
+    /* every filter sees the original string, same as the single version */
+    const char* in[count];
+    char* newout[count];
+    int i;
+    for (i = 0; i < count; i++)
+        in[i] = strs[i];
+
+    while (stack) {
+        if (!StringFilterIsActive(stack)) {
+            stack = stack->next;
+            continue;
+        }
+        FcitxStringFilterHookv2* hook = &stack->stringfilter2;
+        memset(newout, 0, sizeof(newout));
+        if (hook->arrayFunc) {
+            if (hook->arrayFunc(hook->arg, in, newout, count) == 0) {
+                stack = stack->next;
+                continue;
+            }
+        } else {
+            for (i = 0; i < count; i++)
+                newout[i] = hook->func(hook->arg, in[i]);
+        }
+        for (i = 0; i < count; i++) {
+            if (!newout[i])
+                continue;
+            if (strs[i] != in[i])
+                free(strs[i]);
+            strs[i] = newout[i];
+        }
+        stack = stack->next;
+    }
+
+    int changed = 0;
+    for (i = 0; i < count; i++) {
+        if (strs[i] != in[i])
+            changed++;
+    }
+    return changed;
+}
+
 FCITX_EXPORT_API
 char* FcitxInstanceProcessCommitFilter(FcitxInstance* instance, const char *in)
 {
@@ -178,7 +287,11 @@ char* FcitxInstanceProcessCommitFilter(FcitxInstance* instance, const char *in)
     char *out = NULL;
     char* newout = NULL;
     while (stack) {
-        newout = stack->stringfilter.func(stack->stringfilter.arg, in);
+        if (!StringFilterIsActive(stack)) {
+            stack = stack->next;
+            continue;
+        }
+        newout = stack->stringfilter2.func(stack->stringfilter2.arg, in);
         if (newout) {
             if (out) {
                 free(out);
@@ -290,7 +403,10 @@ INPUT_RETURN_VALUE FcitxInstanceProcessHotkey(FcitxInstance* instance, FcitxKeyS
             &tempKey[1].state
         );
         if (FcitxHotkeyIsHotKey(keysym, state, tempKey)) {
+            FCITX_KEY_TRACE_BEGIN(span);
             out = stack->hotkey.hotkeyhandle(stack->hotkey.arg);
+            FCITX_KEY_TRACE_END(instance, span, FKTS_HOTKEY,
+                                stack->hotkey.hotkeyhandle, NULL);
             break;
         }
         stack = stack->next;
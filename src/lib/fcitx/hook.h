@@ -52,6 +52,21 @@ extern "C" {
 
     typedef char* (*FcitxStringFilter)(void* arg, const char* in);
 
+    /**
+     * check whether a filter need to be run at all, a filter that is not
+     * active is skipped without being called.
+     **/
+    typedef boolean (*FcitxStringFilterIsActive)(void* arg);
+
+    /**
+     * string array filter function, out[i] should be set to a malloced
+     * string if in[i] is changed, and left NULL otherwise.
+     *
+     * @return number of changed strings
+     **/
+    typedef int (*FcitxStringArrayFilter)(void* arg, const char* const* in,
+                                          char** out, int count);
+
     /**
      * ime event hook function
      **/
@@ -115,6 +130,32 @@ extern "C" {
         void *arg;
     } FcitxStringFilterHook;
 
+    /**
+     * String filter hook with activity check and array processing.
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxStringFilterHookv2 {
+        /**
+         * Filter function, return NULL if the string is unchanged
+         **/
+        FcitxStringFilter func;
+        /**
+         * Extra argument for the filter function.
+         **/
+        void *arg;
+        /**
+         * optional, filter is skipped if it returns false
+         **/
+        FcitxStringFilterIsActive isActive;
+        /**
+         * optional, used by FcitxInstanceProcessOutputFilterArray instead
+         * of calling func on every string
+         **/
+        FcitxStringArrayFilter arrayFunc;
+        void* padding[4];
+    } FcitxStringFilterHookv2;
+
     /**
      * IME Event hook for Reset, Trigger On/Off, Focus/Unfocus
      **/
@@ -287,6 +328,43 @@ extern "C" {
      **/
     void FcitxInstanceRegisterCommitFilter(struct _FcitxInstance* instance, FcitxStringFilterHook hook);
 
+    /**
+     * register output string filter which can be skipped when inactive
+     *
+     * @param instance fcitx instance
+     * @param hook new hook
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxInstanceRegisterOutputFilterv2(struct _FcitxInstance* instance, FcitxStringFilterHookv2 hook);
+
+    /**
+     * register commit string filter which can be skipped when inactive
+     *
+     * @param instance fcitx instance
+     * @param hook new hook
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxInstanceRegisterCommitFilterv2(struct _FcitxInstance* instance, FcitxStringFilterHookv2 hook);
+
+    /**
+     * process output filter on an array of strings in one pass, strs[i] is
+     * replaced with a malloced string only if it is changed, so the caller
+     * need to free strs[i] if it differs from the original pointer.
+     * Nothing is allocated if no active filter changes anything.
+     *
+     * @param instance fcitx instance
+     * @param strs strings to be filtered
+     * @param count length of strs
+     * @return number of changed strings
+     *
+     * @since 4.2.9.3
+     **/
+    int FcitxInstanceProcessOutputFilterArray(struct _FcitxInstance* instance, char** strs, int count);
+
     /**
      * register a hook for watching when ic status changed
      *
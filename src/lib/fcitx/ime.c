@@ -51,6 +51,7 @@
 #include "fcitx-internal.h"
 #include "addon-internal.h"
 #include "context-internal.h"
+#include "keytrace-internal.h"
 
 
 static const FcitxHotkey* switchKey1[] = {
@@ -715,6 +716,7 @@ INPUT_RETURN_VALUE FcitxInstanceProcessKey(
         return IRV_DONOT_PROCESS;
     }
 
+    FCITX_KEY_TRACE_BEGIN(keySpan);
     INPUT_RETURN_VALUE retVal = IRV_TO_PROCESS;
     FcitxIM* currentIM = FcitxInstanceGetCurrentIM(instance);
     FcitxInputState *input = instance->input;
@@ -797,6 +799,7 @@ INPUT_RETURN_VALUE FcitxInstanceProcessKey(
      * pressed.
      */
 
+    FCITX_KEY_TRACE_BEGIN(hotkeySpan);
     /* process keyrelease event for switch key and 2nd, 3rd key */
     if (event == FCITX_RELEASE_KEY
         && FcitxInstanceGetCurrentState(instance) != IS_CLOSED
@@ -856,12 +859,16 @@ INPUT_RETURN_VALUE FcitxInstanceProcessKey(
             } while(0);
         }
     }
+    FCITX_KEY_TRACE_END(instance, hotkeySpan, FKTS_HOTKEY, NULL, NULL);
 
     if (retVal == IRV_TO_PROCESS && event == FCITX_RELEASE_KEY) {
         FcitxInstanceProcessPreReleaseInputFilter(instance, sym, state, &retVal);
 
          if (retVal == IRV_TO_PROCESS && currentIM && currentIM->DoReleaseInput) {
+            FCITX_KEY_TRACE_BEGIN(imSpan);
             retVal = currentIM->DoReleaseInput(currentIM->klass, sym, state);
+            FCITX_KEY_TRACE_END(instance, imSpan, FKTS_DO_INPUT, NULL,
+                                currentIM->uniqueName);
          }
 
         if (retVal == IRV_TO_PROCESS) {
@@ -883,7 +890,10 @@ INPUT_RETURN_VALUE FcitxInstanceProcessKey(
 
         if (retVal == IRV_TO_PROCESS) {
             if (!FcitxHotkeyIsHotKey(sym, state, imSWNextKey1[fc->iIMSwitchKey]) && currentIM) {
+                FCITX_KEY_TRACE_BEGIN(imSpan);
                 retVal = currentIM->DoInput(currentIM->klass, sym, state);
+                FCITX_KEY_TRACE_END(instance, imSpan, FKTS_DO_INPUT, NULL,
+                                    currentIM->uniqueName);
             }
         }
 
@@ -897,8 +907,10 @@ INPUT_RETURN_VALUE FcitxInstanceProcessKey(
         }
     }
 
-    return FcitxInstanceDoInputCallback(instance, retVal, event, timestamp,
-                                        sym, state);
+    retVal = FcitxInstanceDoInputCallback(instance, retVal, event, timestamp,
+                                          sym, state);
+    FCITX_KEY_TRACE_END(instance, keySpan, FKTS_PROCESS_KEY, NULL, NULL);
+    return retVal;
 }
 
 
@@ -915,9 +927,12 @@ void FcitxInstanceChooseCandidateByIndex(
     FcitxIM* currentIM = FcitxInstanceGetCurrentIM(instance);
     if (FcitxInstanceGetCurrentStatev2(instance) == IS_ACTIVE && currentIM && (retVal & IRV_FLAG_UPDATE_CANDIDATE_WORDS)) {
         if (currentIM->GetCandWords) {
+            FCITX_KEY_TRACE_BEGIN(candSpan);
             FcitxInstanceCleanInputWindow(instance);
             retVal = currentIM->GetCandWords(currentIM->klass);
             FcitxInstanceProcessUpdateCandidates(instance);
+            FCITX_KEY_TRACE_END(instance, candSpan, FKTS_GET_CAND_WORDS, NULL,
+                                currentIM->uniqueName);
         }
     }
     FcitxInstanceProcessInputReturnValue(instance, retVal);
@@ -943,9 +958,12 @@ INPUT_RETURN_VALUE FcitxInstanceDoInputCallback(
     if (FcitxInstanceGetCurrentStatev2(instance) == IS_ACTIVE && currentIM &&
         (retVal & IRV_FLAG_UPDATE_CANDIDATE_WORDS)) {
         if (currentIM->GetCandWords) {
+            FCITX_KEY_TRACE_BEGIN(candSpan);
             FcitxInstanceCleanInputWindow(instance);
             retVal = currentIM->GetCandWords(currentIM->klass);
             FcitxInstanceProcessUpdateCandidates(instance);
+            FCITX_KEY_TRACE_END(instance, candSpan, FKTS_GET_CAND_WORDS, NULL,
+                                currentIM->uniqueName);
         }
     }
 
@@ -1000,6 +1018,8 @@ void FcitxInstanceProcessInputReturnValue(
 
     if (retVal & IRV_FLAG_PENDING_COMMIT_STRING) {
         FcitxInstanceCommitString(instance, instance->CurrentIC, FcitxInputStateGetOutputString(input));
+        /* committed text should not wait for the next frame */
+        FcitxUIUpdateInputWindowImmediately(instance);
     }
 
     if (retVal & IRV_FLAG_DO_PHRASE_TIPS) {
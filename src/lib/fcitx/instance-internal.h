@@ -97,6 +97,11 @@ struct _FcitxInstance {
     sem_t startUpSem;
     sem_t notifySem;
     pthread_t pid;
+    pthread_t instanceThread;
+    FcitxCommandQueue* commandQueue;
+    /* other threads using commandQueue right now, it is freed after 0 */
+    int commandQueueUsers;
+    struct _FcitxKeyTrace* keyTrace;
     fd_set rfds, wfds, efds;
     int maxfd;
     char* uiname;
@@ -168,6 +173,14 @@ struct _FcitxInstance {
 
     FcitxInputContext* lastIC;
     char* delayedIM;
+
+    /* only valid during FcitxModuleLoad */
+    struct _FcitxModuleScheduler* moduleScheduler;
+
+    /* input window update scheduling, see FcitxUIScheduleInputWindowUpdate */
+    uint64_t uiLastUpdate;
+    uint64_t uiUpdateTimeout;
+    boolean uiUpdateUrgent;
 };
 
 void FcitxInstanceSetLastIC(FcitxInstance* instance, FcitxInputContext* ic);
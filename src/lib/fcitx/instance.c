@@ -31,6 +31,7 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <regex.h>
+#include <sched.h>
 
 #include "instance.h"
 #include "fcitx-utils/log.h"
@@ -46,6 +47,7 @@
 #include "instance-internal.h"
 #include "module-internal.h"
 #include "addon-internal.h"
+#include "keytrace-internal.h"
 #include "setjmp.h"
 
 #define CHECK_ENV(env, value, icase) (!getenv(env) \
@@ -93,6 +95,7 @@ static void FcitxInstanceInitBuiltContext(FcitxInstance* instance);
 static void FcitxInstanceShowRemindStatusChanged(void* arg, const void* value);
 static void FcitxInstanceRealEnd(FcitxInstance* instance);
 static void FcitxInstanceInitNoPreeditApps(FcitxInstance* instance);
+static void FcitxInstanceFreeCommandQueue(FcitxInstance* instance);
 
 /**
  * 显示命令行参数
@@ -222,6 +225,14 @@ jmp_buf FcitxRecover;
 void* RunInstance(void* arg)
 {
     FcitxInstance* instance = (FcitxInstance*) arg;
+    instance->instanceThread = pthread_self();
+    FcitxCommandQueue* commandQueue = fcitx_command_queue_new();
+    if (!commandQueue)
+        goto error_exit;
+    instance->commandQueue = commandQueue;
+#ifdef ENABLE_KEY_TRACE
+    instance->keyTrace = FcitxKeyTraceNew();
+#endif
     FcitxAddonsInit(&instance->addons);
     FcitxInstanceInitIM(instance);
     FcitxInstanceInitNoPreeditApps(instance);
@@ -274,8 +285,10 @@ void* RunInstance(void* arg)
     FcitxInstanceInitBuiltInHotkey(instance);
     FcitxInstanceInitBuiltContext(instance);
     FcitxModuleLoad(instance);
-    if (instance->loadingFatalError)
+    if (instance->loadingFatalError) {
+        FcitxInstanceFreeCommandQueue(instance);
         return NULL;
+    }
     if (!FcitxInstanceLoadAllIM(instance)) {
         goto error_exit;
     }
@@ -330,6 +343,7 @@ void* RunInstance(void* arg)
                 FcitxModule* module = (*pmodule)->module;
                 module->ProcessEvent((*pmodule)->addonInstance);
             }
+            fcitx_command_queue_dispatch(commandQueue);
             struct timeval current_time;
             gettimeofday(&current_time, NULL);
             curtime = (current_time.tv_sec * 1000LL) + (current_time.tv_usec / 1000LL);
@@ -359,7 +373,7 @@ void* RunInstance(void* arg)
                 FcitxUIMoveInputWindowReal(instance);
 
             if (instance->eventflag & FEF_UI_UPDATE)
-                FcitxUIUpdateInputWindowReal(instance);
+                FcitxUIScheduleInputWindowUpdate(instance);
         } while ((instance->eventflag & FEF_PROCESS_EVENT_MASK) != FEF_NONE);
 
         setjmp(FcitxRecover);
@@ -391,6 +405,10 @@ void* RunInstance(void* arg)
         }
         if (instance->maxfd == 0)
             break;
+        int queuefd = fcitx_command_queue_get_fd(commandQueue);
+        FD_SET(queuefd, &instance->rfds);
+        if (queuefd > instance->maxfd)
+            instance->maxfd = queuefd;
         struct timeval tval;
         struct timeval* ptval = NULL;
         if (utarray_len(&instance->timeout) != 0) {
@@ -409,6 +427,7 @@ void* RunInstance(void* arg)
         select(instance->maxfd + 1, &instance->rfds, &instance->wfds,
                &instance->efds, ptval);
     }
+    FcitxInstanceFreeCommandQueue(instance);
     if (instance->restart) {
         fcitx_utils_restart_in_place();
     }
@@ -420,6 +439,7 @@ error_exit:
         sem_post(&instance->startUpSem);
     }
     FcitxInstanceEnd(instance);
+    FcitxInstanceFreeCommandQueue(instance);
     return NULL;
 }
 
@@ -455,6 +475,15 @@ void FcitxInstanceEnd(FcitxInstance* instance)
 FCITX_EXPORT_API
 void FcitxInstanceRealEnd(FcitxInstance* instance) {
 
+    /* don't leave any sync caller waiting */
+    FcitxInstanceFreeCommandQueue(instance);
+
+    FcitxInstanceDumpKeyTrace(instance, NULL);
+#ifdef ENABLE_KEY_TRACE
+    FcitxKeyTraceFree(instance->keyTrace);
+    instance->keyTrace = NULL;
+#endif
+
     FcitxProfileSave(instance->profile);
     FcitxInstanceSaveAllIM(instance);
 
@@ -546,6 +575,87 @@ int FcitxInstanceUnlock(FcitxInstance* inst)
     return 0;
 }
 
+/*
+ * other threads hold a use count while they touch the queue, so that the
+ * instance thread can free it once it is closed and the count drops to 0.
+ */
+static FcitxCommandQueue*
+FcitxInstanceUseCommandQueue(FcitxInstance* instance)
+{
+    __sync_fetch_and_add(&instance->commandQueueUsers, 1);
+    FcitxCommandQueue* queue = __sync_fetch_and_add(&instance->commandQueue, 0);
+    if (!queue)
+        __sync_fetch_and_sub(&instance->commandQueueUsers, 1);
+    return queue;
+}
+
+static void
+FcitxInstanceReleaseCommandQueue(FcitxInstance* instance)
+{
+    __sync_fetch_and_sub(&instance->commandQueueUsers, 1);
+}
+
+void FcitxInstanceFreeCommandQueue(FcitxInstance* instance)
+{
+    FcitxCommandQueue* queue = __sync_lock_test_and_set(&instance->commandQueue,
+                                                        NULL);
+    if (!queue)
+        return;
+    /* later pushes fail, the ones already there are run now */
+    fcitx_command_queue_close(queue);
+    fcitx_command_queue_dispatch(queue);
+    while (__sync_fetch_and_add(&instance->commandQueueUsers, 0) != 0)
+        sched_yield();
+    fcitx_command_queue_free(queue);
+}
+
+FCITX_EXPORT_API
+boolean FcitxInstanceQueueCommand(FcitxInstance* instance,
+                                  FcitxCommandCallback callback, void* arg)
+{
+    boolean result = false;
+    FcitxCommandQueue* queue = FcitxInstanceUseCommandQueue(instance);
+    if (queue) {
+        result = fcitx_command_queue_push(queue, callback, arg);
+        FcitxInstanceReleaseCommandQueue(instance);
+    }
+    if (!result)
+        FcitxLog(ERROR, "Command queue is not available");
+    return result;
+}
+
+FCITX_EXPORT_API
+boolean FcitxInstanceRunCommandSync(FcitxInstance* instance,
+                                    FcitxCommandCallback callback, void* arg)
+{
+    boolean result = false;
+    if (pthread_equal(instance->instanceThread, pthread_self())) {
+        callback(arg);
+        return true;
+    }
+    FcitxCommandQueue* queue = FcitxInstanceUseCommandQueue(instance);
+    if (queue) {
+        result = fcitx_command_queue_push_sync(queue, callback, arg);
+        FcitxInstanceReleaseCommandQueue(instance);
+    }
+    if (!result)
+        FcitxLog(ERROR, "Command queue is not available");
+    return result;
+}
+
+FCITX_EXPORT_API
+void FcitxInstanceGetCommandQueueStats(FcitxInstance* instance,
+                                       FcitxCommandQueueStats* stats)
+{
+    FcitxCommandQueue* queue = FcitxInstanceUseCommandQueue(instance);
+    if (!queue) {
+        memset(stats, 0, sizeof(FcitxCommandQueueStats));
+        return;
+    }
+    fcitx_command_queue_get_stats(queue, stats);
+    FcitxInstanceReleaseCommandQueue(instance);
+}
+
 void ToggleRemindState(void* arg)
 {
     FcitxInstance* instance = (FcitxInstance*) arg;
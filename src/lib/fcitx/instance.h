@@ -31,6 +31,7 @@
 #include <sys/select.h>
 #include <fcitx/ui.h>
 #include <fcitx-utils/utarray.h>
+#include <fcitx-utils/commandqueue.h>
 #include <fcitx/configfile.h>
 #include <fcitx/profile.h>
 #include <fcitx/addon.h>
@@ -139,6 +140,53 @@ extern "C" {
      **/
     int FcitxInstanceUnlock(FcitxInstance* instance);
 
+    /**
+     * run callback on the instance thread during next main loop iteration,
+     * this is the preferred way to call into the instance from another
+     * thread, since the instance thread doesn't hold the instance lock while
+     * processing events.
+     *
+     * @param instance fcitx instance
+     * @param callback callback function
+     * @param arg argument
+     * @return false if the instance is not running, callback is not run
+     *
+     * @since 4.2.9.3
+     **/
+    boolean FcitxInstanceQueueCommand(FcitxInstance* instance,
+                                      FcitxCommandCallback callback,
+                                      void* arg);
+
+    /**
+     * same as FcitxInstanceQueueCommand, but wait until the callback is
+     * finished, run it directly if called from instance thread.
+     *
+     * Commands pushed before the instance ends are still run, later ones
+     * fail immediately instead of waiting.
+     *
+     * @param instance fcitx instance
+     * @param callback callback function
+     * @param arg argument
+     * @return false if the instance is not running, callback is not run
+     *
+     * @since 4.2.9.3
+     **/
+    boolean FcitxInstanceRunCommandSync(FcitxInstance* instance,
+                                        FcitxCommandCallback callback,
+                                        void* arg);
+
+    /**
+     * get statistics of the cross thread command queue
+     *
+     * @param instance fcitx instance
+     * @param stats return the statistics
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxInstanceGetCommandQueueStats(FcitxInstance* instance,
+                                           FcitxCommandQueueStats* stats);
+
     /**
      * notify the instance is end
      *
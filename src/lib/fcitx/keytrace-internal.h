@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @file keytrace-internal.h
+ * private header of key trace, the macros here compile to nothing unless
+ * ENABLE_KEY_TRACE is defined.
+ */
+
+#ifndef _FCITX_KEYTRACE_INTERNAL_H_
+#define _FCITX_KEYTRACE_INTERNAL_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "keytrace.h"
+
+typedef struct _FcitxKeyTrace FcitxKeyTrace;
+
+#ifdef ENABLE_KEY_TRACE
+
+FcitxKeyTrace* FcitxKeyTraceNew();
+void FcitxKeyTraceFree(FcitxKeyTrace* trace);
+uint64_t FcitxKeyTraceNow();
+void FcitxKeyTraceRecord(FcitxKeyTrace* trace, FcitxKeyTraceStage stage,
+                         const void* func, const char* name, uint64_t start);
+
+/* start timing a stage, declares a local variable */
+#define FCITX_KEY_TRACE_BEGIN(span) \
+    uint64_t span = FcitxKeyTraceNow()
+
+/* func or name identify the owner of the stage, either may be NULL */
+#define FCITX_KEY_TRACE_END(instance, span, stage, func, name) \
+    FcitxKeyTraceRecord((instance)->keyTrace, stage, \
+                        (const void*)(intptr_t)(func), name, span)
+
+#else
+
+#define FCITX_KEY_TRACE_BEGIN(span)
+#define FCITX_KEY_TRACE_END(instance, span, stage, func, name)
+
+#endif
+
+#endif
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,321 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "fcitx/fcitx.h"
+#include "fcitx-utils/utils.h"
+#include "fcitx-utils/uthash.h"
+#include "fcitx-config/xdg.h"
+#include "instance.h"
+#include "instance-internal.h"
+#include "keytrace-internal.h"
+
+#ifdef ENABLE_KEY_TRACE
+
+/* must be power of 2 */
+#define KEY_TRACE_RING_SIZE 1024
+#define KEY_TRACE_NAME_LENGTH 24
+/* every power of 2 is split into 8 buckets, up to 2^40 ns */
+#define KEY_TRACE_SUB_BUCKET_BITS 3
+#define KEY_TRACE_BUCKET_COUNT (40 << KEY_TRACE_SUB_BUCKET_BITS)
+
+typedef struct _FcitxKeyTraceSample {
+    uint64_t start;
+    uint32_t duration;
+    int stage;
+    const void* func;
+    char name[KEY_TRACE_NAME_LENGTH];
+} FcitxKeyTraceSample;
+
+typedef struct _FcitxKeyTraceKey {
+    int stage;
+    const void* func;
+    char name[KEY_TRACE_NAME_LENGTH];
+} FcitxKeyTraceKey;
+
+typedef struct _FcitxKeyTraceHistogram {
+    FcitxKeyTraceKey key;
+    uint64_t count;
+    uint64_t total;
+    uint32_t max;
+    uint32_t buckets[KEY_TRACE_BUCKET_COUNT];
+    UT_hash_handle hh;
+} FcitxKeyTraceHistogram;
+
+/**
+ * ring is single producer (the instance thread), the consumer side is
+ * serialized by lock, so recording a sample never waits for anyone.
+ */
+struct _FcitxKeyTrace {
+    FcitxKeyTraceSample ring[KEY_TRACE_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint64_t dropped;
+    pthread_mutex_t lock;
+    FcitxKeyTraceHistogram* histograms;
+};
+
+static const char* stageNames[FKTS_LAST] = {
+    "ProcessKey",
+    "Hotkey",
+    "PreInputFilter",
+    "DoInput",
+    "GetCandWords",
+    "PostInputFilter",
+    "UIUpdate",
+    "Frontend"
+};
+
+FcitxKeyTrace* FcitxKeyTraceNew()
+{
+    FcitxKeyTrace* trace = fcitx_utils_new(FcitxKeyTrace);
+    pthread_mutex_init(&trace->lock, NULL);
+    return trace;
+}
+
+void FcitxKeyTraceFree(FcitxKeyTrace* trace)
+{
+    if (!trace)
+        return;
+    while (trace->histograms) {
+        FcitxKeyTraceHistogram* histogram = trace->histograms;
+        HASH_DEL(trace->histograms, histogram);
+        free(histogram);
+    }
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+}
+
+uint64_t FcitxKeyTraceNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+FcitxKeyTraceBucket(uint32_t ns)
+{
+    if (ns < (1 << KEY_TRACE_SUB_BUCKET_BITS))
+        return ns;
+    int msb = 31 - __builtin_clz(ns);
+    int sub = (ns >> (msb - KEY_TRACE_SUB_BUCKET_BITS)) &
+              ((1 << KEY_TRACE_SUB_BUCKET_BITS) - 1);
+    int bucket = ((msb - KEY_TRACE_SUB_BUCKET_BITS + 1) << KEY_TRACE_SUB_BUCKET_BITS) + sub;
+    return bucket < KEY_TRACE_BUCKET_COUNT ? bucket : KEY_TRACE_BUCKET_COUNT - 1;
+}
+
+/* upper bound of a bucket in ns */
+static uint64_t
+FcitxKeyTraceBucketLimit(int bucket)
+{
+    if (bucket < (1 << KEY_TRACE_SUB_BUCKET_BITS))
+        return bucket + 1;
+    int msb = (bucket >> KEY_TRACE_SUB_BUCKET_BITS) + KEY_TRACE_SUB_BUCKET_BITS - 1;
+    int sub = bucket & ((1 << KEY_TRACE_SUB_BUCKET_BITS) - 1);
+    return (1ULL << msb) + ((uint64_t)(sub + 1) << (msb - KEY_TRACE_SUB_BUCKET_BITS));
+}
+
+/* lock must be held */
+static void
+FcitxKeyTraceDrain(FcitxKeyTrace* trace)
+{
+    uint32_t tail = trace->tail;
+    uint32_t head = __sync_fetch_and_add(&trace->head, 0);
+    for (; tail != head; tail++) {
+        FcitxKeyTraceSample* sample = &trace->ring[tail & (KEY_TRACE_RING_SIZE - 1)];
+        FcitxKeyTraceKey key;
+        FcitxKeyTraceHistogram* histogram = NULL;
+        memset(&key, 0, sizeof(key));
+        key.stage = sample->stage;
+        key.func = sample->func;
+        memcpy(key.name, sample->name, KEY_TRACE_NAME_LENGTH);
+        HASH_FIND(hh, trace->histograms, &key, sizeof(key), histogram);
+        if (!histogram) {
+            histogram = fcitx_utils_new(FcitxKeyTraceHistogram);
+            histogram->key = key;
+            HASH_ADD(hh, trace->histograms, key, sizeof(key), histogram);
+        }
+        histogram->count++;
+        histogram->total += sample->duration;
+        if (sample->duration > histogram->max)
+            histogram->max = sample->duration;
+        histogram->buckets[FcitxKeyTraceBucket(sample->duration)]++;
+    }
+    __sync_synchronize();
+    trace->tail = tail;
+}
+
+void FcitxKeyTraceRecord(FcitxKeyTrace* trace, FcitxKeyTraceStage stage,
+                         const void* func, const char* name, uint64_t start)
+{
+    if (!trace)
+        return;
+    uint64_t now = FcitxKeyTraceNow();
+    uint32_t head = trace->head;
+    uint32_t tail = __sync_fetch_and_add(&trace->tail, 0);
+    if (head - tail >= KEY_TRACE_RING_SIZE) {
+        trace->dropped++;
+        return;
+    }
+
+    FcitxKeyTraceSample* sample = &trace->ring[head & (KEY_TRACE_RING_SIZE - 1)];
+    uint64_t duration = now - start;
+    sample->start = start;
+    sample->duration = duration > UINT32_MAX ? UINT32_MAX : duration;
+    sample->stage = stage;
+    sample->func = func;
+    memset(sample->name, 0, KEY_TRACE_NAME_LENGTH);
+    if (name)
+        strncpy(sample->name, name, KEY_TRACE_NAME_LENGTH - 1);
+    __sync_synchronize();
+    trace->head = head + 1;
+
+    /* fold samples into histograms before ring is full, but never wait */
+    if (head + 1 - tail >= KEY_TRACE_RING_SIZE / 2 &&
+        pthread_mutex_trylock(&trace->lock) == 0) {
+        FcitxKeyTraceDrain(trace);
+        pthread_mutex_unlock(&trace->lock);
+    }
+}
+
+static uint64_t
+FcitxKeyTracePercentile(FcitxKeyTraceHistogram* histogram, int percent)
+{
+    uint64_t target = (histogram->count * percent + 99) / 100;
+    uint64_t sum = 0;
+    int i;
+    for (i = 0; i < KEY_TRACE_BUCKET_COUNT; i++) {
+        sum += histogram->buckets[i];
+        if (sum >= target && sum) {
+            uint64_t limit = FcitxKeyTraceBucketLimit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static int
+FcitxKeyTraceHistogramCmp(FcitxKeyTraceHistogram* a, FcitxKeyTraceHistogram* b)
+{
+    if (a->key.stage != b->key.stage)
+        return a->key.stage - b->key.stage;
+    return b->total > a->total ? 1 : (b->total < a->total ? -1 : 0);
+}
+
+static void
+FcitxKeyTraceWriteReport(FcitxKeyTrace* trace, FILE* fp)
+{
+    pthread_mutex_lock(&trace->lock);
+    FcitxKeyTraceDrain(trace);
+    HASH_SORT(trace->histograms, FcitxKeyTraceHistogramCmp);
+
+    fprintf(fp, "%-16s %-32s %10s %10s %10s %10s %10s\n", "stage", "owner",
+            "count", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    FcitxKeyTraceHistogram* histogram;
+    for (histogram = trace->histograms; histogram;
+         histogram = histogram->hh.next) {
+        const char* owner = histogram->key.name;
+        char buf[32];
+        if (!owner[0] && histogram->key.func) {
+            Dl_info info;
+            if (dladdr(histogram->key.func, &info) && info.dli_sname) {
+                owner = info.dli_sname;
+            } else {
+                snprintf(buf, sizeof(buf), "%p", histogram->key.func);
+                owner = buf;
+            }
+        }
+        if (!owner[0])
+            owner = "-";
+        fprintf(fp, "%-16s %-32s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+                stageNames[histogram->key.stage], owner,
+                (unsigned long long) histogram->count,
+                FcitxKeyTracePercentile(histogram, 50) / 1000.0,
+                FcitxKeyTracePercentile(histogram, 90) / 1000.0,
+                FcitxKeyTracePercentile(histogram, 99) / 1000.0,
+                histogram->max / 1000.0);
+    }
+    fprintf(fp, "dropped: %llu\n",
+            (unsigned long long) __sync_fetch_and_add(&trace->dropped, 0));
+    pthread_mutex_unlock(&trace->lock);
+}
+
+FCITX_EXPORT_API
+char* FcitxInstanceGetKeyTraceReport(FcitxInstance* instance)
+{
+    char* result = NULL;
+    size_t size = 0;
+    if (!instance->keyTrace)
+        return NULL;
+    FILE* fp = open_memstream(&result, &size);
+    if (!fp)
+        return NULL;
+    FcitxKeyTraceWriteReport(instance->keyTrace, fp);
+    fclose(fp);
+    return result;
+}
+
+FCITX_EXPORT_API
+boolean FcitxInstanceDumpKeyTrace(FcitxInstance* instance, const char* path)
+{
+    FILE* fp;
+    if (!instance->keyTrace)
+        return false;
+    if (path)
+        fp = fopen(path, "w");
+    else
+        fp = FcitxXDGGetFileUserWithPrefix("log", "keytrace.log", "w", NULL);
+    if (!fp)
+        return false;
+    FcitxKeyTraceWriteReport(instance->keyTrace, fp);
+    fclose(fp);
+    return true;
+}
+
+#else
+
+FCITX_EXPORT_API
+char* FcitxInstanceGetKeyTraceReport(FcitxInstance* instance)
+{
+    FCITX_UNUSED(instance);
+    return NULL;
+}
+
+FCITX_EXPORT_API
+boolean FcitxInstanceDumpKeyTrace(FcitxInstance* instance, const char* path)
+{
+    FCITX_UNUSED(instance);
+    FCITX_UNUSED(path);
+    return false;
+}
+
+#endif
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,98 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @addtogroup Fcitx
+ * @{
+ */
+
+/**
+ * @file keytrace.h
+ *
+ * latency statistics of key processing.
+ *
+ * When fcitx is built with ENABLE_KEY_TRACE, every stage of key handling,
+ * from FcitxInstanceProcessKey to the update of the input window and the
+ * frontend, is timed and collected into histograms per input method and
+ * per hook. Without it the functions here return nothing.
+ */
+
+#ifndef _FCITX_KEYTRACE_H_
+#define _FCITX_KEYTRACE_H_
+
+#include <fcitx-utils/utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    struct _FcitxInstance;
+
+    /**
+     * stages of key processing
+     *
+     * @since 4.2.9.3
+     **/
+    typedef enum _FcitxKeyTraceStage {
+        FKTS_PROCESS_KEY, /**< whole FcitxInstanceProcessKey */
+        FKTS_HOTKEY, /**< built-in and module hotkeys */
+        FKTS_PRE_INPUT_FILTER, /**< one pre input filter hook */
+        FKTS_DO_INPUT, /**< DoInput or DoReleaseInput of input method */
+        FKTS_GET_CAND_WORDS, /**< GetCandWords of input method */
+        FKTS_POST_INPUT_FILTER, /**< one post input filter hook */
+        FKTS_UI_UPDATE, /**< update of input window */
+        FKTS_FRONTEND, /**< commit or preedit sent by frontend */
+        FKTS_LAST
+    } FcitxKeyTraceStage;
+
+    /**
+     * get a text report with percentiles of every stage, one line per
+     * stage and owner (input method or hook function)
+     *
+     * @param instance fcitx instance
+     * @return malloced report, NULL if key trace is not compiled in
+     *
+     * @since 4.2.9.3
+     **/
+    char* FcitxInstanceGetKeyTraceReport(struct _FcitxInstance* instance);
+
+    /**
+     * write the report of FcitxInstanceGetKeyTraceReport to a file
+     *
+     * @param instance fcitx instance
+     * @param path file path, NULL for the default log/keytrace.log
+     * @return false if key trace is not compiled in or file can't be written
+     *
+     * @since 4.2.9.3
+     **/
+    boolean FcitxInstanceDumpKeyTrace(struct _FcitxInstance* instance,
+                                      const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**
+ * @}
+ */
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -22,6 +22,8 @@
 #define _FCITX_MODULE_INTERNAL_H_
 #include "fcitx-utils/utarray.h"
 
+typedef struct _FcitxModuleScheduler FcitxModuleScheduler;
+
 void InitFcitxModules(UT_array* modules);
 
 #endif
@@ -21,6 +21,7 @@
 #include <dlfcn.h>
 #include <libintl.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "fcitx/fcitx.h"
 #include "module.h"
@@ -31,68 +32,307 @@
 #include "instance-internal.h"
 #include "addon-internal.h"
 #include "ime-internal.h"
+#include "module-internal.h"
 
 void InitFcitxModules(UT_array* modules)
 {
     utarray_init(modules, fcitx_ptr_icd);
 }
 
+/* upper bound of worker threads used for module preparation */
+#define FCITX_MODULE_PREPARE_MAX_THREAD 4
+
+typedef struct _FcitxModuleTask {
+    FcitxAddon* addon;
+    void* handle;
+    FcitxModule* module;
+    FcitxModulePrepare* prepare;
+    void* data;
+    int* depends;
+    int dependCount;
+    boolean started;
+    boolean done;
+} FcitxModuleTask;
+
+struct _FcitxModuleScheduler {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    FcitxModuleTask* tasks;
+    int taskCount;
+    pthread_t threads[FCITX_MODULE_PREPARE_MAX_THREAD];
+    int threadCount;
+};
+
+static boolean
+FcitxModuleOpen(FcitxAddon* addon, FcitxModuleTask* task)
+{
+    char *modulePath = NULL;
+    FILE *fp = FcitxXDGGetLibFile(addon->library, "r", &modulePath);
+    void *handle;
+    FcitxModule* module;
+    if (!fp) {
+        free(modulePath);
+        return false;
+    }
+    fclose(fp);
+    handle = dlopen(modulePath, RTLD_NOW | RTLD_NODELETE | (addon->loadLocal ? RTLD_LOCAL : RTLD_GLOBAL));
+    if (!handle) {
+        FcitxLog(ERROR, _("Module: open %s fail %s") , modulePath , dlerror());
+        free(modulePath);
+        return false;
+    }
+    free(modulePath);
+
+    if (!FcitxCheckABIVersion(handle, addon->name)) {
+        FcitxLog(ERROR, "%s ABI Version Error", addon->name);
+        dlclose(handle);
+        return false;
+    }
+
+    module = FcitxGetSymbol(handle, addon->name, "module");
+    if (!module || !module->Create) {
+        FcitxLog(ERROR, _("Module: bad module"));
+        dlclose(handle);
+        return false;
+    }
+
+    task->addon = addon;
+    task->handle = handle;
+    task->module = module;
+    task->prepare = FcitxGetSymbol(handle, addon->name, "module_prepare");
+    if (task->prepare && !task->prepare->Prepare)
+        task->prepare = NULL;
+    return true;
+}
+
+/**
+ * Only dependencies with higher priority (a lower index) are taken into
+ * account, since Create is called in that order as well; this also keeps
+ * the graph acyclic.
+ */
+static void
+FcitxModuleTaskResolveDepends(FcitxModuleTask* tasks, int idx)
+{
+    FcitxModuleTask* task = &tasks[idx];
+    UT_array* dependlist = fcitx_utils_split_string(task->addon->depend, ',');
+    task->depends = fcitx_utils_malloc0(sizeof(int) * (utarray_len(dependlist) + 1));
+    utarray_foreach(depend, dependlist, char*) {
+        int i;
+        for (i = 0; i < idx; i++) {
+            if (strcmp(tasks[i].addon->name, *depend) == 0) {
+                task->depends[task->dependCount++] = i;
+                break;
+            }
+        }
+    }
+    fcitx_utils_free_string_list(dependlist);
+}
+
+static boolean
+FcitxModuleTaskIsReady(FcitxModuleScheduler* sched, FcitxModuleTask* task)
+{
+    int i;
+    for (i = 0; i < task->dependCount; i++) {
+        if (!sched->tasks[task->depends[i]].done)
+            return false;
+    }
+    return true;
+}
+
+/* call with lock held, return with lock held */
+static void
+FcitxModuleTaskRun(FcitxModuleScheduler* sched, FcitxModuleTask* task)
+{
+    task->started = true;
+    if (task->prepare) {
+        pthread_mutex_unlock(&sched->lock);
+        void* data = task->prepare->Prepare(task->addon);
+        pthread_mutex_lock(&sched->lock);
+        task->data = data;
+    }
+    task->done = true;
+    pthread_cond_broadcast(&sched->cond);
+}
+
+static void*
+FcitxModulePrepareWorker(void* arg)
+{
+    FcitxModuleScheduler* sched = arg;
+    pthread_mutex_lock(&sched->lock);
+    while (true) {
+        FcitxModuleTask* next = NULL;
+        boolean pending = false;
+        int i;
+        for (i = 0; i < sched->taskCount; i++) {
+            FcitxModuleTask* task = &sched->tasks[i];
+            if (task->started)
+                continue;
+            pending = true;
+            if (FcitxModuleTaskIsReady(sched, task)) {
+                next = task;
+                break;
+            }
+        }
+        if (next)
+            FcitxModuleTaskRun(sched, next);
+        else if (pending)
+            pthread_cond_wait(&sched->cond, &sched->lock);
+        else
+            break;
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return NULL;
+}
+
+/**
+ * Wait for the preparation of task idx, run it on the calling thread
+ * if no worker has picked it up yet.
+ */
+static void
+FcitxModuleSchedulerWait(FcitxModuleScheduler* sched, int idx)
+{
+    FcitxModuleTask* task = &sched->tasks[idx];
+    pthread_mutex_lock(&sched->lock);
+    while (!task->done) {
+        if (!task->started && FcitxModuleTaskIsReady(sched, task))
+            FcitxModuleTaskRun(sched, task);
+        else
+            pthread_cond_wait(&sched->cond, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static void
+FcitxModuleSchedulerStart(FcitxModuleScheduler* sched)
+{
+    int i;
+    int prepareCount = 0;
+    for (i = 0; i < sched->taskCount; i++) {
+        if (sched->tasks[i].prepare)
+            prepareCount++;
+    }
+    if (prepareCount == 0)
+        return;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthread = ncpu > 1 ? ncpu - 1 : 1;
+    if (nthread > FCITX_MODULE_PREPARE_MAX_THREAD)
+        nthread = FCITX_MODULE_PREPARE_MAX_THREAD;
+    if (nthread > prepareCount)
+        nthread = prepareCount;
+
+    for (i = 0; i < nthread; i++) {
+        /* the instance thread still runs any task it waits for */
+        if (pthread_create(&sched->threads[sched->threadCount], NULL,
+                           FcitxModulePrepareWorker, sched) != 0)
+            break;
+        sched->threadCount++;
+    }
+}
+
+static void
+FcitxModuleSchedulerFinish(FcitxModuleScheduler* sched)
+{
+    int i;
+    pthread_mutex_lock(&sched->lock);
+    for (i = 0; i < sched->taskCount; i++) {
+        /* mark the rest as started, so workers can quit */
+        sched->tasks[i].started = true;
+    }
+    pthread_cond_broadcast(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+
+    for (i = 0; i < sched->threadCount; i++)
+        pthread_join(sched->threads[i], NULL);
+
+    for (i = 0; i < sched->taskCount; i++) {
+        FcitxModuleTask* task = &sched->tasks[i];
+        if (task->data && task->prepare->Free)
+            task->prepare->Free(task->data);
+        free(task->depends);
+    }
+    free(sched->tasks);
+    pthread_cond_destroy(&sched->cond);
+    pthread_mutex_destroy(&sched->lock);
+}
+
 FCITX_EXPORT_API
 void FcitxModuleLoad(FcitxInstance* instance)
 {
     UT_array* addons = &instance->addons;
     FcitxAddon *addon;
+    FcitxModuleScheduler sched;
+    int i;
+
+    memset(&sched, 0, sizeof(FcitxModuleScheduler));
+    pthread_mutex_init(&sched.lock, NULL);
+    pthread_cond_init(&sched.cond, NULL);
+    sched.tasks = fcitx_utils_malloc0(sizeof(FcitxModuleTask) * utarray_len(addons));
+
+    /* dlopen is cheap, do it on instance thread */
     for (addon = (FcitxAddon *) utarray_front(addons);
             addon != NULL;
             addon = (FcitxAddon *) utarray_next(addons, addon)) {
         if (addon->bEnabled && addon->category == AC_MODULE) {
-            char *modulePath;
             switch (addon->type) {
-            case AT_SHAREDLIBRARY: {
-                FILE *fp = FcitxXDGGetLibFile(addon->library, "r", &modulePath);
-                void *handle;
-                FcitxModule* module;
-                void* moduleinstance = NULL;
-                if (!fp)
-                    break;
-                fclose(fp);
-                handle = dlopen(modulePath, RTLD_NOW | RTLD_NODELETE | (addon->loadLocal ? RTLD_LOCAL : RTLD_GLOBAL));
-                if (!handle) {
-                    FcitxLog(ERROR, _("Module: open %s fail %s") , modulePath , dlerror());
-                    break;
+            case AT_SHAREDLIBRARY:
+                if (FcitxModuleOpen(addon, &sched.tasks[sched.taskCount])) {
+                    FcitxModuleTaskResolveDepends(sched.tasks, sched.taskCount);
+                    sched.taskCount++;
                 }
-
-                if (!FcitxCheckABIVersion(handle, addon->name)) {
-                    FcitxLog(ERROR, "%s ABI Version Error", addon->name);
-                    dlclose(handle);
-                    break;
-                }
-
-                module = FcitxGetSymbol(handle, addon->name, "module");
-                if (!module || !module->Create) {
-                    FcitxLog(ERROR, _("Module: bad module"));
-                    dlclose(handle);
-                    break;
-                }
-                if ((moduleinstance = module->Create(instance)) == NULL) {
-                    dlclose(handle);
-                    break;
-                }
-                if (instance->loadingFatalError)
-                    return;
-                addon->module = module;
-                addon->addonInstance = moduleinstance;
-                if (module->ProcessEvent && module->SetFD)
-                    utarray_push_back(&instance->eventmodules, &addon);
-                utarray_push_back(&instance->modules, &addon);
-            }
-            break;
+                break;
             default:
                 break;
             }
-            free(modulePath);
         }
     }
+
+    FcitxModuleSchedulerStart(&sched);
+    instance->moduleScheduler = &sched;
+
+    /* Create may register hooks and other state, keep it serial and in priority order */
+    for (i = 0; i < sched.taskCount; i++) {
+        FcitxModuleTask* task = &sched.tasks[i];
+        void* moduleinstance = NULL;
+        FcitxModuleSchedulerWait(&sched, i);
+        addon = task->addon;
+        if ((moduleinstance = task->module->Create(instance)) == NULL) {
+            dlclose(task->handle);
+            continue;
+        }
+        if (instance->loadingFatalError)
+            break;
+        addon->module = task->module;
+        addon->addonInstance = moduleinstance;
+        if (task->module->ProcessEvent && task->module->SetFD)
+            utarray_push_back(&instance->eventmodules, &addon);
+        utarray_push_back(&instance->modules, &addon);
+    }
+
+    instance->moduleScheduler = NULL;
+    FcitxModuleSchedulerFinish(&sched);
+}
+
+FCITX_EXPORT_API
+void* FcitxModuleTakePrepareData(FcitxInstance* instance, const char* name)
+{
+    FcitxModuleScheduler* sched = instance->moduleScheduler;
+    void* data = NULL;
+    int i;
+    if (!sched || !name)
+        return NULL;
+
+    pthread_mutex_lock(&sched->lock);
+    for (i = 0; i < sched->taskCount; i++) {
+        FcitxModuleTask* task = &sched->tasks[i];
+        if (task->done && strcmp(task->addon->name, name) == 0) {
+            data = task->data;
+            task->data = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return data;
 }
 
 FCITX_EXPORT_API
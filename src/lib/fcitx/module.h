@@ -66,6 +66,29 @@ extern "C" {
         void (*ReloadConfig)(void*);
     } FcitxModule;
 
+    /**
+     * Optional preparation phase of a module, export it with
+     * FCITX_DEFINE_MODULE_PREPARE.
+     *
+     * Prepare is called on a worker thread before Create, after the
+     * preparation of the modules it depends on. It should only do file
+     * I/O and parsing, and must not touch the instance. The result can be
+     * retrieved in Create with FcitxModuleTakePrepareData.
+     **/
+    typedef struct _FcitxModulePrepare {
+        /**
+         * load data, addon should be treated as read only
+         */
+        void* (*Prepare)(FcitxAddon* addon);
+        /**
+         * free the data if it is never taken, no need to implement
+         */
+        void (*Free)(void* data);
+    } FcitxModulePrepare;
+
+#define FCITX_DEFINE_MODULE_PREPARE(name) \
+FCITX_EXPORT_API FcitxModulePrepare name##_module_prepare
+
     /**
      * the argument to invoke module function
      **/
@@ -85,6 +108,17 @@ extern "C" {
      **/
     void FcitxModuleLoad(struct _FcitxInstance* instance);
 
+    /**
+     * take the data returned by the Prepare of a module, only valid inside
+     * the Create function of that module.
+     *
+     * @param instance fcitx instance
+     * @param name addon name
+     * @return void* prepared data, NULL if there is none
+     **/
+    void* FcitxModuleTakePrepareData(struct _FcitxInstance* instance,
+                                     const char* name);
+
     /**
      * Find a exported function of a addon.
      *
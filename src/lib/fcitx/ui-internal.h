@@ -37,6 +37,15 @@
  * @return void
  **/
 void FcitxUIUpdateInputWindowReal(FcitxInstance *instance);
+/**
+ * called by main loop once per iteration when input window needs update,
+ * updates at most once per UIUpdateInterval unless the update is urgent,
+ * otherwise a timeout is added to update it later
+ *
+ * @param instance fcitx instance
+ * @return void
+ **/
+void FcitxUIScheduleInputWindowUpdate(FcitxInstance *instance);
 /**
  * real move input window, will trigger user interface module to move
  *
@@ -22,6 +22,7 @@
 #include <libintl.h>
 #include <stdarg.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "ui.h"
 #include "addon.h"
@@ -29,7 +30,9 @@
 #include "fcitx-config/xdg.h"
 #include "fcitx-utils/log.h"
 #include "fcitx-utils/utils.h"
+#include "fcitx-utils/memory.h"
 #include "instance.h"
+#include "hook.h"
 #include "hook-internal.h"
 #include "ime-internal.h"
 #include "candidate.h"
@@ -38,6 +41,7 @@
 #include "addon-internal.h"
 #include "ui-internal.h"
 #include "candidate-internal.h"
+#include "keytrace-internal.h"
 
 /**
  * @file ui.c
@@ -83,6 +87,7 @@ struct _FcitxMessages {
 #define UI_FUNC_IS_VALID_FALLBACK(funcname) (!(FcitxInstanceGetCurrentCapacity(instance) & CAPACITY_CLIENT_SIDE_UI) && instance->uifallback && instance->uifallback->ui->funcname)
 
 static void FcitxUIShowInputWindow(FcitxInstance* instance);
+static void FcitxUIUpdateInputWindowTimeout(void* arg);
 static boolean FcitxUILoadInternal(FcitxInstance* instance, FcitxAddon* addon);
 static void FcitxMenuItemFree(void* arg);
 
@@ -351,7 +356,8 @@ FCITX_EXPORT_API
 void FcitxUICloseInputWindow(FcitxInstance* instance)
 {
     FcitxInstanceCleanInputWindow(instance);
-    instance->eventflag |= FEF_UI_UPDATE;
+    /* window left open after commit or reset looks like a lag */
+    FcitxUIUpdateInputWindowImmediately(instance);
 }
 
 FCITX_EXPORT_API
@@ -360,6 +366,47 @@ void FcitxUIUpdateInputWindow(FcitxInstance *instance)
     instance->eventflag |= FEF_UI_UPDATE;
 }
 
+FCITX_EXPORT_API
+void FcitxUIUpdateInputWindowImmediately(FcitxInstance *instance)
+{
+    instance->eventflag |= FEF_UI_UPDATE;
+    instance->uiUpdateUrgent = true;
+}
+
+void FcitxUIUpdateInputWindowTimeout(void* arg)
+{
+    FcitxInstance* instance = arg;
+    instance->uiUpdateTimeout = 0;
+    instance->eventflag |= FEF_UI_UPDATE;
+}
+
+void FcitxUIScheduleInputWindowUpdate(FcitxInstance *instance)
+{
+    struct timeval current_time;
+    gettimeofday(&current_time, NULL);
+    uint64_t curtime = (current_time.tv_sec * 1000LL) + (current_time.tv_usec / 1000LL);
+    uint64_t interval = instance->config->iUIUpdateInterval > 0 ? instance->config->iUIUpdateInterval : 0;
+
+    /* clock may go backward, don't wait forever in that case */
+    if (!instance->uiUpdateUrgent && curtime >= instance->uiLastUpdate
+        && curtime - instance->uiLastUpdate < interval) {
+        if (!instance->uiUpdateTimeout)
+            instance->uiUpdateTimeout = FcitxInstanceAddTimeout(instance,
+                                                                interval - (curtime - instance->uiLastUpdate),
+                                                                FcitxUIUpdateInputWindowTimeout,
+                                                                instance);
+        return;
+    }
+
+    if (instance->uiUpdateTimeout) {
+        FcitxInstanceRemoveTimeoutById(instance, instance->uiUpdateTimeout);
+        instance->uiUpdateTimeout = 0;
+    }
+    instance->uiUpdateUrgent = false;
+    instance->uiLastUpdate = curtime;
+    FcitxUIUpdateInputWindowReal(instance);
+}
+
 void FcitxUIShowInputWindow(FcitxInstance* instance)
 {
     if (UI_FUNC_IS_VALID(ShowInputWindow))
@@ -879,6 +926,234 @@ int FcitxUINewMessageToOldStyleMessage(FcitxInstance* instance, FcitxMessages* m
     return extraLength;
 }
 
+struct _FcitxUIRenderModel {
+    /* messages shown by ui, index 0 is up and 1 is down */
+    FcitxMessages* msg[2];
+    /* messages just converted, swapped with msg if different */
+    FcitxMessages* scratch[2];
+    char* filtered[2][MAX_MESSAGE_COUNT];
+    /* strings derived from msg, reset when msg is changed */
+    FcitxMemoryPool* pool[2];
+    int cursorPos;
+    uint32_t filterState;
+    boolean valid;
+
+    char* upString;
+
+    boolean tableValid;
+    int candidateCount;
+    int highlight;
+    const char* labels[MAX_MESSAGE_COUNT];
+    const char* texts[MAX_MESSAGE_COUNT];
+};
+
+FCITX_EXPORT_API
+FcitxUIRenderModel* FcitxUIRenderModelNew()
+{
+    FcitxUIRenderModel* model = fcitx_utils_new(FcitxUIRenderModel);
+    int i;
+    for (i = 0; i < 2; i++) {
+        model->msg[i] = FcitxMessagesNew();
+        model->scratch[i] = FcitxMessagesNew();
+        model->pool[i] = fcitx_memory_pool_create();
+    }
+    return model;
+}
+
+FCITX_EXPORT_API
+void FcitxUIRenderModelFree(FcitxUIRenderModel* model)
+{
+    int i;
+    for (i = 0; i < 2; i++) {
+        free(model->msg[i]);
+        free(model->scratch[i]);
+        fcitx_memory_pool_destroy(model->pool[i]);
+    }
+    free(model);
+}
+
+static boolean
+FcitxMessagesEqual(FcitxMessages* m1, FcitxMessages* m2)
+{
+    uint i;
+    if (m1->msgCount != m2->msgCount)
+        return false;
+    for (i = 0; i < m1->msgCount; i++) {
+        if (m1->msg[i].type != m2->msg[i].type ||
+            strcmp(m1->msg[i].strMsg, m2->msg[i].strMsg) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void
+FcitxUIRenderModelFilter(FcitxInstance* instance, FcitxUIRenderModel* model,
+                         int side)
+{
+    FcitxMessages* msg = model->msg[side];
+    char** strs = model->filtered[side];
+    uint i;
+
+    fcitx_memory_pool_reset(model->pool[side]);
+    for (i = 0; i < msg->msgCount; i++)
+        strs[i] = msg->msg[i].strMsg;
+    if (FcitxInstanceProcessOutputFilterArray(instance, strs,
+                                              msg->msgCount) == 0)
+        return;
+
+    /* keep filtered strings in the pool, so they go away with it */
+    for (i = 0; i < msg->msgCount; i++) {
+        if (strs[i] == msg->msg[i].strMsg)
+            continue;
+        size_t len = strlen(strs[i]) + 1;
+        char* str = fcitx_memory_pool_alloc(model->pool[side], len);
+        memcpy(str, strs[i], len);
+        free(strs[i]);
+        strs[i] = str;
+    }
+}
+
+FCITX_EXPORT_API
+unsigned int FcitxUIRenderModelUpdate(FcitxInstance* instance,
+                                      FcitxUIRenderModel* model)
+{
+    unsigned int changed = 0;
+    int i;
+    int cursorPos = FcitxUINewMessageToOldStyleMessage(instance,
+                                                       model->scratch[0],
+                                                       model->scratch[1]);
+    uint32_t filterState = FcitxInstanceGetOutputFilterState(instance);
+    /* a toggled filter changes the output of the same messages */
+    boolean refilter = !model->valid || filterState != model->filterState;
+
+    model->valid = true;
+    model->filterState = filterState;
+    for (i = 0; i < 2; i++) {
+        if (!refilter && FcitxMessagesEqual(model->msg[i], model->scratch[i]))
+            continue;
+        FcitxMessages* temp = model->msg[i];
+        model->msg[i] = model->scratch[i];
+        model->scratch[i] = temp;
+        FcitxUIRenderModelFilter(instance, model, i);
+        changed |= (i == 0) ? RENDER_MODEL_UP : RENDER_MODEL_DOWN;
+    }
+
+    if (changed & RENDER_MODEL_UP)
+        model->upString = NULL;
+    if (changed & RENDER_MODEL_DOWN)
+        model->tableValid = false;
+    if (refilter || cursorPos != model->cursorPos) {
+        model->cursorPos = cursorPos;
+        changed |= RENDER_MODEL_CURSOR;
+    }
+    return changed;
+}
+
+FCITX_EXPORT_API
+void FcitxUIRenderModelInvalidate(FcitxUIRenderModel* model)
+{
+    model->valid = false;
+}
+
+FCITX_EXPORT_API
+FcitxMessages* FcitxUIRenderModelGetMessages(FcitxUIRenderModel* model,
+                                             boolean up)
+{
+    return model->msg[up ? 0 : 1];
+}
+
+FCITX_EXPORT_API
+char** FcitxUIRenderModelGetFilteredStrings(FcitxUIRenderModel* model,
+                                            boolean up)
+{
+    return model->filtered[up ? 0 : 1];
+}
+
+FCITX_EXPORT_API
+int FcitxUIRenderModelGetCursorPos(FcitxUIRenderModel* model)
+{
+    return model->cursorPos;
+}
+
+static char*
+FcitxUIRenderModelJoin(FcitxMemoryPool* pool, char** strs, int begin, int end)
+{
+    size_t len = 0;
+    int i;
+    for (i = begin; i < end; i++)
+        len += strlen(strs[i]);
+    char* str = fcitx_memory_pool_alloc(pool, len + 1);
+    char* p = str;
+    for (i = begin; i < end; i++) {
+        size_t l = strlen(strs[i]);
+        memcpy(p, strs[i], l);
+        p += l;
+    }
+    *p = '\0';
+    return str;
+}
+
+FCITX_EXPORT_API
+const char* FcitxUIRenderModelGetUpString(FcitxUIRenderModel* model)
+{
+    if (!model->upString)
+        model->upString = FcitxUIRenderModelJoin(model->pool[0],
+                                                 model->filtered[0], 0,
+                                                 model->msg[0]->msgCount);
+    return model->upString;
+}
+
+static void
+FcitxUIRenderModelBuildTable(FcitxUIRenderModel* model)
+{
+    FcitxMessages* msg = model->msg[1];
+    char** strs = model->filtered[1];
+    int count = msg->msgCount;
+    int nLabels = 0, nTexts = 0;
+    int start = 0;
+    int i;
+
+    model->tableValid = true;
+    model->highlight = -1;
+    model->candidateCount = 0;
+    if (count == 0)
+        return;
+
+    for (i = 0; i < count; i++) {
+        FcitxMessageType type = msg->msg[i].type & MSG_REGULAR_MASK;
+        if (type == MSG_INDEX) {
+            /* anything before the first index is not part of a candidate */
+            if (nLabels)
+                model->texts[nTexts++] = FcitxUIRenderModelJoin(
+                    model->pool[1], strs, start, i);
+            model->labels[nLabels++] = strs[i];
+            start = i + 1;
+        } else if (type == MSG_FIRSTCAND) {
+            model->highlight = nTexts;
+        }
+    }
+    model->texts[nTexts++] = FcitxUIRenderModelJoin(model->pool[1], strs,
+                                                    start, count);
+    for (; nLabels < nTexts; nLabels++)
+        model->labels[nLabels] = "";
+    for (; nTexts < nLabels; nTexts++)
+        model->texts[nTexts] = "";
+    model->candidateCount = nTexts;
+}
+
+FCITX_EXPORT_API
+int FcitxUIRenderModelGetCandidateTable(FcitxUIRenderModel* model,
+                                        const char*** labels,
+                                        const char*** texts, int* highlight)
+{
+    if (!model->tableValid)
+        FcitxUIRenderModelBuildTable(model);
+    *labels = model->labels;
+    *texts = model->texts;
+    *highlight = model->highlight;
+    return model->candidateCount;
+}
+
 FCITX_EXPORT_API
 char* FcitxUIMessagesToCString(FcitxMessages* messages)
 {
@@ -978,7 +1253,7 @@ char* FcitxUICandidateWordToCString(FcitxInstance* instance)
     return result;
 }
 
-void FcitxUIUpdateInputWindowReal(FcitxInstance *instance)
+static void FcitxUIUpdateInputWindowInternal(FcitxInstance *instance)
 {
     FcitxInputState* input = instance->input;
     FcitxInputContext* ic = FcitxInstanceGetCurrentIC(instance);
@@ -1023,6 +1298,14 @@ void FcitxUIUpdateInputWindowReal(FcitxInstance *instance)
     FcitxMessagesSetMessageChanged(input->msgClientPreedit, false);
 }
 
+void FcitxUIUpdateInputWindowReal(FcitxInstance *instance)
+{
+    FCITX_KEY_TRACE_BEGIN(span);
+    FcitxUIUpdateInputWindowInternal(instance);
+    FCITX_KEY_TRACE_END(instance, span, FKTS_UI_UPDATE, NULL,
+                        instance->ui ? instance->ui->name : NULL);
+}
+
 void FcitxUIMoveInputWindowReal(FcitxInstance *instance)
 {
     if (UI_FUNC_IS_VALID(MoveInputWindow))
@@ -818,6 +818,125 @@ extern "C" {
      **/
     int FcitxUINewMessageToOldStyleMessage(struct _FcitxInstance* instance, FcitxMessages* msgUp, FcitxMessages* msgDown);
 
+    /**
+     * fields of FcitxUIRenderModel changed by FcitxUIRenderModelUpdate
+     *
+     * @since 4.2.9.3
+     **/
+    typedef enum _FcitxUIRenderModelField {
+        RENDER_MODEL_UP = (1 << 0), /**< aux up and preedit */
+        RENDER_MODEL_DOWN = (1 << 1), /**< aux down and candidate words */
+        RENDER_MODEL_CURSOR = (1 << 2) /**< cursor position in up messages */
+    } FcitxUIRenderModelField;
+
+    /**
+     * old style up and down messages with output filter applied, shared by
+     * user interface implementations. Strings are only converted and
+     * filtered again if the messages they come from are changed, and are
+     * kept in memory pools reused between updates.
+     *
+     * @since 4.2.9.3
+     **/
+    typedef struct _FcitxUIRenderModel FcitxUIRenderModel;
+
+    /**
+     * create a new render model
+     *
+     * @return FcitxUIRenderModel*
+     *
+     * @since 4.2.9.3
+     **/
+    FcitxUIRenderModel* FcitxUIRenderModelNew();
+
+    /**
+     * free a render model
+     *
+     * @param model render model
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxUIRenderModelFree(FcitxUIRenderModel* model);
+
+    /**
+     * update model from current input state, strings returned by the model
+     * before are invalid if their field is changed
+     *
+     * @param instance fcitx instance
+     * @param model render model
+     * @return mask of changed FcitxUIRenderModelField
+     *
+     * @since 4.2.9.3
+     **/
+    unsigned int FcitxUIRenderModelUpdate(struct _FcitxInstance* instance, FcitxUIRenderModel* model);
+
+    /**
+     * mark all fields as changed on next update
+     *
+     * @param model render model
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxUIRenderModelInvalidate(FcitxUIRenderModel* model);
+
+    /**
+     * get up or down messages, same as FcitxUINewMessageToOldStyleMessage
+     *
+     * @param model render model
+     * @param up up or down messages
+     * @return FcitxMessages*
+     *
+     * @since 4.2.9.3
+     **/
+    FcitxMessages* FcitxUIRenderModelGetMessages(FcitxUIRenderModel* model, boolean up);
+
+    /**
+     * get output filtered strings of up or down messages, owned by model
+     *
+     * @param model render model
+     * @param up up or down messages
+     * @return char**
+     *
+     * @since 4.2.9.3
+     **/
+    char** FcitxUIRenderModelGetFilteredStrings(FcitxUIRenderModel* model, boolean up);
+
+    /**
+     * get cursor position, same as FcitxUINewMessageToOldStyleMessage
+     *
+     * @param model render model
+     * @return int
+     *
+     * @since 4.2.9.3
+     **/
+    int FcitxUIRenderModelGetCursorPos(FcitxUIRenderModel* model);
+
+    /**
+     * get filtered up messages joined into one string, owned by model
+     *
+     * @param model render model
+     * @return const char*
+     *
+     * @since 4.2.9.3
+     **/
+    const char* FcitxUIRenderModelGetUpString(FcitxUIRenderModel* model);
+
+    /**
+     * get down messages as a lookup table, each label is an index message,
+     * the text is all following messages joined until next index. Arrays
+     * and strings are owned by model.
+     *
+     * @param model render model
+     * @param labels return labels
+     * @param texts return texts
+     * @param highlight return index of highlighted candidate, or -1
+     * @return number of candidates
+     *
+     * @since 4.2.9.3
+     **/
+    int FcitxUIRenderModelGetCandidateTable(FcitxUIRenderModel* model, const char*** labels, const char*** texts, int* highlight);
+
     /**
      * convert messages to pure c string
      *
@@ -852,6 +971,18 @@ extern "C" {
      **/
     void FcitxUIUpdateInputWindow(struct _FcitxInstance* instance);
 
+    /**
+     * mark input window should update, and update it in current main loop
+     * iteration without waiting for UIUpdateInterval, used when the change
+     * must be visible at once, e.g. after commit
+     *
+     * @param instance fcitx instance
+     * @return void
+     *
+     * @since 4.2.9.3
+     **/
+    void FcitxUIUpdateInputWindowImmediately(struct _FcitxInstance* instance);
+
 
     /**
      * User interface should switch to the fallback
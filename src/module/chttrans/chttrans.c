@@ -46,6 +46,7 @@
 
 static void* ChttransCreate(FcitxInstance* instance);
 static char* ChttransOutputFilter(void* arg, const char* strin);
+static boolean ChttransFilterIsActive(void* arg);
 static void ChttransIMChanged(void* arg);
 static void ReloadChttrans(void* arg);
 static char *ConvertGBKSimple2Tradition(FcitxChttrans* transState,
@@ -99,6 +100,37 @@ ChttransEnabled(FcitxChttrans *chttrans)
     return result;
 }
 
+typedef enum {
+    CHTTRANS_NONE,
+    CHTTRANS_S2T,
+    CHTTRANS_T2S
+} ChttransDirection;
+
+static ChttransDirection
+ChttransGetDirection(FcitxChttrans *transState)
+{
+    FcitxIM* im = FcitxInstanceGetCurrentIM(transState->owner);
+
+    /* don't trans for "zh" */
+    if (!im || strncmp(im->langCode, "zh", 2) != 0 || strlen(im->langCode) == 2)
+        return CHTTRANS_NONE;
+
+    if (ChttransEnabled(transState)) {
+        if (strcmp(im->langCode, "zh_HK") == 0 ||
+            strcmp(im->langCode, "zh_TW") == 0) {
+            return CHTTRANS_NONE;
+        } else {
+            return CHTTRANS_S2T;
+        }
+    } else {
+        if (strcmp(im->langCode, "zh_CN") == 0) {
+            return CHTTRANS_NONE;
+        } else {
+            return CHTTRANS_T2S;
+        }
+    }
+}
+
 static void
 ChttransEnabledForIMFilter(FcitxGenericConfig *config, FcitxConfigGroup *group,
                            FcitxConfigOption *option, void *value,
@@ -135,17 +167,19 @@ void *ChttransCreate(FcitxInstance* instance)
     hk.hotkey = transState->hkToggle;
     hk.hotkeyhandle = HotkeyToggleChttransState;
 
-    FcitxStringFilterHook shk;
+    FcitxStringFilterHookv2 shk;
+    memset(&shk, 0, sizeof(shk));
     shk.arg = transState;
     shk.func = ChttransOutputFilter;
+    shk.isActive = ChttransFilterIsActive;
 
     FcitxIMEventHook imhk;
     imhk.arg = transState;
     imhk.func = ChttransIMChanged;
 
     FcitxInstanceRegisterHotkeyFilter(instance, hk);
-    FcitxInstanceRegisterOutputFilter(instance, shk);
-    FcitxInstanceRegisterCommitFilter(instance, shk);
+    FcitxInstanceRegisterOutputFilterv2(instance, shk);
+    FcitxInstanceRegisterCommitFilterv2(instance, shk);
     FcitxInstanceRegisterIMChangedHook(instance, imhk);
     FcitxUIRegisterStatus(instance, transState, "chttrans",
                           ChttransEnabled(transState) ? _("Traditional Chinese") :  _("Simplified Chinese"),
@@ -206,30 +240,28 @@ boolean GetChttransEnabled(void* arg)
     return ChttransEnabled(transState);
 }
 
+boolean ChttransFilterIsActive(void* arg)
+{
+    FcitxChttrans* transState = (FcitxChttrans*) arg;
+    return ChttransGetDirection(transState) != CHTTRANS_NONE;
+}
+
 char* ChttransOutputFilter(void* arg, const char *strin)
 {
     FcitxChttrans* transState = (FcitxChttrans*) arg;
-    FcitxIM* im = FcitxInstanceGetCurrentIM(transState->owner);
 
-    /* don't trans for "zh" */
-    if (!im || strncmp(im->langCode, "zh", 2) != 0 || strlen(im->langCode) == 2)
+    /* neither direction touches ascii, don't bother to copy it */
+    if (*fcitx_utils_get_ascii_end(strin) == '\0')
         return NULL;
 
-    if (ChttransEnabled(transState)) {
-        if (strcmp(im->langCode, "zh_HK") == 0 ||
-            strcmp(im->langCode, "zh_TW") == 0) {
-            return NULL;
-        } else {
-            return ConvertGBKSimple2Tradition(transState, strin);
-        }
-    } else {
-        if (strcmp(im->langCode, "zh_CN") == 0) {
-            return NULL;
-        } else {
-            return ConvertGBKTradition2Simple(transState, strin);
-        }
+    switch (ChttransGetDirection(transState)) {
+    case CHTTRANS_S2T:
+        return ConvertGBKSimple2Tradition(transState, strin);
+    case CHTTRANS_T2S:
+        return ConvertGBKTradition2Simple(transState, strin);
+    default:
+        return NULL;
     }
-    return NULL;
 }
 
 void ChttransIMChanged(void* arg)
@@ -42,6 +42,7 @@ typedef struct _FcitxDBus {
     DBusDaemonProperty daemon;
     char* serviceName;
     FcitxHandlerTable* handler;
+    UT_array ioWatches;
 } FcitxDBus;
 
 #define RETRY_INTERVAL 2
@@ -60,6 +61,18 @@ typedef struct _FcitxDBusWatchNameNotify {
     FcitxDBusWatchNameCallback func;
 } FcitxDBusWatchNameNotify;
 
+/*
+ * plain fds of other addons polled by the main loop together with dbus,
+ * frontends have no SetFD/ProcessEvent of their own
+ */
+typedef struct _FcitxDBusIOWatch {
+    int fd;
+    FcitxDBusIOCallback func;
+    void *data;
+} FcitxDBusIOWatch;
+
+static const UT_icd io_watch_icd = {sizeof(FcitxDBusIOWatch), NULL, NULL, NULL};
+
 static void
 FcitxDBusWatchNameNotifyFreeFunc(void *obj)
 {
@@ -379,6 +392,7 @@ void* DBusCreate(FcitxInstance* instance)
     vtable.free = DBusRemoveMatch;
     dbusmodule->handler = fcitx_handler_table_new_with_keydata(sizeof(FcitxDBusWatchNameNotify), FcitxDBusWatchNameNotifyFreeFunc, &vtable);
 
+    utarray_init(&dbusmodule->ioWatches, &io_watch_icd);
     FcitxDBusAddFunctions(instance);
     dbus_error_free(&err);
 
@@ -399,6 +413,7 @@ void DBusDestroy(void* arg) {
     FcitxDBus* dbusmodule = (FcitxDBus*)arg;
 
     fcitx_handler_table_free(dbusmodule->handler);
+    utarray_done(&dbusmodule->ioWatches);
 
     if (dbusmodule->conn) {
         dbus_bus_release_name(dbusmodule->conn, dbusmodule->serviceName, NULL);
@@ -424,7 +439,17 @@ void DBusSetFD(void* arg)
     fd_set *wfds =  FcitxInstanceGetWriteFDSet(instance);
     fd_set *efds =  FcitxInstanceGetExceptFDSet(instance);
 
-    DBusUpdateFDSet(dbusmodule->watches, rfds, wfds, efds);
+    int maxfd = DBusUpdateFDSet(dbusmodule->watches, rfds, wfds, efds);
+    FcitxDBusIOWatch* watch;
+    for (watch = (FcitxDBusIOWatch*) utarray_front(&dbusmodule->ioWatches);
+         watch != NULL;
+         watch = (FcitxDBusIOWatch*) utarray_next(&dbusmodule->ioWatches, watch)) {
+        FD_SET(watch->fd, rfds);
+        if (maxfd < watch->fd)
+            maxfd = watch->fd;
+    }
+    if (FcitxInstanceGetMaxFD(instance) < maxfd)
+        FcitxInstanceSetMaxFD(instance, maxfd);
 }
 
 
@@ -437,6 +462,18 @@ void DBusProcessEvent(void* arg)
     fd_set *efds =  FcitxInstanceGetExceptFDSet(instance);
 
     DBusProcessEventForWatches(dbusmodule->watches, rfds, wfds, efds);
+    /* callback may add or remove watches, so walk by index */
+    unsigned int i;
+    for (i = 0; i < utarray_len(&dbusmodule->ioWatches); i++) {
+        FcitxDBusIOWatch* watch =
+            (FcitxDBusIOWatch*) utarray_eltptr(&dbusmodule->ioWatches, i);
+        int fd = watch->fd;
+        if (FD_ISSET(fd, rfds)) {
+            /* don't run it twice if the array moves under us */
+            FD_CLR(fd, rfds);
+            watch->func(watch->data, fd);
+        }
+    }
     DBusProcessEventForConnection(dbusmodule->conn);
     DBusProcessEventForConnection(dbusmodule->privconn);
 }
@@ -469,4 +506,35 @@ void DBusUnwatchName(void* arg, int id)
     fcitx_handler_table_remove_by_id_full(dbusmodule->handler, id);
 }
 
+void DBusRemoveIOWatch(void* arg, int fd)
+{
+    FcitxDBus* dbusmodule = (FcitxDBus*) arg;
+    unsigned int i;
+
+    for (i = 0; i < utarray_len(&dbusmodule->ioWatches); i++) {
+        FcitxDBusIOWatch* watch =
+            (FcitxDBusIOWatch*) utarray_eltptr(&dbusmodule->ioWatches, i);
+        if (watch->fd == fd) {
+            utarray_erase(&dbusmodule->ioWatches, i, 1);
+            return;
+        }
+    }
+}
+
+boolean DBusAddIOWatch(void* arg, int fd, FcitxDBusIOCallback func, void* data)
+{
+    FcitxDBus* dbusmodule = (FcitxDBus*) arg;
+    FcitxDBusIOWatch watch;
+
+    if (fd < 0 || fd >= FD_SETSIZE || !func)
+        return false;
+
+    DBusRemoveIOWatch(dbusmodule, fd);
+    watch.fd = fd;
+    watch.func = func;
+    watch.data = data;
+    utarray_push_back(&dbusmodule->ioWatches, &watch);
+    return true;
+}
+
 #include "fcitx-dbus-addfunctions.h"
@@ -37,6 +37,13 @@ extern "C" {
 
 typedef void (*FcitxDBusWatchNameCallback)(void* owner, void* arg, const char* serviceName, const char* oldName, const char* newName);
 
+/**
+ * called from the main loop of fcitx when fd becomes readable
+ *
+ * @since 4.2.9.3
+ **/
+typedef void (*FcitxDBusIOCallback)(void* arg, int fd);
+
 #ifdef __cplusplus
 }
 #endif
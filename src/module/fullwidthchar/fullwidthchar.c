@@ -68,6 +68,7 @@ static void* FullWidthCharCreate(FcitxInstance* instance);
 char* ProcessFullWidthChar(void* arg, const char* str);
 static void ToggleFullWidthState(void *arg);
 static boolean GetFullWidthState(void *arg);
+static boolean FullWidthFilterIsActive(void *arg);
 static INPUT_RETURN_VALUE ToggleFullWidthStateWithHotkey(void *arg);
 static boolean FullWidthPostFilter(void* arg, FcitxKeySym sym,
                               unsigned int state,
@@ -92,10 +93,12 @@ void* FullWidthCharCreate(FcitxInstance* instance)
     FcitxFullWidthChar* fwchar = fcitx_utils_malloc0(sizeof(FcitxFullWidthChar));
     FcitxGlobalConfig* config = FcitxInstanceGetGlobalConfig(instance);
     fwchar->owner = instance;
-    FcitxStringFilterHook hk;
+    FcitxStringFilterHookv2 hk;
+    memset(&hk, 0, sizeof(hk));
     hk.arg = fwchar;
     hk.func = ProcessFullWidthChar;
-    FcitxInstanceRegisterCommitFilter(instance, hk);
+    hk.isActive = FullWidthFilterIsActive;
+    FcitxInstanceRegisterCommitFilterv2(instance, hk);
 
     FcitxKeyFilterHook phk;
     phk.arg = fwchar;
@@ -148,12 +151,24 @@ boolean FullWidthPostFilter(void* arg, FcitxKeySym sym,
 }
 
 
-char* ProcessFullWidthChar(void* arg, const char* str)
+boolean FullWidthFilterIsActive(void* arg)
 {
     FcitxFullWidthChar* fwchar = (FcitxFullWidthChar*)arg;
     FcitxProfile* profile = FcitxInstanceGetProfile(fwchar->owner);
     FcitxUIStatus *status = FcitxUIGetStatusByName(fwchar->owner, "fullwidth");
-    if (profile->bUseFullWidthChar && status->visible) {
+    return profile->bUseFullWidthChar && status->visible;
+}
+
+char* ProcessFullWidthChar(void* arg, const char* str)
+{
+    if (FullWidthFilterIsActive(arg)) {
+        const char* p = str;
+        /* nothing to convert, report unchanged */
+        while (*p && !(*p >= '\x20' && *p <= '\x7e'))
+            p++;
+        if (!*p)
+            return NULL;
+
         size_t i = 0, ret_len = 0, len = fcitx_utf8_strlen(str);
         char* ret = (char *) fcitx_utils_malloc0(sizeof(char) * (UTF8_MAX_LENGTH * len + 1));
         const char* ps = str;
@@ -73,6 +73,8 @@ static FcitxPunc* LoadPuncFile(const char* filename);
 static char *GetPunc(struct _FcitxPuncState* puncState, int iKey);
 static void FreePunc(struct _FcitxPuncState* puncState);
 static void* PuncCreate(FcitxInstance* instance);
+static void* PuncPrepare(FcitxAddon* addon);
+static void PuncPrepareFree(void* arg);
 static boolean PuncPreFilter(void* arg, FcitxKeySym sym, unsigned int state, INPUT_RETURN_VALUE* retVal);
 static boolean ProcessPunc(void* arg, FcitxKeySym sym, unsigned int state, INPUT_RETURN_VALUE* retVal);
 static void TogglePuncState(void *arg);
@@ -107,11 +109,35 @@ FCITX_DEFINE_PLUGIN(fcitx_punc, module, FcitxModule) = {
     ReloadPunc
 };
 
-void* PuncCreate(FcitxInstance* instance)
+FCITX_DEFINE_MODULE_PREPARE(fcitx_punc) = {
+    PuncPrepare,
+    PuncPrepareFree
+};
+
+void* PuncPrepare(FcitxAddon* addon)
 {
+    FCITX_UNUSED(addon);
     FcitxPuncState* puncState = fcitx_utils_malloc0(sizeof(FcitxPuncState));
-    puncState->owner = instance;
     LoadPuncDict(puncState);
+    return puncState;
+}
+
+void PuncPrepareFree(void* arg)
+{
+    FcitxPuncState* puncState = (FcitxPuncState*) arg;
+    FreePunc(puncState);
+    free(puncState);
+}
+
+void* PuncCreate(FcitxInstance* instance)
+{
+    FcitxPuncState* puncState = FcitxModuleTakePrepareData(instance,
+                                                           FCITX_PUNC_NAME);
+    if (!puncState) {
+        puncState = fcitx_utils_malloc0(sizeof(FcitxPuncState));
+        LoadPuncDict(puncState);
+    }
+    puncState->owner = instance;
     FcitxKeyFilterHook hk;
     hk.arg = puncState;
     hk.func = ProcessPunc;
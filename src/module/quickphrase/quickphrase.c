@@ -92,6 +92,8 @@ typedef struct {
 } QuickPhraseCand;
 
 static void *QuickPhraseCreate(FcitxInstance *instance);
+static void *QuickPhrasePrepare(FcitxAddon *addon);
+static void QuickPhrasePrepareFree(void *arg);
 static void LoadQuickPhrase(QuickPhraseState* qpstate);
 static void FreeQuickPhrase(void* arg);
 static void ReloadQuickPhrase(void* arg);
@@ -123,6 +125,11 @@ FCITX_DEFINE_PLUGIN(fcitx_quickphrase, module, FcitxModule) = {
     ReloadQuickPhrase
 };
 
+FCITX_DEFINE_MODULE_PREPARE(fcitx_quickphrase) = {
+    QuickPhrasePrepare,
+    QuickPhrasePrepareFree
+};
+
 static const FcitxHotkey FCITX_QP_GRACE[2] = {
     {NULL, FcitxKey_grave, FcitxKeyState_None},
     {NULL, 0, 0},
@@ -167,20 +174,37 @@ int PhraseCmpA(const void* a, const void* b)
     }
 }
 
-void *QuickPhraseCreate(FcitxInstance *instance)
+void *QuickPhrasePrepare(FcitxAddon *addon)
 {
+    FCITX_UNUSED(addon);
     QuickPhraseState *qpstate = fcitx_utils_new(QuickPhraseState);
+    qpstate->memPool = fcitx_memory_pool_create();
+    LoadQuickPhrase(qpstate);
+    return qpstate;
+}
+
+void QuickPhrasePrepareFree(void *arg)
+{
+    QuickPhraseState *qpstate = (QuickPhraseState*) arg;
+    FreeQuickPhrase(qpstate);
+    fcitx_memory_pool_destroy(qpstate->memPool);
+    free(qpstate);
+}
+
+void *QuickPhraseCreate(FcitxInstance *instance)
+{
+    QuickPhraseState *qpstate =
+        FcitxModuleTakePrepareData(instance, FCITX_QUICKPHRASE_NAME);
+    if (!qpstate)
+        qpstate = QuickPhrasePrepare(NULL);
     qpstate->owner = instance;
     qpstate->enabled = false;
-    qpstate->memPool = fcitx_memory_pool_create();
 
     if (!LoadQuickPhraseConfig(&qpstate->config)) {
-        free(qpstate);
+        QuickPhrasePrepareFree(qpstate);
         return NULL;
     }
 
-    LoadQuickPhrase(qpstate);
-
     FcitxKeyFilterHook hk;
     hk.arg = qpstate;
     hk.func = QuickPhrasePostFilter;
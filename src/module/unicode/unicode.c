@@ -165,20 +165,22 @@ INPUT_RETURN_VALUE UnicodeGetCandWord(void* arg, FcitxCandidateWord* candWord)
     return IRV_COMMIT_STRING;
 }
 
-INPUT_RETURN_VALUE UnicodeGetCandWords(UnicodeModule* uni)
-{
-    FcitxInputState *input = FcitxInstanceGetInputState(uni->owner);
-    FcitxInstanceCleanInputWindow(uni->owner);
-    FcitxMessagesAddMessageStringsAtLast(FcitxInputStateGetPreedit(input),
-                                         MSG_INPUT, uni->buffer);
-    FcitxInputStateSetShowCursor(input, true);
-    FcitxInputStateSetCursorPos(input, strlen(uni->buffer));
+/* matched characters, turned into candidates page by page */
+typedef struct _UnicodeCandidates {
+    UnicodeModule* uni;
+    UT_array* result;
+} UnicodeCandidates;
 
-    FcitxCandidateWordList* candList = FcitxInputStateGetCandidateList(input);
-    FcitxCandidateWordSetLayoutHint(candList, CLH_Vertical);
-
-    UT_array* result = CharSelectDataFind(uni->charselectdata, uni->buffer);
-    utarray_foreach(c, result, uint32_t) {
+static int
+UnicodeProvideCandWords(void* arg, FcitxCandidateWordList* candList,
+                        int start, int count)
+{
+    UnicodeCandidates* cands = arg;
+    UnicodeModule* uni = cands->uni;
+    int total = utarray_len(cands->result);
+    int i;
+    for (i = 0; i < count && start + i < total; i++) {
+        uint32_t* c = (uint32_t*) utarray_eltptr(cands->result, start + i);
         char* s = fcitx_utils_malloc0(sizeof(char) * (UTF8_MAX_LENGTH + 1));
         fcitx_ucs4_to_utf8(*c, s);
         FcitxCandidateWord candWord;
@@ -193,7 +195,36 @@ INPUT_RETURN_VALUE UnicodeGetCandWords(UnicodeModule* uni)
         free(name);
         FcitxCandidateWordAppend(candList, &candWord);
     }
-    utarray_free(result);
+    return i;
+}
+
+static void
+UnicodeFreeCandidates(void* arg)
+{
+    UnicodeCandidates* cands = arg;
+    utarray_free(cands->result);
+    free(cands);
+}
+
+INPUT_RETURN_VALUE UnicodeGetCandWords(UnicodeModule* uni)
+{
+    FcitxInputState *input = FcitxInstanceGetInputState(uni->owner);
+    FcitxInstanceCleanInputWindow(uni->owner);
+    FcitxMessagesAddMessageStringsAtLast(FcitxInputStateGetPreedit(input),
+                                         MSG_INPUT, uni->buffer);
+    FcitxInputStateSetShowCursor(input, true);
+    FcitxInputStateSetCursorPos(input, strlen(uni->buffer));
+
+    FcitxCandidateWordList* candList = FcitxInputStateGetCandidateList(input);
+    FcitxCandidateWordSetLayoutHint(candList, CLH_Vertical);
+
+    /* a short keyword can match thousands of characters, only look up the
+     * names of those really shown */
+    UnicodeCandidates* cands = fcitx_utils_new(UnicodeCandidates);
+    cands->uni = uni;
+    cands->result = CharSelectDataFind(uni->charselectdata, uni->buffer);
+    FcitxCandidateWordSetProvider(candList, UnicodeProvideCandWords, cands,
+                                  UnicodeFreeCandidates);
     return IRV_FLAG_UPDATE_INPUT_WINDOW;
 }
 
@@ -107,6 +107,7 @@ static void SwitchVK(FcitxVKState *vkstate);
 static void LoadVKMapFile(FcitxVKState *vkstate);
 static void ChangVK(FcitxVKState* vkstate);
 static void ReloadVK(void *arg);
+static void VKDestroy(void *arg);
 static int MyToUpper(int iChar);
 static int MyToLower(int iChar);
 static cairo_surface_t* LoadVKImage(VKWindow* vkWindow);
@@ -135,7 +136,7 @@ FCITX_DEFINE_PLUGIN(fcitx_vk, module, FcitxModule) = {
     VKCreate,
     NULL,
     NULL,
-    NULL,
+    VKDestroy,
     ReloadVK
 };
 
@@ -800,5 +801,14 @@ void ReloadVK(void* arg)
     LoadVKMapFile(vkstate);
 }
 
+/* the font cache refresh thread must not outlive the addon */
+void VKDestroy(void* arg)
+{
+    FCITX_UNUSED(arg);
+#ifndef _ENABLE_PANGO
+    FontCacheFinish();
+#endif
+}
+
 
 // kate: indent-mode cstyle; space-indent on; indent-width 0;
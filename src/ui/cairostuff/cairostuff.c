@@ -18,9 +18,12 @@
  *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
  ***************************************************************************/
 
+#include <string.h>
 #include <cairo.h>
 #include "fcitx/fcitx.h"
+#include "fcitx-utils/utils.h"
 #include "fcitx-utils/utf8.h"
+#include "fcitx-utils/uthash.h"
 #include "fcitx-config/fcitx-config.h"
 #include "cairostuff.h"
 
@@ -28,6 +31,16 @@
 #include <pango/pangocairo.h>
 #endif
 
+/* enough for aux, preedit and a few pages of candidates */
+#define EXTENT_CACHE_SIZE 256
+
+typedef struct _FcitxCairoStringExtent {
+    char* str;
+    int width;
+    int height;
+    UT_hash_handle hh;
+} FcitxCairoStringExtent;
+
 struct _FcitxCairoTextContext {
     boolean ownSurface;
     cairo_surface_t* surface;
@@ -37,6 +50,15 @@ struct _FcitxCairoTextContext {
     PangoLayout* pangoLayout;
     PangoFontDescription* fontDesc;
 #endif
+    char* font;
+    int fontSize;
+    int dpi;
+    /*
+     * string size measured by context with its own surface, least recently
+     * used one is at the head of the hash list.
+     */
+    FcitxCairoStringExtent* extents;
+    unsigned int extentCount;
 };
 
 
@@ -73,8 +95,21 @@ FcitxCairoTextContext* FcitxCairoTextContextCreate(cairo_t* cr)
     return ctc;
 }
 
+void FcitxCairoTextContextClearCache(FcitxCairoTextContext* ctc)
+{
+    while (ctc->extents) {
+        FcitxCairoStringExtent* extent = ctc->extents;
+        HASH_DEL(ctc->extents, extent);
+        free(extent->str);
+        free(extent);
+    }
+    ctc->extentCount = 0;
+}
+
 void FcitxCairoTextContextFree(FcitxCairoTextContext* ctc)
 {
+    FcitxCairoTextContextClearCache(ctc);
+    fcitx_utils_free(ctc->font);
 #ifdef _ENABLE_PANGO
     g_object_unref(ctc->pangoLayout);
     g_object_unref(ctc->pangoContext);
@@ -93,14 +128,22 @@ void FcitxCairoTextContextFree(FcitxCairoTextContext* ctc)
 
 void FcitxCairoTextContextSet(FcitxCairoTextContext* ctc, const char* font, int fontSize, int dpi)
 {
+    /* a kept context is set again on every repaint, skip if nothing changed */
+    if (ctc->font && strcmp(ctc->font, font) == 0
+        && ctc->fontSize == fontSize && ctc->dpi == dpi)
+        return;
+    fcitx_utils_string_swap(&ctc->font, font);
+    ctc->fontSize = fontSize;
+    ctc->dpi = dpi;
+    FcitxCairoTextContextClearCache(ctc);
+
 #ifdef _ENABLE_PANGO
     PangoFontDescription* fontDesc = GetPangoFontDescription(font, fontSize, dpi);
     pango_cairo_context_set_resolution(ctc->pangoContext, dpi);
     pango_layout_set_font_description(ctc->pangoLayout, fontDesc);
-    if (ctc->fontDesc) {
+    if (ctc->fontDesc)
         pango_font_description_free(ctc->fontDesc);
-        ctc->fontDesc = fontDesc;
-    }
+    ctc->fontDesc = fontDesc;
 #else
     cairo_select_font_face(ctc->cr, font,
                             CAIRO_FONT_SLANT_NORMAL,
@@ -109,6 +152,21 @@ void FcitxCairoTextContextSet(FcitxCairoTextContext* ctc, const char* font, int
 #endif
 }
 
+static void FcitxCairoTextContextMeasure(FcitxCairoTextContext* ctc, const char* str, int* w, int* h)
+{
+#ifdef _ENABLE_PANGO
+    pango_layout_set_text(ctc->pangoLayout, str, -1);
+    pango_layout_get_pixel_size(ctc->pangoLayout, w, h);
+#else
+    cairo_text_extents_t extents;
+    cairo_font_extents_t fontextents;
+    cairo_text_extents(ctc->cr, str, &extents);
+    cairo_font_extents(ctc->cr, &fontextents);
+    *w = extents.x_advance;
+    *h = fontextents.height;
+#endif
+}
+
 void FcitxCairoTextContextStringSize(FcitxCairoTextContext* ctc, const char* str, int* w, int* h)
 {
     if (!str || str[0] == 0) {
@@ -116,26 +174,40 @@ void FcitxCairoTextContextStringSize(FcitxCairoTextContext* ctc, const char* str
         if (h) *h = 0;
         return;
     }
-    if (!fcitx_utf8_check_string(str)) {
-        if (w) *w = 0;
-        if (h) *h = 0;
 
+    /* context drawing on other's surface is short lived, don't cache */
+    if (!ctc->ownSurface) {
+        int width = 0, height = 0;
+        if (fcitx_utf8_check_string(str))
+            FcitxCairoTextContextMeasure(ctc, str, &width, &height);
+        if (w) *w = width;
+        if (h) *h = height;
         return;
     }
 
-#ifdef _ENABLE_PANGO
-    pango_layout_set_text(ctc->pangoLayout, str, -1);
-    pango_layout_get_pixel_size(ctc->pangoLayout, w, h);
-#else
-    cairo_text_extents_t extents;
-    cairo_font_extents_t fontextents;
-    cairo_text_extents(ctc->cr, str, &extents);
-    cairo_font_extents(ctc->cr, &fontextents);
-    if (w)
-        *w = extents.x_advance;
-    if (h)
-        *h = fontextents.height;
-#endif
+    FcitxCairoStringExtent* extent = NULL;
+    HASH_FIND_STR(ctc->extents, str, extent);
+    if (extent) {
+        /* move to the tail, so it is evicted last */
+        HASH_DEL(ctc->extents, extent);
+    } else {
+        extent = fcitx_utils_new(FcitxCairoStringExtent);
+        extent->str = strdup(str);
+        if (fcitx_utf8_check_string(str))
+            FcitxCairoTextContextMeasure(ctc, str, &extent->width, &extent->height);
+        if (ctc->extentCount == EXTENT_CACHE_SIZE) {
+            FcitxCairoStringExtent* lru = ctc->extents;
+            HASH_DEL(ctc->extents, lru);
+            free(lru->str);
+            free(lru);
+        } else {
+            ctc->extentCount++;
+        }
+    }
+    HASH_ADD_KEYPTR(hh, ctc->extents, extent->str, strlen(extent->str), extent);
+
+    if (w) *w = extent->width;
+    if (h) *h = extent->height;
 }
 
 void FcitxCairoTextContextStringSizeStrict(FcitxCairoTextContext* ctc, const char* str, int* w, int* h)
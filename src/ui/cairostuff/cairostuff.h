@@ -28,6 +28,8 @@ typedef struct _FcitxCairoTextContext FcitxCairoTextContext;
 
 FcitxCairoTextContext* FcitxCairoTextContextCreate(cairo_t* cr);
 void FcitxCairoTextContextFree(FcitxCairoTextContext* ctc);
+/* drop string sizes measured so far, needed if font config is reloaded */
+void FcitxCairoTextContextClearCache(FcitxCairoTextContext* ctc);
 void FcitxCairoTextContextSet(FcitxCairoTextContext* ctc, const char* font, int fontSize, int dpi);
 void FcitxCairoTextContextStringSize(FcitxCairoTextContext* ctc, const char* str, int* w, int* h);
 void FcitxCairoTextContextStringSizeStrict(FcitxCairoTextContext* ctc, const char* str, int* w, int* h);
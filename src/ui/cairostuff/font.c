@@ -27,46 +27,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include <libintl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "fcitx/fcitx.h"
 #include "fcitx-utils/utils.h"
 #include "fcitx-utils/log.h"
+#include "fcitx-utils/uthash.h"
+#include "fcitx-utils/utarray.h"
+#include "fcitx-config/xdg.h"
 
-/**
- * Get Usable Font
- *
- * @param strUserLocale font language
- * @param font input as a malloc-ed font name, out put as new malloc-ed font name.
- * @return void
- **/
-void GetValidFont(const char* strUserLocale, char **font)
-{
+#define FONT_CACHE_PREFIX "cache"
+#define FONT_CACHE_FILE "font"
+#define FONT_CACHE_TEMP_FILE "font_XXXXXX"
 
-    if (!FcInit()) {
-        FcitxLog(ERROR, _("Error: Load fontconfig failed"));
+/*
+ * resolved family of a (locale, font) pair, key is "locale\tfont". stamp is
+ * the fontconfig stamp the family is resolved with, 0 if fontconfig was not
+ * up to date at that time.
+ */
+typedef struct _FontCacheEntry {
+    char* key;
+    char* family;
+    time_t stamp;
+    UT_hash_handle hh;
+} FontCacheEntry;
+
+/* stale keys resolved again by the refresh thread */
+typedef struct _FontCacheRefreshArg {
+    FcConfig* config;
+    time_t stamp;
+    UT_array keys;
+} FontCacheRefreshArg;
+
+static pthread_mutex_t fontCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static FontCacheEntry* fontCache = NULL;
+static boolean fontCacheLoaded = false;
+/* at most one refresh thread, joined by the next refresh or FontCacheFinish */
+static pthread_t fontCacheThread;
+static boolean fontCacheThreadStarted = false;
+static boolean fontCacheRefreshing = false;
+
+static void
+FontStampUpdate(FcStrList* list, time_t* stamp)
+{
+    FcChar8* file;
+    struct stat st;
+    if (!list)
         return;
+    while ((file = FcStrListNext(list))) {
+        if (stat((const char*) file, &st) == 0 && st.st_mtime > *stamp)
+            *stamp = st.st_mtime;
     }
-    char locale[3];
+    FcStrListDone(list);
+}
 
-    if (strUserLocale)
-        strncpy(locale, strUserLocale, 2);
-    else
-        strcpy(locale, "zh");
-    locale[2] = '\0';
+/* latest modification time of fontconfig config files and font dirs */
+static time_t
+FontConfigStamp()
+{
+    time_t stamp = 0;
+    FontStampUpdate(FcConfigGetConfigFiles(NULL), &stamp);
+    FontStampUpdate(FcConfigGetFontDirs(NULL), &stamp);
+    return stamp;
+}
 
-    boolean      found = false;
-    while(true) {
+/* return malloc-ed family, "" if there is no valid font */
+static char*
+FontResolve(FcConfig* config, const char* locale, const char* font)
+{
+    char* result = NULL;
+    while (true) {
         FcFontSet   *fs = NULL;
         FcPattern   *pat = NULL;
         FcObjectSet *os = NULL;
 
         do {
-            if (strcmp(*font, "") == 0) {
-                fcitx_utils_local_cat_str(strpat, strlen(":lang=") + sizeof(locale),
+            if (strcmp(font, "") == 0) {
+                fcitx_utils_local_cat_str(strpat, strlen(":lang=") + strlen(locale) + 1,
                                         ":lang=", locale);
                 pat = FcNameParse((FcChar8*)strpat);
             } else {
-                pat = FcNameParse((FcChar8*)(*font));
+                pat = FcNameParse((FcChar8*)font);
             }
 
             if (!pat) {
@@ -78,7 +122,7 @@ void GetValidFont(const char* strUserLocale, char **font)
                 break;
             }
 
-            fs = FcFontList(0, pat, os);
+            fs = FcFontList(config, pat, os);
             if (!fs || fs->nfont <= 0) {
                 break;
             }
@@ -88,9 +132,7 @@ void GetValidFont(const char* strUserLocale, char **font)
                 break;
             }
 
-            found = true;
-            free(*font);
-            *font = strdup((const char*) family);
+            result = strdup((const char*) family);
         } while (0);
 
         if (fs) {
@@ -103,19 +145,255 @@ void GetValidFont(const char* strUserLocale, char **font)
             FcPatternDestroy(pat);
         }
 
-        if (found) {
+        if (result) {
             break;
         }
 
-        if (strcmp(*font, "") != 0) {
-            /* *font must have enough space for "" */
-            strcpy(*font, "");
+        if (strcmp(font, "") != 0) {
+            font = "";
         } else {
             break;
         }
     }
 
-    if (found) {
+    return result ? result : strdup("");
+}
+
+/* called with lock held */
+static FontCacheEntry*
+FontCacheSet(const char* key, const char* family, time_t stamp)
+{
+    FontCacheEntry* entry = NULL;
+    HASH_FIND_STR(fontCache, key, entry);
+    if (!entry) {
+        entry = fcitx_utils_new(FontCacheEntry);
+        entry->key = strdup(key);
+        HASH_ADD_KEYPTR(hh, fontCache, entry->key, strlen(entry->key), entry);
+    }
+    fcitx_utils_string_swap(&entry->family, family);
+    entry->stamp = stamp;
+    return entry;
+}
+
+/* called with lock held, line is "stamp\tlocale\tfont\tfamily" */
+static void
+FontCacheLoad()
+{
+    FILE* fp = FcitxXDGGetFileUserWithPrefix(FONT_CACHE_PREFIX, FONT_CACHE_FILE, "r", NULL);
+    char* line = NULL;
+    size_t bufsize = 0;
+    fontCacheLoaded = true;
+    if (!fp)
+        return;
+
+    while (getline(&line, &bufsize, fp) != -1) {
+        char* end;
+        char* family;
+        long stamp;
+        line[strcspn(line, "\n")] = '\0';
+        stamp = strtol(line, &end, 10);
+        if (*end != '\t')
+            continue;
+        /* family is after the third tab */
+        family = strchr(end + 1, '\t');
+        if (!family || !(family = strchr(family + 1, '\t')))
+            continue;
+        *family = '\0';
+        FontCacheSet(end + 1, family + 1, stamp);
+    }
+    free(line);
+    fclose(fp);
+}
+
+/* called with lock held, write to a temp file so a reader never sees half */
+static void
+FontCacheSave()
+{
+    char* tempfile = NULL;
+    char* cachefile = NULL;
+    FontCacheEntry* entry;
+    FILE* fp = NULL;
+    int fd;
+
+    FcitxXDGMakeDirUser(FONT_CACHE_PREFIX);
+    FcitxXDGGetFileUserWithPrefix(FONT_CACHE_PREFIX, FONT_CACHE_TEMP_FILE, NULL, &tempfile);
+    fd = mkstemp(tempfile);
+    if (fd >= 0)
+        fp = fdopen(fd, "w");
+    if (!fp) {
+        if (fd >= 0)
+            close(fd);
+        free(tempfile);
+        return;
+    }
+
+    for (entry = fontCache; entry; entry = entry->hh.next)
+        fprintf(fp, "%ld\t%s\t%s\n", (long) entry->stamp, entry->key, entry->family);
+    fclose(fp);
+
+    FcitxXDGGetFileUserWithPrefix(FONT_CACHE_PREFIX, FONT_CACHE_FILE, NULL, &cachefile);
+    if (rename(tempfile, cachefile) < 0)
+        unlink(tempfile);
+    free(cachefile);
+    free(tempfile);
+}
+
+/*
+ * resolve the stale entries again, fonts may be installed or removed. The
+ * config is brought up to date and referenced by the caller, this thread
+ * never changes the current config that other threads are using.
+ */
+static void*
+FontCacheRefresh(void* arg)
+{
+    FontCacheRefreshArg* refresh = arg;
+    char** pkey;
+
+    for (pkey = (char**) utarray_front(&refresh->keys); pkey;
+         pkey = (char**) utarray_next(&refresh->keys, pkey)) {
+        char* key = *pkey;
+        char* sep = strchr(key, '\t');
+        *sep = '\0';
+        char* family = FontResolve(refresh->config, key, sep + 1);
+        *sep = '\t';
+
+        pthread_mutex_lock(&fontCacheLock);
+        FontCacheSet(key, family, refresh->stamp);
+        pthread_mutex_unlock(&fontCacheLock);
+        free(family);
+    }
+
+    pthread_mutex_lock(&fontCacheLock);
+    FontCacheSave();
+    fontCacheRefreshing = false;
+    pthread_mutex_unlock(&fontCacheLock);
+
+    FcConfigDestroy(refresh->config);
+    utarray_done(&refresh->keys);
+    free(refresh);
+    return NULL;
+}
+
+/* called with lock held */
+static void
+FontCacheJoin()
+{
+    pthread_t thread = fontCacheThread;
+    if (!fontCacheThreadStarted)
+        return;
+    fontCacheThreadStarted = false;
+    /* the thread takes the lock before it ends */
+    pthread_mutex_unlock(&fontCacheLock);
+    pthread_join(thread, NULL);
+    pthread_mutex_lock(&fontCacheLock);
+}
+
+/* called with lock held, stamp is the one of the up to date config */
+static void
+FontCacheStartRefresh(time_t stamp)
+{
+    FontCacheEntry* entry;
+    if (fontCacheRefreshing)
+        return;
+    /* the last one is finished, reap it before starting another */
+    FontCacheJoin();
+
+    FontCacheRefreshArg* refresh = fcitx_utils_new(FontCacheRefreshArg);
+    utarray_init(&refresh->keys, fcitx_str_icd);
+    for (entry = fontCache; entry; entry = entry->hh.next) {
+        if (entry->stamp != stamp)
+            utarray_push_back(&refresh->keys, &entry->key);
+    }
+    refresh->stamp = stamp;
+    refresh->config = FcConfigReference(NULL);
+    if (!refresh->config) {
+        utarray_done(&refresh->keys);
+        free(refresh);
+        return;
+    }
+
+    if (pthread_create(&fontCacheThread, NULL, FontCacheRefresh, refresh) == 0) {
+        fontCacheThreadStarted = true;
+        fontCacheRefreshing = true;
+    } else {
+        FcConfigDestroy(refresh->config);
+        utarray_done(&refresh->keys);
+        free(refresh);
+    }
+}
+
+/**
+ * wait for the background refresh of font cache
+ *
+ * must be called before the addon using GetValidFont is unloaded
+ **/
+void FontCacheFinish()
+{
+    pthread_mutex_lock(&fontCacheLock);
+    FontCacheJoin();
+    pthread_mutex_unlock(&fontCacheLock);
+}
+
+/**
+ * Get Usable Font
+ *
+ * Resolved family is cached in memory and in the user cache dir, an entry
+ * resolved with older fontconfig config or font dirs is still used, and
+ * resolved again in a background thread.
+ *
+ * @param strUserLocale font language
+ * @param font input as a malloc-ed font name, out put as new malloc-ed font name.
+ * @return void
+ **/
+void GetValidFont(const char* strUserLocale, char **font)
+{
+
+    if (!FcInit()) {
+        FcitxLog(ERROR, _("Error: Load fontconfig failed"));
+        return;
+    }
+    char locale[3];
+
+    if (strUserLocale)
+        strncpy(locale, strUserLocale, 2);
+    else
+        strcpy(locale, "zh");
+    locale[2] = '\0';
+
+    fcitx_utils_local_cat_str(key, sizeof(locale) + 1 + strlen(*font),
+                              locale, "\t", *font);
+    time_t stamp = FontConfigStamp();
+    FontCacheEntry* entry = NULL;
+
+    pthread_mutex_lock(&fontCacheLock);
+    if (!fontCacheLoaded)
+        FontCacheLoad();
+    HASH_FIND_STR(fontCache, key, entry);
+    if (entry) {
+        fcitx_utils_string_swap(font, entry->family);
+        /*
+         * the current config may only be replaced on this thread, where
+         * fontconfig and cairo are used, and never by the refresh thread.
+         */
+        if (entry->stamp != stamp && FcInitBringUptoDate()
+            && FcConfigUptoDate(NULL))
+            FontCacheStartRefresh(stamp);
+    }
+    pthread_mutex_unlock(&fontCacheLock);
+
+    if (!entry) {
+        char* family = FontResolve(NULL, locale, *font);
+        if (!FcConfigUptoDate(NULL))
+            stamp = 0;
+        pthread_mutex_lock(&fontCacheLock);
+        FontCacheSet(key, family, stamp);
+        FontCacheSave();
+        pthread_mutex_unlock(&fontCacheLock);
+        free(*font);
+        *font = family;
+    }
+
+    if ((*font)[0]) {
         FcitxLog(INFO, _("your current font is: %s"), *font);
     } else {
         FcitxLog(WARNING, _("no valid font."));
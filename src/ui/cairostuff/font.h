@@ -26,6 +26,7 @@
 #include "fcitx/fcitx.h"
 
 void GetValidFont(const char* strUserLocale, char **font);
+void FontCacheFinish();
 
 #endif
 
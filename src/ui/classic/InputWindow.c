@@ -40,6 +40,7 @@
 #include "InputWindow.h"
 #include "classicui.h"
 #include "skin.h"
+#include "skinpreload.h"
 #include "MainWindow.h"
 #include "fcitx-utils/log.h"
 
@@ -69,6 +70,7 @@ void InputWindowInit(InputWindow* inputWindow)
                         InputWindowPaint
     );
 
+    window->trackDamage = true;
     inputWindow->iOffsetX = 0;
     inputWindow->iOffsetY = 8;
 }
@@ -83,11 +85,94 @@ InputWindow* InputWindowCreate(FcitxClassicUI *classicui)
     FcitxX11AddCompositeHandler(classicui->owner,
                                 InputWindowReload, inputWindow);
 
-    inputWindow->msgUp = FcitxMessagesNew();
-    inputWindow->msgDown = FcitxMessagesNew();
+    inputWindow->model = FcitxUIRenderModelNew();
     return inputWindow;
 }
 
+static inline uint32_t
+InputWindowHashString(uint32_t hash, const char* str)
+{
+    for (; *str; str++) {
+        hash ^= (unsigned char) *str;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static inline uint32_t
+InputWindowHashInt(uint32_t hash, uint32_t value)
+{
+    hash ^= value;
+    hash *= 16777619;
+    return hash;
+}
+
+static void
+InputWindowArrowPosition(InputWindow* inputWindow, unsigned int contentWidth,
+                         boolean prev, int* x, int* y)
+{
+    FcitxXlibWindow* window = &inputWindow->parent;
+    FcitxSkin* sc = &window->owner->skin;
+    int arrowX = prev ? sc->skinInputBar.iBackArrowX : sc->skinInputBar.iForwardArrowX;
+    int arrowY = prev ? sc->skinInputBar.iBackArrowY : sc->skinInputBar.iForwardArrowY;
+    *x = contentWidth - arrowX + window->background->marginRight - window->background->marginLeft;
+    *y = arrowY - window->background->marginTop;
+}
+
+/*
+ * compare what is going to be drawn with last time, only changed strings,
+ * cursor and page arrows need to be painted again.
+ */
+static void
+InputWindowUpdateDamage(InputWindow* inputWindow, int count, FcitxRect* rects,
+                        uint32_t* hashes, FcitxRect* cursorRect,
+                        uint32_t arrowState, unsigned int contentWidth)
+{
+    FcitxXlibWindow* window = &inputWindow->parent;
+    FcitxSkin* sc = &window->owner->skin;
+    FcitxDamageAddChangedItems(&window->damage, inputWindow->itemCount,
+                               inputWindow->itemRect, inputWindow->itemHash,
+                               count, rects, hashes);
+    FcitxDamageAddChangedItems(&window->damage, 1, &inputWindow->cursorRect, NULL,
+                               1, cursorRect, NULL);
+
+    if (arrowState != inputWindow->arrowState) {
+        SkinImage* prev = LoadImage(sc, sc->skinInputBar.backArrow, false);
+        SkinImage* next = LoadImage(sc, sc->skinInputBar.forwardArrow, false);
+        if (prev && next) {
+            FcitxRect rect;
+            InputWindowArrowPosition(inputWindow, contentWidth, true, &rect.x1, &rect.y1);
+            rect.x2 = rect.x1 + cairo_image_surface_get_width(prev->image);
+            rect.y2 = rect.y1 + cairo_image_surface_get_height(prev->image);
+            FcitxXlibWindowAddDamage(window, rect);
+            InputWindowArrowPosition(inputWindow, contentWidth, false, &rect.x1, &rect.y1);
+            rect.x2 = rect.x1 + cairo_image_surface_get_width(next->image);
+            rect.y2 = rect.y1 + cairo_image_surface_get_height(next->image);
+            FcitxXlibWindowAddDamage(window, rect);
+        }
+    }
+
+    memcpy(inputWindow->itemRect, rects, sizeof(FcitxRect) * count);
+    memcpy(inputWindow->itemHash, hashes, sizeof(uint32_t) * count);
+    inputWindow->itemCount = count;
+    inputWindow->cursorRect = *cursorRect;
+    inputWindow->arrowState = arrowState;
+}
+
+static inline void
+InputWindowAddItem(FcitxRect* rects, uint32_t* hashes, int* count,
+                   int x, int y, int width, int height,
+                   const char* str, uint32_t state)
+{
+    /* glyph may go a little beyond its logical size */
+    rects[*count].x1 = x - 2;
+    rects[*count].y1 = y - 2;
+    rects[*count].x2 = x + width + 2;
+    rects[*count].y2 = y + height + 2;
+    hashes[*count] = InputWindowHashInt(InputWindowHashString(2166136261u, str), state);
+    (*count)++;
+}
+
 void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* width, unsigned int* height)
 {
     InputWindow* inputWindow = (InputWindow*) window;
@@ -97,7 +182,13 @@ void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* widt
     FcitxCandidateLayoutHint layout = FcitxCandidateWordGetLayoutHint(candList);
     FcitxClassicUI* classicui = window->owner;
 
-    inputWindow->cursorPos = FcitxUINewMessageToOldStyleMessage(instance, inputWindow->msgUp, inputWindow->msgDown);
+    FcitxUIRenderModel* model = inputWindow->model;
+    FcitxUIRenderModelUpdate(instance, model);
+    inputWindow->msgUp = FcitxUIRenderModelGetMessages(model, true);
+    inputWindow->msgDown = FcitxUIRenderModelGetMessages(model, false);
+    inputWindow->strUp = FcitxUIRenderModelGetFilteredStrings(model, true);
+    inputWindow->strDown = FcitxUIRenderModelGetFilteredStrings(model, false);
+    inputWindow->cursorPos = FcitxUIRenderModelGetCursorPos(model);
 
     boolean vertical = window->owner->bVerticalList;
     if (layout == CLH_Vertical)
@@ -124,22 +215,19 @@ void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* widt
     int outputHeight = 0;
     int iChar = inputWindow->cursorPos;
     int strWidth = 0, strHeight = 0;
+    FcitxRect itemRect[MAX_MESSAGE_COUNT * 2];
+    uint32_t itemHash[MAX_MESSAGE_COUNT * 2];
+    int itemCount = 0;
 
     inputWidth = 0;
     int dpi = sc->skinFont.respectDPI? classicui->dpi : 0;
     FCITX_UNUSED(dpi);
 
-    FcitxCairoTextContext* ctc = FcitxCairoTextContextCreate(NULL);
-    FcitxCairoTextContextSet(ctc, window->owner->font, window->owner->fontSize > 0 ? window->owner->fontSize : sc->skinFont.fontSize, dpi);
+    FcitxCairoTextContext* ctc = ClassicUIGetTextContext(&classicui->inputTextContext, window->owner->font, window->owner->fontSize > 0 ? window->owner->fontSize : sc->skinFont.fontSize, dpi);
 
     int fontHeight = FcitxCairoTextContextFontHeight(ctc);
     inputWindow->fontHeight = fontHeight;
     for (i = 0; i < FcitxMessagesGetMessageCount(msgup) ; i++) {
-        char *trans = FcitxInstanceProcessOutputFilter(instance, FcitxMessagesGetMessageString(msgup, i));
-        if (trans)
-            strUp[i] = trans;
-        else
-            strUp[i] = FcitxMessagesGetMessageString(msgup, i);
         posUpX[i] = inputWidth;
 
         FcitxCairoTextContextStringSize(ctc, strUp[i], &strWidth, &strHeight);
@@ -148,6 +236,9 @@ void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* widt
             posUpY[i] = sc->skinInputBar.iInputPos + fontHeight - strHeight;
         else
             posUpY[i] = sc->skinInputBar.iInputPos - strHeight;
+        InputWindowAddItem(itemRect, itemHash, &itemCount, posUpX[i], posUpY[i],
+                           strWidth, strHeight, strUp[i],
+                           FcitxMessagesGetMessageType(msgup, i));
         inputWidth += strWidth;
         if (FcitxInputStateGetShowCursor(input)) {
             int length = strlen(FcitxMessagesGetMessageString(msgup, i));
@@ -185,12 +276,6 @@ void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* widt
     int candidateIndex = -1;
     int lastRightBottomX = 0, lastRightBottomY = 0;
     for (i = 0; i < FcitxMessagesGetMessageCount(msgdown) ; i++) {
-        char *trans = FcitxInstanceProcessOutputFilter(instance, FcitxMessagesGetMessageString(msgdown, i));
-        if (trans)
-            strDown[i] = trans;
-        else
-            strDown[i] = FcitxMessagesGetMessageString(msgdown, i);
-
         if (vertical) { /* vertical */
             if (FcitxMessagesGetMessageType(msgdown, i) == MSG_INDEX) {
                 if (currentX > outputWidth)
@@ -225,6 +310,11 @@ void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* widt
             }
         }
 
+        InputWindowAddItem(itemRect, itemHash, &itemCount, posDownX[i], posDownY[i],
+                           strWidth, strHeight, strDown[i],
+                           (FcitxMessagesGetMessageType(msgdown, i) << 1)
+                           | (CANDIDATE_HIGHLIGHT(candidateIndex) == inputWindow->highlight));
+
         lastRightBottomX = posDownX[i] + strWidth;
         lastRightBottomY = posDownY[i] + strHeight;
     }
@@ -250,7 +340,27 @@ void InputWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* widt
         newWidth = (newWidth < INPUT_BAR_HMIN_WIDTH) ? INPUT_BAR_HMIN_WIDTH : newWidth;
     }
 
-    FcitxCairoTextContextFree(ctc);
+    FcitxRect cursorRect = { 0, 0, 0, 0 };
+    if (FcitxMessagesGetMessageCount(msgup) && FcitxInputStateGetShowCursor(input)) {
+        cursorRect.x1 = pixelCursorPos - 1;
+        cursorRect.x2 = pixelCursorPos + 2;
+        if (sc->skinFont.respectDPI) {
+            cursorRect.y1 = sc->skinInputBar.iInputPos;
+            cursorRect.y2 = sc->skinInputBar.iInputPos + fontHeight;
+        } else {
+            cursorRect.y1 = sc->skinInputBar.iInputPos - fontHeight;
+            cursorRect.y2 = sc->skinInputBar.iInputPos;
+        }
+    }
+    uint32_t arrowState = 0;
+    if (FcitxCandidateWordHasPrev(candList) || FcitxCandidateWordHasNext(candList)) {
+        arrowState = (1 << 0) | (FcitxCandidateWordHasPrev(candList) << 1)
+            | (FcitxCandidateWordHasNext(candList) << 2)
+            | ((inputWindow->highlight == PREVNEXT_HIGHLIGHT(true)) << 3)
+            | ((inputWindow->highlight == PREVNEXT_HIGHLIGHT(false)) << 4);
+    }
+    InputWindowUpdateDamage(inputWindow, itemCount, itemRect, itemHash,
+                            &cursorRect, arrowState, newWidth);
 
     *width = newWidth;
     *height = newHeight;
@@ -309,6 +419,7 @@ boolean InputWindowEventHandler(void *arg, XEvent* event)
             }
             break;
         case Expose:
+            FcitxXlibWindowDamageAll(&inputWindow->parent);
             FcitxXlibWindowPaint(&inputWindow->parent);
             break;
         case ButtonPress:
@@ -401,13 +512,13 @@ void InputWindowMoveWindow(FcitxXlibWindow* window)
 
 void InputWindowClose(InputWindow* inputWindow)
 {
-    XUnmapWindow(inputWindow->parent.owner->dpy, inputWindow->parent.wId);
+    FcitxXlibWindowUnmap(&inputWindow->parent);
 }
 
 void InputWindowReload(void* arg, boolean enabled)
 {
     InputWindow* inputWindow = (InputWindow*) arg;
-    boolean visable = WindowIsVisable(inputWindow->parent.owner->dpy, inputWindow->parent.wId);
+    boolean visable = inputWindow->parent.mapped;
     FcitxXlibWindowDestroy(&inputWindow->parent);
 
     InputWindowInit(inputWindow);
@@ -418,10 +529,17 @@ void InputWindowReload(void* arg, boolean enabled)
 
 void InputWindowShow(InputWindow* inputWindow)
 {
-    if (!WindowIsVisable(inputWindow->parent.owner->dpy, inputWindow->parent.wId))
+    FcitxSkin* sc = &inputWindow->parent.owner->skin;
+    if (!inputWindow->parent.mapped)
         InputWindowMoveWindow(&inputWindow->parent);
-    XMapRaised(inputWindow->parent.owner->dpy, inputWindow->parent.wId);
-    FcitxXlibWindowPaint(&inputWindow->parent);
+    FcitxXlibWindowMap(&inputWindow->parent);
+    if (sc->firstPaintReported) {
+        FcitxXlibWindowPaint(&inputWindow->parent);
+    } else {
+        double start = SkinPreloadTimestamp();
+        FcitxXlibWindowPaint(&inputWindow->parent);
+        SkinPreloadReportFirstPaint(sc, SkinPreloadTimestamp() - start);
+    }
 }
 
 void InputWindowPaint(FcitxXlibWindow* window, cairo_t* c)
@@ -454,8 +572,7 @@ void InputWindowPaint(FcitxXlibWindow* window, cairo_t* c)
     ) {
         if (prev && next) {
             int x, y;
-            x = window->contentWidth - sc->skinInputBar.iBackArrowX + window->background->marginRight - window->background->marginLeft;
-            y = sc->skinInputBar.iBackArrowY - window->background->marginTop;
+            InputWindowArrowPosition(inputWindow, window->contentWidth, true, &x, &y);
             cairo_set_source_surface(c, prev->image, x, y);
             if (FcitxCandidateWordHasPrev(candList)) {
                 inputWindow->prevRect.x1 = x;
@@ -473,8 +590,7 @@ void InputWindowPaint(FcitxXlibWindow* window, cairo_t* c)
                 cairo_paint_with_alpha(c, 0.3);
             }
 
-            x = window->contentWidth - sc->skinInputBar.iForwardArrowX + window->background->marginRight - window->background->marginLeft;
-            y = sc->skinInputBar.iForwardArrowY - window->background->marginTop;
+            InputWindowArrowPosition(inputWindow, window->contentWidth, false, &x, &y);
             cairo_set_source_surface(c, next->image, x, y);
             if (FcitxCandidateWordHasNext(candList)) {
                 inputWindow->nextRect.x1 = x;
@@ -502,8 +618,6 @@ void InputWindowPaint(FcitxXlibWindow* window, cairo_t* c)
     int i;
     for (i = 0; i < FcitxMessagesGetMessageCount(msgup) ; i++) {
         FcitxCairoTextContextOutputString(ctc, strUp[i], posUpX[i], posUpY[i], &sc->skinFont.fontColor[FcitxMessagesGetMessageType(msgup, i) % 7]);
-        if (strUp[i] != FcitxMessagesGetMessageString(msgup, i))
-            free(strUp[i]);
     }
 
     int candidateIndex = -1;
@@ -525,8 +639,6 @@ void InputWindowPaint(FcitxXlibWindow* window, cairo_t* c)
         cairo_set_source_rgba(c, color.r, color.g, color.b, alpha);
 
         FcitxCairoTextContextOutputString(ctc, strDown[i], posDownX[i], posDownY[i], NULL);
-        if (strDown[i] != FcitxMessagesGetMessageString(msgdown, i))
-            free(strDown[i]);
     }
     FcitxCairoTextContextFree(ctc);
 
@@ -54,14 +54,15 @@ typedef struct _InputWindow {
     int     iOffsetX;
     int     iOffsetY;
 
+    FcitxUIRenderModel* model;
     FcitxMessages* msgUp;
     FcitxMessages* msgDown;
     int cursorPos;
     boolean vertical;
 
     /* cached data */
-    char *strUp[MAX_MESSAGE_COUNT];
-    char *strDown[MAX_MESSAGE_COUNT];
+    char **strUp;
+    char **strDown;
     int posUpX[MAX_MESSAGE_COUNT], posUpY[MAX_MESSAGE_COUNT];
     FcitxRect candRect[10];
     int posDownX[MAX_MESSAGE_COUNT], posDownY[MAX_MESSAGE_COUNT];
@@ -69,6 +70,13 @@ typedef struct _InputWindow {
     int pixelCursorPos;
     FcitxRect prevRect, nextRect;
     uint32_t highlight;
+
+    /* what is drawn last time, to find out the damaged area */
+    FcitxRect itemRect[MAX_MESSAGE_COUNT * 2];
+    uint32_t itemHash[MAX_MESSAGE_COUNT * 2];
+    int itemCount;
+    FcitxRect cursorRect;
+    uint32_t arrowState;
 } InputWindow;
 
 InputWindow* InputWindowCreate(struct _FcitxClassicUI* classicui);
@@ -88,6 +88,9 @@ void MainWindowInit(MainWindow* mainWindow)
                         MainWindowCalculateContentSize,
                         MainWindowPaint
     );
+    /* content is only drawn again when a status changes */
+    window->trackDamage = true;
+    mainWindow->statusHash = 0;
 }
 
 MainWindow* MainWindowCreate(FcitxClassicUI* classicui)
@@ -116,12 +119,95 @@ void MainWindowShow(MainWindow* mainWindow)
     }
 }
 
+static inline uint32_t
+MainWindowHashString(uint32_t hash, const char* str)
+{
+    if (!str)
+        str = "";
+    for (; *str; str++) {
+        hash ^= (unsigned char) *str;
+        hash *= 16777619;
+    }
+    hash ^= 0xff;
+    hash *= 16777619;
+    return hash;
+}
+
+static inline uint32_t
+MainWindowHashInt(uint32_t hash, uint32_t value)
+{
+    hash ^= value;
+    hash *= 16777619;
+    return hash;
+}
+
+/* everything the layout and the drawn icons of main window depend on */
+static uint32_t
+MainWindowStatusHash(MainWindow* mainWindow)
+{
+    FcitxClassicUI* classicui = mainWindow->parent.owner;
+    FcitxInstance *instance = classicui->owner;
+    FcitxIM* im = FcitxInstanceGetCurrentIM(instance);
+    uint32_t hash = 2166136261u;
+
+    hash = MainWindowHashInt(hash, MainWindowShouldShow(mainWindow));
+    hash = MainWindowHashInt(hash, classicui->epoch);
+    hash = MainWindowHashInt(hash, FcitxInstanceGetCurrentStatev2(instance));
+    hash = MainWindowHashString(hash, im ? im->uniqueName : NULL);
+    hash = MainWindowHashString(hash, im ? im->strIconName : NULL);
+    hash = MainWindowHashString(hash, im ? im->langCode : NULL);
+    hash = MainWindowHashInt(hash, mainWindow->logostat.mouse);
+    hash = MainWindowHashInt(hash, mainWindow->imiconstat.mouse);
+
+    FcitxUIComplexStatus* compstatus;
+    UT_array* uicompstats = FcitxInstanceGetUIComplexStats(instance);
+    for (compstatus = (FcitxUIComplexStatus*) utarray_front(uicompstats);
+            compstatus != NULL;
+            compstatus = (FcitxUIComplexStatus*) utarray_next(uicompstats, compstatus)
+        ) {
+        FcitxClassicUIStatus* privstat = GetPrivateStatus(compstatus);
+        hash = MainWindowHashInt(hash, compstatus->visible);
+        if (!compstatus->visible)
+            continue;
+        hash = MainWindowHashString(hash, compstatus->getIconName(compstatus->arg));
+        hash = MainWindowHashString(hash, compstatus->shortDescription);
+        hash = MainWindowHashInt(hash, privstat ? privstat->mouse : 0);
+    }
+
+    FcitxUIStatus* status;
+    UT_array* uistats = FcitxInstanceGetUIStats(instance);
+    for (status = (FcitxUIStatus*) utarray_front(uistats);
+            status != NULL;
+            status = (FcitxUIStatus*) utarray_next(uistats, status)
+        ) {
+        FcitxClassicUIStatus* privstat = GetPrivateStatus(status);
+        hash = MainWindowHashInt(hash, status->visible);
+        if (!status->visible)
+            continue;
+        hash = MainWindowHashInt(hash, status->getCurrentStatus(status->arg));
+        hash = MainWindowHashString(hash, status->shortDescription);
+        hash = MainWindowHashInt(hash, privstat ? privstat->mouse : 0);
+    }
+    return hash;
+}
+
 void MainWindowCalculateContentSize(FcitxXlibWindow* window, unsigned int* width, unsigned int* height)
 {
+    MainWindow* mainWindow = (MainWindow*) window;
     FcitxClassicUI* classicui = window->owner;
     FcitxSkin *sc = &window->owner->skin;
     FcitxInstance *instance = window->owner->owner;
 
+    /* nothing changed, keep the layout and what is drawn */
+    uint32_t hash = MainWindowStatusHash(mainWindow);
+    if (!window->damage.full && hash == mainWindow->statusHash) {
+        *width = window->contentWidth;
+        *height = window->contentHeight;
+        return;
+    }
+    mainWindow->statusHash = hash;
+    FcitxXlibWindowDamageAll(window);
+
     FcitxUIStatus* status;
     UT_array* uistats = FcitxInstanceGetUIStats(instance);
     for (status = (FcitxUIStatus*) utarray_front(uistats);
@@ -538,6 +624,7 @@ boolean MainWindowEventHandler(void *arg, XEvent* event)
     if (event->xany.window == window->wId) {
         switch (event->type) {
         case Expose:
+            FcitxXlibWindowDamageAll(&mainWindow->parent);
             FcitxXlibWindowPaint(&mainWindow->parent);
             break;
         case MotionNotify:
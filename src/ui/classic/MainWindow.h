@@ -49,6 +49,8 @@ typedef struct _MainWindow {
     FcitxXlibWindow parent;
     FcitxClassicUIStatus logostat;
     FcitxClassicUIStatus imiconstat;
+    /* status values and skin epoch the drawn content is laid out with */
+    uint32_t statusHash;
 } MainWindow;
 
 MainWindow* MainWindowCreate(FcitxClassicUI* classicui);
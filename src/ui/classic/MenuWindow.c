@@ -75,10 +75,8 @@ void XlibMenuInit(XlibMenu* menu)
 
     int dpi = sc->skinFont.respectDPI? classicui->dpi: 0;
 
-    FcitxCairoTextContext* ctc = FcitxCairoTextContextCreate(NULL);
-    FcitxCairoTextContextSet(ctc, classicui->menuFont, sc->skinFont.menuFontSize, dpi);
+    FcitxCairoTextContext* ctc = ClassicUIGetTextContext(&classicui->menuTextContext, classicui->menuFont, sc->skinFont.menuFontSize, dpi);
     menu->fontheight = FcitxCairoTextContextFontHeight(ctc);
-    FcitxCairoTextContextFree(ctc);
 }
 
 
@@ -268,8 +266,7 @@ void XlibMenuCalculateContentSize(FcitxXlibWindow* window, unsigned int* width,
     FcitxSkin *sc = &classicui->skin;
     int dpi = sc->skinFont.respectDPI? classicui->dpi: 0;
 
-    FcitxCairoTextContext* ctc = FcitxCairoTextContextCreate(NULL);
-    FcitxCairoTextContextSet(ctc, classicui->menuFont, sc->skinFont.menuFontSize, dpi);
+    FcitxCairoTextContext* ctc = ClassicUIGetTextContext(&classicui->menuTextContext, classicui->menuFont, sc->skinFont.menuFontSize, dpi);
 
     for (i = 0; i < utarray_len(&menu->menushell->shell); i++) {
         if (GetMenuItem(menu->menushell, i)->type == MENUTYPE_SIMPLE || GetMenuItem(menu->menushell, i)->type == MENUTYPE_SUBMENU)
@@ -282,8 +279,6 @@ void XlibMenuCalculateContentSize(FcitxXlibWindow* window, unsigned int* width,
             menuwidth = width;
     }
 
-    FcitxCairoTextContextFree(ctc);
-
     /* region for mark and arrow */
     menuwidth += 15 + 20;
 
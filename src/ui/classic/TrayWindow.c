@@ -126,6 +126,7 @@ void TrayWindowRelease(TrayWindow *trayWindow)
     trayWindow->window = None;
     trayWindow->cs = NULL;
     trayWindow->cs_x = NULL;
+    trayWindow->drawnIcon = NULL;
 }
 
 void TrayWindowDraw(TrayWindow* trayWindow)
@@ -161,38 +162,49 @@ void TrayWindowDraw(TrayWindow* trayWindow)
     }
     png_surface = image->image;
 
-    c = cairo_create(trayWindow->cs);
-    cairo_set_source_rgba(c, 1, 1, 1, 0);
-    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
-    cairo_paint(c);
+    /* icon in cs is still the same, only copy it to the window again */
+    if (png_surface != trayWindow->drawnIcon
+        || image->serial != trayWindow->drawnSerial
+        || trayWindow->size != trayWindow->drawnSize
+        || classicui->epoch != trayWindow->drawnEpoch) {
+        c = cairo_create(trayWindow->cs);
+        cairo_set_source_rgba(c, 1, 1, 1, 0);
+        cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(c);
 
-    do {
-        if (png_surface) {
-            int w = cairo_image_surface_get_width(png_surface);
-            int h = cairo_image_surface_get_height(png_surface);
-            if (w == 0 || h == 0)
-                break;
-            double scaleW = 1.0, scaleH = 1.0;
-            if (w > trayWindow->size || h > trayWindow->size)
-            {
-                scaleW = ((double) trayWindow->size) / w;
-                scaleH = ((double) trayWindow->size) / h;
-                if (scaleW > scaleH)
-                    scaleH = scaleW;
-                else
-                    scaleW = scaleH;
+        do {
+            if (png_surface) {
+                int w = cairo_image_surface_get_width(png_surface);
+                int h = cairo_image_surface_get_height(png_surface);
+                if (w == 0 || h == 0)
+                    break;
+                double scaleW = 1.0, scaleH = 1.0;
+                if (w > trayWindow->size || h > trayWindow->size)
+                {
+                    scaleW = ((double) trayWindow->size) / w;
+                    scaleH = ((double) trayWindow->size) / h;
+                    if (scaleW > scaleH)
+                        scaleH = scaleW;
+                    else
+                        scaleW = scaleH;
+                }
+                int aw = scaleW * w;
+                int ah = scaleH * h;
+
+                cairo_scale(c, scaleW, scaleH);
+                cairo_set_source_surface(c, png_surface, (trayWindow->size - aw) / 2 , (trayWindow->size - ah) / 2);
+                cairo_set_operator(c, CAIRO_OPERATOR_OVER);
+                cairo_paint_with_alpha(c, 1);
             }
-            int aw = scaleW * w;
-            int ah = scaleH * h;
+        } while(0);
 
-            cairo_scale(c, scaleW, scaleH);
-            cairo_set_source_surface(c, png_surface, (trayWindow->size - aw) / 2 , (trayWindow->size - ah) / 2);
-            cairo_set_operator(c, CAIRO_OPERATOR_OVER);
-            cairo_paint_with_alpha(c, 1);
-        }
-    } while(0);
+        cairo_destroy(c);
 
-    cairo_destroy(c);
+        trayWindow->drawnIcon = png_surface;
+        trayWindow->drawnSerial = image->serial;
+        trayWindow->drawnSize = trayWindow->size;
+        trayWindow->drawnEpoch = classicui->epoch;
+    }
 
     XVisualInfo* vi = trayWindow->visual.visual ? &trayWindow->visual : NULL;
     if (!(vi && vi->visual)) {
@@ -48,6 +48,12 @@ typedef struct _TrayWindow {
     int size;
     struct _FcitxClassicUI* owner;
     Window dockWindow;
+
+    /* icon drawn in cs, it is not drawn again if nothing changed */
+    cairo_surface_t *drawnIcon;
+    unsigned int drawnSerial;
+    int drawnSize;
+    unsigned int drawnEpoch;
 } TrayWindow;
 
 TrayWindow* TrayWindowCreate(struct _FcitxClassicUI *classicui);
@@ -1,8 +1,28 @@
 #include "XlibWindow.h"
 #include "classicui.h"
 #include <cairo-xlib.h>
+#include <time.h>
 #include <X11/extensions/shape.h>
 
+/* X window grows by this, so most width changes don't resize it */
+#define XLIB_WINDOW_SIZE_STEP 64
+/* seconds a window stays larger than needed before it is shrunk */
+#define XLIB_WINDOW_SHRINK_DELAY 5.0
+
+static inline double
+XlibWindowTimestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline unsigned int
+XlibWindowAllocSize(unsigned int size)
+{
+    return (size + XLIB_WINDOW_SIZE_STEP - 1) / XLIB_WINDOW_SIZE_STEP * XLIB_WINDOW_SIZE_STEP;
+}
+
 void* FcitxXlibWindowCreate(FcitxClassicUI* classicui, size_t size)
 {
     FcitxXlibWindow* window = fcitx_utils_malloc0(size);
@@ -35,8 +55,10 @@ void FcitxXlibWindowInit(FcitxXlibWindow* window,
     window->MoveWindow = moveWindow;
     window->CalculateContentSize = calculateContentSize;
     window->paintContent = paintContent;
-    window->oldContentHeight = 0;
-    window->oldContentWidth = 0;
+    window->shrinkTime = 0;
+    window->mapped = false;
+    FcitxDamageReset(&window->damage);
+    FcitxDamageAll(&window->damage);
 
     SkinImage *back = NULL;
 
@@ -75,10 +97,10 @@ void FcitxXlibWindowInit(FcitxXlibWindow* window,
                                 vs, attribmask,
                                 &attrib);
 
+    window->allocWidth = window->width;
+    window->allocHeight = window->height;
     window->xlibSurface = cairo_xlib_surface_create(dpy, window->wId, vs, window->width, window->height);
     window->contentSurface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, window->width, window->height);
-    window->backgroundSurface = cairo_surface_create_similar(window->contentSurface, CAIRO_CONTENT_COLOR_ALPHA,
-                                                                    window->width, window->height);
 
     XSelectInput(dpy, window->wId, inputMask);
 
@@ -99,11 +121,84 @@ FcitxRect RectUnion(FcitxRect rt1, FcitxRect rt2)
     return rt;
 }
 
+void FcitxXlibWindowAddDamage(FcitxXlibWindow* window, FcitxRect rect)
+{
+    FcitxDamageAdd(&window->damage, rect);
+}
+
+void FcitxXlibWindowDamageAll(FcitxXlibWindow* window)
+{
+    FcitxDamageAll(&window->damage);
+}
+
+/*
+ * mapped state is tracked here, asking X server costs a round trip. A mapped
+ * window is still raised, to stay above popups opened after it.
+ */
+void FcitxXlibWindowMap(FcitxXlibWindow* window)
+{
+    if (window->mapped) {
+        XRaiseWindow(window->owner->dpy, window->wId);
+        return;
+    }
+    XMapRaised(window->owner->dpy, window->wId);
+    window->mapped = true;
+}
+
+void FcitxXlibWindowUnmap(FcitxXlibWindow* window)
+{
+    if (!window->mapped)
+        return;
+    XUnmapWindow(window->owner->dpy, window->wId);
+    window->mapped = false;
+}
+
+/*
+ * decide the size of X window, return true if it need to be resized.
+ * without XShape the window can't be larger than its content.
+ */
+static boolean
+XlibWindowUpdateAllocSize(FcitxXlibWindow* window, unsigned int width, unsigned int height)
+{
+    unsigned int allocWidth = window->allocWidth;
+    unsigned int allocHeight = window->allocHeight;
+    if (!window->owner->hasXShape) {
+        allocWidth = width;
+        allocHeight = height;
+    } else if (width > allocWidth || height > allocHeight) {
+        allocWidth = FCITX_MAX(allocWidth, XlibWindowAllocSize(width));
+        allocHeight = FCITX_MAX(allocHeight, XlibWindowAllocSize(height));
+        window->shrinkTime = 0;
+    } else if (XlibWindowAllocSize(width) < allocWidth
+               || XlibWindowAllocSize(height) < allocHeight) {
+        double now = XlibWindowTimestamp();
+        if (window->shrinkTime == 0) {
+            window->shrinkTime = now;
+        } else if (now - window->shrinkTime >= XLIB_WINDOW_SHRINK_DELAY) {
+            allocWidth = XlibWindowAllocSize(width);
+            allocHeight = XlibWindowAllocSize(height);
+            window->shrinkTime = 0;
+            /* the content surface is shrunk together with the window */
+            cairo_surface_destroy(window->contentSurface);
+            window->contentSurface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, allocWidth, allocHeight);
+        }
+    } else {
+        window->shrinkTime = 0;
+    }
+
+    if (allocWidth == window->allocWidth && allocHeight == window->allocHeight)
+        return false;
+    window->allocWidth = allocWidth;
+    window->allocHeight = allocHeight;
+    return true;
+}
+
 void FcitxXlibWindowPaintBackground(FcitxXlibWindow* window,
                                     cairo_t* c,
                                     unsigned int offX, unsigned int offY,
                                     unsigned int contentWidth, unsigned int contentHeight,
-                                    unsigned int overlayX, unsigned int overlayY
+                                    unsigned int overlayX, unsigned int overlayY,
+                                    boolean updateShape
                                    )
 {
     FcitxClassicUI* classicui = window->owner;
@@ -124,35 +219,11 @@ void FcitxXlibWindowPaintBackground(FcitxXlibWindow* window,
         backgrondWidth += window->background->marginLeft + window->background->marginRight;
         backgrondHeight += window->background->marginTop + window->background->marginBottom;
 
-        if (window->epoch != classicui->epoch || window->oldContentWidth != contentWidth || window->oldContentHeight != contentHeight) {
-            window->epoch = classicui->epoch;
-            window->oldContentHeight = contentHeight;
-            window->oldContentWidth = contentWidth;
-
-            EnlargeCairoSurface(&window->backgroundSurface, backgrondWidth, backgrondHeight);
-
-            cairo_t* backgroundcr = cairo_create(window->backgroundSurface);
-            DrawResizableBackground(backgroundcr,
-                                    back->image,
-                                    backgrondWidth, backgrondHeight,
-                                    window->background->marginLeft,
-                                    window->background->marginTop,
-                                    window->background->marginRight,
-                                    window->background->marginBottom,
-                                    window->background->fillV,
-                                    window->background->fillH
-                                );
-            cairo_destroy(backgroundcr);
-            cairo_surface_flush(window->backgroundSurface);
-        }
-
         cairo_save(c);
         cairo_translate(c, offX, offY);
-        cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
-        cairo_set_source_surface(c, window->backgroundSurface, 0, 0);
-        cairo_rectangle(c, 0, 0, backgrondWidth, backgrondHeight);
-        cairo_clip(c);
-        cairo_paint(c);
+        DrawCachedBackground(&window->backgroundCache, classicui->epoch, c,
+                             back->image, window->background,
+                             backgrondWidth, backgrondHeight);
         cairo_restore(c);
 
     } while (0);
@@ -173,7 +244,7 @@ void FcitxXlibWindowPaintBackground(FcitxXlibWindow* window,
         cairo_restore(c);
     } while (0);
 
-    if (classicui->hasXShape) {
+    if (classicui->hasXShape && updateShape) {
         if (overlay
             || window->background->clickMarginLeft != 0
             || window->background->clickMarginRight != 0
@@ -196,6 +267,40 @@ void FcitxXlibWindowPaintBackground(FcitxXlibWindow* window,
     }
 }
 
+typedef struct _XlibWindowPaintArg {
+    FcitxXlibWindow* window;
+    unsigned int offX, offY;
+    int contentX, contentY;
+    unsigned int contentWidth, contentHeight;
+    unsigned int overlayX, overlayY;
+    SkinImage* overlayImage;
+} XlibWindowPaintArg;
+
+static void
+XlibWindowPaintContent(cairo_t* c, boolean full, void* data)
+{
+    XlibWindowPaintArg* arg = data;
+    FcitxXlibWindow* window = arg->window;
+    FcitxXlibWindowPaintBackground(window, c, arg->offX, arg->offY, arg->contentWidth, arg->contentHeight, arg->overlayX, arg->overlayY, full);
+
+    if (arg->overlayImage) {
+        cairo_save(c);
+        cairo_set_operator(c, CAIRO_OPERATOR_OVER);
+        cairo_set_source_surface(c, arg->overlayImage->image, arg->overlayX, arg->overlayY);
+        cairo_paint(c);
+        cairo_restore(c);
+    }
+
+    window->contentX = arg->contentX;
+    window->contentY = arg->contentY;
+    window->contentWidth = arg->contentWidth;
+    window->contentHeight = arg->contentHeight;
+    cairo_save(c);
+    cairo_translate(c, window->contentX, window->contentY);
+    window->paintContent(window, c);
+    cairo_restore(c);
+}
+
 void FcitxXlibWindowPaint(FcitxXlibWindow* window)
 {
     FcitxClassicUI* classicui = window->owner;
@@ -258,55 +363,56 @@ void FcitxXlibWindowPaint(FcitxXlibWindow* window)
         height = 1;
     }
 
-    EnlargeCairoSurface(&window->contentSurface, width, height);
-    cairo_t* c = cairo_create(window->contentSurface);
-    FcitxXlibWindowPaintBackground(window, c, offX, offY, contentWidth, contentHeight, overlayX, overlayY);
+    int contentX = offX + (window->background ? window->background->marginLeft : 0);
+    int contentY = offY + (window->background ? window->background->marginTop : 0);
 
-    if (overlayImage) {
-        cairo_save(c);
-        cairo_set_operator(c, CAIRO_OPERATOR_OVER);
-        cairo_set_source_surface(c, overlayImage->image, overlayX, overlayY);
-        cairo_paint(c);
-        cairo_restore(c);
-    }
+    boolean resizeFlag = XlibWindowUpdateAllocSize(window, width, height);
 
-    window->contentX = offX + (window->background ? window->background->marginLeft : 0);
-    window->contentY = offY + (window->background ? window->background->marginTop : 0);
-    window->contentWidth = contentWidth;
-    window->contentHeight = contentHeight;
-    cairo_save(c);
-    cairo_translate(c, window->contentX, window->contentY);
-    window->paintContent(window, c);
-    cairo_restore(c);
-    cairo_destroy(c);
-    cairo_surface_flush(window->contentSurface);
-
-    boolean resizeFlag = false;
-    if (width != oldWidth || height != oldHeight) {
-        resizeFlag = true;
-        window->width = width;
-        window->height = height;
+    /* anything moved, content surface can't be reused */
+    boolean full = !window->trackDamage || window->damage.full || resizeFlag
+        || width != oldWidth || height != oldHeight
+        || contentX != window->contentX || contentY != window->contentY
+        || contentWidth != window->contentWidth || contentHeight != window->contentHeight
+        || window->epoch != classicui->epoch;
+    window->epoch = classicui->epoch;
+
+    XlibWindowPaintArg arg = {
+        window, offX, offY, contentX, contentY, contentWidth, contentHeight,
+        overlayX, overlayY, overlayImage
+    };
+    /* sized like the X window, so it is not enlarged again on every grow step */
+    window->paintedArea = FcitxDamagePaintContent(&window->damage, &window->contentSurface,
+                                                  window->allocWidth, window->allocHeight,
+                                                  contentX, contentY, width, height,
+                                                  full, XlibWindowPaintContent, &arg);
+    if (FcitxDamageIsEmpty(&window->damage)) {
+        window->MoveWindow(window);
+        return;
     }
 
+    boolean sizeChanged = (width != oldWidth || height != oldHeight);
+    window->width = width;
+    window->height = height;
+
     window->MoveWindow(window);
     if (resizeFlag) {
         cairo_xlib_surface_set_size(window->xlibSurface,
-                                    window->width,
-                                    window->height);
+                                    window->allocWidth,
+                                    window->allocHeight);
         XResizeWindow(window->owner->dpy,
                       window->wId,
-                      window->width,
-                      window->height);
+                      window->allocWidth,
+                      window->allocHeight);
+    }
+    /* cheaper than resize, compositor doesn't need a new pixmap for it */
+    if (window->owner->hasXShape && (sizeChanged || resizeFlag)) {
+        XRectangle r = { 0, 0, window->width, window->height };
+        XShapeCombineRectangles(window->owner->dpy, window->wId, ShapeBounding,
+                                0, 0, &r, 1, ShapeSet, Unsorted);
     }
 
-    cairo_t* xlibc = cairo_create(window->xlibSurface);
-    cairo_set_operator(xlibc, CAIRO_OPERATOR_SOURCE);
-    cairo_set_source_surface(xlibc, window->contentSurface, 0, 0);
-    cairo_rectangle(xlibc, 0, 0, window->width, window->height);
-    cairo_clip(xlibc);
-    cairo_paint(xlibc);
-    cairo_destroy(xlibc);
-    cairo_surface_flush(window->xlibSurface);
+    FcitxDamageFlush(&window->damage, window->contentSurface, window->xlibSurface,
+                     contentX, contentY, window->width, window->height);
 }
 
 void FcitxXlibWindowDestroy(FcitxXlibWindow* window)
@@ -315,8 +421,9 @@ void FcitxXlibWindowDestroy(FcitxXlibWindow* window)
         return;
 
     cairo_surface_destroy(window->contentSurface);
-    cairo_surface_destroy(window->backgroundSurface);
+    BackgroundCacheFree(&window->backgroundCache);
     cairo_surface_destroy(window->xlibSurface);
     XDestroyWindow(window->owner->dpy, window->wId);
     window->wId = None;
+    window->mapped = false;
 }
@@ -5,6 +5,8 @@
 #include <X11/Xlib.h>
 
 #include "module/x11/x11stuff.h"
+#include "damage.h"
+#include "skin.h"
 
 struct _FcitxClassicUI;
 
@@ -20,19 +22,34 @@ struct _FcitxXlibWindow {
 
     cairo_surface_t *xlibSurface;
     cairo_surface_t *contentSurface;
-    cairo_surface_t *backgroundSurface;
+    BackgroundCache backgroundCache;
 
     struct _FcitxClassicUI *owner;
     FcitxMoveWindowFunc MoveWindow;
     FcitxCalculateContentSizeFunc CalculateContentSize;
     FcitxPaintContentFunc paintContent;
-    unsigned int oldContentWidth;
-    unsigned int oldContentHeight;
     int contentX;
     int contentY;
     unsigned int contentHeight;
     unsigned int contentWidth;
     unsigned int epoch;
+
+    /*
+     * window reports changed area with FcitxXlibWindowAddDamage from
+     * CalculateContentSize, otherwise every paint redraws everything.
+     */
+    boolean trackDamage;
+    FcitxDamage damage;
+    unsigned int paintedArea; /* pixels drawn by last paint */
+
+    /*
+     * size of X window and xlib surface, with XShape it grows in steps and
+     * shrinks late, the visible part is cut to width and height by shape.
+     */
+    unsigned int allocWidth;
+    unsigned int allocHeight;
+    double shrinkTime; /* when window became larger than needed, 0 if not */
+    boolean mapped;
 };
 
 void* FcitxXlibWindowCreate(struct _FcitxClassicUI* classicui, size_t size);
@@ -49,5 +66,9 @@ void FcitxXlibWindowInit(FcitxXlibWindow* window,
                         );
 void FcitxXlibWindowDestroy(FcitxXlibWindow* window);
 void FcitxXlibWindowPaint(FcitxXlibWindow* window);
+void FcitxXlibWindowAddDamage(FcitxXlibWindow* window, FcitxRect rect);
+void FcitxXlibWindowDamageAll(FcitxXlibWindow* window);
+void FcitxXlibWindowMap(FcitxXlibWindow* window);
+void FcitxXlibWindowUnmap(FcitxXlibWindow* window);
 
 #endif // XLIBWINDOW_H
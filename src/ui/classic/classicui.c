@@ -46,6 +46,7 @@
 #include "fcitx/hook.h"
 #include "fcitx-utils/utils.h"
 #include "module/notificationitem/fcitx-notificationitem.h"
+#include "ui/cairostuff/font.h"
 
 struct _FcitxSkin;
 static boolean MainMenuAction(FcitxUIMenu* menu, int index);
@@ -69,6 +70,7 @@ static void ClassicUIInputReset(void *arg);
 static void ReloadConfigClassicUI(void *arg);
 static void ClassicUISuspend(void *arg);
 static void ClassicUIResume(void *arg);
+static void ClassicUIDestroy(void *arg);
 static void ClassicUIDelayedInitTray(void* arg);
 static void ClassicUIDelayedShowTray(void* arg);
 static void ClassicUINotificationItemAvailable(void* arg, boolean avaiable);
@@ -96,7 +98,7 @@ FCITX_DEFINE_PLUGIN(fcitx_classic_ui, ui, FcitxUI) = {
     ReloadConfigClassicUI,
     ClassicUISuspend,
     ClassicUIResume,
-    NULL,
+    ClassicUIDestroy,
     ClassicUIRegisterComplexStatus,
     ClassicUIUpdateComplexStatus,
     ClassicUIUnRegisterMenu,
@@ -324,6 +326,15 @@ void ClassicUIResume(void* arg)
     ClassicUIDelayedInitTray(classicui);
 }
 
+/* the font cache refresh thread must not outlive the addon */
+void ClassicUIDestroy(void* arg)
+{
+    FCITX_UNUSED(arg);
+#ifndef _ENABLE_PANGO
+    FontCacheFinish();
+#endif
+}
+
 void ClassicUINotificationItemAvailable(void* arg, boolean avaiable) {
     FcitxClassicUI* classicui = (FcitxClassicUI*) arg;
     /* ClassicUISuspend has already done all clean up */
@@ -573,6 +584,14 @@ void ReloadConfigClassicUI(void* arg)
     DisplaySkin(classicui, classicui->skinType);
 }
 
+FcitxCairoTextContext* ClassicUIGetTextContext(FcitxCairoTextContext** ctc, const char* font, int fontSize, int dpi)
+{
+    if (!*ctc)
+        *ctc = FcitxCairoTextContextCreate(NULL);
+    FcitxCairoTextContextSet(*ctc, font, fontSize, dpi);
+    return *ctc;
+}
+
 boolean WindowIsVisable(Display* dpy, Window window)
 {
     XWindowAttributes attr;
@@ -580,27 +599,6 @@ boolean WindowIsVisable(Display* dpy, Window window)
     return attr.map_state == IsViewable;
 }
 
-boolean EnlargeCairoSurface(cairo_surface_t** sur, int w, int h)
-{
-    int ow = cairo_image_surface_get_width(*sur);
-    int oh = cairo_image_surface_get_height(*sur);
-
-    if (ow >= w && oh >= h)
-        return false;
-
-    while (ow < w) {
-        ow *= 2;
-    }
-
-    while (oh < h) {
-        oh *= 2;
-    }
-
-    cairo_surface_destroy(*sur);
-    *sur = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ow, oh);
-    return true;
-}
-
 void ResizeSurface(cairo_surface_t** surface, int w, int h)
 {
     int ow = cairo_image_surface_get_width(*surface);
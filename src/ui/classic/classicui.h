@@ -90,6 +90,10 @@ typedef struct _FcitxClassicUI {
 
     unsigned int epoch;
     uint64_t waitDelayed;
+
+    /* used to measure text, kept so string sizes are cached across repaint */
+    FcitxCairoTextContext* inputTextContext;
+    FcitxCairoTextContext* menuTextContext;
 } FcitxClassicUI;
 
 FcitxRect GetScreenGeometry(FcitxClassicUI* classicui, int x, int y);
@@ -101,8 +105,8 @@ void ActivateWindow(Display *dpy, int iScreen, Window window);
 boolean LoadClassicUIConfig(FcitxClassicUI* classicui);
 void SaveClassicUIConfig(FcitxClassicUI* classicui);
 boolean WindowIsVisable(Display* dpy, Window window);
-boolean EnlargeCairoSurface(cairo_surface_t** sur, int w, int h);
 void ResizeSurface(cairo_surface_t** surface, int w, int h);
+FcitxCairoTextContext* ClassicUIGetTextContext(FcitxCairoTextContext** ctc, const char* font, int fontSize, int dpi);
 
 #define FCITX_MIN(a,b) ((a) < (b)?(a) : (b))
 #define FCITX_MAX(a,b) ((a) > (b)?(a) : (b))
@@ -0,0 +1,192 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include "damage.h"
+
+#define FCITX_MIN(a,b) ((a) < (b)?(a) : (b))
+#define FCITX_MAX(a,b) ((a) > (b)?(a) : (b))
+
+static inline boolean RectIsEmpty(FcitxRect rect)
+{
+    return rect.x2 <= rect.x1 || rect.y2 <= rect.y1;
+}
+
+static inline boolean RectIntersect(FcitxRect rt1, FcitxRect rt2)
+{
+    return rt1.x1 < rt2.x2 && rt2.x1 < rt1.x2
+        && rt1.y1 < rt2.y2 && rt2.y1 < rt1.y2;
+}
+
+static inline boolean RectEqual(const FcitxRect* rt1, const FcitxRect* rt2)
+{
+    return rt1->x1 == rt2->x1 && rt1->y1 == rt2->y1
+        && rt1->x2 == rt2->x2 && rt1->y2 == rt2->y2;
+}
+
+static inline FcitxRect RectUnion(FcitxRect rt1, FcitxRect rt2)
+{
+    FcitxRect rt = {
+        FCITX_MIN(rt1.x1, rt2.x1),
+        FCITX_MIN(rt1.y1, rt2.y1),
+        FCITX_MAX(rt1.x2, rt2.x2),
+        FCITX_MAX(rt1.y2, rt2.y2)
+    };
+    return rt;
+}
+
+void FcitxDamageReset(FcitxDamage* damage)
+{
+    damage->full = false;
+    damage->count = 0;
+}
+
+void FcitxDamageAll(FcitxDamage* damage)
+{
+    damage->full = true;
+}
+
+boolean FcitxDamageIsEmpty(FcitxDamage* damage)
+{
+    return !damage->full && damage->count == 0;
+}
+
+void FcitxDamageAdd(FcitxDamage* damage, FcitxRect rect)
+{
+    if (damage->full || RectIsEmpty(rect))
+        return;
+
+    /* keep rects disjoint, so area is simply the sum */
+    int i = 0;
+    while (i < damage->count) {
+        if (RectIntersect(damage->rects[i], rect)) {
+            rect = RectUnion(rect, damage->rects[i]);
+            damage->rects[i] = damage->rects[--damage->count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (damage->count == FCITX_DAMAGE_MAX_RECT) {
+        for (i = 0; i < damage->count; i++)
+            rect = RectUnion(rect, damage->rects[i]);
+        damage->count = 0;
+    }
+    damage->rects[damage->count++] = rect;
+}
+
+unsigned int FcitxDamageAppendPath(FcitxDamage* damage, cairo_t* c, int x, int y, int width, int height)
+{
+    if (damage->full) {
+        cairo_rectangle(c, 0, 0, width, height);
+        return width * height;
+    }
+
+    unsigned int area = 0;
+    int i;
+    for (i = 0; i < damage->count; i++) {
+        FcitxRect rect = damage->rects[i];
+        rect.x1 = FCITX_MAX(rect.x1 + x, 0);
+        rect.y1 = FCITX_MAX(rect.y1 + y, 0);
+        rect.x2 = FCITX_MIN(rect.x2 + x, width);
+        rect.y2 = FCITX_MIN(rect.y2 + y, height);
+        if (RectIsEmpty(rect))
+            continue;
+        cairo_rectangle(c, rect.x1, rect.y1, rect.x2 - rect.x1, rect.y2 - rect.y1);
+        area += (rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+    }
+    return area;
+}
+
+void FcitxDamageAddChangedItems(FcitxDamage* damage,
+                                int oldCount, const FcitxRect* oldRects, const uint32_t* oldHashes,
+                                int count, const FcitxRect* rects, const uint32_t* hashes)
+{
+    int i;
+    for (i = 0; i < count || i < oldCount; i++) {
+        if (i < count && i < oldCount
+            && (!hashes || hashes[i] == oldHashes[i])
+            && RectEqual(&rects[i], &oldRects[i]))
+            continue;
+        if (i < oldCount)
+            FcitxDamageAdd(damage, oldRects[i]);
+        if (i < count)
+            FcitxDamageAdd(damage, rects[i]);
+    }
+}
+
+boolean EnlargeCairoSurface(cairo_surface_t** sur, int w, int h)
+{
+    int ow = cairo_image_surface_get_width(*sur);
+    int oh = cairo_image_surface_get_height(*sur);
+
+    if (ow >= w && oh >= h)
+        return false;
+
+    while (ow < w) {
+        ow *= 2;
+    }
+
+    while (oh < h) {
+        oh *= 2;
+    }
+
+    cairo_surface_destroy(*sur);
+    *sur = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ow, oh);
+    return true;
+}
+
+unsigned int FcitxDamagePaintContent(FcitxDamage* damage, cairo_surface_t** content,
+                                     int surfaceWidth, int surfaceHeight,
+                                     int x, int y, int width, int height, boolean full,
+                                     FcitxDamagePaintFunc paint, void* arg)
+{
+    /* a new surface has nothing to reuse, never skip this for full */
+    if (EnlargeCairoSurface(content, surfaceWidth, surfaceHeight))
+        full = true;
+    if (full)
+        FcitxDamageAll(damage);
+    if (FcitxDamageIsEmpty(damage))
+        return 0;
+
+    cairo_t* c = cairo_create(*content);
+    unsigned int area = FcitxDamageAppendPath(damage, c, x, y, width, height);
+    cairo_clip(c);
+    paint(c, full, arg);
+    cairo_destroy(c);
+    cairo_surface_flush(*content);
+    return area;
+}
+
+void FcitxDamageFlush(FcitxDamage* damage, cairo_surface_t* content, cairo_surface_t* target,
+                      int x, int y, int width, int height)
+{
+    cairo_t* c = cairo_create(target);
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(c, content, 0, 0);
+    FcitxDamageAppendPath(damage, c, x, y, width, height);
+    cairo_clip(c);
+    cairo_paint(c);
+    cairo_destroy(c);
+    cairo_surface_flush(target);
+    FcitxDamageReset(damage);
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <cairo.h>
+#include "fcitx/fcitx.h"
+#include "module/x11/x11stuff.h"
+
+/* more rects are merged into their bounding box */
+#define FCITX_DAMAGE_MAX_RECT 4
+
+/**
+ * changed area of a window since last paint, in content coordinate
+ **/
+typedef struct _FcitxDamage {
+    boolean full;
+    int count;
+    FcitxRect rects[FCITX_DAMAGE_MAX_RECT];
+} FcitxDamage;
+
+void FcitxDamageReset(FcitxDamage* damage);
+void FcitxDamageAll(FcitxDamage* damage);
+void FcitxDamageAdd(FcitxDamage* damage, FcitxRect rect);
+boolean FcitxDamageIsEmpty(FcitxDamage* damage);
+
+/**
+ * add damaged rects moved by (x, y) and clipped to (0, 0, width, height)
+ * to the path of c, return the pixel area covered.
+ **/
+unsigned int FcitxDamageAppendPath(FcitxDamage* damage, cairo_t* c, int x, int y, int width, int height);
+
+/**
+ * damage items whose rect or hash (if hashes is not NULL) differs from last
+ * paint, both where they were and where they are now.
+ **/
+void FcitxDamageAddChangedItems(FcitxDamage* damage,
+                                int oldCount, const FcitxRect* oldRects, const uint32_t* oldHashes,
+                                int count, const FcitxRect* rects, const uint32_t* hashes);
+
+/**
+ * make *sur at least w x h, return true if it is recreated, the content is
+ * lost in that case.
+ **/
+boolean EnlargeCairoSurface(cairo_surface_t** sur, int w, int h);
+
+/* paint into c, which is clipped to the damage, full if everything is */
+typedef void (*FcitxDamagePaintFunc)(cairo_t* c, boolean full, void* arg);
+
+/**
+ * repaint the damaged part of *content, content is first enlarged to
+ * surfaceWidth x surfaceHeight, which damages everything when it happens.
+ * (x, y, width, height) are the same as FcitxDamageAppendPath. Return the
+ * pixel area painted, the damage is kept for FcitxDamageFlush.
+ **/
+unsigned int FcitxDamagePaintContent(FcitxDamage* damage, cairo_surface_t** content,
+                                     int surfaceWidth, int surfaceHeight,
+                                     int x, int y, int width, int height, boolean full,
+                                     FcitxDamagePaintFunc paint, void* arg);
+
+/**
+ * copy the damaged part of content to target, then reset the damage.
+ **/
+void FcitxDamageFlush(FcitxDamage* damage, cairo_surface_t* content, cairo_surface_t* target,
+                      int x, int y, int width, int height);
+
+#endif
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -48,6 +48,7 @@
 
 #include "classicui.h"
 #include "skin.h"
+#include "skinpreload.h"
 #include "MenuWindow.h"
 #include "InputWindow.h"
 #include "MainWindow.h"
@@ -61,6 +62,8 @@
 #include "fcitx/candidate.h"
 
 static const UT_icd place_icd = { sizeof(SkinPlacement), NULL, NULL, NULL };
+/* never reused, so a text icon is told apart from a freed one at same address */
+static unsigned int textIconSerial = 0;
 
 static boolean SkinMenuAction(FcitxUIMenu* menu, int index);
 static void UpdateSkinMenu(FcitxUIMenu* menu);
@@ -77,6 +80,8 @@ int LoadSkinConfig(FcitxSkin* sc, char** skinType)
     FILE    *fp;
     boolean    isreload = False;
     int ret = 0;
+    if (sc->preload)
+        SkinPreloadCancel(sc);
     if (sc->config.configFile) {
         utarray_done(&sc->skinMainBar.skinPlacement);
         FcitxConfigFree(&sc->config);
@@ -136,6 +141,9 @@ reload:
         fclose(fp);
     sc->skinType = skinType;
 
+    if (ret == 0)
+        SkinPreloadStart(sc);
+
     return ret;
 
 }
@@ -149,6 +157,13 @@ SkinImage* LoadImageWithText(FcitxClassicUI* classicui, FcitxSkin* sc, const cha
         name++;
     }
 
+    SkinImage* cached = NULL;
+    HASH_FIND_STR(sc->imageTable, name, cached);
+    if (cached && cached->textIcon && cached->epoch == classicui->epoch
+        && cached->textWidth == w && cached->textHeight == h
+        && cached->textActive == active && strcmp(cached->text, text) == 0)
+        return cached;
+
     UnloadSingleImage(sc, name);
 
     int len = fcitx_utf8_char_len(text);
@@ -192,14 +207,19 @@ SkinImage* LoadImageWithText(FcitxClassicUI* classicui, FcitxSkin* sc, const cha
     image->name = strdup(name);
     image->image = newsurface;
     image->textIcon = true;
+    image->text = strdup(text);
+    image->textWidth = w;
+    image->textHeight = h;
+    image->textActive = active;
+    image->epoch = classicui->epoch;
+    image->serial = ++textIconSerial;
     HASH_ADD_KEYPTR(hh, sc->imageTable, image->name, strlen(image->name), image);
     return image;
 }
 
-SkinImage* LoadImageFromTable(SkinImage** imageTable, const char* skinType, const char* name, int flag)
+cairo_surface_t* LoadImageFile(const char* skinType, const char* name, int flag)
 {
     cairo_surface_t *png = NULL;
-    SkinImage *image = NULL;
     char *buf;
     fcitx_utils_alloc_cat_str(buf, "skin/", skinType);
     const char* fallbackChainNoFallback[] = { buf };
@@ -207,16 +227,6 @@ SkinImage* LoadImageFromTable(SkinImage** imageTable, const char* skinType, cons
     const char* fallbackChainTray[] = { "imicon" };
     const char* fallbackChainPanelIMIcon[] = { buf, "imicon", "skin/default" };
 
-    if (name[0] == '@') {
-        name ++;
-    }
-
-    HASH_FIND_STR(*imageTable, name, image);
-    if (image != NULL) {
-        free(buf);
-        return image;
-    }
-
     const char** fallbackChain;
     int fallbackSize;
     switch(flag) {
@@ -270,7 +280,24 @@ SkinImage* LoadImageFromTable(SkinImage** imageTable, const char* skinType, cons
         }
     }
     free(buf);
+    return png;
+}
+
+SkinImage* LoadImageFromTable(SkinImage** imageTable, const char* skinType, const char* name, int flag)
+{
+    cairo_surface_t *png = NULL;
+    SkinImage *image = NULL;
+
+    if (name[0] == '@') {
+        name ++;
+    }
 
+    HASH_FIND_STR(*imageTable, name, image);
+    if (image != NULL) {
+        return image;
+    }
+
+    png = LoadImageFile(skinType, name, flag);
     if (png != NULL) {
         image = fcitx_utils_new(SkinImage);
         image->name = strdup(name);
@@ -284,6 +311,12 @@ SkinImage* LoadImageFromTable(SkinImage** imageTable, const char* skinType, cons
 
 SkinImage* LoadImage(FcitxSkin* sc, const char* name, int flag)
 {
+    if (sc->preload && flag != 2) {
+        /* wait for the preloader rather than decoding the same file twice */
+        SkinPreloadTakeImage(sc, name);
+        if (sc->preload)
+            SkinPreloadFinish(sc);
+    }
     if (flag == 2)
         return LoadImageFromTable(&sc->trayImageTable, *sc->skinType, name, flag);
     else
@@ -539,6 +572,127 @@ void DrawResizableBackground(cairo_t *c,
     cairo_restore(c);
 }
 
+/*
+ * With F_COPY the middle column is tiled from the left, so a background
+ * rendered with a larger width has the same pixels on the left side, and
+ * the right border only depends on the height. Round up the width to share
+ * one rendering between the widths of a candidate window.
+ */
+static int
+BackgroundCacheWidth(FcitxWindowBackground* wb, int width)
+{
+    if (wb->fillH != F_COPY)
+        return width;
+    return (width + BACKGROUND_CACHE_WIDTH_STEP - 1)
+           / BACKGROUND_CACHE_WIDTH_STEP * BACKGROUND_CACHE_WIDTH_STEP;
+}
+
+static BackgroundCacheEntry*
+BackgroundCacheLookup(BackgroundCache* cache, unsigned int epoch,
+                      cairo_surface_t* background, FcitxWindowBackground* wb,
+                      int width, int height)
+{
+    BackgroundCacheEntry* victim = NULL;
+    BackgroundCacheEntry* base = NULL;
+    int cacheWidth = BackgroundCacheWidth(wb, width);
+    int i;
+
+    cache->tick++;
+    for (i = 0; i < BACKGROUND_CACHE_SIZE; i++) {
+        BackgroundCacheEntry* entry = &cache->entry[i];
+        if (entry->surface && entry->epoch == epoch
+            && entry->height == height) {
+            if (entry->width == cacheWidth) {
+                entry->lastUsed = cache->tick;
+                return entry;
+            }
+            if (wb->fillH == F_COPY && (!base || entry->width > base->width))
+                base = entry;
+        }
+        if (!victim || (victim->surface
+                        && (!entry->surface
+                            || entry->lastUsed < victim->lastUsed)))
+            victim = entry;
+    }
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                          cacheWidth, height);
+    cairo_t* c = cairo_create(surface);
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    if (base) {
+        /* reuse the corners and borders, only tile the new part of middle */
+        int common = FCITX_MIN(base->width, cacheWidth) - wb->marginRight;
+        cairo_save(c);
+        cairo_set_source_surface(c, base->surface, 0, 0);
+        cairo_rectangle(c, 0, 0, common, height);
+        cairo_fill(c);
+        cairo_set_source_surface(c, base->surface, cacheWidth - base->width, 0);
+        cairo_rectangle(c, cacheWidth - wb->marginRight, 0,
+                        wb->marginRight, height);
+        cairo_fill(c);
+        cairo_restore(c);
+        if (common < cacheWidth - wb->marginRight) {
+            cairo_rectangle(c, common, 0,
+                            cacheWidth - wb->marginRight - common, height);
+            cairo_clip(c);
+            DrawResizableBackground(c, background, cacheWidth, height,
+                                    wb->marginLeft, wb->marginTop,
+                                    wb->marginRight, wb->marginBottom,
+                                    wb->fillV, wb->fillH);
+        }
+    } else {
+        DrawResizableBackground(c, background, cacheWidth, height,
+                                wb->marginLeft, wb->marginTop,
+                                wb->marginRight, wb->marginBottom,
+                                wb->fillV, wb->fillH);
+    }
+    cairo_destroy(c);
+    cairo_surface_flush(surface);
+
+    if (victim->surface)
+        cairo_surface_destroy(victim->surface);
+    victim->surface = surface;
+    victim->epoch = epoch;
+    victim->width = cacheWidth;
+    victim->height = height;
+    victim->lastUsed = cache->tick;
+    return victim;
+}
+
+void DrawCachedBackground(BackgroundCache* cache, unsigned int epoch,
+                          cairo_t* c, cairo_surface_t* background,
+                          FcitxWindowBackground* wb, int width, int height)
+{
+    BackgroundCacheEntry* entry = BackgroundCacheLookup(cache, epoch,
+                                                        background, wb,
+                                                        width, height);
+    cairo_save(c);
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    if (entry->width == width) {
+        cairo_set_source_surface(c, entry->surface, 0, 0);
+        cairo_rectangle(c, 0, 0, width, height);
+        cairo_fill(c);
+    } else {
+        cairo_set_source_surface(c, entry->surface, 0, 0);
+        cairo_rectangle(c, 0, 0, width - wb->marginRight, height);
+        cairo_fill(c);
+        cairo_set_source_surface(c, entry->surface, width - entry->width, 0);
+        cairo_rectangle(c, width - wb->marginRight, 0, wb->marginRight, height);
+        cairo_fill(c);
+    }
+    cairo_restore(c);
+}
+
+void BackgroundCacheFree(BackgroundCache* cache)
+{
+    int i;
+    for (i = 0; i < BACKGROUND_CACHE_SIZE; i++) {
+        if (cache->entry[i].surface)
+            cairo_surface_destroy(cache->entry[i].surface);
+    }
+    memset(cache, 0, sizeof(BackgroundCache));
+}
+
 void DestroyImage(cairo_surface_t ** png)
 {
     if (png != NULL) {
@@ -574,6 +728,7 @@ void DrawImage(cairo_t *c, cairo_surface_t * png, int x, int y, MouseE mouse)
 
 void DisplaySkin(FcitxClassicUI* classicui, char * skinname)
 {
+    double start = SkinPreloadTimestamp();
     char *pivot = classicui->skinType;
     classicui->skinType = strdup(skinname);
     if (pivot)
@@ -587,13 +742,24 @@ void DisplaySkin(FcitxClassicUI* classicui, char * skinname)
     GetValidFont(classicui->strUserLocale, &classicui->menuFont);
 #endif
 
+    /* font may be resolved differently after reload even with same name */
+    if (classicui->inputTextContext)
+        FcitxCairoTextContextClearCache(classicui->inputTextContext);
+    if (classicui->menuTextContext)
+        FcitxCairoTextContextClearCache(classicui->menuTextContext);
+
+    /* before painting, anything cached with the old skin is invalid now */
+    classicui->epoch ++;
+
     FcitxXlibWindowPaint(&classicui->mainWindow->parent);
-    FcitxXlibWindowPaint(&classicui->inputWindow->parent);
+    /* hidden input window is painted on show, leave its images to preload */
+    if (classicui->inputWindow->parent.mapped)
+        FcitxXlibWindowPaint(&classicui->inputWindow->parent);
     TrayWindowDraw(classicui->trayWindow);
 
     SaveClassicUIConfig(classicui);
 
-    classicui->epoch ++;
+    classicui->skin.loadTime = SkinPreloadTimestamp() - start;
 }
 
 void FreeImageTable(SkinImage* table)
@@ -603,6 +769,7 @@ void FreeImageTable(SkinImage* table)
         SkinImage* curimage = images;
         HASH_DEL(images, curimage);
         free(curimage->name);
+        fcitx_utils_free(curimage->text);
         cairo_surface_destroy(curimage->image);
         free(curimage);
     }
@@ -625,6 +792,7 @@ void UnloadSingleImage(FcitxSkin* sc, const char* name)
         SkinImage* curimage = image;
         HASH_DEL(sc->imageTable, image);
         free(curimage->name);
+        fcitx_utils_free(curimage->text);
         cairo_surface_destroy(curimage->image);
         free(curimage);
     }
@@ -87,11 +87,38 @@ typedef struct _FcitxWindowBackground {
     FillRule fillH;
 } FcitxWindowBackground;
 
+#define BACKGROUND_CACHE_SIZE 4
+#define BACKGROUND_CACHE_WIDTH_STEP 32
+
+typedef struct _BackgroundCacheEntry {
+    cairo_surface_t* surface;
+    unsigned int epoch;
+    int width;
+    int height;
+    unsigned int lastUsed;
+} BackgroundCacheEntry;
+
+/**
+ * rendered nine-patch backgrounds of one window, keyed by skin epoch,
+ * width and height
+ **/
+typedef struct _BackgroundCache {
+    BackgroundCacheEntry entry[BACKGROUND_CACHE_SIZE];
+    unsigned int tick;
+} BackgroundCache;
+
 typedef struct _SkinImage {
     char *name;
     cairo_surface_t *image;
     boolean textIcon;
     UT_hash_handle hh;
+    /* what a text icon is rendered with, it is reused if nothing changed */
+    char *text;
+    int textWidth;
+    int textHeight;
+    boolean textActive;
+    unsigned int epoch;
+    unsigned int serial; /* 0 for image loaded from file */
 } SkinImage;
 
 typedef struct _SkinInfo {
@@ -190,6 +217,15 @@ typedef struct _FcitxSkin {
 
     SkinImage* imageTable;
     SkinImage* trayImageTable;
+
+    /* images of skin config being decoded by a worker thread */
+    struct _SkinPreload* preload;
+
+    /* startup metric, in ms */
+    double loadTime; /* spent by DisplaySkin on the input thread */
+    double preloadTime; /* spent by the worker on resolving and decoding */
+    double preloadWaitTime; /* spent on waiting for the worker */
+    boolean firstPaintReported;
 } FcitxSkin;
 
 FcitxConfigFileDesc* GetSkinDesc();
@@ -197,6 +233,7 @@ int LoadSkinConfig(FcitxSkin* sc, char** skinType);
 void DrawImage(cairo_t* c, cairo_surface_t* png, int x, int y, MouseE mouse);
 void DrawInputBar(struct _InputWindow* inputWindow, boolean vertical, int iCursorPos);
 SkinImage* LoadImage(FcitxSkin* sc, const char* name, int fallback);
+cairo_surface_t* LoadImageFile(const char* skinType, const char* name, int flag);
 SkinImage* LoadImageWithText(struct _FcitxClassicUI *classicui, FcitxSkin* sc, const char* name, const char* text, int w, int h, boolean active);
 void InitSkinMenu(struct _FcitxClassicUI* classicui);
 void DisplaySkin(struct _FcitxClassicUI* classicui, char * skinname);
@@ -213,6 +250,10 @@ void DrawResizableBackground(cairo_t *c,
                              FillRule fillV,
                              FillRule fillH
                             );
+void DrawCachedBackground(BackgroundCache* cache, unsigned int epoch,
+                          cairo_t* c, cairo_surface_t* background,
+                          FcitxWindowBackground* wb, int width, int height);
+void BackgroundCacheFree(BackgroundCache* cache);
 #define fcitx_cairo_set_color(c, color) cairo_set_source_rgb((c), (color)->r, (color)->g, (color)->b)
 
 CONFIG_BINDING_DECLARE(FcitxSkin);
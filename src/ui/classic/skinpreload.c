@@ -0,0 +1,353 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <cairo.h>
+
+#include "fcitx/fcitx.h"
+#include "fcitx-utils/log.h"
+#include "fcitx-utils/utils.h"
+#include "fcitx-utils/uthash.h"
+
+#include "skin.h"
+#include "skinpreload.h"
+
+#define SKIN_PRELOAD_MAX 16
+/* images not larger than this are packed into the atlas */
+#define SKIN_ATLAS_ICON_SIZE 64
+#define SKIN_ATLAS_WIDTH 256
+
+typedef struct _SkinPreloadImage {
+    char* name;
+    int flag;
+    cairo_surface_t* image;
+    boolean ready;
+    boolean taken;
+} SkinPreloadImage;
+
+typedef struct _SkinPreload {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char* skinType;
+    int count;
+    SkinPreloadImage images[SKIN_PRELOAD_MAX];
+    boolean cancelled;
+    boolean done;
+    double time;
+    double waitTime;
+} SkinPreload;
+
+static const cairo_user_data_key_t atlas_key;
+
+static void
+SkinPreloadAddImage(SkinPreload* preload, const char* name, int flag)
+{
+    int i;
+    if (!name)
+        return;
+    if (name[0] == '@')
+        name ++;
+    if (name[0] == '\0' || strcmp(name, "NONE") == 0)
+        return;
+    for (i = 0; i < preload->count; i++) {
+        if (strcmp(preload->images[i].name, name) == 0)
+            return;
+    }
+    if (preload->count == SKIN_PRELOAD_MAX)
+        return;
+    preload->images[preload->count].name = strdup(name);
+    preload->images[preload->count].flag = flag;
+    preload->count++;
+}
+
+static void
+SkinPreloadFree(SkinPreload* preload)
+{
+    int i;
+    for (i = 0; i < preload->count; i++) {
+        free(preload->images[i].name);
+        if (preload->images[i].image)
+            cairo_surface_destroy(preload->images[i].image);
+    }
+    pthread_cond_destroy(&preload->cond);
+    pthread_mutex_destroy(&preload->lock);
+    free(preload->skinType);
+    free(preload);
+}
+
+static int
+SkinPreloadCompareHeight(const void* a, const void* b)
+{
+    const SkinPreloadImage* ia = *(SkinPreloadImage* const*) a;
+    const SkinPreloadImage* ib = *(SkinPreloadImage* const*) b;
+    return cairo_image_surface_get_height(ib->image)
+           - cairo_image_surface_get_height(ia->image);
+}
+
+/*
+ * copy small images not taken yet into one surface, shelf by shelf, and
+ * replace them with image surfaces pointing into it. Each of them keeps a
+ * reference to the atlas. Called with lock held.
+ */
+static void
+SkinPreloadPackAtlas(SkinPreload* preload)
+{
+    SkinPreloadImage* icons[SKIN_PRELOAD_MAX];
+    int pos[SKIN_PRELOAD_MAX][2];
+    int count = 0;
+    int i;
+
+    for (i = 0; i < preload->count; i++) {
+        SkinPreloadImage* image = &preload->images[i];
+        if (image->taken || !image->image)
+            continue;
+        cairo_format_t format = cairo_image_surface_get_format(image->image);
+        if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+            continue;
+        if (cairo_image_surface_get_width(image->image) > SKIN_ATLAS_ICON_SIZE
+            || cairo_image_surface_get_height(image->image) > SKIN_ATLAS_ICON_SIZE)
+            continue;
+        icons[count++] = image;
+    }
+    if (count < 2)
+        return;
+
+    qsort(icons, count, sizeof(icons[0]), SkinPreloadCompareHeight);
+
+    int x = 0, y = 0, shelf = 0;
+    for (i = 0; i < count; i++) {
+        int w = cairo_image_surface_get_width(icons[i]->image);
+        int h = cairo_image_surface_get_height(icons[i]->image);
+        if (x + w > SKIN_ATLAS_WIDTH) {
+            x = 0;
+            y += shelf;
+            shelf = 0;
+        }
+        pos[i][0] = x;
+        pos[i][1] = y;
+        x += w;
+        if (h > shelf)
+            shelf = h;
+    }
+
+    cairo_surface_t* atlas = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                        SKIN_ATLAS_WIDTH,
+                                                        y + shelf);
+    if (cairo_surface_status(atlas)) {
+        cairo_surface_destroy(atlas);
+        return;
+    }
+    cairo_t* c = cairo_create(atlas);
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    for (i = 0; i < count; i++) {
+        cairo_set_source_surface(c, icons[i]->image, pos[i][0], pos[i][1]);
+        cairo_rectangle(c, pos[i][0], pos[i][1],
+                        cairo_image_surface_get_width(icons[i]->image),
+                        cairo_image_surface_get_height(icons[i]->image));
+        cairo_fill(c);
+    }
+    cairo_destroy(c);
+    cairo_surface_flush(atlas);
+
+    unsigned char* data = cairo_image_surface_get_data(atlas);
+    int stride = cairo_image_surface_get_stride(atlas);
+    for (i = 0; i < count; i++) {
+        cairo_surface_t* view = cairo_image_surface_create_for_data(
+            data + pos[i][1] * stride + pos[i][0] * 4, CAIRO_FORMAT_ARGB32,
+            cairo_image_surface_get_width(icons[i]->image),
+            cairo_image_surface_get_height(icons[i]->image), stride);
+        if (cairo_surface_status(view)
+            || cairo_surface_set_user_data(view, &atlas_key,
+                                           cairo_surface_reference(atlas),
+                                           (cairo_destroy_func_t) cairo_surface_destroy)) {
+            cairo_surface_destroy(view);
+            continue;
+        }
+        cairo_surface_destroy(icons[i]->image);
+        icons[i]->image = view;
+    }
+    cairo_surface_destroy(atlas);
+}
+
+static void*
+SkinPreloadRun(void* arg)
+{
+    SkinPreload* preload = arg;
+    double start = SkinPreloadTimestamp();
+    int i;
+
+    for (i = 0; i < preload->count; i++) {
+        SkinPreloadImage* image = &preload->images[i];
+        cairo_surface_t* png = NULL;
+
+        pthread_mutex_lock(&preload->lock);
+        boolean cancelled = preload->cancelled;
+        pthread_mutex_unlock(&preload->lock);
+        if (!cancelled)
+            png = LoadImageFile(preload->skinType, image->name, image->flag);
+
+        pthread_mutex_lock(&preload->lock);
+        image->image = png;
+        image->ready = true;
+        pthread_cond_broadcast(&preload->cond);
+        pthread_mutex_unlock(&preload->lock);
+    }
+
+    pthread_mutex_lock(&preload->lock);
+    if (!preload->cancelled)
+        SkinPreloadPackAtlas(preload);
+    preload->time = SkinPreloadTimestamp() - start;
+    preload->done = true;
+    pthread_mutex_unlock(&preload->lock);
+    return NULL;
+}
+
+void SkinPreloadStart(FcitxSkin* sc)
+{
+    SkinPreload* preload = fcitx_utils_new(SkinPreload);
+    pthread_mutex_init(&preload->lock, NULL);
+    pthread_cond_init(&preload->cond, NULL);
+    preload->skinType = strdup(*sc->skinType);
+
+    /* in the order windows are created and painted */
+    SkinPreloadAddImage(preload, sc->skinInputBar.background.background, 0);
+    SkinPreloadAddImage(preload, sc->skinInputBar.background.overlay, 0);
+    SkinPreloadAddImage(preload, sc->skinMainBar.background.background, 0);
+    SkinPreloadAddImage(preload, sc->skinMainBar.background.overlay, 0);
+    SkinPreloadAddImage(preload, sc->skinMainBar.logo, 0);
+    SkinPreloadAddImage(preload, sc->skinMainBar.eng, 0);
+    SkinPreloadAddImage(preload, sc->skinMainBar.active, 0);
+    SkinPreloadAddImage(preload, sc->skinInputBar.backArrow, 0);
+    SkinPreloadAddImage(preload, sc->skinInputBar.forwardArrow, 0);
+    SkinPreloadAddImage(preload, sc->skinTrayIcon.active, 1);
+    SkinPreloadAddImage(preload, sc->skinTrayIcon.inactive, 1);
+    SkinPreloadAddImage(preload, sc->skinMenu.background.background, 0);
+    SkinPreloadAddImage(preload, sc->skinMenu.background.overlay, 0);
+
+    if (preload->count == 0
+        || pthread_create(&preload->thread, NULL, SkinPreloadRun, preload) != 0) {
+        SkinPreloadFree(preload);
+        return;
+    }
+    sc->preload = preload;
+}
+
+static void
+SkinPreloadAddToTable(FcitxSkin* sc, SkinPreloadImage* preloadImage)
+{
+    SkinImage* image = NULL;
+    preloadImage->taken = true;
+    if (!preloadImage->image)
+        return;
+
+    HASH_FIND_STR(sc->imageTable, preloadImage->name, image);
+    if (image) {
+        cairo_surface_destroy(preloadImage->image);
+    } else {
+        image = fcitx_utils_new(SkinImage);
+        image->name = preloadImage->name;
+        image->image = preloadImage->image;
+        HASH_ADD_KEYPTR(hh, sc->imageTable, image->name,
+                        strlen(image->name), image);
+        preloadImage->name = NULL;
+    }
+    preloadImage->image = NULL;
+}
+
+void SkinPreloadTakeImage(FcitxSkin* sc, const char* name)
+{
+    SkinPreload* preload = sc->preload;
+    int i;
+    if (name[0] == '@')
+        name ++;
+
+    for (i = 0; i < preload->count; i++) {
+        SkinPreloadImage* image = &preload->images[i];
+        if (image->taken || !image->name || strcmp(image->name, name) != 0)
+            continue;
+
+        pthread_mutex_lock(&preload->lock);
+        if (!image->ready) {
+            double start = SkinPreloadTimestamp();
+            while (!image->ready)
+                pthread_cond_wait(&preload->cond, &preload->lock);
+            preload->waitTime += SkinPreloadTimestamp() - start;
+        }
+        SkinPreloadAddToTable(sc, image);
+        pthread_mutex_unlock(&preload->lock);
+        break;
+    }
+}
+
+void SkinPreloadFinish(FcitxSkin* sc)
+{
+    SkinPreload* preload = sc->preload;
+    int i;
+
+    pthread_mutex_lock(&preload->lock);
+    boolean done = preload->done;
+    pthread_mutex_unlock(&preload->lock);
+    if (!done)
+        return;
+
+    pthread_join(preload->thread, NULL);
+    sc->preload = NULL;
+    for (i = 0; i < preload->count; i++) {
+        if (!preload->images[i].taken)
+            SkinPreloadAddToTable(sc, &preload->images[i]);
+    }
+    sc->preloadTime = preload->time;
+    sc->preloadWaitTime = preload->waitTime;
+    SkinPreloadFree(preload);
+}
+
+void SkinPreloadCancel(FcitxSkin* sc)
+{
+    SkinPreload* preload = sc->preload;
+    pthread_mutex_lock(&preload->lock);
+    preload->cancelled = true;
+    pthread_mutex_unlock(&preload->lock);
+    pthread_join(preload->thread, NULL);
+    sc->preload = NULL;
+    SkinPreloadFree(preload);
+}
+
+void SkinPreloadReportFirstPaint(FcitxSkin* sc, double paintTime)
+{
+    if (sc->firstPaintReported)
+        return;
+    sc->firstPaintReported = true;
+
+    if (sc->preload) {
+        FcitxLog(DEBUG, "skin %s: loading %.2fms, first input window paint "
+                 "%.2fms, preload is still running",
+                 *sc->skinType, sc->loadTime, paintTime);
+    } else {
+        FcitxLog(DEBUG, "skin %s: loading %.2fms, first input window paint "
+                 "%.2fms, preload %.2fms on worker thread, %.2fms waited",
+                 *sc->skinType, sc->loadTime, paintTime, sc->preloadTime,
+                 sc->preloadWaitTime);
+    }
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,69 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef _SKINPRELOAD_H
+#define _SKINPRELOAD_H
+
+#include <time.h>
+#include "fcitx/fcitx.h"
+#include "skin.h"
+
+struct _SkinPreload;
+
+/**
+ * resolve and decode images referenced by the skin config on a worker
+ * thread, small images are packed into a shared atlas surface
+ **/
+void SkinPreloadStart(FcitxSkin* sc);
+
+/**
+ * move decoded images into the image table if the worker is done
+ **/
+void SkinPreloadFinish(FcitxSkin* sc);
+
+/**
+ * wait until the image is decoded and move it into the image table,
+ * do nothing if the image is not preloaded
+ **/
+void SkinPreloadTakeImage(FcitxSkin* sc, const char* name);
+
+/**
+ * wait for the worker and drop its result
+ **/
+void SkinPreloadCancel(FcitxSkin* sc);
+
+/**
+ * log how long the skin blocked the input thread, called on the first
+ * show of input window after loading a skin
+ **/
+void SkinPreloadReportFirstPaint(FcitxSkin* sc, double paintTime);
+
+/* monotonic time in ms */
+static inline double
+SkinPreloadTimestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+#endif
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -124,8 +124,8 @@ typedef struct _FcitxKimpanelUI {
     DBusConnection* conn;
     int iOffsetY;
     int iOffsetX;
+    FcitxUIRenderModel* model;
     FcitxMessages* messageUp;
-    FcitxMessages* messageDown;
     int iCursorPos;
     int lastUpdateY;
     int lastUpdateX;
@@ -134,6 +134,16 @@ typedef struct _FcitxKimpanelUI {
     int lastUpdateH;
     int lastCursor;
     boolean hasSetLookupTable;
+
+    /* what the panel is showing for stateIC, -1 means unknown */
+    FcitxInputContext* stateIC;
+    int auxShown;
+    int preeditShown;
+    int lookupTableShown;
+    int lastCaret;
+    int upMode;
+    char* lastLookupTable;
+    size_t lastLookupTableLen;
 } FcitxKimpanelUI;
 
 static void* KimpanelCreate(FcitxInstance* instance);
@@ -159,16 +169,16 @@ static void KimShowPreedit(FcitxKimpanelUI* kimpanel, boolean toShow);
 static void KimUpdateSpotLocation(FcitxKimpanelUI* kimpanel, int x, int y);
 static void KimSetSpotRect(FcitxKimpanelUI* kimpanel, int x, int y, int w, int h);
 static void KimShowLookupTable(FcitxKimpanelUI* kimpanel, boolean toShow);
-static void KimUpdateLookupTable(FcitxKimpanelUI* kimpanel, char *labels[], int nLabel, char *texts[], int nText, boolean has_prev, boolean has_next);
+static void KimUpdateLookupTable(FcitxKimpanelUI* kimpanel, const char *labels[], int nLabel, const char *texts[], int nText, boolean has_prev, boolean has_next);
 static void KimSetLookupTable(FcitxKimpanelUI* kimpanel,
-                              char *labels[], int nLabel,
-                              char *texts[], int nText,
+                              const char *labels[], int nLabel,
+                              const char *texts[], int nText,
                               boolean has_prev,
                               boolean has_next,
                               int cursor,
                               int layout);
-static void KimUpdatePreeditText(FcitxKimpanelUI* kimpanel, char *text);
-static void KimUpdateAux(FcitxKimpanelUI* kimpanel, char *text);
+static void KimUpdatePreeditText(FcitxKimpanelUI* kimpanel, const char *text);
+static void KimUpdateAux(FcitxKimpanelUI* kimpanel, const char *text);
 static void KimUpdatePreeditCaret(FcitxKimpanelUI* kimpanel, int position);
 static void KimEnable(FcitxKimpanelUI* kimpanel, boolean toEnable);
 static void KimRegisterProperties(FcitxKimpanelUI* kimpanel, char *props[], int n);
@@ -185,8 +195,8 @@ static void KimExecMenu(FcitxKimpanelUI* kimpanel, char *props[], int n);
 static void KimpanelServiceExistCallback(DBusPendingCall *call, void *data);
 static void KimpanelIntrospect(FcitxKimpanelUI* kimpanel);
 static void KimpanelIntrospectCallback(DBusPendingCall *call, void *data);
+static void KimpanelReset(FcitxKimpanelUI* kimpanel);
 
-#define KIMPANEL_BUFFER_SIZE 4096
 #ifndef DBUS_TIMEOUT_USE_DEFAULT
 #  define DBUS_TIMEOUT_USE_DEFAULT (-1)
 #endif
@@ -304,7 +314,7 @@ void* KimpanelCreate(FcitxInstance* instance)
     FcitxKimpanelUI *kimpanel = fcitx_utils_malloc0(sizeof(FcitxKimpanelUI));
 
     kimpanel->addon = FcitxAddonsGetAddonByName(FcitxInstanceGetAddons(instance), "fcitx-kimpanel-ui");
-    kimpanel->lastCursor = -2;
+    KimpanelReset(kimpanel);
     kimpanel->version = 1;
     kimpanel->iCursorPos = 0;
     kimpanel->owner = instance;
@@ -351,8 +361,7 @@ void* KimpanelCreate(FcitxInstance* instance)
 
         dbus_connection_register_object_path(kimpanel->conn, FCITX_KIMPANEL_PATH, &vtable, kimpanel);
 
-        kimpanel->messageUp = FcitxMessagesNew();
-        kimpanel->messageDown = FcitxMessagesNew();
+        kimpanel->model = FcitxUIRenderModelNew();
 
         FcitxIMEventHook imchangehk;
         imchangehk.arg = kimpanel;
@@ -449,6 +458,7 @@ void KimpanelInputIMChanged(void* arg)
 void KimpanelOnInputFocus(void* arg)
 {
     FcitxKimpanelUI* kimpanel = (FcitxKimpanelUI*) arg;
+    KimpanelReset(kimpanel);
     KimEnable(kimpanel, (FcitxInstanceGetCurrentStatev2(kimpanel->owner) == IS_ACTIVE));
     KimpanelSetIMStatus(kimpanel);
 }
@@ -456,6 +466,7 @@ void KimpanelOnInputFocus(void* arg)
 void KimpanelOnInputUnFocus(void* arg)
 {
     FcitxKimpanelUI* kimpanel = (FcitxKimpanelUI*) arg;
+    KimpanelReset(kimpanel);
     KimEnable(kimpanel, (FcitxInstanceGetCurrentStatev2(kimpanel->owner) == IS_ACTIVE));
     KimpanelSetIMStatus(kimpanel);
 }
@@ -482,6 +493,7 @@ void KimpanelCloseInputWindow(void* arg)
     KimShowAux(kimpanel, false);
     KimShowPreedit(kimpanel, false);
     KimShowLookupTable(kimpanel, false);
+    dbus_connection_flush(kimpanel->conn);
 }
 
 void KimpanelMoveInputWindow(void* arg)
@@ -555,14 +567,62 @@ char* ComplexStatus2String(FcitxInstance* instance, FcitxUIComplexStatus* status
     return str;
 }
 
+/*
+ * keep a copy of the lookup table last sent to panel, return false if the
+ * new one is the same, so only the cursor need to be updated
+ */
+static boolean
+KimpanelLookupTableChanged(FcitxKimpanelUI* kimpanel, const char** labels,
+                           const char** texts, int n, boolean hasPrev,
+                           boolean hasNext, int layout)
+{
+    int header[4] = { n, hasPrev, hasNext, layout };
+    size_t len = sizeof(header);
+    int i;
+    for (i = 0; i < n; i++)
+        len += strlen(labels[i]) + strlen(texts[i]) + 2;
+
+    char* table = fcitx_utils_malloc0(len);
+    char* p = table;
+    memcpy(p, header, sizeof(header));
+    p += sizeof(header);
+    for (i = 0; i < n; i++) {
+        size_t l = strlen(labels[i]) + 1;
+        memcpy(p, labels[i], l);
+        p += l;
+        l = strlen(texts[i]) + 1;
+        memcpy(p, texts[i], l);
+        p += l;
+    }
+
+    if (kimpanel->lastLookupTable && kimpanel->lastLookupTableLen == len &&
+        memcmp(kimpanel->lastLookupTable, table, len) == 0) {
+        free(table);
+        return false;
+    }
+    free(kimpanel->lastLookupTable);
+    kimpanel->lastLookupTable = table;
+    kimpanel->lastLookupTableLen = len;
+    return true;
+}
+
 void KimpanelShowInputWindow(void* arg)
 {
     FcitxKimpanelUI* kimpanel = (FcitxKimpanelUI*) arg;
     FcitxInstance* instance = kimpanel->owner;
     FcitxInputState* input = FcitxInstanceGetInputState(instance);
     FcitxCandidateWordList* candList = FcitxInputStateGetCandidateList(input);
-    kimpanel->iCursorPos = FcitxUINewMessageToOldStyleMessage(instance, kimpanel->messageUp, kimpanel->messageDown);
-    FcitxMessages* messageDown = kimpanel->messageDown;
+    FcitxUIRenderModel* model = kimpanel->model;
+    FcitxInputContext* ic = FcitxInstanceGetCurrentIC(instance);
+    /* panel may still show the content of another ic */
+    if (ic != kimpanel->stateIC) {
+        KimpanelReset(kimpanel);
+        kimpanel->stateIC = ic;
+    }
+    unsigned int changed = FcitxUIRenderModelUpdate(instance, model);
+    kimpanel->iCursorPos = FcitxUIRenderModelGetCursorPos(model);
+    kimpanel->messageUp = FcitxUIRenderModelGetMessages(model, true);
+    FcitxMessages* messageDown = FcitxUIRenderModelGetMessages(model, false);
     FcitxMessages* messageUp = kimpanel->messageUp;
     FcitxLog(DEBUG, "KimpanelShowInputWindow");
     KimpanelMoveInputWindow(kimpanel);
@@ -572,109 +632,60 @@ void KimpanelShowInputWindow(void* arg)
     FcitxCandidateLayoutHint layout = FcitxCandidateWordGetLayoutHint(candList);
 
     int n = FcitxMessagesGetMessageCount(messageDown);
-    int nLabels = 0;
-    int nTexts = 0;
-    char *label[33];
-    char *text[33];
-    char cmb[KIMPANEL_BUFFER_SIZE] = "";
-    int i;
     int pos = -1;
 
     if (n) {
-        for (i = 0; i < n; i++) {
-            FcitxLog(DEBUG, "Type: %d Text: %s" , FcitxMessagesGetMessageType(messageDown, i), FcitxMessagesGetMessageString(messageDown, i));
-
-            if (FcitxMessagesGetMessageType(messageDown, i) == MSG_INDEX) {
-                if (nLabels) {
-                    text[nTexts++] = strdup(cmb);
-                }
-                char *needfree = FcitxInstanceProcessOutputFilter(instance, FcitxMessagesGetMessageString(messageDown, i));
-                char *msgstr;
-                if (needfree)
-                    msgstr = needfree;
-                else
-                    msgstr = strdup(FcitxMessagesGetMessageString(messageDown, i));
-
-                label[nLabels++] = msgstr;
-                strcpy(cmb, "");
-            } else {
-                char *needfree = FcitxInstanceProcessOutputFilter(instance, FcitxMessagesGetMessageString(messageDown, i));
-                char *msgstr;
-                if (needfree)
-                    msgstr = needfree;
-                else
-                    msgstr = FcitxMessagesGetMessageString(messageDown, i);
-
-                if (strlen(cmb) + strlen(msgstr) + 1 < KIMPANEL_BUFFER_SIZE)
-                    strcat(cmb, msgstr);
-                if (needfree)
-                    free(needfree);
-                if (FcitxMessagesGetMessageType(messageDown, i) == MSG_FIRSTCAND)
-                    pos = nTexts;
-            }
-        }
-        text[nTexts++] = strdup(cmb);
-        if (nLabels < nTexts) {
-            for (; nLabels < nTexts; nLabels++) {
-                label[nLabels] = strdup("");
-            }
-        } else if (nTexts < nLabels) {
-            for (; nTexts < nLabels; nTexts++) {
-                text[nTexts] = strdup("");
-            }
-        }
-        FcitxLog(DEBUG, "Labels %d, Texts %d, CMB:%s", nLabels, nTexts, cmb);
+        const char **label;
+        const char **text;
+        int nTexts = FcitxUIRenderModelGetCandidateTable(model, &label, &text, &pos);
+        FcitxLog(DEBUG, "Candidates %d", nTexts);
         if (nTexts == 0) {
             KimShowLookupTable(kimpanel, false);
         } else {
-            if (kimpanel->hasSetLookupTable)
-                KimSetLookupTable(kimpanel, label, nLabels, text, nTexts, hasPrev, hasNext, pos, layout);
-            else
-                KimUpdateLookupTable(kimpanel, label, nLabels, text, nTexts, hasPrev, hasNext);
+            /* if only the highlight moved, cursor update below is enough */
+            if (KimpanelLookupTableChanged(kimpanel, label, text, nTexts, hasPrev, hasNext, layout)) {
+                if (kimpanel->hasSetLookupTable) {
+                    KimSetLookupTable(kimpanel, label, nTexts, text, nTexts, hasPrev, hasNext, pos, layout);
+                    kimpanel->lastCursor = pos;
+                } else
+                    KimUpdateLookupTable(kimpanel, label, nTexts, text, nTexts, hasPrev, hasNext);
+            }
             KimShowLookupTable(kimpanel, true);
         }
-        for (i = 0; i < nTexts; i++)
-            free(text[i]);
-        for (i = 0; i < nLabels; i++)
-            free(label[i]);
     } else {
-        if (kimpanel->hasSetLookupTable)
-            KimSetLookupTable(kimpanel, NULL, 0, NULL, 0, hasNext, hasNext, pos, layout);
-        else
-            KimUpdateLookupTable(kimpanel, NULL, 0, NULL, 0, hasPrev, hasNext);
+        if (KimpanelLookupTableChanged(kimpanel, NULL, NULL, 0, hasPrev, hasNext, layout)) {
+            if (kimpanel->hasSetLookupTable) {
+                KimSetLookupTable(kimpanel, NULL, 0, NULL, 0, hasNext, hasNext, pos, layout);
+                kimpanel->lastCursor = pos;
+            } else
+                KimUpdateLookupTable(kimpanel, NULL, 0, NULL, 0, hasPrev, hasNext);
+        }
         KimShowLookupTable(kimpanel, false);
     }
 
-    if (!kimpanel->hasSetLookupTable)
-        KimUpdateLookupTableCursor(kimpanel, pos);
+    KimUpdateLookupTableCursor(kimpanel, pos);
 
     n = FcitxMessagesGetMessageCount(messageUp);
-    char aux[MESSAGE_MAX_LENGTH] = "";
-    char empty[MESSAGE_MAX_LENGTH] = "";
     if (n) {
-        for (i = 0; i < n; i++) {
-
-            char *needfree = FcitxInstanceProcessOutputFilter(instance, FcitxMessagesGetMessageString(messageUp, i));
-            char *msgstr;
-            if (needfree)
-                msgstr = needfree;
-            else
-                msgstr = FcitxMessagesGetMessageString(messageUp, i);
-
-            strcat(aux, msgstr);
-            if (needfree)
-                free(needfree);
-            FcitxLog(DEBUG, "updateMesssages Up:%s", aux);
-        }
-        if (FcitxInputStateGetShowCursor(input)) {
-            KimUpdatePreeditText(kimpanel, aux);
-            KimUpdateAux(kimpanel, empty);
+        const char* aux = FcitxUIRenderModelGetUpString(model);
+        boolean showCursor = FcitxInputStateGetShowCursor(input);
+        boolean textChanged = (changed & RENDER_MODEL_UP) || kimpanel->upMode != showCursor;
+        FcitxLog(DEBUG, "updateMesssages Up:%s", aux);
+        kimpanel->upMode = showCursor;
+        if (showCursor) {
+            if (textChanged) {
+                KimUpdatePreeditText(kimpanel, aux);
+                KimUpdateAux(kimpanel, "");
+                kimpanel->lastCaret = -1;
+            }
             KimShowPreedit(kimpanel, true);
             KimUpdatePreeditCaret(kimpanel, CalKimCursorPos(kimpanel));
             KimShowAux(kimpanel, false);
         } else {
-            KimUpdatePreeditText(kimpanel, empty);
-            KimUpdateAux(kimpanel, aux);
+            if (textChanged) {
+                KimUpdatePreeditText(kimpanel, "");
+                KimUpdateAux(kimpanel, aux);
+            }
             KimShowPreedit(kimpanel, false);
             KimShowAux(kimpanel, true);
         }
@@ -683,6 +694,8 @@ void KimpanelShowInputWindow(void* arg)
         KimShowAux(kimpanel, false);
     }
 
+    /* everything above goes to panel at once */
+    dbus_connection_flush(kimpanel->conn);
 }
 
 void KimpanelUpdateStatus(void* arg, FcitxUIStatus* status)
@@ -726,6 +739,14 @@ void KimpanelReset(FcitxKimpanelUI* kimpanel)
     kimpanel->lastUpdateW = -2;
     kimpanel->lastUpdateX = -2;
     kimpanel->lastUpdateY = -2;
+    kimpanel->auxShown = -1;
+    kimpanel->preeditShown = -1;
+    kimpanel->lookupTableShown = -1;
+    kimpanel->lastCaret = -1;
+    kimpanel->upMode = -1;
+    free(kimpanel->lastLookupTable);
+    kimpanel->lastLookupTable = NULL;
+    kimpanel->lastLookupTableLen = 0;
 }
 
 DBusHandlerResult KimpanelDBusFilter(DBusConnection* connection, DBusMessage* msg, void* user_data)
@@ -1131,6 +1152,10 @@ void KimEnable(FcitxKimpanelUI* kimpanel, boolean toEnable)
 
 void KimShowAux(FcitxKimpanelUI* kimpanel, boolean toShow)
 {
+    if (kimpanel->auxShown != toShow)
+        kimpanel->auxShown = toShow;
+    else
+        return;
 
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
     DBusMessage* msg;
@@ -1163,6 +1188,10 @@ void KimShowAux(FcitxKimpanelUI* kimpanel, boolean toShow)
 
 void KimShowPreedit(FcitxKimpanelUI* kimpanel, boolean toShow)
 {
+    if (kimpanel->preeditShown != toShow)
+        kimpanel->preeditShown = toShow;
+    else
+        return;
 
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
     DBusMessage* msg;
@@ -1229,6 +1258,10 @@ void KimUpdateLookupTableCursor(FcitxKimpanelUI* kimpanel, int cursor)
 
 void KimShowLookupTable(FcitxKimpanelUI* kimpanel, boolean toShow)
 {
+    if (kimpanel->lookupTableShown != toShow)
+        kimpanel->lookupTableShown = toShow;
+    else
+        return;
 
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
     DBusMessage* msg;
@@ -1259,7 +1292,7 @@ void KimShowLookupTable(FcitxKimpanelUI* kimpanel, boolean toShow)
 
 }
 
-void KimUpdateLookupTable(FcitxKimpanelUI* kimpanel, char *labels[], int nLabel, char *texts[], int nText, boolean has_prev, boolean has_next)
+void KimUpdateLookupTable(FcitxKimpanelUI* kimpanel, const char *labels[], int nLabel, const char *texts[], int nText, boolean has_prev, boolean has_next)
 {
     int i;
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
@@ -1328,8 +1361,8 @@ void KimUpdateLookupTable(FcitxKimpanelUI* kimpanel, char *labels[], int nLabel,
 }
 
 void KimSetLookupTable(FcitxKimpanelUI* kimpanel,
-                       char *labels[], int nLabel,
-                       char *texts[], int nText,
+                       const char *labels[], int nLabel,
+                       const char *texts[], int nText,
                        boolean has_prev,
                        boolean has_next,
                        int cursor,
@@ -1405,6 +1438,10 @@ void KimSetLookupTable(FcitxKimpanelUI* kimpanel,
 
 void KimUpdatePreeditCaret(FcitxKimpanelUI* kimpanel, int position)
 {
+    if (kimpanel->lastCaret != position)
+        kimpanel->lastCaret = position;
+    else
+        return;
 
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
     DBusMessage* msg;
@@ -1435,7 +1472,7 @@ void KimUpdatePreeditCaret(FcitxKimpanelUI* kimpanel, int position)
 
 }
 
-void KimUpdatePreeditText(FcitxKimpanelUI* kimpanel, char *text)
+void KimUpdatePreeditText(FcitxKimpanelUI* kimpanel, const char *text)
 {
 
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
@@ -1471,7 +1508,7 @@ void KimUpdatePreeditText(FcitxKimpanelUI* kimpanel, char *text)
 
 }
 
-void KimUpdateAux(FcitxKimpanelUI* kimpanel, char *text)
+void KimUpdateAux(FcitxKimpanelUI* kimpanel, const char *text)
 {
 
     dbus_uint32_t serial = 0; // unique number to associate replies with requests
@@ -1721,6 +1758,7 @@ void KimpanelSuspend(void* arg)
     FcitxKimpanelUI* kimpanel = (FcitxKimpanelUI*) arg;
     kimpanel->version = 1;
     kimpanel->hasSetLookupTable = false;
+    KimpanelReset(kimpanel);
 }
 
 
@@ -1741,8 +1779,8 @@ void KimpanelDestroy(void* arg)
 
     dbus_connection_flush(kimpanel->conn);
 
-    free(kimpanel->messageUp);
-    free(kimpanel->messageDown);
+    FcitxUIRenderModelFree(kimpanel->model);
+    free(kimpanel->lastLookupTable);
     free(kimpanel);
 }
 
@@ -0,0 +1,236 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include "fcitx/fcitx.h"
+#include "fcitx/frontend.h"
+#include "fcitx/instance.h"
+#include "fcitx/ime.h"
+#include "fcitx/ui.h"
+#include "fcitx/candidate.h"
+#include "fcitx/hook.h"
+#include "fcitx-utils/utils.h"
+#include "benchaddon.h"
+
+static void* BenchFrontendCreate(FcitxInstance* instance, int frontendid);
+static boolean BenchFrontendDestroy(void* arg);
+static void BenchFrontendCreateIC(void* arg, FcitxInputContext* context, void *priv);
+static boolean BenchFrontendCheckIC(void* arg, FcitxInputContext* context, void* priv);
+static void BenchFrontendDestroyIC(void* arg, FcitxInputContext* context);
+static void BenchFrontendEnableIM(void* arg, FcitxInputContext* ic);
+static void BenchFrontendCloseIM(void* arg, FcitxInputContext* ic);
+static void BenchFrontendCommitString(void* arg, FcitxInputContext* ic, const char* str);
+static void BenchFrontendForwardKey(void* arg, FcitxInputContext* ic, FcitxKeyEventType event, FcitxKeySym sym, unsigned int state);
+static void BenchFrontendSetWindowOffset(void* arg, FcitxInputContext* ic, int x, int y);
+static void BenchFrontendGetWindowRect(void* arg, FcitxInputContext* ic, int* x, int* y, int* w, int* h);
+static void BenchFrontendUpdatePreedit(void* arg, FcitxInputContext* ic);
+
+static void* BenchUICreate(FcitxInstance* instance);
+static void BenchUIShowInputWindow(void* arg);
+static void BenchUICloseInputWindow(void* arg);
+
+static void* BenchIMCreate(FcitxInstance* instance);
+static void BenchIMDestroy(void* arg);
+static INPUT_RETURN_VALUE BenchIMDoInput(void* arg, FcitxKeySym sym, unsigned int state);
+
+FCITX_DEFINE_PLUGIN(fcitx_bench_frontend, frontend, FcitxFrontend) = {
+    BenchFrontendCreate,
+    BenchFrontendDestroy,
+    BenchFrontendCreateIC,
+    BenchFrontendCheckIC,
+    BenchFrontendDestroyIC,
+    BenchFrontendEnableIM,
+    BenchFrontendCloseIM,
+    BenchFrontendCommitString,
+    BenchFrontendForwardKey,
+    BenchFrontendSetWindowOffset,
+    BenchFrontendGetWindowRect,
+    BenchFrontendUpdatePreedit,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+FCITX_DEFINE_PLUGIN(fcitx_bench_ui, ui, FcitxUI) = {
+    BenchUICreate,
+    BenchUICloseInputWindow,
+    BenchUIShowInputWindow,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+FCITX_DEFINE_PLUGIN(fcitx_bench_im, ime, FcitxIMClass) = {
+    BenchIMCreate,
+    BenchIMDestroy
+};
+
+static FcitxBenchFrontend benchFrontend;
+static FcitxBenchReadyCallback readyCallback = NULL;
+static void* readyArg = NULL;
+
+FCITX_EXPORT_API
+void FcitxBenchSetReadyCallback(FcitxBenchReadyCallback callback, void* arg)
+{
+    readyCallback = callback;
+    readyArg = arg;
+}
+
+void* BenchFrontendCreate(FcitxInstance* instance, int frontendid)
+{
+    benchFrontend.owner = instance;
+    benchFrontend.frontendid = frontendid;
+    if (readyCallback)
+        readyCallback(&benchFrontend, readyArg);
+    return &benchFrontend;
+}
+
+boolean BenchFrontendDestroy(void* arg)
+{
+    return true;
+}
+
+void BenchFrontendCreateIC(void* arg, FcitxInputContext* context, void *priv)
+{
+    context->contextCaps = CAPACITY_PREEDIT;
+}
+
+boolean BenchFrontendCheckIC(void* arg, FcitxInputContext* context, void* priv)
+{
+    return true;
+}
+
+void BenchFrontendDestroyIC(void* arg, FcitxInputContext* context)
+{
+}
+
+void BenchFrontendEnableIM(void* arg, FcitxInputContext* ic)
+{
+}
+
+void BenchFrontendCloseIM(void* arg, FcitxInputContext* ic)
+{
+}
+
+void BenchFrontendCommitString(void* arg, FcitxInputContext* ic, const char* str)
+{
+    FcitxBenchFrontend* frontend = arg;
+    frontend->commitCount++;
+}
+
+void BenchFrontendForwardKey(void* arg, FcitxInputContext* ic, FcitxKeyEventType event, FcitxKeySym sym, unsigned int state)
+{
+    FcitxBenchFrontend* frontend = arg;
+    frontend->forwardCount++;
+}
+
+void BenchFrontendSetWindowOffset(void* arg, FcitxInputContext* ic, int x, int y)
+{
+}
+
+void BenchFrontendGetWindowRect(void* arg, FcitxInputContext* ic, int* x, int* y, int* w, int* h)
+{
+    *x = *y = 0;
+    *w = *h = 1;
+}
+
+void BenchFrontendUpdatePreedit(void* arg, FcitxInputContext* ic)
+{
+    FcitxBenchFrontend* frontend = arg;
+    FcitxInputState* input = FcitxInstanceGetInputState(frontend->owner);
+    char* str = FcitxUIMessagesToCString(FcitxInputStateGetClientPreedit(input));
+    free(str);
+    frontend->preeditCount++;
+}
+
+typedef struct _FcitxBenchUI {
+    FcitxInstance* owner;
+    FcitxMessages* msgUp;
+    FcitxMessages* msgDown;
+} FcitxBenchUI;
+
+void* BenchUICreate(FcitxInstance* instance)
+{
+    FcitxBenchUI* ui = fcitx_utils_new(FcitxBenchUI);
+    ui->owner = instance;
+    ui->msgUp = FcitxMessagesNew();
+    ui->msgDown = FcitxMessagesNew();
+    return ui;
+}
+
+/* do the same text work as a real ui, without drawing anything */
+void BenchUIShowInputWindow(void* arg)
+{
+    FcitxBenchUI* ui = arg;
+    char* strs[MAX_MESSAGE_COUNT];
+    int i, count;
+    FcitxUINewMessageToOldStyleMessage(ui->owner, ui->msgUp, ui->msgDown);
+    count = FcitxMessagesGetMessageCount(ui->msgDown);
+    for (i = 0; i < count; i++)
+        strs[i] = FcitxMessagesGetMessageString(ui->msgDown, i);
+    FcitxInstanceProcessOutputFilterArray(ui->owner, strs, count);
+    for (i = 0; i < count; i++) {
+        if (strs[i] != FcitxMessagesGetMessageString(ui->msgDown, i))
+            free(strs[i]);
+    }
+    benchFrontend.showCount++;
+}
+
+void BenchUICloseInputWindow(void* arg)
+{
+    benchFrontend.closeCount++;
+}
+
+void* BenchIMCreate(FcitxInstance* instance)
+{
+    /* a do nothing keyboard, so that index 0 is never a real input method */
+    FcitxInstanceRegisterIM(instance, &benchFrontend, "bench-keyboard",
+                            "Benchmark Keyboard", "kbd", NULL, NULL,
+                            BenchIMDoInput, NULL, NULL, NULL, NULL, NULL,
+                            PRIORITY_MAGIC_FIRST, "");
+    return &benchFrontend;
+}
+
+void BenchIMDestroy(void* arg)
+{
+}
+
+INPUT_RETURN_VALUE BenchIMDoInput(void* arg, FcitxKeySym sym, unsigned int state)
+{
+    return IRV_TO_PROCESS;
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
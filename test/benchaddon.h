@@ -0,0 +1,52 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @file benchaddon.h
+ *
+ * headless frontend, ui and input method used by benchkey, benchkey links
+ * to the same shared object fcitx loads, so it can see the addon state.
+ */
+
+#ifndef _FCITX_BENCHADDON_H_
+#define _FCITX_BENCHADDON_H_
+
+#include <fcitx/instance.h>
+
+typedef struct _FcitxBenchFrontend {
+    FcitxInstance* owner;
+    int frontendid;
+    unsigned int commitCount;
+    unsigned int preeditCount;
+    unsigned int forwardCount;
+    unsigned int showCount;
+    unsigned int closeCount;
+} FcitxBenchFrontend;
+
+typedef void (*FcitxBenchReadyCallback)(FcitxBenchFrontend* frontend, void* arg);
+
+/**
+ * callback is called on the instance thread once the frontend is created
+ **/
+void FcitxBenchSetReadyCallback(FcitxBenchReadyCallback callback, void* arg);
+
+#endif
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include "benchalloc.h"
+
+static unsigned long alloc_count = 0;
+
+#ifdef __GLIBC__
+/* glibc allows replacing malloc, forward everything to the real one */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+    __sync_fetch_and_add(&alloc_count, 1);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&alloc_count, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    __sync_fetch_and_add(&alloc_count, 1);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+unsigned long bench_alloc_count()
+{
+    return __sync_fetch_and_add(&alloc_count, 0);
+}
@@ -0,0 +1,8 @@
+#ifndef BENCHALLOC_H
+#define BENCHALLOC_H
+
+/* number of heap allocations done by the process so far, always 0 if it
+ * can't be counted on this libc */
+unsigned long bench_alloc_count();
+
+#endif
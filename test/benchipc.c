@@ -0,0 +1,543 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @file benchipc.c
+ *
+ * measure the D-Bus round trip cost of key events sent to the ipc frontend
+ * one by one with ProcessKeyEvent, and in batches with ProcessKeyEvents,
+ * against the shared memory channel opened by OpenShmChannel, where the
+ * same batch of keys is in flight at once.
+ *
+ * usage: benchipc [-n keys] [-b batch] <bench home>
+ *
+ * A private dbus-daemon is started as the session bus, fcitx runs in process
+ * with the benchmark addons from <bench home> (see benchkey.c), and the
+ * in-tree fcitx-dbus and fcitx-ipc copied there by the build. The benchmark
+ * fails if any of them can't be started.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <semaphore.h>
+#include <dbus/dbus.h>
+
+#include "fcitx/fcitx.h"
+#include "fcitx/instance.h"
+#include "fcitx/frontend.h"
+#include "fcitx-utils/utils.h"
+#include "fcitx-utils/shmchannel.h"
+#include "frontend/ipc/ipc.h"
+#include "dbuslauncher.h"
+#include "dbusstuff.h"
+#include "benchaddon.h"
+
+#define DEFAULT_KEYS 2000
+#define DEFAULT_BATCH 8
+#define CALL_TIMEOUT 5000
+
+typedef struct {
+    FcitxInstance* instance;
+    FcitxBenchFrontend* frontend;
+    sem_t ready;
+    int pipefd[2];
+} BenchContext;
+
+typedef struct {
+    DBusConnection* conn;
+    char service[64];
+    char path[32];
+    int32_t icid;
+    uint32_t timestamp;
+    unsigned int calls;
+    FcitxShmChannel* channel;
+    unsigned int messages; /* non key result messages from the channel */
+} BenchClient;
+
+static uint64_t
+BenchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+BenchReady(FcitxBenchFrontend* frontend, void* arg)
+{
+    BenchContext* context = arg;
+    context->frontend = frontend;
+    context->instance = frontend->owner;
+    sem_post(&context->ready);
+}
+
+static void*
+BenchRunInstance(void* arg)
+{
+    BenchContext* context = arg;
+    char* argv[] = {
+        "fcitx", "-D", "-s", "0", "-u", "fcitx-bench-ui", "--disable", "all",
+        "--enable", "fcitx-bench-frontend,fcitx-bench-ui,fcitx-bench-im,"
+                    "fcitx-dbus,fcitx-ipc", NULL
+    };
+    FcitxInstanceRun(FCITX_ARRAY_SIZE(argv) - 1, argv, context->pipefd[0]);
+    context->frontend = NULL;
+    sem_post(&context->ready);
+    return NULL;
+}
+
+static void
+BenchNoop(void* arg)
+{
+    FCITX_UNUSED(arg);
+}
+
+static void
+BenchEnd(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstanceEnd(context->instance);
+}
+
+static DBusMessage*
+BenchCall(BenchClient* client, DBusMessage* msg)
+{
+    DBusError error;
+    dbus_error_init(&error);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        client->conn, msg, CALL_TIMEOUT, &error);
+    dbus_message_unref(msg);
+    if (dbus_error_is_set(&error)) {
+        fprintf(stderr, "%s\n", error.message);
+        dbus_error_free(&error);
+    }
+    client->calls++;
+    return reply;
+}
+
+static boolean
+BenchCallIC(BenchClient* client, const char* method)
+{
+    DBusMessage* msg = dbus_message_new_method_call(client->service,
+                                                    client->path,
+                                                    FCITX_IC_DBUS_INTERFACE,
+                                                    method);
+    DBusMessage* reply = BenchCall(client, msg);
+    if (!reply)
+        return false;
+    dbus_message_unref(reply);
+    return true;
+}
+
+static boolean
+BenchCreateIC(BenchClient* client)
+{
+    const char* appname = "benchipc";
+    int32_t pid = getpid();
+    int32_t id;
+    DBusMessage* msg = dbus_message_new_method_call(client->service,
+                                                    FCITX_IM_DBUS_PATH,
+                                                    FCITX_IM_DBUS_INTERFACE,
+                                                    "CreateICv3");
+    dbus_message_append_args(msg, DBUS_TYPE_STRING, &appname,
+                             DBUS_TYPE_INT32, &pid, DBUS_TYPE_INVALID);
+    DBusMessage* reply = BenchCall(client, msg);
+    if (!reply)
+        return false;
+    boolean result = dbus_message_get_args(reply, NULL,
+                                           DBUS_TYPE_INT32, &id,
+                                           DBUS_TYPE_INVALID);
+    dbus_message_unref(reply);
+    if (!result)
+        return false;
+    client->icid = id;
+    sprintf(client->path, FCITX_IC_DBUS_PATH, id);
+
+    uint32_t caps = CAPACITY_PREEDIT | CAPACITY_BATCH_KEY_EVENT;
+    msg = dbus_message_new_method_call(client->service, client->path,
+                                       FCITX_IC_DBUS_INTERFACE, "SetCapacity");
+    dbus_message_append_args(msg, DBUS_TYPE_UINT32, &caps, DBUS_TYPE_INVALID);
+    reply = BenchCall(client, msg);
+    if (reply)
+        dbus_message_unref(reply);
+    return reply && BenchCallIC(client, "FocusIn")
+        && BenchCallIC(client, "EnableIC");
+}
+
+static void
+BenchNextKey(BenchClient* client, unsigned int i, int32_t type,
+             uint32_t* keyval, uint32_t* t)
+{
+    *keyval = 'a' + (i % 26);
+    *t = client->timestamp;
+    client->timestamp += (type == FCITX_PRESS_KEY) ? 20 : 80;
+}
+
+/* every key is a press and a release, so two calls per key */
+static boolean
+BenchSingle(BenchClient* client, unsigned int keys)
+{
+    unsigned int i;
+    int32_t type;
+    for (i = 0; i < keys; i++) {
+        for (type = FCITX_PRESS_KEY; type <= FCITX_RELEASE_KEY; type++) {
+            uint32_t keyval, keycode = 0, state = 0, t;
+            BenchNextKey(client, i, type, &keyval, &t);
+            DBusMessage* msg = dbus_message_new_method_call(
+                client->service, client->path, FCITX_IC_DBUS_INTERFACE,
+                "ProcessKeyEvent");
+            dbus_message_append_args(msg, DBUS_TYPE_UINT32, &keyval,
+                                     DBUS_TYPE_UINT32, &keycode,
+                                     DBUS_TYPE_UINT32, &state,
+                                     DBUS_TYPE_INT32, &type,
+                                     DBUS_TYPE_UINT32, &t,
+                                     DBUS_TYPE_INVALID);
+            DBusMessage* reply = BenchCall(client, msg);
+            if (!reply)
+                return false;
+            dbus_message_unref(reply);
+        }
+    }
+    return true;
+}
+
+static boolean
+BenchBatch(BenchClient* client, unsigned int keys, unsigned int batch)
+{
+    unsigned int i = 0;
+    while (i < keys) {
+        DBusMessageIter args, array, sub;
+        DBusMessage* msg = dbus_message_new_method_call(
+            client->service, client->path, FCITX_IC_DBUS_INTERFACE,
+            "ProcessKeyEvents");
+        unsigned int count = 0;
+        dbus_message_iter_init_append(msg, &args);
+        dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(uuuiu)",
+                                         &array);
+        for (; i < keys && count < batch; i++, count++) {
+            int32_t type;
+            for (type = FCITX_PRESS_KEY; type <= FCITX_RELEASE_KEY; type++) {
+                uint32_t keyval, keycode = 0, state = 0, t;
+                BenchNextKey(client, i, type, &keyval, &t);
+                dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT,
+                                                 NULL, &sub);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_UINT32, &keyval);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_UINT32, &keycode);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_UINT32, &state);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_INT32, &type);
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_UINT32, &t);
+                dbus_message_iter_close_container(&array, &sub);
+            }
+        }
+        dbus_message_iter_close_container(&args, &array);
+
+        DBusMessage* reply = BenchCall(client, msg);
+        if (!reply)
+            return false;
+        int32_t* result = NULL;
+        int len = 0;
+        boolean ok = dbus_message_get_args(reply, NULL, DBUS_TYPE_ARRAY,
+                                           DBUS_TYPE_INT32, &result, &len,
+                                           DBUS_TYPE_INVALID);
+        dbus_message_unref(reply);
+        if (!ok || len != (int) count * 2) {
+            fprintf(stderr, "ProcessKeyEvents returned %d results for %u events\n",
+                    len, count * 2);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the client side of the channel, NULL if the frontend or dbus can't do it */
+static FcitxShmChannel*
+BenchOpenShm(BenchClient* client)
+{
+#ifdef DBUS_TYPE_UNIX_FD
+    DBusMessage* msg = dbus_message_new_method_call(client->service,
+                                                    FCITX_IM_DBUS_PATH,
+                                                    FCITX_IM_DBUS_INTERFACE,
+                                                    "OpenShmChannel");
+    DBusMessage* reply = BenchCall(client, msg);
+    int memfd, rxfd, txfd;
+    if (!reply)
+        return NULL;
+    boolean ok = dbus_message_get_args(reply, NULL,
+                                       DBUS_TYPE_UNIX_FD, &memfd,
+                                       DBUS_TYPE_UNIX_FD, &rxfd,
+                                       DBUS_TYPE_UNIX_FD, &txfd,
+                                       DBUS_TYPE_INVALID);
+    dbus_message_unref(reply);
+    if (!ok)
+        return NULL;
+    return fcitx_shm_channel_open(memfd, rxfd, txfd);
+#else
+    FCITX_UNUSED(client);
+    return NULL;
+#endif
+}
+
+static boolean
+BenchShmWait(BenchClient* client, unsigned int* results)
+{
+    FcitxShmMessage message;
+    int fd = fcitx_shm_channel_get_fd(client->channel);
+    fd_set rfds;
+    struct timeval tval = {CALL_TIMEOUT / 1000, 0};
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    if (select(fd + 1, &rfds, NULL, NULL, &tval) <= 0) {
+        fprintf(stderr, "no reply from shared memory channel\n");
+        return false;
+    }
+    while (fcitx_shm_channel_receive(client->channel, &message)) {
+        if (message.type == FCITX_SHM_KEY_RESULT)
+            (*results)++;
+        else
+            client->messages++;
+    }
+    return !fcitx_shm_channel_is_broken(client->channel);
+}
+
+/* a batch of keys is in flight, then wait for all the results */
+static boolean
+BenchShm(BenchClient* client, unsigned int keys, unsigned int batch)
+{
+    unsigned int i = 0;
+    uint32_t serial = 0;
+    while (i < keys) {
+        unsigned int count = 0, results = 0;
+        for (; i < keys && count < batch; i++, count++) {
+            int32_t type;
+            for (type = FCITX_PRESS_KEY; type <= FCITX_RELEASE_KEY; type++) {
+                FcitxShmKeyEvent key;
+                BenchNextKey(client, i, type, &key.keyval, &key.time);
+                key.keycode = 0;
+                key.state = 0;
+                key.type = type;
+                if (!fcitx_shm_channel_send(client->channel, FCITX_SHM_KEY_EVENT,
+                                            client->icid, serial++,
+                                            &key, sizeof(key))) {
+                    fprintf(stderr, "shared memory channel is full\n");
+                    return false;
+                }
+            }
+        }
+        while (results < count * 2) {
+            if (!BenchShmWait(client, &results))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* signals sent and skipped by the ipc frontend so far */
+static void
+BenchSignalStats(BenchClient* client, uint64_t stats[2])
+{
+    DBusMessage* msg = dbus_message_new_method_call(client->service,
+                                                    FCITX_IM_DBUS_PATH,
+                                                    FCITX_IM_DBUS_INTERFACE,
+                                                    "GetSignalStats");
+    DBusMessage* reply = BenchCall(client, msg);
+    client->calls--;
+    stats[0] = stats[1] = 0;
+    if (!reply)
+        return;
+    dbus_uint64_t sent, skipped;
+    if (dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT64, &sent,
+                              DBUS_TYPE_UINT64, &skipped, DBUS_TYPE_INVALID)) {
+        stats[0] = sent;
+        stats[1] = skipped;
+    }
+    dbus_message_unref(reply);
+}
+
+static void
+BenchReport(BenchClient* client, const char* name, unsigned int keys,
+            uint64_t elapsed, const uint64_t before[2])
+{
+    uint64_t after[2];
+    BenchSignalStats(client, after);
+    printf("%-24s keys %6u calls %6u %10.0f keys/s %8.1fus/key"
+           " signals sent %6llu skipped %6llu\n",
+           name, keys, client->calls, keys * 1e9 / elapsed,
+           elapsed / 1000.0 / keys,
+           (unsigned long long) (after[0] - before[0]),
+           (unsigned long long) (after[1] - before[1]));
+}
+
+/* a batch with wrong signature must be refused as invalid arguments */
+static boolean
+BenchBatchInvalid(BenchClient* client)
+{
+    uint32_t keyval = 'a';
+    DBusError error;
+    DBusMessage* msg = dbus_message_new_method_call(
+        client->service, client->path, FCITX_IC_DBUS_INTERFACE,
+        "ProcessKeyEvents");
+    dbus_message_append_args(msg, DBUS_TYPE_UINT32, &keyval,
+                             DBUS_TYPE_INVALID);
+    dbus_error_init(&error);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        client->conn, msg, CALL_TIMEOUT, &error);
+    dbus_message_unref(msg);
+    if (reply)
+        dbus_message_unref(reply);
+    boolean result = dbus_error_has_name(&error, DBUS_ERROR_INVALID_ARGS);
+    if (!result)
+        fprintf(stderr, "ProcessKeyEvents accepted wrong arguments\n");
+    dbus_error_free(&error);
+    return result;
+}
+
+static boolean
+BenchRunClient(BenchClient* client, unsigned int keys, unsigned int batch)
+{
+    char name[32];
+    uint64_t start;
+    uint64_t stats[2];
+
+    if (!BenchCreateIC(client)) {
+        fprintf(stderr, "input context can't be created\n");
+        return false;
+    }
+
+    BenchSignalStats(client, stats);
+    client->calls = 0;
+    start = BenchNow();
+    if (!BenchSingle(client, keys))
+        return false;
+    BenchReport(client, "ProcessKeyEvent", keys, BenchNow() - start, stats);
+
+    if (!BenchBatchInvalid(client))
+        return false;
+    BenchSignalStats(client, stats);
+    client->calls = 0;
+    start = BenchNow();
+    if (!BenchBatch(client, keys, batch))
+        return false;
+    snprintf(name, sizeof(name), "ProcessKeyEvents x%u", batch);
+    BenchReport(client, name, keys, BenchNow() - start, stats);
+
+    client->channel = BenchOpenShm(client);
+    if (!client->channel) {
+        fprintf(stderr, "shared memory channel is not available\n");
+        return false;
+    }
+    BenchSignalStats(client, stats);
+    client->calls = 0;
+    start = BenchNow();
+    if (!BenchShm(client, keys, batch))
+        return false;
+    snprintf(name, sizeof(name), "ShmChannel x%u", batch);
+    BenchReport(client, name, keys, BenchNow() - start, stats);
+    printf("%-24s messages %u\n", "", client->messages);
+    fcitx_shm_channel_free(client->channel);
+    client->channel = NULL;
+
+    return BenchCallIC(client, "DestroyIC");
+}
+
+int main(int argc, char* argv[])
+{
+    BenchContext context;
+    BenchClient client;
+    pthread_t thread;
+    unsigned int keys = DEFAULT_KEYS;
+    unsigned int batch = DEFAULT_BATCH;
+    int argi = 1;
+    int result = 1;
+
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-n") == 0)
+            keys = atoi(argv[argi + 1]);
+        else if (strcmp(argv[argi], "-b") == 0)
+            batch = atoi(argv[argi + 1]);
+        else
+            break;
+        argi += 2;
+    }
+    if (argi >= argc || keys == 0 || batch == 0) {
+        fprintf(stderr, "usage: %s [-n keys] [-b batch] <bench home>\n",
+                argv[0]);
+        return 1;
+    }
+
+    dbus_threads_init_default();
+    DBusDaemonProperty daemon = DBusLaunch(NULL);
+    if (daemon.pid == 0) {
+        fprintf(stderr, "dbus-daemon can't be started\n");
+        return 1;
+    }
+    setenv("DBUS_SESSION_BUS_ADDRESS", daemon.address, 1);
+    setenv("FCITX_NO_PRIVATE_DBUS", "1", 1);
+    setenv("XDG_CONFIG_HOME", argv[argi], 1);
+
+    memset(&context, 0, sizeof(context));
+    sem_init(&context.ready, 0, 0);
+    if (pipe(context.pipefd) < 0) {
+        DBusKill(&daemon);
+        return 1;
+    }
+    FcitxBenchSetReadyCallback(BenchReady, &context);
+    pthread_create(&thread, NULL, BenchRunInstance, &context);
+    sem_wait(&context.ready);
+
+    if (!context.frontend) {
+        fprintf(stderr, "fcitx instance can't be created\n");
+        pthread_join(thread, NULL);
+        DBusKill(&daemon);
+        return 1;
+    }
+    /* once the main loop runs, all frontends are loaded */
+    FcitxInstanceRunCommandSync(context.instance, BenchNoop, NULL);
+
+    memset(&client, 0, sizeof(client));
+    client.timestamp = 1000;
+    snprintf(client.service, sizeof(client.service), "%s-%d",
+             FCITX_DBUS_SERVICE, fcitx_utils_get_display_number());
+    /* the instance owns the shared session connection */
+    client.conn = dbus_bus_get_private(DBUS_BUS_SESSION, NULL);
+    if (client.conn) {
+        dbus_connection_set_exit_on_disconnect(client.conn, FALSE);
+        if (BenchRunClient(&client, keys, batch))
+            result = 0;
+        dbus_connection_close(client.conn);
+        dbus_connection_unref(client.conn);
+    } else {
+        fprintf(stderr, "cannot connect to dbus-daemon\n");
+    }
+
+    FcitxInstanceRunCommandSync(context.instance, BenchEnd, &context);
+    write(context.pipefd[1], "", 1);
+    sem_wait(&context.ready);
+    pthread_join(thread, NULL);
+    DBusKill(&daemon);
+    return result;
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
@@ -0,0 +1,414 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @file benchkey.c
+ *
+ * replay recorded key traces through FcitxInstanceProcessKey and report
+ * throughput and latency per key, no X or D-Bus is needed.
+ *
+ * usage: benchkey [-n repeat] [-i interval] <bench home> <trace>...
+ *
+ * -i sets UIUpdateInterval in milliseconds, the number of input window
+ * paints (show and close of the bench ui) per key is reported with it.
+ *
+ * <bench home> is used as XDG_CONFIG_HOME, it must contain the benchmark
+ * addons and the input methods of the traces (the build copies the in-tree
+ * pinyin, table and punc addons with their data there). A trace whose input
+ * method is not available is a failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "fcitx/fcitx.h"
+#include "fcitx/instance.h"
+#include "fcitx/frontend.h"
+#include "fcitx/ime.h"
+#include "fcitx/ui.h"
+#include "fcitx/profile.h"
+#include "fcitx-config/hotkey.h"
+#include "fcitx-utils/utarray.h"
+#include "fcitx-utils/utils.h"
+#include "benchaddon.h"
+#include "benchalloc.h"
+
+#define DEFAULT_REPEAT 20
+
+typedef struct {
+    FcitxKeySym sym;
+    unsigned int state;
+} BenchKey;
+
+static const UT_icd bench_key_icd = {
+    sizeof(BenchKey), NULL, NULL, NULL
+};
+
+typedef struct {
+    char* im;
+    UT_array keys;
+} BenchTrace;
+
+typedef struct {
+    FcitxInstance* instance;
+    FcitxBenchFrontend* frontend;
+    FcitxInputContext* ic;
+    sem_t ready;
+    int pipefd[2];
+    unsigned long timestamp;
+    int interval;
+} BenchContext;
+
+typedef struct {
+    BenchContext* context;
+    const char* im;
+    boolean ok;
+} BenchSelectIM;
+
+typedef struct {
+    BenchContext* context;
+    const BenchKey* key;
+    uint64_t elapsed;
+} BenchKeyEvent;
+
+static uint64_t
+BenchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static boolean
+BenchParseToken(const char* token, UT_array* keys)
+{
+    BenchKey key;
+    const char* p;
+    boolean isKeyName = strlen(token) > 1;
+    for (p = token; *p && isKeyName; p++) {
+        if (!isupper(*p) && !isdigit(*p) && *p != '_')
+            isKeyName = false;
+    }
+    if (isKeyName) {
+        if (!FcitxHotkeyParseKey(token, &key.sym, &key.state))
+            return false;
+        utarray_push_back(keys, &key);
+        return true;
+    }
+    /* type every character */
+    for (p = token; *p; p++) {
+        char str[2] = {*p, '\0'};
+        if (!FcitxHotkeyParseKey(str, &key.sym, &key.state))
+            return false;
+        utarray_push_back(keys, &key);
+    }
+    return true;
+}
+
+static boolean
+BenchLoadTrace(const char* path, BenchTrace* trace)
+{
+    FILE* fp = fopen(path, "r");
+    char* line = NULL;
+    size_t bufsize = 0;
+    boolean result = true;
+    if (!fp) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+
+    trace->im = NULL;
+    utarray_init(&trace->keys, &bench_key_icd);
+    while (getline(&line, &bufsize, fp) != -1) {
+        char* saveptr = NULL;
+        char* token = strtok_r(line, " \t\r\n", &saveptr);
+        if (!token || token[0] == '#')
+            continue;
+        if (strcmp(token, "IM") == 0) {
+            token = strtok_r(NULL, " \t\r\n", &saveptr);
+            if (token)
+                fcitx_utils_string_swap(&trace->im, token);
+            continue;
+        }
+        for (; token; token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            if (!BenchParseToken(token, &trace->keys)) {
+                fprintf(stderr, "%s: unknown key %s\n", path, token);
+                result = false;
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (!trace->im) {
+        fprintf(stderr, "%s: no input method\n", path);
+        result = false;
+    }
+    return result;
+}
+
+static void
+BenchFreeTrace(BenchTrace* trace)
+{
+    fcitx_utils_free(trace->im);
+    utarray_done(&trace->keys);
+}
+
+static void
+BenchReady(FcitxBenchFrontend* frontend, void* arg)
+{
+    BenchContext* context = arg;
+    context->frontend = frontend;
+    context->instance = frontend->owner;
+    sem_post(&context->ready);
+}
+
+static void*
+BenchRunInstance(void* arg)
+{
+    BenchContext* context = arg;
+    char* argv[] = {
+        "fcitx", "-D", "-s", "0", "-u", "fcitx-bench-ui", "--disable", "all",
+        "--enable", "fcitx-bench-frontend,fcitx-bench-ui,fcitx-bench-im,"
+                    "fcitx-pinyin,fcitx-table,fcitx-punc", NULL
+    };
+    FcitxInstanceRun(FCITX_ARRAY_SIZE(argv) - 1, argv, context->pipefd[0]);
+    /* either loading failed, or the instance has ended */
+    context->frontend = NULL;
+    sem_post(&context->ready);
+    return NULL;
+}
+
+static void
+BenchSetup(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstance* instance = context->instance;
+    FcitxProfile* profile = FcitxInstanceGetProfile(instance);
+    fcitx_utils_string_swap(&profile->imList, "bench-keyboard:True,"
+                            "pinyin:True,shuangpin:True,wubi:True");
+    FcitxInstanceUpdateIMList(instance);
+    if (context->interval >= 0)
+        FcitxInstanceGetGlobalConfig(instance)->iUIUpdateInterval = context->interval;
+
+    context->ic = FcitxInstanceCreateIC(instance, context->frontend->frontendid,
+                                        NULL);
+    FcitxInstanceSetCurrentIC(instance, context->ic);
+    FcitxUIOnInputFocus(instance);
+}
+
+static void
+BenchSelect(void* arg)
+{
+    BenchSelectIM* select = arg;
+    FcitxInstance* instance = select->context->instance;
+    FcitxInstanceEnableIM(instance, select->context->ic, false);
+    FcitxInstanceSwitchIMByName(instance, select->im);
+    FcitxIM* im = FcitxInstanceGetCurrentIM(instance);
+    select->ok = im && strcmp(im->uniqueName, select->im) == 0 &&
+                 FcitxInstanceGetCurrentState(instance) == IS_ACTIVE;
+}
+
+static void
+BenchProcessKey(void* arg)
+{
+    BenchKeyEvent* event = arg;
+    BenchContext* context = event->context;
+    uint64_t start = BenchNow();
+    FcitxInstanceProcessKey(context->instance, FCITX_PRESS_KEY,
+                            context->timestamp, event->key->sym,
+                            event->key->state);
+    FcitxInstanceProcessKey(context->instance, FCITX_RELEASE_KEY,
+                            context->timestamp + 20, event->key->sym,
+                            event->key->state);
+    event->elapsed = BenchNow() - start;
+    context->timestamp += 100;
+}
+
+static void
+BenchReset(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstanceResetInput(context->instance);
+    FcitxUIUpdateInputWindow(context->instance);
+}
+
+static void
+BenchNothing(void* arg)
+{
+}
+
+static void
+BenchEnd(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstanceEnd(context->instance);
+}
+
+static int
+BenchCompare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double
+BenchPercentile(uint64_t* samples, size_t count, int percent)
+{
+    return samples[(count - 1) * percent / 100] / 1000.0;
+}
+
+static boolean
+BenchRunTrace(BenchContext* context, BenchTrace* trace, int repeat)
+{
+    FcitxInstance* instance = context->instance;
+    BenchSelectIM select = {context, trace->im, false};
+    FcitxInstanceRunCommandSync(instance, BenchSelect, &select);
+    if (!select.ok) {
+        fprintf(stderr, "%s: input method is not available\n", trace->im);
+        return false;
+    }
+
+    size_t count = utarray_len(&trace->keys) * repeat;
+    if (count == 0)
+        return true;
+    uint64_t* process = fcitx_utils_malloc0(sizeof(uint64_t) * count);
+    uint64_t* roundtrip = fcitx_utils_malloc0(sizeof(uint64_t) * count);
+    unsigned int commitCount = context->frontend->commitCount;
+    unsigned int paintCount = context->frontend->showCount +
+                              context->frontend->closeCount;
+    size_t n = 0;
+    int i;
+    unsigned long allocs = bench_alloc_count();
+    uint64_t start = BenchNow();
+    for (i = 0; i < repeat; i++) {
+        BenchKey* key;
+        for (key = (BenchKey*) utarray_front(&trace->keys);
+             key != NULL;
+             key = (BenchKey*) utarray_next(&trace->keys, key)) {
+            BenchKeyEvent event = {context, key, 0};
+            uint64_t keyStart = BenchNow();
+            FcitxInstanceRunCommandSync(instance, BenchProcessKey, &event);
+            roundtrip[n] = BenchNow() - keyStart;
+            process[n] = event.elapsed;
+            n++;
+        }
+        FcitxInstanceRunCommandSync(instance, BenchReset, context);
+    }
+    uint64_t total = BenchNow() - start;
+    allocs = bench_alloc_count() - allocs;
+    /* paint is done after the command, let it and the delayed one happen */
+    if (context->interval > 0)
+        usleep((context->interval + 10) * 1000);
+    FcitxInstanceRunCommandSync(instance, BenchNothing, NULL);
+    paintCount = context->frontend->showCount + context->frontend->closeCount
+                 - paintCount;
+
+    qsort(process, count, sizeof(uint64_t), BenchCompare);
+    qsort(roundtrip, count, sizeof(uint64_t), BenchCompare);
+    printf("%-12s keys %7zu %10.0f keys/s process p50 %7.1fus p99 %7.1fus"
+           " roundtrip p50 %7.1fus p99 %7.1fus allocs/key %6.1f commits %u"
+           " paints/key %4.2f\n",
+           trace->im, count, count * 1e9 / total,
+           BenchPercentile(process, count, 50),
+           BenchPercentile(process, count, 99),
+           BenchPercentile(roundtrip, count, 50),
+           BenchPercentile(roundtrip, count, 99),
+           (double) allocs / count,
+           context->frontend->commitCount - commitCount,
+           (double) paintCount / count);
+    free(process);
+    free(roundtrip);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchContext context;
+    pthread_t thread;
+    int repeat = DEFAULT_REPEAT;
+    int interval = -1;
+    int argi = 1;
+    int result = 0;
+    int i;
+
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-n") == 0)
+            repeat = atoi(argv[argi + 1]);
+        else if (strcmp(argv[argi], "-i") == 0)
+            interval = atoi(argv[argi + 1]);
+        else
+            break;
+        argi += 2;
+    }
+    if (argi >= argc || repeat <= 0) {
+        fprintf(stderr, "usage: %s [-n repeat] [-i interval] <bench home>"
+                " <trace>...\n", argv[0]);
+        return 1;
+    }
+    setenv("XDG_CONFIG_HOME", argv[argi++], 1);
+
+    int traceCount = argc - argi;
+    BenchTrace traces[traceCount > 0 ? traceCount : 1];
+    for (i = 0; i < traceCount; i++) {
+        if (!BenchLoadTrace(argv[argi + i], &traces[i]))
+            return 1;
+    }
+
+    memset(&context, 0, sizeof(context));
+    context.timestamp = 1000;
+    context.interval = interval;
+    sem_init(&context.ready, 0, 0);
+    if (pipe(context.pipefd) < 0)
+        return 1;
+    FcitxBenchSetReadyCallback(BenchReady, &context);
+    pthread_create(&thread, NULL, BenchRunInstance, &context);
+    sem_wait(&context.ready);
+
+    if (!context.frontend) {
+        fprintf(stderr, "fcitx instance can't be created\n");
+        pthread_join(thread, NULL);
+        return 1;
+    }
+
+    FcitxInstanceRunCommandSync(context.instance, BenchSetup, &context);
+    for (i = 0; i < traceCount; i++) {
+        if (!BenchRunTrace(&context, &traces[i], repeat))
+            result = 1;
+    }
+
+    FcitxInstanceRunCommandSync(context.instance, BenchEnd, &context);
+    write(context.pipefd[1], "", 1);
+    sem_wait(&context.ready);
+    pthread_join(thread, NULL);
+
+    for (i = 0; i < traceCount; i++)
+        BenchFreeTrace(&traces[i]);
+    return result;
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
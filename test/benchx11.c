@@ -0,0 +1,532 @@
+/***************************************************************************
+ *   Copyright (C) 2012~2012 by CSSlayer                                   *
+ *   wengxt@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+/**
+ * @file benchx11.c
+ *
+ * count the X round trips classic ui makes per key while the input window
+ * is shown, updated and hidden by pinyin input.
+ *
+ * usage: benchx11 [-n repeat] <bench home>
+ *
+ * A private Xvfb is started, fcitx runs in process and connects to it
+ * through a proxy that counts the replies sent by the server, every reply
+ * is a round trip of the client. <bench home> must contain the benchmark
+ * addons, the in-tree fcitx-x11, fcitx-classic-ui, fcitx-pinyin, fcitx-punc
+ * and the default skin (the build copies them). The benchmark exits with 77
+ * (skipped) if Xvfb is not available.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "fcitx/fcitx.h"
+#include "fcitx/instance.h"
+#include "fcitx/frontend.h"
+#include "fcitx/ime.h"
+#include "fcitx/ui.h"
+#include "fcitx/profile.h"
+#include "fcitx-utils/utils.h"
+#include "benchaddon.h"
+
+#define DEFAULT_REPEAT 20
+#define SKIP_RETURN_CODE 77
+#define PROXY_MAX_CONN 8
+/* first display number tried for the proxy, far from the usual ones */
+#define PROXY_DISPLAY_BASE 150
+/* let the delayed paint of the input window happen */
+#define PAINT_WAIT 50000
+
+typedef struct {
+    FcitxInstance* instance;
+    FcitxBenchFrontend* frontend;
+    FcitxInputContext* ic;
+    sem_t ready;
+    int pipefd[2];
+    unsigned long timestamp;
+} BenchContext;
+
+typedef struct {
+    BenchContext* context;
+    FcitxKeySym sym;
+} BenchKeyEvent;
+
+/*
+ * one client connection, the server to client stream is split into the
+ * setup reply and then 32 bytes packets, replies and generic events carry
+ * more data after them.
+ */
+typedef struct {
+    int client;
+    int server;
+    boolean setup;
+    unsigned char header[8];
+    size_t headerLen;
+    size_t skip;
+} ProxyConn;
+
+typedef struct {
+    char xserver[108];
+    int listenfd;
+    int stopfd[2];
+    ProxyConn conns[PROXY_MAX_CONN];
+    int count;
+    pthread_t thread;
+} Proxy;
+
+static unsigned long replies = 0;
+
+static uint64_t
+BenchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+ProxyParse(ProxyConn* conn, const unsigned char* buf, size_t len)
+{
+    while (len > 0) {
+        if (conn->skip > 0) {
+            size_t n = conn->skip < len ? conn->skip : len;
+            conn->skip -= n;
+            buf += n;
+            len -= n;
+            continue;
+        }
+        size_t n = sizeof(conn->header) - conn->headerLen;
+        if (n > len)
+            n = len;
+        memcpy(conn->header + conn->headerLen, buf, n);
+        conn->headerLen += n;
+        buf += n;
+        len -= n;
+        if (conn->headerLen < sizeof(conn->header))
+            break;
+        conn->headerLen = 0;
+
+        /* client uses the byte order of this host */
+        if (!conn->setup) {
+            uint16_t extra;
+            memcpy(&extra, conn->header + 6, sizeof(extra));
+            conn->setup = true;
+            conn->skip = extra * 4;
+            continue;
+        }
+        uint8_t type = conn->header[0] & 0x7f;
+        if (type == 1 || type == 35) {
+            uint32_t extra;
+            memcpy(&extra, conn->header + 4, sizeof(extra));
+            conn->skip = 32 - sizeof(conn->header) + (size_t) extra * 4;
+            if (type == 1)
+                __sync_fetch_and_add(&replies, 1);
+        } else {
+            conn->skip = 32 - sizeof(conn->header);
+        }
+    }
+}
+
+static void
+ProxyClose(Proxy* proxy, int i)
+{
+    close(proxy->conns[i].client);
+    close(proxy->conns[i].server);
+    proxy->conns[i] = proxy->conns[--proxy->count];
+}
+
+static void
+ProxyAccept(Proxy* proxy)
+{
+    int client = accept(proxy->listenfd, NULL, NULL);
+    if (client < 0)
+        return;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, proxy->xserver, sizeof(addr.sun_path) - 1);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (proxy->count == PROXY_MAX_CONN || server < 0
+        || connect(server, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(client);
+        if (server >= 0)
+            close(server);
+        return;
+    }
+    ProxyConn* conn = &proxy->conns[proxy->count++];
+    memset(conn, 0, sizeof(*conn));
+    conn->client = client;
+    conn->server = server;
+}
+
+static boolean
+ProxyForward(int from, int to, ProxyConn* conn)
+{
+    unsigned char buf[4096];
+    ssize_t len = read(from, buf, sizeof(buf));
+    if (len <= 0)
+        return len < 0 && errno == EINTR;
+    if (conn)
+        ProxyParse(conn, buf, len);
+    ssize_t written = 0;
+    while (written < len) {
+        ssize_t n = write(to, buf + written, len - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        written += n;
+    }
+    return true;
+}
+
+static void*
+ProxyRun(void* arg)
+{
+    Proxy* proxy = arg;
+    struct pollfd fds[2 + PROXY_MAX_CONN * 2];
+    while (true) {
+        int i, nfds = 0;
+        fds[nfds].fd = proxy->stopfd[0];
+        fds[nfds++].events = POLLIN;
+        fds[nfds].fd = proxy->listenfd;
+        fds[nfds++].events = POLLIN;
+        for (i = 0; i < proxy->count; i++) {
+            fds[nfds].fd = proxy->conns[i].client;
+            fds[nfds++].events = POLLIN;
+            fds[nfds].fd = proxy->conns[i].server;
+            fds[nfds++].events = POLLIN;
+        }
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[0].revents)
+            break;
+        /* from the last one, closing moves the last connection */
+        for (i = proxy->count - 1; i >= 0; i--) {
+            ProxyConn* conn = &proxy->conns[i];
+            boolean ok = true;
+            if (fds[2 + i * 2].revents)
+                ok = ProxyForward(conn->client, conn->server, NULL);
+            if (ok && fds[3 + i * 2].revents)
+                ok = ProxyForward(conn->server, conn->client, conn);
+            if (!ok)
+                ProxyClose(proxy, i);
+        }
+        if (fds[1].revents)
+            ProxyAccept(proxy);
+    }
+    while (proxy->count > 0)
+        ProxyClose(proxy, proxy->count - 1);
+    return NULL;
+}
+
+/* listen on a free tcp display of localhost, return the display number */
+static int
+ProxyStart(Proxy* proxy, int xdisplay)
+{
+    int display;
+    memset(proxy, 0, sizeof(*proxy));
+    snprintf(proxy->xserver, sizeof(proxy->xserver), "/tmp/.X11-unix/X%d",
+             xdisplay);
+    proxy->listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (proxy->listenfd < 0)
+        return -1;
+    for (display = PROXY_DISPLAY_BASE; display < PROXY_DISPLAY_BASE + 50;
+         display++) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(6000 + display);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(proxy->listenfd, (struct sockaddr*) &addr, sizeof(addr)) == 0)
+            break;
+    }
+    if (display == PROXY_DISPLAY_BASE + 50 || listen(proxy->listenfd, 4) < 0
+        || pipe(proxy->stopfd) < 0) {
+        close(proxy->listenfd);
+        return -1;
+    }
+    pthread_create(&proxy->thread, NULL, ProxyRun, proxy);
+    return display;
+}
+
+static void
+ProxyStop(Proxy* proxy)
+{
+    write(proxy->stopfd[1], "", 1);
+    pthread_join(proxy->thread, NULL);
+    close(proxy->stopfd[0]);
+    close(proxy->stopfd[1]);
+    close(proxy->listenfd);
+}
+
+/* return the display number of a new Xvfb, -1 if it can't be started */
+static int
+XvfbStart(pid_t* pid)
+{
+    int fds[2];
+    char buf[16];
+    size_t len = 0;
+    if (pipe(fds) < 0)
+        return -1;
+    *pid = fork();
+    if (*pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (*pid == 0) {
+        char fdstr[16];
+        close(fds[0]);
+        snprintf(fdstr, sizeof(fdstr), "%d", fds[1]);
+        execlp("Xvfb", "Xvfb", "-displayfd", fdstr, "-nolisten", "tcp",
+               "-screen", "0", "1024x768x24", "-ac", NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    /* the display number followed by a newline, once it is ready */
+    while (len < sizeof(buf) - 1) {
+        ssize_t n = read(fds[0], buf + len, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || buf[len] == '\n')
+            break;
+        len++;
+    }
+    close(fds[0]);
+    buf[len] = '\0';
+    if (len == 0) {
+        waitpid(*pid, NULL, 0);
+        return -1;
+    }
+    return atoi(buf);
+}
+
+static void
+XvfbStop(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static void
+BenchReady(FcitxBenchFrontend* frontend, void* arg)
+{
+    BenchContext* context = arg;
+    context->frontend = frontend;
+    context->instance = frontend->owner;
+    sem_post(&context->ready);
+}
+
+static void*
+BenchRunInstance(void* arg)
+{
+    BenchContext* context = arg;
+    char* argv[] = {
+        "fcitx", "-D", "-s", "0", "-u", "fcitx-classic-ui", "--disable", "all",
+        "--enable", "fcitx-bench-frontend,fcitx-bench-im,fcitx-x11,"
+                    "fcitx-classic-ui,fcitx-pinyin,fcitx-punc", NULL
+    };
+    FcitxInstanceRun(FCITX_ARRAY_SIZE(argv) - 1, argv, context->pipefd[0]);
+    context->frontend = NULL;
+    sem_post(&context->ready);
+    return NULL;
+}
+
+static void
+BenchSetup(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstance* instance = context->instance;
+    FcitxProfile* profile = FcitxInstanceGetProfile(instance);
+    fcitx_utils_string_swap(&profile->imList, "bench-keyboard:True,pinyin:True");
+    FcitxInstanceUpdateIMList(instance);
+    FcitxInstanceGetGlobalConfig(instance)->iUIUpdateInterval = 0;
+
+    context->ic = FcitxInstanceCreateIC(instance, context->frontend->frontendid,
+                                        NULL);
+    FcitxInstanceSetCurrentIC(instance, context->ic);
+    FcitxUIOnInputFocus(instance);
+    FcitxInstanceEnableIM(instance, context->ic, false);
+    FcitxInstanceSwitchIMByName(instance, "pinyin");
+}
+
+static void
+BenchCheck(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstance* instance = context->instance;
+    FcitxIM* im = FcitxInstanceGetCurrentIM(instance);
+    FcitxAddon* ui = FcitxInstanceGetCurrentUI(instance);
+    if (!im || strcmp(im->uniqueName, "pinyin") != 0
+        || FcitxInstanceGetCurrentState(instance) != IS_ACTIVE
+        || !ui || strcmp(ui->name, "fcitx-classic-ui") != 0)
+        context->ic = NULL;
+}
+
+static void
+BenchProcessKey(void* arg)
+{
+    BenchKeyEvent* event = arg;
+    BenchContext* context = event->context;
+    FcitxInstanceProcessKey(context->instance, FCITX_PRESS_KEY,
+                            context->timestamp, event->sym, 0);
+    FcitxInstanceProcessKey(context->instance, FCITX_RELEASE_KEY,
+                            context->timestamp + 20, event->sym, 0);
+    context->timestamp += 100;
+}
+
+static void
+BenchNothing(void* arg)
+{
+}
+
+static void
+BenchEnd(void* arg)
+{
+    BenchContext* context = arg;
+    FcitxInstanceEnd(context->instance);
+}
+
+/* wait for the paints caused by the commands run so far */
+static void
+BenchSettle(BenchContext* context)
+{
+    usleep(PAINT_WAIT);
+    FcitxInstanceRunCommandSync(context->instance, BenchNothing, NULL);
+}
+
+static void
+BenchRun(BenchContext* context, int repeat)
+{
+    /* words are committed with space, the input window closes after them */
+    const char* words = "nihao women zhongguo ";
+    unsigned int keys = 0;
+    const char* p;
+    int i;
+
+    BenchSettle(context);
+    unsigned long before = replies;
+    uint64_t start = BenchNow();
+    for (i = 0; i < repeat; i++) {
+        for (p = words; *p; p++) {
+            BenchKeyEvent event = {context, *p == ' ' ? FcitxKey_space : *p};
+            FcitxInstanceRunCommandSync(context->instance, BenchProcessKey,
+                                        &event);
+            keys++;
+        }
+    }
+    uint64_t elapsed = BenchNow() - start;
+    BenchSettle(context);
+    unsigned long count = replies - before;
+    printf("keys %6u %8.1fus/key round trips %6lu per key %5.2f"
+           " commits %u\n", keys, elapsed / 1000.0 / keys, count,
+           (double) count / keys, context->frontend->commitCount);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchContext context;
+    Proxy proxy;
+    pthread_t thread;
+    pid_t xvfb;
+    char display[32];
+    int repeat = DEFAULT_REPEAT;
+    int argi = 1;
+    int result = 1;
+
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-n") == 0)
+            repeat = atoi(argv[argi + 1]);
+        else
+            break;
+        argi += 2;
+    }
+    if (argi >= argc || repeat <= 0) {
+        fprintf(stderr, "usage: %s [-n repeat] <bench home>\n", argv[0]);
+        return 1;
+    }
+
+    int xdisplay = XvfbStart(&xvfb);
+    if (xdisplay < 0) {
+        printf("Xvfb is not available, benchmark skipped\n");
+        return SKIP_RETURN_CODE;
+    }
+    int proxyDisplay = ProxyStart(&proxy, xdisplay);
+    if (proxyDisplay < 0) {
+        fprintf(stderr, "cannot listen for X clients\n");
+        XvfbStop(xvfb);
+        return 1;
+    }
+    snprintf(display, sizeof(display), "127.0.0.1:%d", proxyDisplay);
+    setenv("DISPLAY", display, 1);
+    setenv("XDG_CONFIG_HOME", argv[argi], 1);
+
+    memset(&context, 0, sizeof(context));
+    context.timestamp = 1000;
+    sem_init(&context.ready, 0, 0);
+    if (pipe(context.pipefd) < 0) {
+        ProxyStop(&proxy);
+        XvfbStop(xvfb);
+        return 1;
+    }
+    FcitxBenchSetReadyCallback(BenchReady, &context);
+    pthread_create(&thread, NULL, BenchRunInstance, &context);
+    sem_wait(&context.ready);
+
+    if (!context.frontend) {
+        fprintf(stderr, "fcitx instance can't be created\n");
+    } else {
+        FcitxInstanceRunCommandSync(context.instance, BenchSetup, &context);
+        FcitxInstanceRunCommandSync(context.instance, BenchCheck, &context);
+        if (context.ic) {
+            BenchRun(&context, repeat);
+            result = 0;
+        } else {
+            fprintf(stderr, "classic ui or pinyin is not available\n");
+        }
+        FcitxInstanceRunCommandSync(context.instance, BenchEnd, &context);
+        write(context.pipefd[1], "", 1);
+        sem_wait(&context.ready);
+    }
+    pthread_join(thread, NULL);
+
+    ProxyStop(&proxy);
+    XvfbStop(xvfb);
+    return result;
+}
+
+// kate: indent-mode cstyle; space-indent on; indent-width 0;
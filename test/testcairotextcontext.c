@@ -0,0 +1,96 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "fcitx/fcitx.h"
+#include "ui/cairostuff/cairostuff.h"
+
+#define REPAINT_COUNT 2000
+
+static const char* strs[] = {
+    "ni", "hao", "1.", "\xe4\xbd\xa0", "2.", "\xe5\xb0\xbc",
+    "3.", "\xe6\x8b\x9f", "4.", "\xe9\x80\x86", "5.", "\xe8\x85\xbb",
+    "\xe4\xbd\xa0\xe5\xa5\xbd", "pinyin"
+};
+
+#define STR_COUNT (sizeof(strs) / sizeof(strs[0]))
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what InputWindowCalculateContentSize does on every repaint */
+static int
+measure(FcitxCairoTextContext* ctc)
+{
+    unsigned int i;
+    int total = FcitxCairoTextContextFontHeight(ctc);
+    for (i = 0; i < STR_COUNT; i++) {
+        int w, h;
+        FcitxCairoTextContextStringSize(ctc, strs[i], &w, &h);
+        total += w + h;
+    }
+    return total;
+}
+
+int main()
+{
+    int i;
+    int expected;
+    char buf[32];
+
+    /* reference result from a fresh context, nothing is cached yet */
+    FcitxCairoTextContext* ctc = FcitxCairoTextContextCreate(NULL);
+    FcitxCairoTextContextSet(ctc, "Sans", 12, 96);
+    expected = measure(ctc);
+    FcitxCairoTextContextFree(ctc);
+
+    double start = now();
+    for (i = 0; i < REPAINT_COUNT; i++) {
+        ctc = FcitxCairoTextContextCreate(NULL);
+        FcitxCairoTextContextSet(ctc, "Sans", 12, 96);
+        assert(measure(ctc) == expected);
+        FcitxCairoTextContextFree(ctc);
+    }
+    double fresh = now() - start;
+
+    FcitxCairoTextContext* kept = FcitxCairoTextContextCreate(NULL);
+    start = now();
+    for (i = 0; i < REPAINT_COUNT; i++) {
+        FcitxCairoTextContextSet(kept, "Sans", 12, 96);
+        assert(measure(kept) == expected);
+    }
+    double cached = now() - start;
+
+    /* empty and invalid string are still zero sized */
+    int w = -1, h = -1;
+    FcitxCairoTextContextStringSize(kept, "", &w, &h);
+    assert(w == 0 && h == 0);
+    FcitxCairoTextContextStringSize(kept, "\xff\xfe", &w, &h);
+    assert(w == 0 && h == 0);
+
+    /* fill beyond the cache size, old entries must be measured again */
+    for (i = 0; i < 1000; i++) {
+        sprintf(buf, "%d", i);
+        FcitxCairoTextContextStringWidth(kept, buf);
+    }
+    assert(measure(kept) == expected);
+
+    /* size is changed with font, cache must not return the old one */
+    FcitxCairoTextContextSet(kept, "Sans", 24, 96);
+    int larger = measure(kept);
+    assert(larger > expected);
+    FcitxCairoTextContextClearCache(kept);
+    assert(measure(kept) == larger);
+    FcitxCairoTextContextSet(kept, "Sans", 12, 96);
+    assert(measure(kept) == expected);
+    FcitxCairoTextContextFree(kept);
+
+    printf("repaint: fresh context %.2fus kept context %.2fus\n",
+           fresh * 1e6 / REPAINT_COUNT, cached * 1e6 / REPAINT_COUNT);
+    return 0;
+}
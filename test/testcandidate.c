@@ -0,0 +1,245 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "fcitx/candidate.h"
+#include "benchalloc.h"
+
+#define LARGE_SIZE 200000
+#define PAGE_SIZE 5
+#define KEYS 200
+#define KEY_SIZE 300
+
+typedef struct {
+    int total;
+    int calls;
+    int freed;
+} Provider;
+
+static INPUT_RETURN_VALUE
+get_cand_word(void* arg, FcitxCandidateWord* candWord)
+{
+    FCITX_UNUSED(arg);
+    FCITX_UNUSED(candWord);
+    return IRV_COMMIT_STRING;
+}
+
+/* same amount of work an input method does for each candidate */
+static void
+append_word(FcitxCandidateWordList* candList, int i)
+{
+    FcitxCandidateWord candWord;
+    char buf[32];
+    sprintf(buf, "%d", i);
+    candWord.strWord = strdup(buf);
+    sprintf(buf, " U+%05X", i);
+    candWord.strExtra = strdup(buf);
+    candWord.callback = get_cand_word;
+    candWord.owner = NULL;
+    candWord.priv = NULL;
+    candWord.wordType = MSG_OTHER;
+    candWord.extraType = MSG_CODE;
+    FcitxCandidateWordAppend(candList, &candWord);
+}
+
+static void
+append_pooled_word(FcitxCandidateWordList* candList, int i)
+{
+    FcitxCandidateWord candWord;
+    char buf[32];
+    sprintf(buf, "%d", i);
+    candWord.strWord = FcitxCandidateWordStrdup(candList, buf);
+    sprintf(buf, " U+%05X", i);
+    candWord.strExtra = FcitxCandidateWordStrdup(candList, buf);
+    candWord.callback = get_cand_word;
+    candWord.owner = NULL;
+    candWord.priv = FcitxCandidateWordAlloc(candList, sizeof(void*) * 3);
+    candWord.wordType = MSG_OTHER;
+    candWord.extraType = MSG_CODE;
+    FcitxCandidateWordAppend(candList, &candWord);
+}
+
+static int
+provide(void* arg, FcitxCandidateWordList* candList, int start, int count)
+{
+    Provider* provider = arg;
+    int i;
+    assert(start == FcitxCandidateWordGetListSize(candList));
+    provider->calls++;
+    for (i = 0; i < count && start + i < provider->total; i++)
+        append_word(candList, start + i);
+    return i;
+}
+
+static void
+provider_free(void* arg)
+{
+    Provider* provider = arg;
+    provider->freed++;
+}
+
+static uint64_t
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* what one key does to the list: fill it, show the first page, go next */
+static void
+show_pages(FcitxCandidateWordList* candList)
+{
+    FcitxCandidateWord* candWord;
+    int count = 0;
+    for (candWord = FcitxCandidateWordGetCurrentWindow(candList); candWord;
+         candWord = FcitxCandidateWordGetCurrentWindowNext(candList, candWord))
+        count++;
+    assert(count == PAGE_SIZE);
+    assert(FcitxCandidateWordHasNext(candList));
+    assert(FcitxCandidateWordGoNextPage(candList));
+    assert(FcitxCandidateWordGetCurrentWindowSize(candList) == PAGE_SIZE);
+}
+
+int main()
+{
+    FcitxCandidateWordList* candList = FcitxCandidateWordNewList();
+    Provider provider;
+    int i;
+    FcitxCandidateWordSetPageSize(candList, PAGE_SIZE);
+
+    /* 12 candidates, 2 of them appended up front */
+    memset(&provider, 0, sizeof(provider));
+    provider.total = 12;
+    append_word(candList, 0);
+    append_word(candList, 1);
+    FcitxCandidateWordSetProvider(candList, provide, &provider, provider_free);
+    assert(!FcitxCandidateWordIsListSizeKnown(candList));
+    assert(provider.calls == 0);
+    /* current page and one more */
+    assert(FcitxCandidateWordGetListSize(candList) == PAGE_SIZE + 1);
+    assert(strcmp(FcitxCandidateWordGetCurrentWindow(candList)->strWord, "0") == 0);
+    assert(strcmp(FcitxCandidateWordGetByIndex(candList, 4)->strWord, "4") == 0);
+    assert(!FcitxCandidateWordHasPrev(candList));
+    assert(FcitxCandidateWordHasNext(candList));
+    assert(FcitxCandidateWordGoNextPage(candList));
+    assert(FcitxCandidateWordGetCurrentWindowSize(candList) == PAGE_SIZE);
+    assert(FcitxCandidateWordGoNextPage(candList));
+    assert(FcitxCandidateWordGetListSize(candList) == 12);
+    assert(FcitxCandidateWordIsListSizeKnown(candList));
+    assert(FcitxCandidateWordGetCurrentWindowSize(candList) == 2);
+    assert(!FcitxCandidateWordHasNext(candList));
+    assert(!FcitxCandidateWordGoNextPage(candList));
+    assert(FcitxCandidateWordPageCount(candList) == 3);
+    assert(strcmp(FcitxCandidateWordGetByTotalIndex(candList, 11)->strWord, "11") == 0);
+    assert(FcitxCandidateWordGetByTotalIndex(candList, 12) == NULL);
+    assert(provider.freed == 0);
+    FcitxCandidateWordReset(candList);
+    assert(provider.freed == 1);
+
+    /* random access and jumping pages */
+    memset(&provider, 0, sizeof(provider));
+    provider.total = 100;
+    FcitxCandidateWordSetProvider(candList, provide, &provider, provider_free);
+    assert(strcmp(FcitxCandidateWordGetByTotalIndex(candList, 42)->strWord, "42") == 0);
+    assert(FcitxCandidateWordGetListSize(candList) == 43);
+    FcitxCandidateWordSetPage(candList, 15);
+    assert(FcitxCandidateWordGetCurrentPage(candList) == 15);
+    assert(strcmp(FcitxCandidateWordGetCurrentWindow(candList)->strWord, "75") == 0);
+    FcitxCandidateWordSetPage(candList, 20);
+    assert(FcitxCandidateWordGetCurrentPage(candList) == 15);
+    assert(FcitxCandidateWordIsListSizeKnown(candList));
+
+    /* merging a lazy list takes all of it */
+    FcitxCandidateWordList* newList = FcitxCandidateWordNewList();
+    Provider provider2;
+    memset(&provider2, 0, sizeof(provider2));
+    provider2.total = 7;
+    FcitxCandidateWordSetProvider(newList, provide, &provider2, provider_free);
+    FcitxCandidateWordMerge(candList, newList, -1);
+    assert(FcitxCandidateWordGetListSize(candList) == 107);
+    FcitxCandidateWordFreeList(newList);
+    assert(provider2.freed == 1);
+    FcitxCandidateWordReset(candList);
+
+    /* empty provider */
+    memset(&provider, 0, sizeof(provider));
+    FcitxCandidateWordSetProvider(candList, provide, &provider, NULL);
+    assert(FcitxCandidateWordGetListSize(candList) == 0);
+    assert(FcitxCandidateWordGetCurrentWindow(candList) == NULL);
+    assert(FcitxCandidateWordChooseByIndex(candList, 0) == IRV_TO_PROCESS);
+    FcitxCandidateWordReset(candList);
+
+    /* pooled words, mixed with heap ones */
+    for (i = 0; i < 10; i++)
+        append_pooled_word(candList, i);
+    void** priv = FcitxCandidateWordGetByTotalIndex(candList, 3)->priv;
+    assert(priv[0] == NULL && priv[1] == NULL && priv[2] == NULL);
+    assert(((uintptr_t) priv) % sizeof(void*) == 0);
+    FcitxCandidateWordRemoveByIndex(candList, 0);
+    FcitxCandidateWordResize(candList, 8);
+    assert(strcmp(FcitxCandidateWordGetFirst(candList)->strWord, "1") == 0);
+    FcitxCandidateWordReset(candList);
+    for (i = 0; i < 10; i++)
+        append_pooled_word(candList, i);
+    append_word(candList, 10);
+    newList = FcitxCandidateWordNewList();
+    for (i = 11; i < 20; i++)
+        append_pooled_word(newList, i);
+    FcitxCandidateWordMerge(candList, newList, -1);
+    FcitxCandidateWordFreeList(newList);
+    assert(strcmp(FcitxCandidateWordGetByTotalIndex(candList, 10)->strWord, "10") == 0);
+    assert(strcmp(FcitxCandidateWordGetByTotalIndex(candList, 19)->strExtra, " U+00013") == 0);
+    FcitxCandidateWordReset(candList);
+
+    /* allocations per key with a few hundred candidates */
+    unsigned long heapAllocs, poolAllocs, count;
+    for (i = 0; i < 2; i++) {
+        int j;
+        count = bench_alloc_count();
+        for (j = 0; j < KEY_SIZE; j++)
+            append_word(candList, j);
+        FcitxCandidateWordReset(candList);
+        heapAllocs = bench_alloc_count() - count;
+    }
+    for (i = 0; i < 2; i++) {
+        int j;
+        count = bench_alloc_count();
+        for (j = 0; j < KEY_SIZE; j++)
+            append_pooled_word(candList, j);
+        FcitxCandidateWordReset(candList);
+        poolAllocs = bench_alloc_count() - count;
+    }
+    /* the pool keeps its memory from the previous key */
+    assert(poolAllocs <= heapAllocs / 100);
+    printf("%d candidates per key: heap %lu allocations pool %lu allocations\n",
+           KEY_SIZE, heapAllocs, poolAllocs);
+
+    /* large candidate set, eager against lazy */
+    uint64_t start = now();
+    for (i = 0; i < KEYS / 20; i++) {
+        int j;
+        for (j = 0; j < LARGE_SIZE; j++)
+            append_word(candList, j);
+        show_pages(candList);
+        FcitxCandidateWordReset(candList);
+    }
+    uint64_t eager = (now() - start) / (KEYS / 20);
+
+    start = now();
+    for (i = 0; i < KEYS; i++) {
+        memset(&provider, 0, sizeof(provider));
+        provider.total = LARGE_SIZE;
+        FcitxCandidateWordSetProvider(candList, provide, &provider, NULL);
+        show_pages(candList);
+        assert(FcitxCandidateWordGetListSize(candList) <= 3 * PAGE_SIZE);
+        FcitxCandidateWordReset(candList);
+    }
+    uint64_t lazy = (now() - start) / KEYS;
+
+    printf("%d candidates per key: eager %.1fus lazy %.1fus\n", LARGE_SIZE,
+           eager / 1000.0, lazy / 1000.0);
+
+    FcitxCandidateWordFreeList(candList);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * check commands pushed from other threads into a running instance
+ *
+ * usage: testcommandqueue <bench home>
+ *
+ * fcitx runs in process with the benchmark addons from <bench home>, worker
+ * threads mix async and sync commands that process key events, then the
+ * instance is ended while they are still pushing.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "fcitx-utils/commandqueue.h"
+#include "fcitx/fcitx.h"
+#include "fcitx/instance.h"
+#include "fcitx/frontend.h"
+#include "fcitx/ui.h"
+#include "benchaddon.h"
+
+#define THREAD_NUM 8
+#define COMMAND_PER_THREAD 2000
+#define SYNC_EVERY 50
+
+typedef struct {
+    FcitxInstance* instance;
+    FcitxBenchFrontend* frontend;
+    FcitxInputContext* ic;
+    sem_t ready;
+    int pipefd[2];
+} TestContext;
+
+typedef struct {
+    TestContext* context;
+    int id;
+    int expected;
+    int done;
+    int pushed;
+    boolean endless;
+} Worker;
+
+typedef struct {
+    Worker* worker;
+    int seq;
+} Request;
+
+static Request requests[THREAD_NUM][COMMAND_PER_THREAD];
+static int finished = 0;
+
+static void
+TestReady(FcitxBenchFrontend* frontend, void* arg)
+{
+    TestContext* context = arg;
+    context->frontend = frontend;
+    context->instance = frontend->owner;
+    sem_post(&context->ready);
+}
+
+static void*
+TestRunInstance(void* arg)
+{
+    TestContext* context = arg;
+    char* argv[] = {
+        "fcitx", "-D", "-s", "0", "-u", "fcitx-bench-ui", "--disable", "all",
+        "--enable", "fcitx-bench-frontend,fcitx-bench-ui,fcitx-bench-im", NULL
+    };
+    FcitxInstanceRun(FCITX_ARRAY_SIZE(argv) - 1, argv, context->pipefd[0]);
+    context->frontend = NULL;
+    sem_post(&context->ready);
+    return NULL;
+}
+
+static void
+TestSetup(void* arg)
+{
+    TestContext* context = arg;
+    FcitxInstance* instance = context->instance;
+    context->ic = FcitxInstanceCreateIC(instance, context->frontend->frontendid,
+                                        NULL);
+    FcitxInstanceSetCurrentIC(instance, context->ic);
+    FcitxUIOnInputFocus(instance);
+}
+
+static void
+TestEnd(void* arg)
+{
+    TestContext* context = arg;
+    FcitxInstanceEnd(context->instance);
+}
+
+static void
+handle_request(void* arg)
+{
+    Request* request = arg;
+    Worker* worker = request->worker;
+    FcitxInstance* instance = worker->context->instance;
+    /* commands of one thread must arrive in order */
+    assert(request->seq == worker->expected % COMMAND_PER_THREAD);
+    worker->expected++;
+    worker->done++;
+    FcitxInstanceProcessKey(instance, FCITX_PRESS_KEY, request->seq,
+                            'a' + request->seq % 26, 0);
+    FcitxInstanceProcessKey(instance, FCITX_RELEASE_KEY, request->seq,
+                            'a' + request->seq % 26, 0);
+}
+
+static void*
+worker_main(void* arg)
+{
+    Worker* worker = arg;
+    FcitxInstance* instance = worker->context->instance;
+    int i;
+    for (i = 0; i < COMMAND_PER_THREAD; i++) {
+        Request* request = &requests[worker->id][i];
+        request->worker = worker;
+        request->seq = i;
+        if (i % SYNC_EVERY == SYNC_EVERY - 1) {
+            if (!FcitxInstanceRunCommandSync(instance, handle_request,
+                                             request))
+                break;
+            worker->pushed++;
+            assert(worker->done == worker->pushed);
+        } else {
+            if (!FcitxInstanceQueueCommand(instance, handle_request, request))
+                break;
+            worker->pushed++;
+        }
+        /* keep pushing until the instance refuses */
+        if (worker->endless && i == COMMAND_PER_THREAD - 1)
+            i = -1;
+    }
+    __sync_fetch_and_add(&finished, 1);
+    return NULL;
+}
+
+static void
+refused_command(void* arg)
+{
+    assert(false);
+}
+
+static void
+test_queue_close()
+{
+    FcitxCommandQueue* queue = fcitx_command_queue_new();
+    assert(queue);
+    assert(fcitx_command_queue_push(queue, free, strdup("pending")));
+    fcitx_command_queue_close(queue);
+    /* refused, and not run by dispatch */
+    assert(!fcitx_command_queue_push(queue, refused_command, NULL));
+    assert(!fcitx_command_queue_push_sync(queue, refused_command, NULL));
+    /* pushed before close, still run */
+    assert(fcitx_command_queue_dispatch(queue) == 1);
+    fcitx_command_queue_free(queue);
+}
+
+int main(int argc, char* argv[])
+{
+    TestContext context;
+    Worker workers[THREAD_NUM];
+    pthread_t threads[THREAD_NUM];
+    pthread_t thread;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <bench home>\n", argv[0]);
+        return 1;
+    }
+    setenv("XDG_CONFIG_HOME", argv[1], 1);
+
+    test_queue_close();
+
+    memset(&context, 0, sizeof(context));
+    sem_init(&context.ready, 0, 0);
+    if (pipe(context.pipefd) < 0)
+        return 1;
+    FcitxBenchSetReadyCallback(TestReady, &context);
+    pthread_create(&thread, NULL, TestRunInstance, &context);
+    sem_wait(&context.ready);
+    if (!context.frontend) {
+        fprintf(stderr, "fcitx instance can't be created\n");
+        return 1;
+    }
+    FcitxInstance* instance = context.instance;
+    assert(FcitxInstanceRunCommandSync(instance, TestSetup, &context));
+
+    /* first round, every command must be run in order */
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < THREAD_NUM; i++) {
+        workers[i].context = &context;
+        workers[i].id = i;
+        int rc = pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+        assert(rc == 0);
+        FCITX_UNUSED(rc);
+    }
+    for (i = 0; i < THREAD_NUM; i++) {
+        pthread_join(threads[i], NULL);
+        assert(workers[i].pushed == COMMAND_PER_THREAD);
+    }
+    /* sync command is run after every async one pushed before it */
+    assert(FcitxInstanceRunCommandSync(instance, TestSetup, &context));
+    for (i = 0; i < THREAD_NUM; i++)
+        assert(workers[i].done == COMMAND_PER_THREAD);
+
+    FcitxCommandQueueStats stats;
+    FcitxInstanceGetCommandQueueStats(instance, &stats);
+    assert(stats.pushed == THREAD_NUM * COMMAND_PER_THREAD + 2);
+    assert(stats.dispatched == stats.pushed);
+    printf("commands: %llu contended: %llu\n",
+           (unsigned long long) stats.pushed,
+           (unsigned long long) stats.contended);
+
+    /* second round, the instance ends while workers keep pushing */
+    finished = 0;
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < THREAD_NUM; i++) {
+        workers[i].context = &context;
+        workers[i].id = i;
+        workers[i].endless = true;
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    usleep(10000);
+    assert(FcitxInstanceRunCommandSync(instance, TestEnd, &context));
+    write(context.pipefd[1], "", 1);
+    sem_wait(&context.ready);
+    pthread_join(thread, NULL);
+
+    /* every accepted command is run, no worker is left waiting */
+    for (i = 0; i < THREAD_NUM; i++) {
+        pthread_join(threads[i], NULL);
+        assert(workers[i].done == workers[i].pushed);
+    }
+    assert(finished == THREAD_NUM);
+    assert(!FcitxInstanceRunCommandSync(instance, TestEnd, &context));
+    assert(!FcitxInstanceQueueCommand(instance, TestEnd, &context));
+    return 0;
+}
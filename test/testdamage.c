@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <cairo.h>
+#include "fcitx/fcitx.h"
+#include "ui/classic/damage.h"
+
+#define WIDTH 400
+#define HEIGHT 60
+#define CELL_COUNT 5
+#define CELL_WIDTH 60
+#define CELL_HEIGHT 20
+/* content is moved by the margin of background, like the input window */
+#define MARGIN 4
+
+typedef struct {
+    int highlight;
+    int count; /* number of cells */
+    int calls;
+} Frame;
+
+static FcitxRect
+cell_rect(int i)
+{
+    FcitxRect rect = { 10 + i * (CELL_WIDTH + 10), 20, 10 + i * (CELL_WIDTH + 10) + CELL_WIDTH, 20 + CELL_HEIGHT };
+    return rect;
+}
+
+/* items of the frame, as InputWindowCalculateContentSize does it */
+static int
+frame_items(Frame* frame, FcitxRect* rects, uint32_t* hashes)
+{
+    int i;
+    for (i = 0; i < frame->count; i++) {
+        rects[i] = cell_rect(i);
+        hashes[i] = (i == frame->highlight);
+    }
+    return frame->count;
+}
+
+/* stand-in for background and candidate painting of the input window */
+static void
+paint_content(cairo_t* c, boolean full, void* arg)
+{
+    Frame* frame = arg;
+    int i;
+    FCITX_UNUSED(full);
+    frame->calls++;
+    cairo_save(c);
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_rgba(c, 0.9, 0.9, 0.9, 1);
+    cairo_paint(c);
+    cairo_translate(c, MARGIN, MARGIN);
+    for (i = 0; i < frame->count; i++) {
+        FcitxRect rect = cell_rect(i);
+        if (i == frame->highlight)
+            cairo_set_source_rgba(c, 0.2, 0.4, 0.8, 1);
+        else
+            cairo_set_source_rgba(c, 0.3, 0.3, 0.3, 1);
+        cairo_rectangle(c, rect.x1, rect.y1, rect.x2 - rect.x1, rect.y2 - rect.y1);
+        cairo_fill(c);
+    }
+    cairo_restore(c);
+}
+
+typedef struct {
+    FcitxDamage damage;
+    cairo_surface_t* content;
+    cairo_surface_t* target;
+    int itemCount;
+    FcitxRect itemRect[CELL_COUNT];
+    uint32_t itemHash[CELL_COUNT];
+} TestWindow;
+
+static void
+window_init(TestWindow* window, int width, int height)
+{
+    memset(window, 0, sizeof(*window));
+    FcitxDamageReset(&window->damage);
+    /* a window starts with a tiny content surface, see FcitxXlibWindowInit */
+    window->content = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    window->target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+}
+
+static void
+window_free(TestWindow* window)
+{
+    cairo_surface_destroy(window->content);
+    cairo_surface_destroy(window->target);
+}
+
+/* same steps as InputWindowUpdateDamage and FcitxXlibWindowPaint */
+static unsigned int
+window_paint(TestWindow* window, Frame* frame, int width, int height)
+{
+    FcitxRect rects[CELL_COUNT];
+    uint32_t hashes[CELL_COUNT];
+    int count = frame_items(frame, rects, hashes);
+    FcitxDamageAddChangedItems(&window->damage, window->itemCount,
+                               window->itemRect, window->itemHash,
+                               count, rects, hashes);
+    memcpy(window->itemRect, rects, sizeof(FcitxRect) * count);
+    memcpy(window->itemHash, hashes, sizeof(uint32_t) * count);
+    window->itemCount = count;
+
+    unsigned int area = FcitxDamagePaintContent(&window->damage, &window->content,
+                                                width, height, MARGIN, MARGIN,
+                                                width, height, false,
+                                                paint_content, frame);
+    if (!FcitxDamageIsEmpty(&window->damage))
+        FcitxDamageFlush(&window->damage, window->content, window->target,
+                         MARGIN, MARGIN, width, height);
+    assert(FcitxDamageIsEmpty(&window->damage));
+    return area;
+}
+
+/* target of window must be the same as a window painting it from scratch */
+static boolean
+same_as_fresh(TestWindow* window, Frame* frame, int width, int height)
+{
+    TestWindow fresh;
+    Frame copy = *frame;
+    boolean result = true;
+    int y;
+    window_init(&fresh, width, height);
+    window_paint(&fresh, &copy, width, height);
+    unsigned char* d1 = cairo_image_surface_get_data(window->target);
+    unsigned char* d2 = cairo_image_surface_get_data(fresh.target);
+    int s1 = cairo_image_surface_get_stride(window->target);
+    int s2 = cairo_image_surface_get_stride(fresh.target);
+    for (y = 0; y < height; y++) {
+        if (memcmp(d1 + y * s1, d2 + y * s2, width * 4) != 0)
+            result = false;
+    }
+    window_free(&fresh);
+    return result;
+}
+
+static void
+test_damage()
+{
+    FcitxDamage damage;
+    FcitxRect r1 = { 0, 0, 10, 10 };
+    FcitxRect r2 = { 5, 5, 20, 20 };
+    FcitxRect r3 = { 30, 0, 40, 10 };
+    FcitxRect empty = { 10, 10, 10, 20 };
+    int i;
+
+    FcitxDamageReset(&damage);
+    assert(FcitxDamageIsEmpty(&damage));
+    FcitxDamageAdd(&damage, empty);
+    assert(FcitxDamageIsEmpty(&damage));
+
+    /* overlapped rects are merged */
+    FcitxDamageAdd(&damage, r1);
+    FcitxDamageAdd(&damage, r3);
+    FcitxDamageAdd(&damage, r2);
+    assert(damage.count == 2);
+
+    /* too many rects become the bounding box */
+    for (i = 0; i < FCITX_DAMAGE_MAX_RECT * 2; i++) {
+        FcitxRect rect = { 100 + i * 20, 0, 110 + i * 20, 10 };
+        FcitxDamageAdd(&damage, rect);
+    }
+    assert(damage.count <= FCITX_DAMAGE_MAX_RECT);
+    FcitxDamageAll(&damage);
+    assert(!FcitxDamageIsEmpty(&damage));
+    FcitxDamageReset(&damage);
+}
+
+int main()
+{
+    TestWindow window;
+    Frame frame = { 1, CELL_COUNT, 0 };
+
+    test_damage();
+
+    /* the first paint only damages the cells, but the content surface is new */
+    window_init(&window, WIDTH * 2, HEIGHT * 2);
+    unsigned int full = window_paint(&window, &frame, WIDTH, HEIGHT);
+    assert(full == WIDTH * HEIGHT);
+    assert(cairo_image_surface_get_width(window.content) >= WIDTH);
+    assert(cairo_image_surface_get_height(window.content) >= HEIGHT);
+    assert(same_as_fresh(&window, &frame, WIDTH, HEIGHT));
+
+    /* highlight moves from candidate 1 to 3, only two cells are damaged */
+    frame.highlight = 3;
+    unsigned int partial = window_paint(&window, &frame, WIDTH, HEIGHT);
+    assert(partial == 2 * CELL_WIDTH * CELL_HEIGHT);
+    assert(same_as_fresh(&window, &frame, WIDTH, HEIGHT));
+
+    /* nothing changed, nothing painted */
+    frame.calls = 0;
+    assert(window_paint(&window, &frame, WIDTH, HEIGHT) == 0);
+    assert(frame.calls == 0);
+
+    /* a new cell only damages itself while the surface is large enough */
+    frame.count = CELL_COUNT - 1;
+    window_paint(&window, &frame, WIDTH, HEIGHT);
+    frame.count = CELL_COUNT;
+    assert(window_paint(&window, &frame, WIDTH, HEIGHT) == CELL_WIDTH * CELL_HEIGHT);
+    assert(same_as_fresh(&window, &frame, WIDTH, HEIGHT));
+
+    /* window grows beyond the surface, damage of one cell is not enough */
+    frame.highlight = 4;
+    unsigned int grown = window_paint(&window, &frame, WIDTH * 2, HEIGHT * 2);
+    assert(grown == WIDTH * 2 * HEIGHT * 2);
+    assert(same_as_fresh(&window, &frame, WIDTH * 2, HEIGHT * 2));
+
+    /* expose repaints everything */
+    FcitxDamageAll(&window.damage);
+    assert(window_paint(&window, &frame, WIDTH * 2, HEIGHT * 2) == WIDTH * 2 * HEIGHT * 2);
+
+    printf("painted pixels: full %u highlight change %u grown %u\n", full, partial, grown);
+
+    window_free(&window);
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fcitx/fcitx.h"
+#include "fcitx-utils/utils.h"
+#include "ui/cairostuff/font.h"
+
+#define STALE_FAMILY "Stale Family"
+
+/* return the cached family of the font, NULL if the entry is still stale */
+static char*
+read_entry(const char* path, const char* font)
+{
+    FILE* fp = fopen(path, "r");
+    char* line = NULL;
+    size_t bufsize = 0;
+    char* result = NULL;
+    char prefix[64];
+    assert(fp);
+    sprintf(prefix, "\tzh\t%s\t", font);
+    while (getline(&line, &bufsize, fp) != -1) {
+        char* p = strstr(line, prefix);
+        if (!p || strncmp(line, "1\t", 2) == 0)
+            continue;
+        p += strlen(prefix);
+        p[strcspn(p, "\n")] = '\0';
+        result = strdup(p);
+    }
+    free(line);
+    fclose(fp);
+    return result;
+}
+
+int main()
+{
+    char home[] = "/tmp/testfontXXXXXX";
+    char* path;
+    char* family;
+    assert(mkdtemp(home));
+    setenv("XDG_CONFIG_HOME", home, 1);
+    fcitx_utils_alloc_cat_str(path, home, "/fcitx");
+    mkdir(path, 0700);
+    free(path);
+    fcitx_utils_alloc_cat_str(path, home, "/fcitx/cache");
+    mkdir(path, 0700);
+    free(path);
+    fcitx_utils_alloc_cat_str(path, home, "/fcitx/cache/font");
+
+    /* entry from an old fontconfig stamp is used, then resolved again */
+    FILE* fp = fopen(path, "w");
+    fprintf(fp, "1\tzh\tNoSuchFont\t" STALE_FAMILY "\n");
+    fclose(fp);
+
+    char* font = strdup("NoSuchFont");
+    GetValidFont("zh_CN", &font);
+    assert(strcmp(font, STALE_FAMILY) == 0);
+    /* the refresh thread is joined, the entry is rewritten by then */
+    FontCacheFinish();
+    family = read_entry(path, "NoSuchFont");
+    assert(family);
+    assert(strcmp(family, STALE_FAMILY) != 0);
+
+    free(font);
+    font = strdup("NoSuchFont");
+    GetValidFont("zh_CN", &font);
+    assert(strcmp(font, family) == 0);
+    free(font);
+
+    /* cold entry is resolved at once, and saved */
+    char* empty = strdup("");
+    GetValidFont("zh_CN", &empty);
+    char* saved = read_entry(path, "");
+    assert(saved && strcmp(saved, empty) == 0);
+    char* again = strdup("");
+    GetValidFont("zh_CN", &again);
+    assert(strcmp(again, empty) == 0);
+
+    printf("font: \"%s\" fallback: \"%s\"\n", empty, family);
+
+    free(again);
+    free(saved);
+    free(empty);
+    free(family);
+    unlink(path);
+    free(path);
+    fcitx_utils_alloc_cat_str(path, home, "/fcitx/cache");
+    rmdir(path);
+    free(path);
+    fcitx_utils_alloc_cat_str(path, home, "/fcitx");
+    rmdir(path);
+    free(path);
+    rmdir(home);
+    return 0;
+}
@@ -0,0 +1,323 @@
+/**
+ * check the messages sent by kimpanel ui to a mock panel
+ *
+ * usage: testkimpanel <bench home>
+ *
+ * A private dbus-daemon is started as the session bus, the mock panel owns
+ * org.kde.impanel on it, and fcitx runs in process with the benchmark addons
+ * and the in-tree fcitx-dbus and fcitx-kimpanel-ui from <bench home>. The test
+ * fails if any of them can't be started.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <dbus/dbus.h>
+
+#include "fcitx/fcitx.h"
+#include "fcitx/instance.h"
+#include "fcitx/frontend.h"
+#include "fcitx/candidate.h"
+#include "fcitx/addon.h"
+#include "fcitx-utils/utils.h"
+#include "dbuslauncher.h"
+#include "dbusstuff.h"
+#include "benchaddon.h"
+
+#define CALL_TIMEOUT 5000
+#define KIMPANEL_INTERFACE "org.kde.kimpanel.inputmethod"
+
+typedef struct {
+    FcitxInstance* instance;
+    FcitxBenchFrontend* frontend;
+    FcitxInputContext* ic;
+    sem_t ready;
+    int pipefd[2];
+} TestContext;
+
+typedef struct {
+    DBusConnection* conn;
+    char service[64];
+    unsigned int signals;
+    unsigned int lookupTable;
+    unsigned int lookupTableCursor;
+    unsigned int spot;
+    unsigned int aux;
+    unsigned int preedit;
+    unsigned int show;
+    int cursor;
+} MockPanel;
+
+typedef struct {
+    TestContext* context;
+    const char** words;
+    int count;
+    int highlight;
+    boolean ok;
+} TestStep;
+
+static void
+TestReady(FcitxBenchFrontend* frontend, void* arg)
+{
+    TestContext* context = arg;
+    context->frontend = frontend;
+    context->instance = frontend->owner;
+    sem_post(&context->ready);
+}
+
+static void*
+TestRunInstance(void* arg)
+{
+    TestContext* context = arg;
+    char* argv[] = {
+        "fcitx", "-D", "-s", "0", "-u", "fcitx-kimpanel-ui", "--disable", "all",
+        "--enable", "fcitx-bench-frontend,fcitx-bench-im,fcitx-dbus,"
+                    "fcitx-kimpanel-ui", NULL
+    };
+    FcitxInstanceRun(FCITX_ARRAY_SIZE(argv) - 1, argv, context->pipefd[0]);
+    context->frontend = NULL;
+    sem_post(&context->ready);
+    return NULL;
+}
+
+static void
+TestSetup(void* arg)
+{
+    TestStep* step = arg;
+    TestContext* context = step->context;
+    FcitxInstance* instance = context->instance;
+    FcitxAddon* ui = FcitxInstanceGetCurrentUI(instance);
+    step->ok = ui && strcmp(ui->name, "fcitx-kimpanel-ui") == 0;
+    if (!step->ok)
+        return;
+    context->ic = FcitxInstanceCreateIC(instance, context->frontend->frontendid,
+                                        NULL);
+    FcitxInstanceSetCurrentIC(instance, context->ic);
+    FcitxUIOnInputFocus(instance);
+}
+
+/* what an input method does on every key, the window is updated after it */
+static void
+TestShow(void* arg)
+{
+    TestStep* step = arg;
+    FcitxInstance* instance = step->context->instance;
+    FcitxInputState* input = FcitxInstanceGetInputState(instance);
+    FcitxCandidateWordList* candList = FcitxInputStateGetCandidateList(input);
+    int i;
+
+    FcitxInstanceCleanInputWindow(instance);
+    FcitxCandidateWordSetChoose(candList, DIGIT_STR_CHOOSE);
+    FcitxCandidateWordSetOverrideDefaultHighlight(candList, false);
+    for (i = 0; i < step->count; i++) {
+        FcitxCandidateWord word;
+        memset(&word, 0, sizeof(word));
+        word.strWord = strdup(step->words[i]);
+        word.wordType = (i == step->highlight) ? MSG_CANDIATE_CURSOR : MSG_OTHER;
+        FcitxCandidateWordAppend(candList, &word);
+    }
+    FcitxMessagesAddMessageStringsAtLast(FcitxInputStateGetAuxUp(input),
+                                         MSG_INPUT, "ni");
+    FcitxUIUpdateInputWindow(instance);
+}
+
+static void
+TestEnd(void* arg)
+{
+    TestContext* context = arg;
+    FcitxInstanceEnd(context->instance);
+}
+
+static DBusHandlerResult
+MockPanelFilter(DBusConnection* conn, DBusMessage* msg, void* arg)
+{
+    MockPanel* panel = arg;
+    if (dbus_message_is_method_call(msg, DBUS_INTERFACE_INTROSPECTABLE,
+                                    "Introspect")) {
+        /* the old protocol only, no org.kde.impanel2 */
+        const char* xml = "<node></node>";
+        DBusMessage* reply = dbus_message_new_method_return(msg);
+        dbus_message_append_args(reply, DBUS_TYPE_STRING, &xml,
+                                 DBUS_TYPE_INVALID);
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_SIGNAL ||
+        !dbus_message_has_interface(msg, KIMPANEL_INTERFACE))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    const char* member = dbus_message_get_member(msg);
+    panel->signals++;
+    if (strcmp(member, "UpdateLookupTable") == 0) {
+        panel->lookupTable++;
+    } else if (strcmp(member, "UpdateLookupTableCursor") == 0) {
+        dbus_int32_t cursor = -1;
+        dbus_message_get_args(msg, NULL, DBUS_TYPE_INT32, &cursor,
+                              DBUS_TYPE_INVALID);
+        panel->cursor = cursor;
+        panel->lookupTableCursor++;
+    } else if (strcmp(member, "UpdateSpotLocation") == 0) {
+        panel->spot++;
+    } else if (strcmp(member, "UpdateAux") == 0) {
+        panel->aux++;
+    } else if (strcmp(member, "UpdatePreeditText") == 0) {
+        panel->preedit++;
+    } else if (strncmp(member, "Show", strlen("Show")) == 0) {
+        panel->show++;
+    }
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/*
+ * messages from one connection arrive in order, once the reply from fcitx
+ * is here, every signal sent before it is here as well
+ */
+static void
+MockPanelSync(MockPanel* panel)
+{
+    DBusMessage* msg = dbus_message_new_method_call(panel->service, "/kimpanel",
+                                                    DBUS_INTERFACE_INTROSPECTABLE,
+                                                    "Introspect");
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        panel->conn, msg, CALL_TIMEOUT, NULL);
+    dbus_message_unref(msg);
+    assert(reply);
+    dbus_message_unref(reply);
+    while (dbus_connection_dispatch(panel->conn) == DBUS_DISPATCH_DATA_REMAINS);
+}
+
+static void
+TestRunStep(TestContext* context, MockPanel* panel, const char** words,
+            int count, int highlight)
+{
+    TestStep step = { context, words, count, highlight, false };
+    FcitxInstanceRunCommandSync(context->instance, TestShow, &step);
+    MockPanelSync(panel);
+}
+
+static boolean
+TestRun(TestContext* context, MockPanel* panel)
+{
+    const char* page1[] = { "\xe4\xbd\xa0", "\xe5\xb0\xbc", "\xe6\x8b\x9f",
+                            "\xe9\x80\x86", "\xe8\x85\xbb" };
+    const char* page2[] = { "\xe6\xb3\xa5", "\xe5\x80\xaa", "\xe5\xa6\xae",
+                            "\xe9\x9c\x93", "\xe6\x98\xb5" };
+    TestStep setup = { context, NULL, 0, 0, false };
+    unsigned int signals;
+
+    FcitxInstanceRunCommandSync(context->instance, TestSetup, &setup);
+    if (!setup.ok) {
+        fprintf(stderr, "kimpanel ui is not loaded\n");
+        return false;
+    }
+    MockPanelSync(panel);
+
+    /* first show sends everything */
+    TestRunStep(context, panel, page1, 5, 0);
+    assert(panel->lookupTable == 1);
+    assert(panel->lookupTableCursor == 1 && panel->cursor == 0);
+    assert(panel->spot == 1);
+    assert(panel->aux == 1);
+    assert(panel->preedit == 1);
+
+    /* only the highlight moves */
+    TestRunStep(context, panel, page1, 5, 2);
+    TestRunStep(context, panel, page1, 5, 3);
+    TestRunStep(context, panel, page1, 5, 1);
+    assert(panel->lookupTable == 1);
+    assert(panel->lookupTableCursor == 4 && panel->cursor == 1);
+    assert(panel->spot == 1);
+    assert(panel->aux == 1);
+    assert(panel->preedit == 1);
+
+    /* nothing changed, nothing sent */
+    signals = panel->signals;
+    TestRunStep(context, panel, page1, 5, 1);
+    assert(panel->signals == signals);
+
+    /* next page */
+    TestRunStep(context, panel, page2, 5, 0);
+    assert(panel->lookupTable == 2);
+    assert(panel->cursor == 0);
+    assert(panel->aux == 1);
+
+    printf("signals %u: lookup table %u cursor %u spot %u aux %u show %u\n",
+           panel->signals, panel->lookupTable, panel->lookupTableCursor,
+           panel->spot, panel->aux, panel->show);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    TestContext context;
+    MockPanel panel;
+    pthread_t thread;
+    int result = 1;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <bench home>\n", argv[0]);
+        return 1;
+    }
+
+    dbus_threads_init_default();
+    DBusDaemonProperty daemon = DBusLaunch(NULL);
+    if (daemon.pid == 0) {
+        fprintf(stderr, "dbus-daemon can't be started\n");
+        return 1;
+    }
+    setenv("DBUS_SESSION_BUS_ADDRESS", daemon.address, 1);
+    setenv("FCITX_NO_PRIVATE_DBUS", "1", 1);
+    setenv("XDG_CONFIG_HOME", argv[1], 1);
+
+    /* panel must be there before kimpanel ui checks for it */
+    memset(&panel, 0, sizeof(panel));
+    panel.cursor = -1;
+    panel.conn = dbus_bus_get_private(DBUS_BUS_SESSION, NULL);
+    if (!panel.conn) {
+        fprintf(stderr, "cannot connect to dbus-daemon\n");
+        DBusKill(&daemon);
+        return 1;
+    }
+    dbus_connection_set_exit_on_disconnect(panel.conn, FALSE);
+    dbus_bus_request_name(panel.conn, "org.kde.impanel", 0, NULL);
+    dbus_bus_add_match(panel.conn, "type='signal',interface='"
+                       KIMPANEL_INTERFACE "'", NULL);
+    dbus_connection_add_filter(panel.conn, MockPanelFilter, &panel, NULL);
+    snprintf(panel.service, sizeof(panel.service), "%s-%d",
+             FCITX_DBUS_SERVICE, fcitx_utils_get_display_number());
+
+    memset(&context, 0, sizeof(context));
+    sem_init(&context.ready, 0, 0);
+    if (pipe(context.pipefd) < 0) {
+        DBusKill(&daemon);
+        return 1;
+    }
+    FcitxBenchSetReadyCallback(TestReady, &context);
+    pthread_create(&thread, NULL, TestRunInstance, &context);
+
+    /* answer the checks done by kimpanel ui while it is created */
+    while (sem_trywait(&context.ready) != 0)
+        dbus_connection_read_write_dispatch(panel.conn, 10);
+
+    if (!context.frontend)
+        fprintf(stderr, "fcitx instance can't be created\n");
+    else if (TestRun(&context, &panel))
+        result = 0;
+    /* fcitx shuts down libdbus when it ends */
+    dbus_connection_close(panel.conn);
+    dbus_connection_unref(panel.conn);
+
+    if (context.frontend) {
+        FcitxInstanceRunCommandSync(context.instance, TestEnd, &context);
+        write(context.pipefd[1], "", 1);
+        sem_wait(&context.ready);
+    }
+    pthread_join(thread, NULL);
+    DBusKill(&daemon);
+    return result;
+}
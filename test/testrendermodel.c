@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include "fcitx/instance.h"
+#include "fcitx/candidate.h"
+#include "fcitx/hook.h"
+#include "fcitx/instance-internal.h"
+#include "fcitx/ime-internal.h"
+
+static boolean upperActive = false;
+static int filterCalled = 0;
+
+static boolean
+upper_is_active(void* arg)
+{
+    return upperActive;
+}
+
+static char*
+upper_filter(void* arg, const char* in)
+{
+    filterCalled++;
+    if (!strchr(in, 'a'))
+        return NULL;
+    char* out = strdup(in);
+    char* p;
+    for (p = out; *p; p++) {
+        if (*p == 'a')
+            *p = 'A';
+    }
+    return out;
+}
+
+static void
+set_candidates(FcitxInstance* instance, int count)
+{
+    char* words[] = { "a", "b", "c", "d", "e" };
+    FcitxCandidateWordList* candList = instance->input->candList;
+    FcitxCandidateWord word;
+    int i;
+    memset(&word, 0, sizeof(word));
+    FcitxCandidateWordReset(candList);
+    for (i = 0; i < count; i++) {
+        word.strWord = strdup(words[i]);
+        word.wordType = MSG_OTHER;
+        FcitxCandidateWordAppend(candList, &word);
+    }
+}
+
+int main()
+{
+    FcitxInstance* instance = fcitx_utils_malloc0(sizeof(FcitxInstance));
+    /* FcitxInputStateCreate is not exported, only what is used here */
+    instance->input = fcitx_utils_malloc0(sizeof(FcitxInputState));
+    instance->input->msgAuxUp = FcitxMessagesNew();
+    instance->input->msgAuxDown = FcitxMessagesNew();
+    instance->input->msgPreedit = FcitxMessagesNew();
+    instance->input->msgClientPreedit = FcitxMessagesNew();
+    instance->input->candList = FcitxCandidateWordNewList();
+    instance->config = fcitx_utils_malloc0(sizeof(FcitxGlobalConfig));
+    instance->config->bPointAfterNumber = true;
+    FcitxCandidateWordSetChoose(instance->input->candList, "12345");
+    FcitxCandidateWordSetOverrideDefaultHighlight(instance->input->candList, true);
+
+    FcitxStringFilterHookv2 hook;
+    memset(&hook, 0, sizeof(hook));
+    hook.func = upper_filter;
+    hook.isActive = upper_is_active;
+    FcitxInstanceRegisterOutputFilterv2(instance, hook);
+
+    FcitxUIRenderModel* model = FcitxUIRenderModelNew();
+    FcitxMessagesAddMessageStringsAtLast(instance->input->msgPreedit, MSG_INPUT, "ab");
+    instance->input->iCursorPos = 1;
+    set_candidates(instance, 3);
+
+    unsigned int changed = FcitxUIRenderModelUpdate(instance, model);
+    assert(changed == (RENDER_MODEL_UP | RENDER_MODEL_DOWN | RENDER_MODEL_CURSOR));
+    assert(strcmp(FcitxUIRenderModelGetUpString(model), "ab") == 0);
+    assert(FcitxUIRenderModelGetCursorPos(model) == 1);
+
+    const char** labels;
+    const char** texts;
+    int highlight;
+    int count = FcitxUIRenderModelGetCandidateTable(model, &labels, &texts, &highlight);
+    assert(count == 3);
+    assert(highlight == 0);
+    assert(strcmp(labels[1], "2.") == 0);
+    assert(strcmp(texts[0], "a ") == 0);
+    assert(strcmp(texts[2], "c ") == 0);
+
+    /* nothing changed, nothing filtered */
+    assert(FcitxUIRenderModelUpdate(instance, model) == 0);
+    assert(FcitxUIRenderModelGetCandidateTable(model, &labels, &texts, &highlight) == 3);
+
+    /* only cursor moved */
+    instance->input->iCursorPos = 2;
+    assert(FcitxUIRenderModelUpdate(instance, model) == RENDER_MODEL_CURSOR);
+
+    /* enabled filter changes the output of the same messages */
+    upperActive = true;
+    changed = FcitxUIRenderModelUpdate(instance, model);
+    assert(changed & RENDER_MODEL_UP);
+    assert(changed & RENDER_MODEL_DOWN);
+    assert(filterCalled > 0);
+    assert(strcmp(FcitxUIRenderModelGetUpString(model), "Ab") == 0);
+    char** strDown = FcitxUIRenderModelGetFilteredStrings(model, false);
+    assert(strcmp(strDown[1], "A") == 0);
+    FcitxUIRenderModelGetCandidateTable(model, &labels, &texts, &highlight);
+    assert(strcmp(texts[0], "A ") == 0);
+
+    /* only candidates changed, up side is not filtered again */
+    int oldCalled = filterCalled;
+    set_candidates(instance, 5);
+    assert(FcitxUIRenderModelUpdate(instance, model) == RENDER_MODEL_DOWN);
+    assert(filterCalled - oldCalled == FcitxMessagesGetMessageCount(FcitxUIRenderModelGetMessages(model, false)));
+    assert(FcitxUIRenderModelGetCandidateTable(model, &labels, &texts, &highlight) == 5);
+    assert(strcmp(texts[4], "e ") == 0);
+
+    /* invalidate forces everything to be filtered again */
+    FcitxUIRenderModelInvalidate(model);
+    assert(FcitxUIRenderModelUpdate(instance, model) == (RENDER_MODEL_UP | RENDER_MODEL_DOWN | RENDER_MODEL_CURSOR));
+
+    /* empty down side gives an empty table */
+    set_candidates(instance, 0);
+    assert(FcitxUIRenderModelUpdate(instance, model) == RENDER_MODEL_DOWN);
+    assert(FcitxUIRenderModelGetCandidateTable(model, &labels, &texts, &highlight) == 0);
+    assert(highlight == -1);
+
+    printf("filter called: %d\n", filterCalled);
+
+    FcitxUIRenderModelFree(model);
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include "fcitx-utils/shmchannel.h"
+#include "fcitx/fcitx.h"
+
+#define MESSAGE_NUM 20000
+#define KEY_IN_FLIGHT 64
+
+static FcitxShmChannel*
+open_peer(FcitxShmChannel* server)
+{
+    int memfd, rxfd, txfd;
+    fcitx_shm_channel_get_peer_fds(server, &memfd, &rxfd, &txfd);
+    return fcitx_shm_channel_open(dup(memfd), dup(rxfd), dup(txfd));
+}
+
+static void
+wait_fd(int fd)
+{
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    select(fd + 1, &rfds, NULL, NULL, NULL);
+}
+
+static void
+make_string(char* buf, uint32_t i)
+{
+    /* vary the length so records wrap at different offsets */
+    uint32_t len = i % 97;
+    uint32_t j;
+    for (j = 0; j < len; j++)
+        buf[j] = 'a' + (i + j) % 26;
+    buf[len] = '\0';
+}
+
+static void
+test_local()
+{
+    FcitxShmChannel* server = fcitx_shm_channel_new(0);
+    FcitxShmChannel* client;
+    FcitxShmMessage message;
+    char buf[128];
+    uint32_t sent = 0, received = 0;
+
+    assert(server);
+    client = open_peer(server);
+    assert(client);
+    assert(!fcitx_shm_channel_receive(server, &message));
+
+    /* fill the ring until it reports full, then drain it in order */
+    while (true) {
+        make_string(buf, sent);
+        if (!fcitx_shm_channel_send(client, FCITX_SHM_COMMIT_STRING, 1, sent,
+                                    buf, strlen(buf) + 1))
+            break;
+        sent++;
+    }
+    assert(sent > 0);
+    while (fcitx_shm_channel_receive(server, &message)) {
+        make_string(buf, received);
+        assert(message.type == FCITX_SHM_COMMIT_STRING);
+        assert(message.serial == received);
+        assert(strcmp(message.data, buf) == 0);
+        received++;
+    }
+    assert(received == sent);
+
+    /* too large for the ring */
+    static char large[1024 * 1024];
+    assert(!fcitx_shm_channel_send(client, FCITX_SHM_COMMIT_STRING, 1, 0,
+                                   large, sizeof(large)));
+
+    /* the client can't crash the server with garbage */
+    int memfd, rxfd, txfd;
+    uint32_t tail, length = 0xffffff;
+    fcitx_shm_channel_get_peer_fds(server, &memfd, &rxfd, &txfd);
+    assert(fcitx_shm_channel_send(client, FCITX_SHM_KEY_EVENT, 1, 0, NULL, 0));
+    /* 64 bytes header, tail of ring 0 at 64, data of ring 0 at 192 */
+    assert(pread(memfd, &tail, sizeof(tail), 64 + 64) == sizeof(tail));
+    assert(pwrite(memfd, &length, sizeof(length),
+                  192 + (tail & (64 * 1024 - 1)) + 12) == sizeof(length));
+    assert(!fcitx_shm_channel_receive(server, &message));
+    assert(fcitx_shm_channel_is_broken(server));
+    fcitx_shm_channel_free(client);
+    fcitx_shm_channel_free(server);
+}
+
+static void
+run_client(FcitxShmChannel* client)
+{
+    FcitxShmMessage message;
+    uint32_t sent = 0, results = 0, commits = 0;
+    char buf[128];
+
+    while (results < MESSAGE_NUM) {
+        /* like a real client, bound the keys waiting for a result */
+        while (sent < MESSAGE_NUM && sent - results < KEY_IN_FLIGHT) {
+            FcitxShmKeyEvent key = {sent, sent + 8, 0, 0, sent};
+            if (!fcitx_shm_channel_send(client, FCITX_SHM_KEY_EVENT, 1, sent,
+                                        &key, sizeof(key)))
+                break;
+            sent++;
+        }
+        wait_fd(fcitx_shm_channel_get_fd(client));
+        while (fcitx_shm_channel_receive(client, &message)) {
+            if (message.type == FCITX_SHM_COMMIT_STRING) {
+                make_string(buf, commits);
+                assert(strcmp(message.data, buf) == 0);
+                commits++;
+            } else {
+                const FcitxShmKeyResult* result = (const void*) message.data;
+                assert(message.type == FCITX_SHM_KEY_RESULT);
+                assert(message.length == sizeof(FcitxShmKeyResult));
+                /* commit of a key must arrive before its result */
+                assert(message.serial == results);
+                assert(commits == results + 1);
+                assert(result->result == (int32_t)(results % 2));
+                results++;
+            }
+        }
+        assert(!fcitx_shm_channel_is_broken(client));
+    }
+}
+
+static void
+run_server(FcitxShmChannel* server)
+{
+    FcitxShmMessage message;
+    uint32_t received = 0;
+    char buf[128];
+
+    while (received < MESSAGE_NUM) {
+        wait_fd(fcitx_shm_channel_get_fd(server));
+        while (fcitx_shm_channel_receive(server, &message)) {
+            const FcitxShmKeyEvent* key = (const void*) message.data;
+            FcitxShmKeyResult result = {received % 2};
+            assert(message.type == FCITX_SHM_KEY_EVENT);
+            assert(message.serial == received);
+            assert(key->keyval == received && key->keycode == received + 8);
+            make_string(buf, received);
+            /* client drains its ring before sending more, never full here */
+            boolean ok = fcitx_shm_channel_send(server,
+                                                FCITX_SHM_COMMIT_STRING,
+                                                message.icid, received, buf,
+                                                strlen(buf) + 1);
+            ok = ok && fcitx_shm_channel_send(server, FCITX_SHM_KEY_RESULT,
+                                              message.icid, message.serial,
+                                              &result, sizeof(result));
+            assert(ok);
+            FCITX_UNUSED(ok);
+            received++;
+        }
+        assert(!fcitx_shm_channel_is_broken(server));
+    }
+}
+
+static void
+test_sealed()
+{
+    FcitxShmChannel* server = fcitx_shm_channel_new(0);
+    int memfd, rxfd, txfd;
+    struct stat st;
+    assert(server);
+    fcitx_shm_channel_get_peer_fds(server, &memfd, &rxfd, &txfd);
+    /* the peer can't change the size under the mapping */
+    assert(fstat(memfd, &st) == 0);
+    assert(ftruncate(memfd, 0) < 0);
+    assert(ftruncate(memfd, st.st_size * 2) < 0);
+
+    /* same content in a file without seals is refused */
+    char path[] = "/tmp/testshmchannel-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    char* content = malloc(st.st_size);
+    assert(pread(memfd, content, st.st_size, 0) == st.st_size);
+    assert(write(fd, content, st.st_size) == st.st_size);
+    free(content);
+    assert(!fcitx_shm_channel_open(fd, eventfd(0, 0), eventfd(0, 0)));
+    fcitx_shm_channel_free(server);
+}
+
+int main()
+{
+    test_local();
+    test_sealed();
+
+    FcitxShmChannel* server = fcitx_shm_channel_new(0);
+    assert(server);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        FcitxShmChannel* client = open_peer(server);
+        fcitx_shm_channel_free(server);
+        assert(client);
+        run_client(client);
+        fcitx_shm_channel_free(client);
+        _exit(0);
+    }
+    run_server(server);
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    fcitx_shm_channel_free(server);
+    return 0;
+}